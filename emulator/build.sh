@@ -38,6 +38,7 @@ function usage()
      --no-128             disable RV128
      -b, --bintr          enable binary translation using system compiler
      -t, --tcc            jit-compile using tcc
+     -j, --jit            jit-compile using the x86-64 JIT
      --no-bintr           disable binary translation
      -x, --expr           enable experimental features (eg. unbounded 32-bit addressing)
      -N bits              enable N-bits of masked address space (experimental feature)
@@ -81,8 +82,9 @@ while [[ "$#" -gt 0 ]]; do
 		--no-64) OPTS="$OPTS -DRISCV_64I=OFF" ;;
 		--128) OPTS="$OPTS -DRISCV_128I=ON" ;;
 		--no-128) OPTS="$OPTS -DRISCV_128I=OFF" ;;
-        -b|--bintr) OPTS="$OPTS -DRISCV_BINARY_TRANSLATION=ON -DRISCV_LIBTCC=OFF" ;;
-        -t|--tcc  ) OPTS="$OPTS -DRISCV_BINARY_TRANSLATION=ON -DRISCV_LIBTCC=ON" ;;
+        -b|--bintr) OPTS="$OPTS -DRISCV_BINARY_TRANSLATION=ON -DRISCV_LIBTCC=OFF -DRISCV_JIT=OFF" ;;
+        -t|--tcc  ) OPTS="$OPTS -DRISCV_BINARY_TRANSLATION=ON -DRISCV_LIBTCC=ON -DRISCV_JIT=OFF" ;;
+        -j|--jit  ) OPTS="$OPTS -DRISCV_BINARY_TRANSLATION=ON -DRISCV_LIBTCC=OFF -DRISCV_JIT=ON" ;;
         --no-bintr) OPTS="$OPTS -DRISCV_BINARY_TRANSLATION=OFF" ;;
         -x|--expr ) OPTS="$OPTS -DRISCV_EXPERIMENTAL=ON -DRISCV_ENCOMPASSING_ARENA=ON" ;;
 		-N) OPTS="$OPTS -DRISCV_EXPERIMENTAL=ON -DRISCV_ENCOMPASSING_ARENA=ON -DRISCV_ENCOMPASSING_ARENA_BITS=$2"; shift ;;
@@ -29,6 +29,7 @@ struct Arguments {
 	bool trace = false;
 	bool no_translate = false;
 	bool translate_regcache = riscv::libtcc_enabled; // Default: Register caching w/libtcc
+	bool translate_chaining = true; // Call translated blocks directly from each other
 	bool translate_future = true;
 	bool mingw = false;
 	bool from_start = false;
@@ -36,12 +37,19 @@ struct Arguments {
 	bool execute_only = false;
 	bool ignore_text = false;
 	bool background = false; // Run binary translation in background thread
+	unsigned hot_threshold = 0; // Tiered execution: Translate only hot code
+	unsigned translate_shards = 1; // Compile binary translations in parallel parts
 	bool proxy_mode = false;  // Proxy mode for system calls
+	bool decoder_cache = false; // Persist decoded execute segments between runs
+	bool lazy_decoding = false; // Decode execute segment pages on first use
+	bool huge_pages = false; // Back guest memory with huge pages
+	int binary_fd = -1; // The opened program, for mapping read-only segments
 	uint64_t fuel = 30'000'000'000ULL; // Default: Timeout after ~30bn instructions
 	std::vector<std::string> allowed_files;
 	std::string output_file;
 	std::string call_function;
 	std::string jump_hints_file;
+	std::string profile_file;
 };
 
 #ifdef HAVE_GETOPT_LONG
@@ -62,8 +70,12 @@ static const struct option long_options[] = {
 	{"no-translate", no_argument, 0, 'n'},
 	{"no-translate-future", no_argument, 0, 'N'},
 	{"translate-regcache", no_argument, 0, 'R'},
+	{"no-chaining", no_argument, 0, 'C'},
 	{"jump-hints", required_argument, 0, 'J'},
+	{"profile", required_argument, 0, 'p'},
 	{"background", no_argument, 0, 'B'},
+	{"hot", required_argument, 0, 'H'},
+	{"jobs", required_argument, 0, 'j'},
 	{"mingw", no_argument, 0, 'm'},
 	{"output", required_argument, 0, 'o'},
 	{"from-start", no_argument, 0, 'F'},
@@ -73,6 +85,9 @@ static const struct option long_options[] = {
 	{"execute-only", no_argument, 0, 'X'},
 	{"ignore-text", no_argument, 0, 'I'},
 	{"call", required_argument, 0, 'c'},
+	{"decoder-cache", no_argument, 0, 'D'},
+	{"lazy", no_argument, 0, 'L'},
+	{"hugepages", no_argument, 0, 'M'},
 	{0, 0, 0, 0}
 };
 
@@ -94,8 +109,12 @@ static void print_help(const char* name)
 		"  -n, --no-translate Disable binary translation\n"
 		"  -N, --no-translate-future Disable binary translation of non-initial segments\n"
 		"  -R, --translate-regcache Enable register caching in binary translator\n"
+		"  -C, --no-chaining  Return to the dispatcher between translated blocks\n"
 		"  -J, --jump-hints file  Load jump location hints from file, unless empty then record instead\n"
+		"  -p, --profile file Translate using the execution profile in file, unless missing then record it instead\n"
 		"  -B  --background   Run binary translation in background thread\n"
+		"  -H, --hot count    Interpret first, and translate code entered count times\n"
+		"  -j, --jobs count   Compile binary translations in count parallel parts (0 = one per core)\n"
 		"  -m, --mingw        Cross-compile for Windows (MinGW)\n"
 		"  -o, --output file  Output embeddable binary translated code (C99)\n"
 		"  -F, --from-start   Start debugger from the beginning (_start)\n"
@@ -105,6 +124,9 @@ static void print_help(const char* name)
 		"  -X, --execute-only Enforce execute-only segments (no read/write)\n"
 		"  -I, --ignore-text  Ignore .text section, and use segments only\n"
 		"  -c, --call func    Call a function after loading the program\n"
+		"  -D, --decoder-cache Store and reuse decoder caches in /tmp\n"
+		"  -L, --lazy         Decode pages of the program when they are first executed\n"
+		"  -M, --hugepages    Back guest memory with huge pages\n"
 		"\n"
 	);
 	printf("libriscv is compiled with:\n"
@@ -152,7 +174,7 @@ static void print_help(const char* name)
 static int parse_arguments(int argc, const char** argv, Arguments& args)
 {
 	int c;
-	while ((c = getopt_long(argc, (char**)argv, "hvQad1f:gstTnNRJ:Bmo:FSPA:XIc:", long_options, nullptr)) != -1)
+	while ((c = getopt_long(argc, (char**)argv, "hvQad1f:gstTnNRCJ:p:BH:j:mo:FSPA:XIc:DLM", long_options, nullptr)) != -1)
 	{
 		switch (c)
 		{
@@ -170,8 +192,12 @@ static int parse_arguments(int argc, const char** argv, Arguments& args)
 			case 'n': args.no_translate = true; break;
 			case 'N': args.translate_future = false; break;
 			case 'R': args.translate_regcache = true; break;
+			case 'C': args.translate_chaining = false; break;
 			case 'J': break;
+			case 'p': break;
 			case 'B': args.background = true; break;
+			case 'H': break;
+			case 'j': break;
 			case 'm': args.mingw = true; break;
 			case 'o': break;
 			case 'F': args.from_start = true; break;
@@ -181,6 +207,9 @@ static int parse_arguments(int argc, const char** argv, Arguments& args)
 			case 'X': args.execute_only = true; break;
 			case 'I': args.ignore_text = true; break;
 			case 'c': break;
+			case 'D': args.decoder_cache = true; break;
+			case 'L': args.lazy_decoding = true; break;
+			case 'M': args.huge_pages = true; break;
 			default:
 				fprintf(stderr, "Unknown option: %c\n", c);
 				return -1;
@@ -209,11 +238,36 @@ static int parse_arguments(int argc, const char** argv, Arguments& args)
 			if (args.verbose) {
 				printf("* Function to VMCall: %s\n", args.call_function.c_str());
 			}
+		} else if (c == 'H') {
+			char* endptr;
+			args.hot_threshold = strtoul(optarg, &endptr, 10);
+			if (*endptr != '\0') {
+				fprintf(stderr, "Invalid number: %s\n", optarg);
+				return -1;
+			}
+			if (args.verbose) {
+				printf("* Hot threshold set to %u\n", args.hot_threshold);
+			}
+		} else if (c == 'j') {
+			char* endptr;
+			args.translate_shards = strtoul(optarg, &endptr, 10);
+			if (*endptr != '\0') {
+				fprintf(stderr, "Invalid number: %s\n", optarg);
+				return -1;
+			}
+			if (args.verbose) {
+				printf("* Translation compile jobs set to %u\n", args.translate_shards);
+			}
 		} else if (c == 'J') {
 			args.jump_hints_file = optarg;
 			if (args.verbose) {
 				printf("* Jump hints file: %s\n", args.jump_hints_file.c_str());
 			}
+		} else if (c == 'p') {
+			args.profile_file = optarg;
+			if (args.verbose) {
+				printf("* Translation profile file: %s\n", args.profile_file.c_str());
+			}
 		}
 	}
 
@@ -250,12 +304,20 @@ static void run_program(
 		cc.push_back(riscv::MachineTranslationEmbeddableCodeOptions{cli_args.output_file});
 	}
 
+	// A missing profile is recorded during this run, instead of translating
+	auto translation_profile = load_translation_profile<W>(cli_args.profile_file, cli_args.verbose);
+	const bool record_profile = !cli_args.profile_file.empty() && translation_profile.empty();
+
 	auto options = std::make_shared<riscv::MachineOptions<W>>(riscv::MachineOptions<W>{
 		.memory_max = MAX_MEMORY,
 		.enforce_exec_only = cli_args.execute_only,
 		.ignore_text_section = cli_args.ignore_text,
+		.binary_fd = cli_args.binary_fd,
 		.verbose_loader = cli_args.verbose,
+		.use_huge_pages = cli_args.huge_pages,
 		.use_shared_execute_segments = false, // We are only creating one machine, disabling this can enable some optimizations
+		.persistent_decoder_cache = cli_args.decoder_cache,
+		.use_lazy_decoding = cli_args.lazy_decoding,
 #ifdef NODEJS_WORKAROUND
 		.ebreak_locations = {
 			"pthread_rwlock_rdlock", "pthread_rwlock_wrlock" // Live-patch locations
@@ -268,18 +330,23 @@ static void run_program(
 		.translate_timing = cli_args.timing,
 		.translate_ignore_instruction_limit = !cli_args.accurate, // Press Ctrl+C to stop
 		.translate_use_register_caching = cli_args.translate_regcache,
+		.translate_block_chaining = cli_args.translate_chaining,
 		.record_slowpaths_to_jump_hints = !cli_args.jump_hints_file.empty(),
+		.record_translation_profile = record_profile,
 #ifdef _WIN32
 		.translation_prefix = "translations/rvbintr-",
 		.translation_suffix = ".dll",
 #else
 		.translator_jump_hints = load_jump_hints<W>(cli_args.jump_hints_file, cli_args.verbose),
+		.translation_profile = std::move(translation_profile),
 		.translate_background_callback = cli_args.background ?
 			[] (auto& compilation_step) {
 				std::thread([compilation_step = std::move(compilation_step)] {
 					compilation_step();
 				}).detach();
 			} : std::function<void(std::function<void()>&)>(nullptr),
+		.translate_hot_threshold = cli_args.hot_threshold,
+		.translate_shards = cli_args.translate_shards,
 		.cross_compile = cc,
 #endif
 #endif
@@ -637,6 +704,13 @@ static void run_program(
 					jump_hints.size(), cli_args.jump_hints_file.c_str());
 		}
 	}
+	if (record_profile) {
+		const auto profile = machine.memory.gather_translation_profile();
+		store_translation_profile<W>(cli_args.profile_file, profile);
+		if (cli_args.verbose)
+			printf("%zu blocks and %zu branches were profiled to %s\n",
+				profile.blocks.size(), profile.branches.size(), cli_args.profile_file.c_str());
+	}
 #endif
 	_exit(0);
 }
@@ -716,6 +790,7 @@ int main(int argc, const char** argv)
 			exit(1);
 		}
 		binary = { (const char*)ptr, size_t(st.st_size) };
+		cli_args.binary_fd = fd;
 #endif
 
 		bool is_dynamic = false;
@@ -731,6 +806,7 @@ int main(int argc, const char** argv)
 				}
 				vbin = load_file(std::string(interpreter));
 				binary = { (const char*)vbin.data(), vbin.size() };
+				cli_args.binary_fd = -1;
 				// Insert program name as argv[1]
 				args.insert(args.begin() + 1, args.at(0));
 				// Set dynamic linker to argv[0]
@@ -784,6 +860,7 @@ void run_sighandler(riscv::Machine<W>& machine)
 #include <stdexcept>
 #include <unistd.h>
 #include <fstream>
+#include <sstream>
 std::vector<uint8_t> load_file(const std::string& filename)
 {
     std::size_t size = 0;
@@ -841,3 +918,70 @@ void store_jump_hints(const std::string& filename, const std::vector<riscv::addr
 		file << "0x" << std::hex << addr << std::endl;
 	}
 }
+
+template <int W>
+riscv::TranslationProfile<W> load_translation_profile(const std::string& filename, bool verbose)
+{
+	riscv::TranslationProfile<W> profile;
+	if (filename.empty())
+		return profile;
+
+	std::ifstream file(filename);
+	if (!file.is_open()) {
+		if (verbose)
+			fprintf(stderr, "No translation profile in %s, recording one\n", filename.c_str());
+		return profile;
+	}
+
+	// Each line is either "block addr count" or "branch addr taken not-taken"
+	std::string line;
+	size_t lineno = 0;
+	while (std::getline(file, line)) {
+		lineno++;
+		if (line.empty() || line[0] == '#') continue;
+		std::istringstream fields(line);
+		std::string kind;
+		std::string addr;
+		uint64_t first = 0, second = 0;
+		bool valid = false;
+		try {
+			fields >> kind >> addr >> first;
+			const riscv::address_type<W> pc = std::stoull(addr, nullptr, 16);
+			if (kind == "block" && fields) {
+				profile.blocks[pc] = first;
+				valid = true;
+			} else if (kind == "branch" && fields >> second) {
+				profile.branches[pc] = { first, second };
+				valid = true;
+			}
+		} catch (const std::exception&) {
+			// Invalid or out-of-range address
+		}
+		if (!valid) {
+			// A damaged profile is ignored, and recorded again by this run
+			fprintf(stderr, "Ignoring translation profile %s: Invalid line %zu: %s\n",
+				filename.c_str(), lineno, line.c_str());
+			return {};
+		}
+	}
+	return profile;
+}
+
+template <int W>
+void store_translation_profile(const std::string& filename, const riscv::TranslationProfile<W>& profile)
+{
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		fprintf(stderr, "Could not open translation profile file for writing: %s\n", filename.c_str());
+		return;
+	}
+
+	file << "# libriscv translation profile" << std::endl;
+	for (const auto& [addr, count] : profile.blocks) {
+		file << "block 0x" << std::hex << addr << std::dec << " " << count << std::endl;
+	}
+	for (const auto& [addr, branch] : profile.branches) {
+		file << "branch 0x" << std::hex << addr << std::dec << " "
+			<< branch.taken << " " << branch.not_taken << std::endl;
+	}
+}
@@ -60,6 +60,7 @@ INSTRUCTION(RV32I_BC_FAST_CALL, rv32i_fast_call) {
 		fprintf(stderr, "FAST_CALL PC 0x%lX => 0x%lX\n", long(pc), long(pc + int32_t(instr.whole)));
 	}
 	REG(REG_RA) = pc + 4;
+	PUSH_RETURN_ADDRESS(4);
 	NEXT_BLOCK(int32_t(DECODER().instr), true);
 }
 
@@ -117,15 +118,19 @@ INSTRUCTION(RV32I_BC_ANDI, rv32i_andi) {
 INSTRUCTION(RV32C_BC_BNEZ, rv32c_bnez) {
 	VIEW_INSTR_AS(fi, FasterItype);
 	if (REG(fi.get_rs1()) != 0) {
+		COUNT_BRANCH(true);
 		PERFORM_BRANCH();
 	}
+	COUNT_BRANCH(false);
 	NEXT_BLOCK(2, false);
 }
 INSTRUCTION(RV32C_BC_BEQZ, rv32c_beqz) {
 	VIEW_INSTR_AS(fi, FasterItype);
 	if (REG(fi.get_rs1()) == 0) {
+		COUNT_BRANCH(true);
 		PERFORM_BRANCH();
 	}
+	COUNT_BRANCH(false);
 	NEXT_BLOCK(2, false);
 }
 INSTRUCTION(RV32C_BC_JMP, rv32c_jmp) {
@@ -141,6 +146,7 @@ INSTRUCTION(RV32C_BC_JAL_ADDIW, rv32c_jal_addiw) {
 	} else { // C.JAL
 		VIEW_INSTR_AS(fi, FasterItype);
 		REG(REG_RA) = pc + 2;
+		PUSH_RETURN_ADDRESS(2);
 		PERFORM_BRANCH();
 	}
 }
@@ -151,6 +157,7 @@ INSTRUCTION(RV32C_BC_JR, rv32c_jr) {
 			long(pc), long(REG(instr.whole)));
 	}
 	pc = REG(instr.whole) & ~addr_t(1);
+	POP_RETURN_ADDRESS();
 	OVERFLOW_CHECKED_JUMP();
 }
 INSTRUCTION(RV32C_BC_JALR, rv32c_jalr) {
@@ -160,6 +167,7 @@ INSTRUCTION(RV32C_BC_JALR, rv32c_jalr) {
 			long(pc), long(REG(instr.whole)));
 	}
 	REG(REG_RA) = pc + 2;
+	PUSH_RETURN_ADDRESS(2);
 	pc = REG(instr.whole) & ~addr_t(1);
 	OVERFLOW_CHECKED_JUMP();
 }
@@ -178,57 +186,73 @@ INSTRUCTION(RV32I_BC_JAL, rv32i_jal)
 INSTRUCTION(RV32I_BC_BEQ, rv32i_beq) {
 	VIEW_INSTR_AS(fi, FasterItype);
 	if (REG(fi.get_rs1()) == REG(fi.get_rs2())) {
+		COUNT_BRANCH(true);
 		PERFORM_BRANCH();
 	}
+	COUNT_BRANCH(false);
 	NEXT_BLOCK(4, false);
 }
 INSTRUCTION(RV32I_BC_BNE, rv32i_bne) {
 	VIEW_INSTR_AS(fi, FasterItype);
 	if (REG(fi.get_rs1()) != REG(fi.get_rs2())) {
+		COUNT_BRANCH(true);
 		PERFORM_BRANCH();
 	}
+	COUNT_BRANCH(false);
 	NEXT_BLOCK(4, false);
 }
 INSTRUCTION(RV32I_BC_BEQ_FW, rv32i_beq_fw) {
 	VIEW_INSTR_AS(fi, FasterItype);
 	if (REG(fi.get_rs1()) == REG(fi.get_rs2())) {
+		COUNT_BRANCH(true);
 		PERFORM_FORWARD_BRANCH();
 	}
+	COUNT_BRANCH(false);
 	NEXT_BLOCK(4, false);
 }
 INSTRUCTION(RV32I_BC_BNE_FW, rv32i_bne_fw) {
 	VIEW_INSTR_AS(fi, FasterItype);
 	if (REG(fi.get_rs1()) != REG(fi.get_rs2())) {
+		COUNT_BRANCH(true);
 		PERFORM_FORWARD_BRANCH();
 	}
+	COUNT_BRANCH(false);
 	NEXT_BLOCK(4, false);
 }
 INSTRUCTION(RV32I_BC_BLT, rv32i_blt) {
 	VIEW_INSTR_AS(fi, FasterItype);
 	if ((saddr_t)REG(fi.get_rs1()) < (saddr_t)REG(fi.get_rs2())) {
+		COUNT_BRANCH(true);
 		PERFORM_BRANCH();
 	}
+	COUNT_BRANCH(false);
 	NEXT_BLOCK(4, false);
 }
 INSTRUCTION(RV32I_BC_BGE, rv32i_bge) {
 	VIEW_INSTR_AS(fi, FasterItype);
 	if ((saddr_t)REG(fi.get_rs1()) >= (saddr_t)REG(fi.get_rs2())) {
+		COUNT_BRANCH(true);
 		PERFORM_BRANCH();
 	}
+	COUNT_BRANCH(false);
 	NEXT_BLOCK(4, false);
 }
 INSTRUCTION(RV32I_BC_BLTU, rv32i_bltu) {
 	VIEW_INSTR_AS(fi, FasterItype);
 	if (REG(fi.get_rs1()) < REG(fi.get_rs2())) {
+		COUNT_BRANCH(true);
 		PERFORM_BRANCH();
 	}
+	COUNT_BRANCH(false);
 	NEXT_BLOCK(4, false);
 }
 INSTRUCTION(RV32I_BC_BGEU, rv32i_bgeu) {
 	VIEW_INSTR_AS(fi, FasterItype);
 	if (REG(fi.get_rs1()) >= REG(fi.get_rs2())) {
+		COUNT_BRANCH(true);
 		PERFORM_BRANCH();
 	}
+	COUNT_BRANCH(false);
 	NEXT_BLOCK(4, false);
 }
 
@@ -320,6 +344,73 @@ INSTRUCTION(RV32I_BC_LUI, rv32i_lui)
 	NEXT_INSTR();
 }
 
+/**
+ * Superinstructions: The first half uses the operands of the current
+ * entry, then the decoder is advanced to the second half, which
+ * keeps its own regular (rewritten) operands.
+*/
+INSTRUCTION(RV32I_BC_LUI_ADDI, rv32i_lui_addi)
+{
+	{
+		VIEW_INSTR();
+		REG(instr.Utype.rd) = instr.Utype.upper_imm();
+	}
+	ADVANCE_INSTR();
+	VIEW_INSTR_AS(fi, FasterItype);
+	REG(fi.get_rs1()) =
+		REG(fi.get_rs2()) + fi.signed_imm();
+	NEXT_INSTR();
+}
+INSTRUCTION(RV32I_BC_AUIPC_ADDI, rv32i_auipc_addi)
+{
+	{
+		VIEW_INSTR();
+		REG(instr.Utype.rd) = (pc - DECODER().block_bytes()) + instr.Utype.upper_imm();
+	}
+	ADVANCE_INSTR();
+	VIEW_INSTR_AS(fi, FasterItype);
+	REG(fi.get_rs1()) =
+		REG(fi.get_rs2()) + fi.signed_imm();
+	NEXT_INSTR();
+}
+INSTRUCTION(RV32I_BC_AUIPC_JALR, rv32i_auipc_jalr)
+{
+	{
+		VIEW_INSTR();
+		REG(instr.Utype.rd) = (pc - DECODER().block_bytes()) + instr.Utype.upper_imm();
+	}
+	ADVANCE_INSTR();
+	VIEW_INSTR_AS(fi, FasterItype);
+	const auto address = REG(fi.rs2) + fi.signed_imm();
+	if (fi.rs1 != 0) {
+		REG(fi.rs1) = pc + 4;
+		PUSH_RETURN_ADDRESS(4);
+	}
+	if constexpr (VERBOSE_JUMPS) {
+		fprintf(stderr, "AUIPC+JALR x%d + %d => rd=%d   PC 0x%lX => 0x%lX\n",
+			fi.rs2, fi.signed_imm(), fi.rs1, long(pc), long(address));
+	}
+	static constexpr addr_t ALIGN_MASK = (compressed_enabled) ? 0x1 : 0x3;
+	pc = address & ~ALIGN_MASK;
+	OVERFLOW_CHECKED_JUMP();
+}
+INSTRUCTION(RV32I_BC_ADDI_BNE, rv32i_addi_bne)
+{
+	{
+		VIEW_INSTR_AS(fi, FasterItype);
+		REG(fi.get_rs1()) =
+			REG(fi.get_rs2()) + fi.signed_imm();
+	}
+	ADVANCE_INSTR();
+	VIEW_INSTR_AS(fi, FasterItype);
+	if (REG(fi.get_rs1()) != REG(fi.get_rs2())) {
+		COUNT_BRANCH(true);
+		PERFORM_BRANCH();
+	}
+	COUNT_BRANCH(false);
+	NEXT_BLOCK(4, false);
+}
+
 #define OP_INSTR()                       \
 	VIEW_INSTR_AS(fi, FasterOpType);     \
 	auto& dst = REG(fi.get_rd());        \
@@ -578,8 +669,10 @@ INSTRUCTION(RV32I_BC_FUNCTION, execute_decoded_function)
 
 INSTRUCTION(RV32I_BC_FUNCBLOCK, execute_function_block) {
 	VIEW_INSTR();
-	auto handler = DECODER().get_handler();
-	handler(CPU(), instr);
+	// The instruction ends the block, so PC is known (eg. for AUIPC)
+	REGISTERS().pc = pc;
+	// The handler may be unresolved, eg. when loaded from a decoder cache file
+	CPU().execute(DECODER().m_handler, instr.whole);
 	NEXT_BLOCK(instr.length(), true);
 }
 
@@ -588,16 +681,20 @@ INSTRUCTION(RV32I_BC_JALR, rv32i_jalr) {
 	// jump to register + immediate
 	// NOTE: if rs1 == rd, avoid clobber by storing address first
 	const auto address = REG(fi.rs2) + fi.signed_imm();
-	// Link *next* instruction (rd = PC + 4)
-	if (fi.rs1 != 0) {
-		REG(fi.rs1) = pc + 4;
-	}
 	if constexpr (VERBOSE_JUMPS) {
 		fprintf(stderr, "JALR x%d + %d => rd=%d   PC 0x%lX => 0x%lX\n",
 			fi.rs2, fi.signed_imm(), fi.rs1, long(pc), long(address));
 	}
 	static constexpr addr_t ALIGN_MASK = (compressed_enabled) ? 0x1 : 0x3;
-	pc = address & ~ALIGN_MASK;
+	// Link *next* instruction (rd = PC + 4)
+	if (fi.rs1 != 0) {
+		REG(fi.rs1) = pc + 4;
+		PUSH_RETURN_ADDRESS(4);
+		pc = address & ~ALIGN_MASK;
+	} else {
+		pc = address & ~ALIGN_MASK;
+		POP_RETURN_ADDRESS();
+	}
 	OVERFLOW_CHECKED_JUMP();
 }
 
@@ -639,11 +736,15 @@ INSTRUCTION(RV32I_BC_OP_DIV, rv32i_op_div) {
 			// division of -9223372036854775808 by -1 cannot be represented in type 'long'
 			if (LIKELY(!((int64_t)src1 == INT64_MIN && (int64_t)src2 == -1ll)))
 				dst = saddr_t(src1) / saddr_t(src2);
+			else
+				dst = src1; // Overflow: The quotient is the dividend
 		} else {
 			// rv32i_instr.cpp:301:2: runtime error:
 			// division of -2147483648 by -1 cannot be represented in type 'int'
 			if (LIKELY(!(src1 == 2147483648 && src2 == 4294967295)))
 				dst = saddr_t(src1) / saddr_t(src2);
+			else
+				dst = src1;
 		}
 	} else {
 		dst = addr_t(-1);
@@ -665,12 +766,18 @@ INSTRUCTION(RV32I_BC_OP_REM, rv32i_op_rem) {
 		if constexpr(W == 4) {
 			if (LIKELY(!(src1 == 2147483648 && src2 == 4294967295)))
 				dst = saddr_t(src1) % saddr_t(src2);
+			else
+				dst = 0; // Overflow: The remainder is zero
 		} else if constexpr (W == 8) {
 			if (LIKELY(!((int64_t)src1 == INT64_MIN && (int64_t)src2 == -1ll)))
 				dst = saddr_t(src1) % saddr_t(src2);
+			else
+				dst = 0;
 		} else {
 			dst = saddr_t(src1) % saddr_t(src2);
 		}
+	} else {
+		dst = src1;
 	}
 	NEXT_INSTR();
 }
@@ -679,7 +786,7 @@ INSTRUCTION(RV32I_BC_OP_REMU, rv32i_op_remu) {
 	if (LIKELY(src2 != 0)) {
 		dst = src1 % src2;
 	} else {
-		dst = addr_t(-1);
+		dst = src1;
 	}
 	NEXT_INSTR();
 }
@@ -792,17 +899,45 @@ INSTRUCTION(RV32V_BC_VSE32, rv32v_vse32) {
 INSTRUCTION(RV32V_BC_VFADD_VV, rv32v_vfadd_vv) {
 	VIEW_INSTR_AS(vi, FasterOpType);
 	auto& rvv = VECTORS();
-	for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-		rvv.f32(vi.rd)[i] = rvv.f32(vi.rs1)[i] + rvv.f32(vi.rs2)[i];
-	}
+	rvv.get(vi.rd) = rvv::lanewise<float>(rvv.get(vi.rs2), rvv.get(vi.rs1), rvv::add);
 	NEXT_INSTR();
 }
 INSTRUCTION(RV32V_BC_VFMUL_VF, rv32v_vfmul_vf) {
 	VIEW_INSTR_AS(vi, FasterOpType);
 	auto& rvv = VECTORS();
-	for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-		rvv.f32(vi.rd)[i] = rvv.f32(vi.rs2)[i] * REGISTERS().getfl(vi.rs1).f32[0];
-	}
+	rvv.get(vi.rd) = rvv::lanewise_scalar<float>(rvv.get(vi.rs2),
+		REGISTERS().getfl(vi.rs1).f32[0], rvv::mul);
+	NEXT_INSTR();
+}
+INSTRUCTION(RV32V_BC_VADD_VV, rv32v_vadd_vv) {
+	VIEW_INSTR_AS(vi, FasterOpType);
+	auto& rvv = VECTORS();
+	rvv.get(vi.rd) = rvv::lanewise<uint32_t>(rvv.get(vi.rs2), rvv.get(vi.rs1), rvv::add);
+	NEXT_INSTR();
+}
+INSTRUCTION(RV32V_BC_VFMUL_VV, rv32v_vfmul_vv) {
+	VIEW_INSTR_AS(vi, FasterOpType);
+	auto& rvv = VECTORS();
+	rvv.get(vi.rd) = rvv::lanewise<float>(rvv.get(vi.rs2), rvv.get(vi.rs1), rvv::mul);
+	NEXT_INSTR();
+}
+INSTRUCTION(RV32V_BC_VFMACC_VV, rv32v_vfmacc_vv) {
+	VIEW_INSTR_AS(vi, FasterOpType);
+	auto& rvv = VECTORS();
+	rvv.get(vi.rd) = rvv::lanewise<float>(rvv.get(vi.rs1), rvv.get(vi.rs2), rvv.get(vi.rd), rvv::mul_add);
+	NEXT_INSTR();
+}
+INSTRUCTION(RV32V_BC_VFMACC_VF, rv32v_vfmacc_vf) {
+	VIEW_INSTR_AS(vi, FasterOpType);
+	auto& rvv = VECTORS();
+	rvv.get(vi.rd) = rvv::lanewise<float>(rvv::splat<float>(REGISTERS().getfl(vi.rs1).f32[0]),
+		rvv.get(vi.rs2), rvv.get(vi.rd), rvv::mul_add);
+	NEXT_INSTR();
+}
+INSTRUCTION(RV32V_BC_VFREDUSUM_VS, rv32v_vfredusum_vs) {
+	VIEW_INSTR_AS(vi, FasterOpType);
+	auto& rvv = VECTORS();
+	rvv.f32(vi.rd)[0] = rvv.f32(vi.rs1)[0] + rvv::reduce_sum<float>(rvv.get(vi.rs2));
 	NEXT_INSTR();
 }
 #endif // RISCV_EXT_VECTOR
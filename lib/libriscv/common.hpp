@@ -1,6 +1,7 @@
 #pragma once
 #include "libriscv_settings.h" // Build-system generated
 
+#include <map>
 #include <memory>
 #include <type_traits>
 #if __has_include(<span>)
@@ -36,6 +37,10 @@
 #define RISCV_BRK_MEMORY_SIZE  (16ull << 20) // 16MB
 #endif
 
+#ifndef RISCV_PAGE_CACHE_SIZE
+#define RISCV_PAGE_CACHE_SIZE  32 // Entries in each of the read and write page caches
+#endif
+
 namespace riscv
 {
 	template <int W> struct Memory;
@@ -68,6 +73,33 @@ namespace riscv
 	};
 	using MachineTranslationOptions = std::variant<MachineTranslationCrossOptions, MachineTranslationEmbeddableCodeOptions>;
 
+	/// @brief Execution profile of a program, recorded during a profiling run
+	/// and used to guide the binary translator. See record_translation_profile.
+	template <int W>
+	struct TranslationProfile
+	{
+		struct Branch {
+			uint64_t taken = 0;
+			uint64_t not_taken = 0;
+		};
+		/// @brief Entries into blocks, by the address of the block.
+		std::map<address_type<W>, uint64_t> blocks;
+		/// @brief Outcomes of conditional branches, by the address of the branch.
+		std::map<address_type<W>, Branch> branches;
+
+		bool empty() const noexcept { return blocks.empty() && branches.empty(); }
+
+		/// @brief Block entries and branches executed within [begin, end).
+		uint64_t heat(address_type<W> begin, address_type<W> end) const {
+			uint64_t total = 0;
+			for (auto it = blocks.lower_bound(begin); it != blocks.end() && it->first < end; ++it)
+				total += it->second;
+			for (auto it = branches.lower_bound(begin); it != branches.end() && it->first < end; ++it)
+				total += it->second.taken + it->second.not_taken;
+			return total;
+		}
+	};
+
 	/// @brief Options passed to Machine constructor
 	/// @tparam W The RISC-V architecture
 	template <int W>
@@ -77,6 +109,14 @@ namespace riscv
 		/// the current page size (4kb).
 		uint64_t memory_max = 64ull << 20; // 64MB
 
+		/// @brief The most resident memory a machine may hold in pages it owns
+		/// or has touched in the memory arena, rounded down to the page size.
+		/// @details Creating a page beyond the quota, or copying a shared page on
+		/// write, throws MEMORY_QUOTA_EXCEEDED. Guest accesses that go directly to
+		/// the flat read-write arena are bounded by memory_max instead.
+		/// Zero means no quota.
+		uint64_t memory_quota = 0;
+
 		/// @brief Virtual memory allocated for the main stack at construction.
 		uint32_t stack_size = 1ul << 20; // 1MB default stack
 
@@ -102,6 +142,16 @@ namespace riscv
 		/// the .text section in order to get correctly aligned instructions.
 		bool ignore_text_section = false;
 
+		/// @brief An open file descriptor of the ELF program, which lets the loader
+		/// map whole pages of read-only segments straight from the file instead of
+		/// copying them.
+		/// @details Inside the memory arena the pages become private file mappings,
+		/// so that identical programs share the host page cache and only pages that
+		/// are written to get copied. Outside of the arena, pages point into the
+		/// binary itself, which must then be a page-aligned mapping of the same file.
+		/// The file must not change while machines use it. Linux only. Default: -1.
+		int binary_fd = -1;
+
 		/// @brief Print some verbose loader information to stdout.
 		/// @details If binary translation is enabled, this will also make the
 		/// binary translation process print verbose information.
@@ -116,6 +166,23 @@ namespace riscv
 		/// locality and also enables read-write arena if the CMake option is ON.
 		bool use_memory_arena = true;
 
+		/// @brief Back the memory arena with a memory file (memfd), so that
+		/// forks of this machine map it privately instead of sharing it.
+		/// @details The host kernel then performs copy-on-write for the arena,
+		/// making forks independent of memory size and giving them native-speed
+		/// access to their own arena. Pages of the main machine that a fork has
+		/// not yet written to are shared with it, so the main machine must not
+		/// modify its memory while it has forks. Linux only, ignored elsewhere.
+		bool use_memfd_arena = false;
+
+		/// @brief Back the memory arena with 2MB huge pages, reducing host
+		/// TLB pressure for guests with large working sets.
+		/// @details Explicit huge pages (hugetlbfs) are used when the host has
+		/// enough of them reserved, and otherwise transparent huge pages are
+		/// requested with madvise(). Falls back to regular pages when neither
+		/// is available. Linux only, ignored elsewhere.
+		bool use_huge_pages = false;
+
 		/// @brief Enable sharing of execute segments between machines.
 		/// @details This will allow multiple machines to share the same execute
 		/// segment, reducing memory usage and increasing performance.
@@ -123,6 +190,51 @@ namespace riscv
 		/// translated code between machines. (Prevents some optimizations)
 		bool use_shared_execute_segments = true;
 
+		/// @brief Share the initial pages of the program between all machines
+		/// that load the same program, instead of giving each machine a copy.
+		/// @details Pages of loadable segments are found by their contents in
+		/// a process-wide cache, and writable pages become copy-on-write. Pages
+		/// inside of the flat read-write arena cannot be shared, so this needs
+		/// use_memory_arena = false, or the program loaded outside of the arena.
+		/// Within the arena, binary_fd can be used instead.
+		bool use_shared_initial_pages = false;
+
+		/// @brief Fuse common adjacent instruction pairs into superinstructions
+		/// when producing the decoder cache, reducing dispatch overhead.
+		/// @details Eg. LUI+ADDI, AUIPC+ADDI, AUIPC+JALR and ADDI+BNE loop tails.
+		/// Fused instructions are still counted as separate instructions.
+		/// Off by default, as the fused pairs are fixed rather than derived
+		/// from a profile. See DecodedExecuteSegment::profile_bytecode_sequences.
+		bool use_superinstructions = false;
+
+		/// @brief Store decoder caches in the file system, and map them back in
+		/// on later program loads instead of decoding the execute segment again.
+		/// @details Files are named from decoder_cache_prefix and a key made from the
+		/// execute segment CRC32-C hash and the emulator settings. Files are mapped
+		/// copy-on-write, so many machines share the same physical pages.
+		/// Binary translated execute segments are always decoded. Files that are not
+		/// owned by the current user, are writable by others, or have invalid entries
+		/// are ignored.
+		bool persistent_decoder_cache = false;
+		/// @brief Prefix for persistent decoder cache files.
+		std::string decoder_cache_prefix = "/tmp/rvdecoder-";
+
+		/// @brief The number of threads used to generate the decoder cache
+		/// of large execute segments. 0 means one per hardware thread.
+		/// @details The segment is split into page-aligned chunks of at least
+		/// 256KB, which are decoded and rewritten concurrently. The result is
+		/// identical to decoding on a single thread.
+		unsigned decoder_cache_workers = 1;
+
+		/// @brief Decode each page of an execute segment the first time
+		/// execution enters it, instead of decoding the whole segment up front.
+		/// @details Reduces startup time and memory usage of large programs
+		/// where only a small part of the code is executed. Blocks end at page
+		/// boundaries. Not used together with persistent decoder caches, binary
+		/// translation, ebreak locations or shared execute segments. Forking
+		/// decodes the remaining pages, as forks share the execute segments.
+		bool use_lazy_decoding = false;
+
 		/// @brief Override a default-injected exit function with another function
 		/// that is found by looking up the provided symbol name in the current program.
 		/// Eg. if default_exit_function is "fast_exit", then the ELF binary must have
@@ -161,6 +273,16 @@ namespace riscv
 		/// Translated shared objects will be stored in a file and can be re-used later.
 		/// @details When TCC is enabled, the translation cache will be disabled.
 		bool translation_cache = true;
+		/// @brief Limit the total size of the translation cache, in bytes.
+		/// @details After a translation is added to the cache, the least recently
+		/// used translations matching translation_prefix and translation_suffix
+		/// are removed until the cache fits. Stale temporary files left by
+		/// interrupted compilations are also removed. Zero means no limit.
+		uint64_t translation_cache_max_bytes = 0;
+		/// @brief A directory of translations produced ahead of time, eg. by a build.
+		/// @details Translations that are missing from the cache are copied
+		/// from here into the cache, instead of being compiled.
+		std::string translation_cache_seed = "";
 		/// @brief Enable the use of the memory arena for the binary translator.
 		/// @details If disabled, remote machines will be able to make remote
 		/// calls to this machine. In most cases, this is not needed.
@@ -180,10 +302,33 @@ namespace riscv
 #else
 		bool translate_use_register_caching = false;
 #endif
+		/// @brief Use register caching in translated blocks that hold whole functions.
+		/// @details Blocks end where guest functions end, as found by following calls.
+		/// Such blocks keep the guest registers in locals across all of their basic
+		/// blocks, loops and internal calls, so that an optimizing compiler can keep
+		/// them in host registers. They are stored only on system calls, calls into
+		/// other blocks, indirect jumps that leave the block, unknown instructions
+		/// and exits. Other blocks use translate_use_register_caching.
+		bool translate_function_register_caching = true;
+		/// @brief Chain translated blocks directly to each other.
+		/// @details A translated block that leaves for a statically known PC in
+		/// another block tail-calls that block. When a block exits through an
+		/// indirect jump, the next block is looked up in a hash table inside the
+		/// translation and called without returning to the dispatcher. A system call
+		/// that changes the current execute segment, eg. by evicting it, returns
+		/// to the dispatcher. So does every block once the decoder cache has
+		/// been modified after decoding, eg. by installing a breakpoint.
+		bool translate_block_chaining = true;
 		/// @brief Enable recording of slowpaths to jump hints for the binary translator.
 		/// @details This will record slowpaths to the MachineOptions jump hints vector.
 		/// From there the CLI can save the jump hints to a file after the program has run.
 		bool record_slowpaths_to_jump_hints = false;
+		/// @brief Record a translation profile instead of translating.
+		/// @details Execute segments that would be translated are interpreted
+		/// instead, counting entries into blocks and the outcomes of conditional
+		/// branches. Memory::gather_translation_profile() collects the result,
+		/// which can be passed back as translation_profile in later runs.
+		bool record_translation_profile = false;
 		/// @brief Prefix for the translation output file.
 		std::string translation_prefix = "/tmp/rvbintr-";
 		/// @brief Suffix for the translation output file. Eg. .dll or .so
@@ -196,6 +341,11 @@ namespace riscv
 		/// @brief Jump location hints for the binary translator.
 		/// @details These hints can improve performance of the binary translation.
 		std::vector<address_type<W>> translator_jump_hints {};
+		/// @brief Execution profile for profile-guided binary translation.
+		/// @details When over the translation limits the hottest blocks are
+		/// translated, hot blocks are emitted first, blocks that never ran are
+		/// compiled for size, and strongly biased branches are given hints.
+		TranslationProfile<W> translation_profile {};
 		/// @brief Enable background compilation of shared objects. The compilation step
 		/// will be executed from a user-provided callback, and will be applied to the machine
 		/// when ready. Applying the translation is thread-safe and will take effect on all
@@ -203,6 +353,24 @@ namespace riscv
 		/// For short-lived programs, this feature should be disabled, as it often takes more
 		/// time to translate and compile than to execute the program.
 		std::function<void(std::function<void()>& compilation_step)> translate_background_callback = nullptr;
+		/// @brief Tiered execution: Interpret first, and translate only code that becomes hot.
+		/// @details When non-zero, an execute segment that needs compiling starts out in
+		/// the interpreter, which counts how often each code region is jumped or looped to.
+		/// Once a region has been entered this many times, every region that is at least
+		/// 1/16th as warm is translated and live-patched into the running segment, using
+		/// translate_background_callback when it is set. This partial translation is not
+		/// cached. If a region that was left out becomes hot later, the whole segment is
+		/// translated, cached and live-patched in. Short-lived programs never pay for
+		/// compilation. Zero translates the whole execute segment up front.
+		/// Without translate_background_callback, promotion compiles inside the
+		/// dispatch loop, and the guest is paused for the duration of the compilation.
+		unsigned translate_hot_threshold = 0;
+		/// @brief Split the generated C code into this many parts by block,
+		/// compile them concurrently and link them into one shared object.
+		/// @details Zero uses one part per host core. Programs with little code
+		/// are split into fewer parts, as each part costs a compiler invocation.
+		/// Only applies to the system compiler, not to libtcc or cross-compilation.
+		unsigned translate_shards = 1;
 		/// @brief Allow the production of a secondary dependency-free DLL that can be
 		/// transferred to and loaded on Windows (or other) machines. It will be used
 		/// to greatly accelerate the emulation of the RISC-V program.
@@ -321,6 +489,11 @@ namespace riscv
 #else
 	static constexpr bool libtcc_enabled = false;
 #endif
+#ifdef RISCV_JIT
+	static constexpr bool jit_enabled = true;
+#else
+	static constexpr bool jit_enabled = false;
+#endif
 
 
 	template <int W> struct MultiThreading;
@@ -49,6 +49,15 @@ namespace riscv
 		this->registers().copy_from(Registers<W>::Options::NoVectors, other.cpu.registers());
 	}
 	template <int W>
+	void CPU<W>::rewind(const CPU<W>& main)
+	{
+		this->m_exec = main.m_exec;
+		this->registers().copy_from(Registers<W>::Options::NoVectors, main.registers());
+		this->clear_current_exception();
+		// The execute page may have been restored
+		this->m_cache = {};
+	}
+	template <int W>
 	void CPU<W>::reset()
 	{
 		this->m_regs = {};
@@ -355,6 +364,10 @@ restart_precise_sim:
 			throw MachineException(EXECUTION_SPACE_PROTECTION_FAULT,
 				"Breakpoint address is not within the execute segment", addr);
 		}
+		// Lazy decoding would overwrite changes to undecoded pages
+		exec.decode_all_lazy_pages();
+		// Chained translated blocks would not see the new entry
+		exec.set_decoder_patched();
 
 		auto* exec_decoder = exec.decoder_cache();
 		auto* decoder_begin = &exec_decoder[exec.exec_begin() / DecoderCache<W>::DIVISOR];
@@ -395,6 +408,10 @@ restart_precise_sim:
 			throw MachineException(INVALID_PROGRAM,
 				"Last instruction in breakpoint block was not aligned", patched_addr);
 		}
+		// 4. A superinstruction must not execute past the new block end
+		auto* prev = last - (compressed_enabled ? 2 : 1);
+		if (prev >= decoder_begin)
+			prev->set_bytecode(superinstruction_first(prev->get_bytecode()));
 
 		return cache_entry;
 	}
@@ -441,6 +458,9 @@ restart_precise_sim:
 			throw MachineException(EXECUTION_SPACE_PROTECTION_FAULT,
 				"Function start address is not within the execute segment", block_pc);
 		}
+		exec.decode_all_lazy_pages();
+		// Chained translated blocks would not see the live-patched return
+		exec.set_decoder_patched();
 
 		auto* exec_decoder = exec.decoder_cache();
 		// The beginning of the function:
@@ -472,6 +492,10 @@ restart_precise_sim:
 						// We found the (potential) end of the function
 						// Now rewrite it to a STOP instruction
 						cache_entry->set_atomic_bytecode_and_handler(RV32I_BC_LIVEPATCH, 1);
+						// An AUIPC+JALR superinstruction would skip the live-patch
+						auto* prev = cache_entry - (compressed_enabled ? 2 : 1);
+						if (prev >= &exec_decoder[exec.exec_begin() / DecoderCache<W>::DIVISOR])
+							prev->set_bytecode(superinstruction_first(prev->get_bytecode()));
 						return true;
 					}
 				} else if (bytecode == RV32I_BC_STOP) {
@@ -120,17 +120,22 @@ namespace riscv
 		// Binary translation functions
 		int  load_translation(const MachineOptions<W>&, std::string* filename, DecodedExecuteSegment<W>&) const;
 		void try_translate(const MachineOptions<W>&, const std::string&, std::shared_ptr<DecodedExecuteSegment<W>>&) const;
+		// Tiered execution: Translate the warm parts of the execute segment at pc
+		void promote_hot_segment(address_t pc) RISCV_COLD_PATH();
 
 		void reset();
 		void reset_stack_pointer() noexcept;
 
 		CPU(Machine<W>&, unsigned cpu_id);
 		CPU(Machine<W>&, unsigned cpu_id, const Machine<W>& other); // Fork
+		void rewind(const CPU& main); // Return a fork to the state of main
 
 		DecodedExecuteSegment<W>& init_execute_area(const void* data, address_t begin, address_t length, bool is_likely_jit = false);
 		void set_execute_segment(DecodedExecuteSegment<W>& seg) noexcept { m_exec = &seg; }
 		auto& current_execute_segment() noexcept { return *m_exec; }
 		auto& current_execute_segment() const noexcept { return *m_exec; }
+		// Binary translations compare this to detect a change of execute segment
+		auto* const& current_execute_segment_ref() const noexcept { return m_exec; }
 		struct NextExecuteReturn {
 			DecodedExecuteSegment<W>* exec;
 			address_t pc;
@@ -210,8 +215,13 @@ namespace riscv
 
 #ifdef RISCV_BINARY_TRANSLATION
 		static std::vector<TransMapping<W>> emit(std::string& code, const TransInfo<W>&);
+		void find_translation_blocks(const MachineOptions<W>&, DecodedExecuteSegment<W>&, TransBlocks<W>&) const;
 		void binary_translate(const MachineOptions<W>&, DecodedExecuteSegment<W>&, TransOutput<W>&) const;
+#ifdef RISCV_JIT
+		void jit_translate(const MachineOptions<W>&, const TransBlocks<W>&, TransOutput<W>&) const;
+#endif
 		static void activate_dylib(const MachineOptions<W>&, DecodedExecuteSegment<W>&, void*, void*, bool, bool) RISCV_INTERNAL;
+		static void activate_mappings(const MachineOptions<W>&, DecodedExecuteSegment<W>&, const Mapping<W>*, unsigned, const bintr_block_func<W>*, unsigned, bool) RISCV_INTERNAL;
 		static bool initialize_translated_segment(DecodedExecuteSegment<W>&, void*, void*, bool) RISCV_INTERNAL;
 		static void produce_embeddable_code(const MachineOptions<W>&, DecodedExecuteSegment<W>&, const TransOutput<W>&, const MachineTranslationEmbeddableCodeOptions&) RISCV_INTERNAL;
 #endif
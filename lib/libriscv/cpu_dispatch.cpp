@@ -1,6 +1,7 @@
 #include "machine.hpp"
 #include "decoder_cache.hpp"
 #include "instruction_counter.hpp"
+#include "return_stack.hpp"
 #include "threaded_bytecodes.hpp"
 #include "rv32i_instr.hpp"
 #include "rvfd.hpp"
@@ -9,6 +10,7 @@
 #endif
 #ifdef RISCV_EXT_VECTOR
 #include "rvv.hpp"
+#include "rvv_kernels.hpp"
 #endif
 
 /**
@@ -42,6 +44,12 @@ namespace riscv
 #define NEXT_C_INSTR() \
 	decoder += 1;      \
 	EXECUTE_INSTR();
+// Step into the second half of a superinstruction
+#define ADVANCE_INSTR()               \
+	if constexpr (compressed_enabled) \
+		decoder += 2;                 \
+	else                              \
+		decoder += 1;
 
 #define NEXT_BLOCK(len, OF)                 \
 	pc += len;                              \
@@ -67,8 +75,26 @@ namespace riscv
 	counter.increment_counter(decoder->instruction_count()); \
 	EXECUTE_INSTR();
 
+#ifdef RISCV_BINARY_TRANSLATION
+// Tiered execution: Count entries into jump and loop targets.
+// Whether the segment is counting is read once per dispatch entry.
+#define COUNT_HOT_BLOCK(addr)                                              \
+	if (UNLIKELY(count_hot_blocks) && exec->count_hot_block(addr)) {     \
+		this->promote_hot_segment(addr);                                   \
+		count_hot_blocks = exec->is_counting_hot_blocks();                 \
+	}
+// Profiling: Count the outcome of the conditional branch at pc
+#define COUNT_BRANCH(taken)          \
+	if (UNLIKELY(count_hot_blocks))  \
+		exec->count_branch(pc, taken);
+#else
+#define COUNT_HOT_BLOCK(addr) /* */
+#define COUNT_BRANCH(taken) /* */
+#endif
+
 #define PERFORM_BRANCH()                 \
 	if constexpr (VERBOSE_JUMPS) fprintf(stderr, "Branch 0x%lX >= 0x%lX (decoder=%p)\n", long(pc), long(pc + fi.signed_imm()), decoder); \
+	COUNT_HOT_BLOCK(pc + fi.signed_imm()); \
 	if (LIKELY(!counter.overflowed())) { \
 		NEXT_BLOCK(fi.signed_imm(), false);     \
 	}                                    \
@@ -79,9 +105,30 @@ namespace riscv
 	if constexpr (VERBOSE_JUMPS) fprintf(stderr, "Fw.Branch 0x%lX >= 0x%lX\n", long(pc), long(pc + fi.signed_imm())); \
 	NEXT_BLOCK(fi.signed_imm(), false);
 
-#define OVERFLOW_CHECKED_JUMP() \
+// Indirect jumps within the current execute segment dispatch directly
+// from their own handler, giving each of them a separate indirect branch.
+#define OVERFLOW_CHECKED_JUMP()                                     \
+	if (LIKELY(!counter.overflowed() &&                             \
+		pc - current_begin < current_end - current_begin)) {        \
+		COUNT_HOT_BLOCK(pc);                                        \
+		NEXT_SEGMENT();                                             \
+	}                                                               \
 	goto check_jump
 
+// Calls push the decoder entry of their return address, and returns
+// that were predicted correctly begin the next block without a lookup.
+#define PUSH_RETURN_ADDRESS(len)                                    \
+	if (LIKELY(pc + len < current_end))                             \
+		ras.push(pc + len, decoder + (len >> DecoderCache<W>::SHIFT));
+#define POP_RETURN_ADDRESS()                                        \
+	if (auto* ret = ras.pop(pc); LIKELY(ret != nullptr && !counter.overflowed())) { \
+		COUNT_HOT_BLOCK(pc);                                        \
+		decoder = ret;                                              \
+		pc += decoder->block_bytes();                               \
+		counter.increment_counter(decoder->instruction_count());    \
+		EXECUTE_INSTR();                                            \
+	}
+
 
 template <int W> DISPATCH_ATTR
 bool CPU<W>::simulate(address_t pc, uint64_t inscounter, uint64_t maxcounter)
@@ -97,11 +144,15 @@ bool CPU<W>::simulate(address_t pc, uint64_t inscounter, uint64_t maxcounter)
 	DecodedExecuteSegment<W>* exec = this->m_exec;
 	address_t current_begin = exec->exec_begin();
 	address_t current_end   = exec->exec_end();
+#ifdef RISCV_BINARY_TRANSLATION
+	bool count_hot_blocks = exec->is_counting_hot_blocks();
+#endif
 
 	DecoderData<W>* exec_decoder = exec->decoder_cache();
 	DecoderData<W>* decoder;
 
 	InstrCounter counter{inscounter, maxcounter};
+	ReturnStack<W> ras;
 
 	// We need an execute segment matching current PC
 	if (UNLIKELY(!(pc >= current_begin && pc < current_end)))
@@ -115,6 +166,7 @@ bool CPU<W>::simulate(address_t pc, uint64_t inscounter, uint64_t maxcounter)
 #  endif
 
 continue_segment:
+	COUNT_HOT_BLOCK(pc);
 	decoder = &exec_decoder[pc >> DecoderCache<W>::SHIFT];
 
 	pc += decoder->block_bytes();
@@ -175,7 +227,7 @@ retry_translated_function:
 	pc = REGISTERS().pc;
 	cnt = bintr_results.counter;
 	max = bintr_results.max_counter;
-	if (LIKELY(cnt < max && (pc - current_begin < current_end - current_begin))) {
+	if (LIKELY(cnt < max && (pc - current_begin < current_end - current_begin) && exec == this->m_exec)) {
 		decoder = &exec_decoder[pc >> DecoderCache<W>::SHIFT];
 		if (decoder->get_bytecode() == RV32I_BC_TRANSLATOR) {
 			goto retry_translated_function;
@@ -184,6 +236,9 @@ retry_translated_function:
 		goto continue_segment;
 	}
 	counter.set_counters(cnt, max);
+	// A system call may have changed the execute segment, eg. by evicting it
+	if (UNLIKELY(exec != this->m_exec) && !counter.overflowed())
+		goto new_execute_segment;
 	goto check_jump;
 }
 #endif // RISCV_BINARY_TRANSLATION
@@ -235,15 +290,15 @@ check_jump:
 		goto new_execute_segment;
 
 counter_overflow:
-#ifdef RISCV_LIBTCC
+	registers().pc = pc;
+	MACHINE().set_instruction_counter(counter.value());
+
+#if defined(RISCV_LIBTCC) || defined(RISCV_JIT)
 	// We need to check if we have a current exception
 	if (UNLIKELY(CPU().has_current_exception()))
 		goto handle_rethrow_exception;
 #endif
 
-	registers().pc = pc;
-	MACHINE().set_instruction_counter(counter.value());
-
 	// Machine stopped normally?
 	return counter.max() == 0;
 
@@ -255,12 +310,21 @@ new_execute_segment: {
 		current_begin = exec->exec_begin();
 		current_end   = exec->exec_end();
 		exec_decoder  = exec->decoder_cache();
+		ras.clear();
+#ifdef RISCV_BINARY_TRANSLATION
+		count_hot_blocks = exec->is_counting_hot_blocks();
+#endif
 	}
 	goto continue_segment;
 
 execute_invalid:
 	// Calculate the current PC from the decoder pointer
 	pc = (decoder - exec_decoder) << DecoderCache<W>::SHIFT;
+	// Lazily decoded pages are decoded when first entered
+	if (exec->is_lazily_decoded() && exec->decode_lazy_page(pc)) {
+		counter.increment_counter(-1);
+		goto continue_segment;
+	}
 	// Check if the instruction is still invalid
 	try {
 		if (exec->is_likely_jit() && MACHINE().memory.template read<uint16_t>(pc) != uint16_t(decoder->instr)) {
@@ -272,7 +336,7 @@ execute_invalid:
 	registers().pc = pc;
 	trigger_exception(ILLEGAL_OPCODE, decoder->instr);
 
-#ifdef RISCV_LIBTCC
+#if defined(RISCV_LIBTCC) || defined(RISCV_JIT)
 handle_rethrow_exception:
 	// We have an exception, so we need to rethrow it
 	const auto except = CPU().current_exception();
@@ -29,6 +29,8 @@ namespace riscv
 #undef PERFORM_BRANCH
 #undef PERFORM_FORWARD_BRANCH
 #undef OVERFLOW_CHECKED_JUMP
+#undef PUSH_RETURN_ADDRESS
+#undef POP_RETURN_ADDRESS
 #define INACCURATE_DISPATCH
 
 #define VIEW_INSTR() \
@@ -65,15 +67,31 @@ namespace riscv
 #define PERFORM_BRANCH()                                                                                        \
 	if constexpr (VERBOSE_JUMPS)                                                                                \
 		fprintf(stderr, "Branch 0x%lX >= 0x%lX (decoder=%p)\n", long(pc), long(pc + fi.signed_imm()), decoder); \
+	COUNT_HOT_BLOCK(pc + fi.signed_imm());                                                                      \
 	NEXT_BLOCK(fi.signed_imm(), false);
 
-#define PERFORM_FORWARD_BRANCH PERFORM_BRANCH
+#define PERFORM_FORWARD_BRANCH()                                                                                \
+	if constexpr (VERBOSE_JUMPS)                                                                                \
+		fprintf(stderr, "Fw.Branch 0x%lX >= 0x%lX\n", long(pc), long(pc + fi.signed_imm()));                   \
+	NEXT_BLOCK(fi.signed_imm(), false);
 
-#define OVERFLOW_CHECKED_JUMP()                                   \
-	if (LIKELY(pc - current_begin < current_end - current_begin)) \
-		goto continue_segment;                                    \
-	else                                                          \
-		goto new_execute_segment;
+#define OVERFLOW_CHECKED_JUMP()                                     \
+	if (LIKELY(pc - current_begin < current_end - current_begin)) { \
+		COUNT_HOT_BLOCK(pc);                                        \
+		NEXT_SEGMENT();                                             \
+	}                                                               \
+	goto new_execute_segment;
+
+#define PUSH_RETURN_ADDRESS(len)                                    \
+	if (LIKELY(pc + len < current_end))                             \
+		ras.push(pc + len, decoder + (len >> DecoderCache<W>::SHIFT));
+#define POP_RETURN_ADDRESS()                                        \
+	if (auto* ret = ras.pop(pc); LIKELY(ret != nullptr)) {          \
+		COUNT_HOT_BLOCK(pc);                                        \
+		decoder = ret;                                              \
+		pc += decoder->block_bytes();                               \
+		EXECUTE_INSTR();                                            \
+	}
 
 	template <int W>
 	DISPATCH_ATTR void CPU<W>::simulate_inaccurate(address_t pc)
@@ -91,9 +109,13 @@ namespace riscv
 		DecodedExecuteSegment<W> *exec = this->m_exec;
 		address_t current_begin = exec->exec_begin();
 		address_t current_end = exec->exec_end();
+#ifdef RISCV_BINARY_TRANSLATION
+		bool count_hot_blocks = exec->is_counting_hot_blocks();
+#endif
 
 		DecoderData<W> *exec_decoder = exec->decoder_cache();
 		DecoderData<W> *decoder;
+		ReturnStack<W> ras;
 
 		// We need an execute segment matching current PC
 		if (UNLIKELY(!(pc >= current_begin && pc < current_end)))
@@ -107,6 +129,7 @@ namespace riscv
 #endif
 
 	continue_segment:
+		COUNT_HOT_BLOCK(pc);
 		decoder = &exec_decoder[pc >> DecoderCache<W>::SHIFT];
 
 		pc += decoder->block_bytes();
@@ -162,6 +185,9 @@ retry_translated_function:
 	auto bintr_results =
 		exec->unchecked_mapping_at(decoder->instr)(*this, 0, 1, pc);
 	pc = REGISTERS().pc;
+	// A system call may have changed the execute segment, eg. by evicting it
+	if (UNLIKELY(exec != this->m_exec) && bintr_results.max_counter != 0)
+		goto new_execute_segment;
 	if (LIKELY(bintr_results.max_counter != 0 && (pc - current_begin < current_end - current_begin)))
 	{
 		decoder = &exec_decoder[pc >> DecoderCache<W>::SHIFT];
@@ -228,12 +254,16 @@ INSTRUCTION(RV32I_BC_STOP, rv32i_stop)
 		current_begin = exec->exec_begin();
 		current_end = exec->exec_end();
 		exec_decoder = exec->decoder_cache();
+		ras.clear();
+#ifdef RISCV_BINARY_TRANSLATION
+		count_hot_blocks = exec->is_counting_hot_blocks();
+#endif
 	}
 		goto continue_segment;
 
 #ifdef RISCV_BINARY_TRANSLATION
 	exit_check:
-#ifdef RISCV_LIBTCC
+#if defined(RISCV_LIBTCC) || defined(RISCV_JIT)
 		// We need to check if we have a current exception
 		if (UNLIKELY(CPU().has_current_exception()))
 			goto handle_rethrow_exception;
@@ -244,6 +274,9 @@ INSTRUCTION(RV32I_BC_STOP, rv32i_stop)
 	execute_invalid:
 		// Calculate the current PC from the decoder pointer
 		pc = (decoder - exec_decoder) << DecoderCache<W>::SHIFT;
+		// Lazily decoded pages are decoded when first entered
+		if (exec->is_lazily_decoded() && exec->decode_lazy_page(pc))
+			goto continue_segment;
 		// Check if the instruction is still invalid
 		try {
 			if (exec->is_likely_jit() && MACHINE().memory.template read<uint16_t>(pc) != uint16_t(decoder->instr)) {
@@ -254,7 +287,7 @@ INSTRUCTION(RV32I_BC_STOP, rv32i_stop)
 		registers().pc = pc;
 		trigger_exception(ILLEGAL_OPCODE, decoder->instr);
 
-#if defined(RISCV_BINARY_TRANSLATION) && defined(RISCV_LIBTCC)
+#if defined(RISCV_BINARY_TRANSLATION) && (defined(RISCV_LIBTCC) || defined(RISCV_JIT))
 	handle_rethrow_exception:
 		// We have an exception, so we need to rethrow it
 		const auto except = CPU().current_exception();
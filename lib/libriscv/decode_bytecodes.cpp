@@ -453,8 +453,10 @@ size_t CPU<W>::computed_index_for(rv32i_instruction instr) noexcept
 			case 0x3: // FLD
 				return RV32F_BC_FLD;
 #ifdef RISCV_EXT_VECTOR
-			case 0x6: // VLE32
-				return RV32V_BC_VLE32;
+			case 0x6: // VLE32 (unit-stride, unmasked)
+				if (rv32v_instruction{instr}.VLS.mop == 0 && rv32v_instruction{instr}.VLS.vm)
+					return RV32V_BC_VLE32;
+				return RV32I_BC_FUNCTION;
 #endif
 			default:
 				return RV32I_BC_INVALID;
@@ -468,8 +470,10 @@ size_t CPU<W>::computed_index_for(rv32i_instruction instr) noexcept
 			case 0x3: // FSD
 				return RV32F_BC_FSD;
 #ifdef RISCV_EXT_VECTOR
-			case 0x6: // VSE32
-				return RV32V_BC_VSE32;
+			case 0x6: // VSE32 (unit-stride, unmasked)
+				if (rv32v_instruction{instr}.VLS.mop == 0 && rv32v_instruction{instr}.VLS.vm)
+					return RV32V_BC_VSE32;
+				return RV32I_BC_FUNCTION;
 #endif
 			default:
 				return RV32I_BC_INVALID;
@@ -500,13 +504,29 @@ size_t CPU<W>::computed_index_for(rv32i_instruction instr) noexcept
 #ifdef RISCV_EXT_VECTOR
 		case RV32V_OP: {
 			const rv32v_instruction vi{instr};
+			// Masked instructions are left to the instruction handlers
+			if (!vi.OPVV.vm)
+				return RV32I_BC_FUNCTION;
 			switch (instr.vwidth())
 			{
+			case 0x0: // OPI.VV
+				switch (vi.OPVV.funct6)
+				{
+				case 0b000000: // VADD.VV
+					return RV32V_BC_VADD_VV;
+				}
+				break;
 			case 0x1: // OPF.VV
 				switch (vi.OPVV.funct6)
 				{
 				case 0b000000: // VFADD.VV
 					return RV32V_BC_VFADD_VV;
+				case 0b000001: // VFREDUSUM.VS
+					return RV32V_BC_VFREDUSUM_VS;
+				case 0b100100: // VFMUL.VV
+					return RV32V_BC_VFMUL_VV;
+				case 0b101100: // VFMACC.VV
+					return RV32V_BC_VFMACC_VV;
 				}
 				break;
 			case 0x5: // OPF.VF
@@ -514,6 +534,8 @@ size_t CPU<W>::computed_index_for(rv32i_instruction instr) noexcept
 				{
 				case 0b100100: // VFMUL.VF
 					return RV32V_BC_VFMUL_VF;
+				case 0b101100: // VFMACC.VF
+					return RV32V_BC_VFMACC_VF;
 				}
 				break;
 			}
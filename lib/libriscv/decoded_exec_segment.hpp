@@ -1,13 +1,71 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <string>
 #include "types.hpp"
 #include <unordered_set>
+#include <vector>
 
 namespace riscv
 {
 	template<int W> struct DecoderCache;
 	template<int W> struct DecoderData;
 
+	// A sequence of adjacent bytecodes within a block,
+	// and how many times it occurs in an execute segment
+	struct BytecodeSequence
+	{
+		std::array<uint8_t, 3> bytecodes {};
+		unsigned length = 0; // 2 (pair) or 3 (triple)
+		size_t   count  = 0;
+	};
+
+	// Per-region execution counters for tiered translation
+	struct HotCounters
+	{
+		std::unique_ptr<std::atomic<uint32_t>[]> counters;
+		size_t   size = 0;
+		uint32_t threshold = 0;
+		// 0: Interpreted, 1: Warm regions translated, 2: Fully translated
+		std::atomic<unsigned> tier = 0;
+		std::atomic<bool> promoting = false;
+		// The regions that were warm when the first tier began
+		std::vector<bool> warm;
+		std::string filename;
+	};
+
+	// Per-instruction counters of a profiling run, see TranslationProfile
+	struct ProfileCounters
+	{
+		struct Slot {
+			std::atomic<uint32_t> entries = 0;
+			std::atomic<uint32_t> taken = 0;
+			std::atomic<uint32_t> not_taken = 0;
+		};
+		std::unique_ptr<Slot[]> slots;
+		size_t size = 0;
+
+		// Saturating, also when machines sharing the segment count at once
+		static void increment(std::atomic<uint32_t>& counter) noexcept {
+			uint32_t value = counter.load(std::memory_order_relaxed);
+			while (value != UINT32_MAX &&
+				!counter.compare_exchange_weak(value, value + 1, std::memory_order_relaxed));
+		}
+	};
+
+	// Pages of a lazily decoded execute segment
+	struct LazyDecoding
+	{
+		std::unique_ptr<std::atomic<bool>[]> decoded;
+		// Compressed: The page begins with a whole instruction
+		std::vector<uint8_t> whole_at_begin;
+		bool superinstructions = false;
+		std::mutex mutex;
+	};
+
 	// A fully decoded execute segment
 	template <int W>
 	struct DecodedExecuteSegment
@@ -40,10 +98,20 @@ namespace riscv
 		size_t decoder_cache_size() const noexcept { return m_decoder_cache_size; }
 
 		auto* create_decoder_cache(DecoderCache<W>* cache, size_t size) {
+			release_mapped_decoder_cache();
 			m_decoder_cache.reset(cache);
 			m_decoder_cache_size = size;
 			return m_decoder_cache.get();
 		}
+		// Use a decoder cache that was mapped (eg. from a file), which
+		// will be unmapped instead of deleted on destruction.
+		auto* create_mapped_decoder_cache(DecoderCache<W>* cache, size_t size, void* mapping, size_t mapping_size) {
+			create_decoder_cache(cache, size);
+			m_decoder_cache_mapping = mapping;
+			m_decoder_cache_mapping_size = mapping_size;
+			return m_decoder_cache.get();
+		}
+		bool is_decoder_cache_mapped() const noexcept { return m_decoder_cache_mapping != nullptr; }
 		void set_decoder(DecoderData<W>* dec) { m_exec_decoder = dec; }
 
 		size_t size_bytes() const noexcept {
@@ -58,24 +126,80 @@ namespace riscv
 
 		size_t threaded_rewrite(size_t bytecode, address_t pc, rv32i_instruction& instr, uint8_t& handler_idx);
 
+		// Install superinstructions for adjacent bytecode pairs in the
+		// decoder cache. Returns the number of fused pairs.
+		size_t fuse_superinstructions();
+		// Profile the most frequent adjacent bytecode pairs and triples
+		// in the decoder cache, ordered by occurrence. Fused entries are
+		// reported using their original bytecodes.
+		std::vector<BytecodeSequence> profile_bytecode_sequences(size_t max_results = 16) const;
+
 		uint32_t crc32c_hash() const noexcept { return m_crc32c_hash; }
 		void set_crc32c_hash(uint32_t hash) { m_crc32c_hash = hash; }
 
 #ifdef RISCV_BINARY_TRANSLATION
 		bool is_binary_translated() const noexcept { return !m_translator_mappings.empty(); }
 		bool is_libtcc() const noexcept { return m_is_libtcc; }
+		bool is_jit() const noexcept { return m_is_jit; }
 		void* binary_translation_so() const { return m_bintr_dl; }
-		void set_binary_translated(void* dl, bool is_libtcc) const { m_bintr_dl = dl; m_is_libtcc = is_libtcc; }
+		void set_binary_translated(void* dl, bool is_libtcc, bool is_jit = false) const
+			{ m_bintr_dl = dl; m_is_libtcc = is_libtcc; m_is_jit = is_jit; }
+		// Keep a replaced translation loaded until destruction, as
+		// other threads may still be executing it
+		void retire_binary_translation() const;
 		uint32_t translation_hash() const { return m_bintr_hash; }
 		void set_translation_hash(uint32_t hash) { m_bintr_hash = hash; }
-		void create_mappings(size_t mappings) { m_translator_mappings.resize(mappings); }
+		void create_mappings(size_t mappings);
+		// Add mappings after the current ones, which remain valid,
+		// returning the index of the first new mapping
+		size_t append_mappings(size_t mappings);
 		void set_mapping(unsigned i, bintr_block_func<W> handler) { m_translator_mappings.at(i) = handler; }
 		bintr_block_func<W> mapping_at(unsigned i) const { return m_translator_mappings.at(i); }
-		bintr_block_func<W> unchecked_mapping_at(unsigned i) const { return m_translator_mappings[i]; }
+		bintr_block_func<W> unchecked_mapping_at(unsigned i) const
+			{ return m_mapping_table.load(std::memory_order_acquire)[i]; }
 		size_t translator_mappings() const noexcept { return m_translator_mappings.size(); }
 		auto* patched_decoder_cache() noexcept { return m_patched_exec_decoder; }
-		void set_patched_decoder_cache(std::unique_ptr<DecoderCache<W>[]> cache, DecoderData<W>* dec)
-			{ m_patched_decoder_cache = std::move(cache); m_patched_exec_decoder = dec; }
+		auto* patched_decoder_cache_base() const noexcept { return m_patched_decoder_cache.get(); }
+		void set_patched_decoder_cache(std::unique_ptr<DecoderCache<W>[]> cache, DecoderData<W>* dec);
+
+		// Tiered execution: Execution counters for each code region
+		static constexpr unsigned HOT_REGION_SHIFT = 8;
+		void enable_hot_counters(unsigned threshold, std::string filename);
+		bool is_tiered() const noexcept { return m_hot != nullptr; }
+		bool is_counting_hot_blocks() const noexcept { return m_count_hot_blocks.load(std::memory_order_relaxed); }
+		// Count an entry into the block at addr, returning true
+		// once, when its region becomes hot
+		bool count_hot_block(address_t addr) noexcept {
+			if (m_profile != nullptr) {
+				if (auto* slot = profile_slot(addr))
+					ProfileCounters::increment(slot->entries);
+				return false;
+			}
+			const size_t idx = (addr - m_vaddr_begin) >> HOT_REGION_SHIFT;
+			if (idx < m_hot->size)
+				return m_hot->counters[idx].fetch_add(1, std::memory_order_relaxed) + 1 == m_hot->threshold;
+			return false;
+		}
+		bool is_warm_region(address_t begin, address_t end) const noexcept;
+		// Stop counting and begin translating the next tier, returning
+		// false when a promotion is already in progress or complete
+		bool begin_hot_promotion() noexcept;
+		// Resume counting the regions that the first tier left out
+		void finish_hot_promotion() noexcept;
+		unsigned hot_tier() const noexcept { return m_hot ? m_hot->tier.load() : 0; }
+		const std::string& hot_translation_filename() const { return m_hot->filename; }
+
+		// Profiling: Count blocks and the outcomes of conditional branches
+		// using the tiered execution counting hooks, but never promote
+		void enable_profile_counters();
+		bool is_profiling() const noexcept { return m_profile != nullptr; }
+		void count_branch(address_t pc, bool taken) noexcept {
+			if (m_profile != nullptr) {
+				if (auto* slot = profile_slot(pc))
+					ProfileCounters::increment(taken ? slot->taken : slot->not_taken);
+			}
+		}
+		const ProfileCounters* profile_counters() const noexcept { return m_profile.get(); }
 
 		void set_record_slowpaths(bool do_record) { m_do_record_slowpaths = do_record; }
 		bool is_recording_slowpaths() const noexcept { return m_do_record_slowpaths; }
@@ -94,6 +218,25 @@ namespace riscv
 		bool is_stale() const noexcept { return m_is_stale; }
 		void set_stale(bool is_stale) { m_is_stale = is_stale; }
 
+		bool has_superinstructions() const noexcept { return m_has_superinstructions; }
+		void set_has_superinstructions(bool has) { m_has_superinstructions = has; }
+
+		// The decoder cache was changed after decoding, eg. by a breakpoint.
+		// Chained translated blocks then return to the dispatcher between blocks.
+		bool is_decoder_patched() const noexcept { return m_is_decoder_patched; }
+		void set_decoder_patched() { m_is_decoder_patched = true; }
+		const bool& decoder_patched_ref() const noexcept { return m_is_decoder_patched; }
+
+		// Lazy decoding: Each page of the decoder cache starts out zeroed
+		// (invalid), and is decoded the first time execution enters it.
+		void enable_lazy_decoding(std::vector<uint8_t> whole_at_begin, bool superinstructions);
+		bool is_lazily_decoded() const noexcept { return m_lazy != nullptr; }
+		// Decode the page containing pc if needed, returning true when there
+		// is now a valid entry at pc, in which case execution should be retried.
+		bool decode_lazy_page(address_t pc);
+		// Decode all remaining pages, eg. before modifying the decoder cache
+		void decode_all_lazy_pages();
+
 	private:
 		address_t m_vaddr_begin = 0;
 		address_t m_vaddr_end   = 0;
@@ -110,25 +253,49 @@ namespace riscv
 		// Decoder cache is used to run bytecode simulation at a high speed
 		size_t          m_decoder_cache_size = 0;
 		std::unique_ptr<DecoderCache<W>[]> m_decoder_cache = nullptr;
+		void*  m_decoder_cache_mapping = nullptr;
+		size_t m_decoder_cache_mapping_size = 0;
+		void release_mapped_decoder_cache();
 
 #ifdef RISCV_BINARY_TRANSLATION
 		std::vector<bintr_block_func<W>> m_translator_mappings;
+		std::atomic<const bintr_block_func<W>*> m_mapping_table = nullptr;
 		std::unique_ptr<DecoderCache<W>[]> m_patched_decoder_cache = nullptr;
 		DecoderData<W>* m_patched_exec_decoder = nullptr;
 		mutable void* m_bintr_dl = nullptr;
+		// Replaced translations, see retire_binary_translation()
+		struct RetiredTranslation {
+			void* dl;
+			bool is_libtcc;
+			bool is_jit;
+		};
+		mutable std::vector<RetiredTranslation> m_retired_dl;
+		std::vector<std::vector<bintr_block_func<W>>> m_retired_mappings;
+		std::vector<std::unique_ptr<DecoderCache<W>[]>> m_retired_decoder_caches;
 		std::unordered_set<address_t> m_slowpath_addresses;
 		uint32_t m_bintr_hash = 0x0; // CRC32-C of the execute segment + compiler options
+		std::unique_ptr<HotCounters> m_hot = nullptr;
+		std::unique_ptr<ProfileCounters> m_profile = nullptr;
+		ProfileCounters::Slot* profile_slot(address_t addr) noexcept {
+			const size_t idx = (addr - m_vaddr_begin) >> 1;
+			return (idx < m_profile->size) ? &m_profile->slots[idx] : nullptr;
+		}
 #endif
 		uint32_t m_crc32c_hash = 0x0; // CRC32-C of the execute segment
 		bool m_is_execute_only = false;
 #ifdef RISCV_BINARY_TRANSLATION
 		bool m_do_record_slowpaths = false;
 		mutable bool m_is_libtcc = false;
+		mutable bool m_is_jit = false;
+		std::atomic<bool> m_count_hot_blocks = false;
 #endif
 		// High-memory execute segments are likely to be JIT'd, and needs to
 		// be nuked when attempting to re-use the segment
 		bool m_is_likely_jit = false;
 		bool m_is_stale = false;
+		bool m_has_superinstructions = false;
+		bool m_is_decoder_patched = false;
+		std::unique_ptr<LazyDecoding> m_lazy = nullptr;
 	};
 
 	template <int W>
@@ -156,25 +323,172 @@ namespace riscv
 
 		m_decoder_cache_size = other.m_decoder_cache_size;
 		m_decoder_cache = std::move(other.m_decoder_cache);
+		m_decoder_cache_mapping = other.m_decoder_cache_mapping;
+		m_decoder_cache_mapping_size = other.m_decoder_cache_mapping_size;
+		other.m_decoder_cache_mapping = nullptr;
+		m_lazy = std::move(other.m_lazy);
 
 #ifdef RISCV_BINARY_TRANSLATION
 		m_translator_mappings = std::move(other.m_translator_mappings);
+		m_mapping_table = other.m_mapping_table.load();
 		m_bintr_dl = other.m_bintr_dl;
 		other.m_bintr_dl = nullptr;
 		m_bintr_hash = other.m_bintr_hash;
 		m_is_libtcc = other.m_is_libtcc;
+		m_is_jit = other.m_is_jit;
 		m_patched_decoder_cache = std::move(other.m_patched_decoder_cache);
 		m_patched_exec_decoder = other.m_patched_exec_decoder;
+		m_retired_dl = std::move(other.m_retired_dl);
+		m_retired_mappings = std::move(other.m_retired_mappings);
+		m_retired_decoder_caches = std::move(other.m_retired_decoder_caches);
+		m_hot = std::move(other.m_hot);
+		m_profile = std::move(other.m_profile);
+		m_count_hot_blocks = other.m_count_hot_blocks.load();
+#endif
+	}
+
+#ifdef RISCV_BINARY_TRANSLATION
+	template <int W>
+	inline void DecodedExecuteSegment<W>::enable_hot_counters(unsigned threshold, std::string filename)
+	{
+		m_hot = std::make_unique<HotCounters>();
+		m_hot->size = ((m_vaddr_end - m_vaddr_begin) >> HOT_REGION_SHIFT) + 1;
+		m_hot->counters.reset(new std::atomic<uint32_t>[m_hot->size]());
+		m_hot->threshold = threshold;
+		m_hot->filename = std::move(filename);
+		m_count_hot_blocks = true;
+	}
+
+	template <int W>
+	inline void DecodedExecuteSegment<W>::enable_profile_counters()
+	{
+		m_profile = std::make_unique<ProfileCounters>();
+		m_profile->size = (m_vaddr_end - m_vaddr_begin) >> 1;
+		m_profile->slots.reset(new ProfileCounters::Slot[m_profile->size]);
+		m_count_hot_blocks = true;
+	}
+
+	template <int W>
+	inline bool DecodedExecuteSegment<W>::is_warm_region(address_t begin, address_t end) const noexcept
+	{
+		// Only the first tier is a partial translation
+		if (m_hot == nullptr || m_hot->tier.load() != 1)
+			return true;
+		const size_t first = (begin - m_vaddr_begin) >> HOT_REGION_SHIFT;
+		const size_t last  = (end - 1 - m_vaddr_begin) >> HOT_REGION_SHIFT;
+		for (size_t idx = first; idx <= last && idx < m_hot->size; idx++) {
+			if (m_hot->warm[idx])
+				return true;
+		}
+		return false;
+	}
+
+	template <int W>
+	inline bool DecodedExecuteSegment<W>::begin_hot_promotion() noexcept
+	{
+		m_count_hot_blocks.store(false, std::memory_order_relaxed);
+		if (m_hot == nullptr || m_hot->promoting.exchange(true))
+			return false;
+		const unsigned tier = m_hot->tier.load();
+		if (tier >= 2)
+			return false;
+		if (tier == 0) {
+			// Translate the regions that are warm right now
+			const uint32_t warm = std::max(1u, m_hot->threshold / 16);
+			m_hot->warm.resize(m_hot->size);
+			for (size_t idx = 0; idx < m_hot->size; idx++)
+				m_hot->warm[idx] = m_hot->counters[idx].load(std::memory_order_relaxed) >= warm;
+		}
+		m_hot->tier.store(tier + 1);
+		return true;
+	}
+
+	template <int W>
+	inline void DecodedExecuteSegment<W>::finish_hot_promotion() noexcept
+	{
+		// After a failed translation, or the full translation, counting stays off
+		if (m_hot == nullptr || m_hot->tier.load() != 1 || !is_binary_translated())
+			return;
+		// Translated regions can no longer become hot, while the
+		// regions that were left out keep their counts
+		for (size_t idx = 0; idx < m_hot->size; idx++) {
+			if (m_hot->warm[idx])
+				m_hot->counters[idx].store(m_hot->threshold + 1, std::memory_order_relaxed);
+		}
+		m_hot->promoting.store(false);
+		m_count_hot_blocks.store(true, std::memory_order_relaxed);
+	}
+
+	template <int W>
+	inline void DecodedExecuteSegment<W>::create_mappings(size_t mappings)
+	{
+		m_translator_mappings.resize(mappings);
+		m_mapping_table.store(m_translator_mappings.data(), std::memory_order_release);
+	}
+
+	template <int W>
+	inline size_t DecodedExecuteSegment<W>::append_mappings(size_t mappings)
+	{
+		const size_t first = m_translator_mappings.size();
+		std::vector<bintr_block_func<W>> table;
+		table.reserve(first + mappings);
+		table.insert(table.end(), m_translator_mappings.begin(), m_translator_mappings.end());
+		table.resize(first + mappings);
+		// The current table may still be in use by other threads
+		m_retired_mappings.push_back(std::move(m_translator_mappings));
+		m_translator_mappings = std::move(table);
+		m_mapping_table.store(m_translator_mappings.data(), std::memory_order_release);
+		return first;
+	}
+
+	template <int W>
+	inline void DecodedExecuteSegment<W>::set_patched_decoder_cache(std::unique_ptr<DecoderCache<W>[]> cache, DecoderData<W>* dec)
+	{
+		// A replaced patched decoder cache may still be in use by other threads
+		if (m_patched_decoder_cache != nullptr)
+			m_retired_decoder_caches.push_back(std::move(m_patched_decoder_cache));
+		m_patched_decoder_cache = std::move(cache);
+		m_patched_exec_decoder = dec;
+	}
+
+	template <int W>
+	inline void DecodedExecuteSegment<W>::retire_binary_translation() const
+	{
+		if (m_bintr_dl != nullptr)
+			m_retired_dl.push_back({m_bintr_dl, m_is_libtcc, m_is_jit});
+		m_bintr_dl = nullptr;
+	}
 #endif
+
+	template <int W>
+	inline void DecodedExecuteSegment<W>::release_mapped_decoder_cache()
+	{
+		if (m_decoder_cache_mapping) {
+			extern void decoder_cache_unmap(void* mapping, size_t size);
+			// The decoder cache is a part of the mapping
+			(void)m_decoder_cache.release();
+			decoder_cache_unmap(m_decoder_cache_mapping, m_decoder_cache_mapping_size);
+			m_decoder_cache_mapping = nullptr;
+		}
 	}
 
 	template <int W>
 	inline DecodedExecuteSegment<W>::~DecodedExecuteSegment()
 	{
+		release_mapped_decoder_cache();
 #ifdef RISCV_BINARY_TRANSLATION
 		extern void  dylib_close(void* dylib, bool is_libtcc);
-		if (m_bintr_dl)
-			dylib_close(m_bintr_dl, m_is_libtcc);
+		retire_binary_translation();
+		for (const auto& retired : m_retired_dl) {
+#ifdef RISCV_JIT
+			extern void jit_close(void* jit);
+			if (retired.is_jit) {
+				jit_close(retired.dl);
+				continue;
+			}
+#endif
+			dylib_close(retired.dl, retired.is_libtcc);
+		}
 #endif
 	}
 
@@ -7,8 +7,10 @@
 #include "threaded_rewriter.cpp"
 #include "threaded_bytecodes.hpp"
 #include "util/crc32.hpp"
+#include <algorithm>
 #include <inttypes.h>
 #include <mutex>
+#include <thread>
 #include <unordered_set>
 //#define ENABLE_TIMINGS
 
@@ -76,6 +78,13 @@ namespace riscv
 	template <int W>
 	static SharedExecuteSegments<W> shared_execute_segments;
 
+	// Segments with and without superinstructions have different
+	// decoder caches, and so they must not be shared with each other.
+	static uint32_t shared_segment_key(uint32_t hash, bool superinstructions)
+	{
+		return superinstructions ? hash : ~hash;
+	}
+
 	template <int W>
 	static bool is_regular_compressed(uint16_t instr) {
 		const rv32c_instruction ci { instr };
@@ -113,15 +122,32 @@ namespace riscv
 		return false;
 	}
 
+	// All instructions that can modify PC or stop the machine end a block,
+	// as well as instructions that have been made block-ending beforehand
 	template <int W>
-	static void realize_fastsim(
-		address_type<W> base_pc, address_type<W> last_pc,
-		const uint8_t* exec_segment, DecoderData<W>* exec_decoder)
+	static bool is_block_ending(rv32i_instruction instruction, const DecoderData<W>& entry)
 	{
+		if (entry.get_bytecode() == RV32I_BC_FUNCBLOCK)
+			return true;
 #ifdef RISCV_BINARY_TRANSLATION
-		const auto translator_op = RV32I_BC_TRANSLATOR;
+		if (entry.get_bytecode() == RV32I_BC_TRANSLATOR)
+			return true;
 #endif
+		if (compressed_enabled && instruction.length() == 2)
+			return !is_regular_compressed<W>(instruction.half[0]);
+		const auto opcode = instruction.opcode();
+		return opcode == RV32I_BRANCH || is_stopping_system(instruction)
+			|| opcode == RV32I_JAL || opcode == RV32I_JALR;
+	}
 
+	// Blocks that begin in [base_pc, end_pc) are measured, and end_pc must
+	// be the beginning of a block (or last_pc), so that ranges can be
+	// realized independently of each other.
+	template <int W>
+	static void realize_fastsim(
+		address_type<W> base_pc, address_type<W> end_pc, address_type<W> last_pc,
+		const uint8_t* exec_segment, DecoderData<W>* exec_decoder)
+	{
 		if constexpr (compressed_enabled)
 		{
 			if (UNLIKELY(base_pc >= last_pc))
@@ -134,7 +160,7 @@ namespace riscv
 			// fill out data and opcode lengths previous instructions.
 			std::array<std::tuple<DecoderData<W>*, unsigned>, 256> block_array;
 			address_type<W> pc = base_pc;
-			while (pc < last_pc) {
+			while (pc < end_pc) {
 				size_t block_array_count = 0;
 				size_t datalength = 0;
 				address_type<W> block_pc = pc;
@@ -142,7 +168,6 @@ namespace riscv
 				while (true) {
 					const auto instruction = read_instruction(
 						exec_segment, pc, last_pc);
-					const auto opcode = instruction.opcode();
 					const auto length = instruction.length();
 
 					// Record the instruction
@@ -169,20 +194,8 @@ namespace riscv
 
 					datalength += length / 2;
 
-					// All opcodes that can modify PC
-					if (length == 2)
-					{
-						if (!is_regular_compressed<W>(instruction.half[0]))
-							break;
-					} else {
-						if (opcode == RV32I_BRANCH || is_stopping_system(instruction)
-							|| opcode == RV32I_JAL || opcode == RV32I_JALR)
-							break;
-					}
-				#ifdef RISCV_BINARY_TRANSLATION
-					if (entry->get_bytecode() == translator_op)
+					if (is_block_ending<W>(instruction, *entry))
 						break;
-				#endif
 
 					// A last test for the last instruction, which should have been a block-ending
 					// instruction. Since it wasn't we must force-end the block here.
@@ -243,23 +256,16 @@ namespace riscv
 			// 32-bits in size. We can use the idxend value for
 			// instruction counting.
 			unsigned idxend = 0;
-			address_type<W> pc = last_pc - 4;
+			address_type<W> pc = end_pc - 4;
 			// NOTE: The last check avoids overflow
-			while (pc >= base_pc && pc < last_pc)
+			while (pc >= base_pc && pc < end_pc)
 			{
 				const auto instruction = read_instruction(
 					exec_segment, pc, last_pc);
 				auto& entry = exec_decoder[pc / DecoderCache<W>::DIVISOR];
-				const auto opcode = instruction.opcode();
 
-				// All opcodes that can modify PC and stop the machine
-				if (opcode == RV32I_BRANCH || is_stopping_system(instruction)
-					|| opcode == RV32I_JAL || opcode == RV32I_JALR)
-					idxend = 0;
-			#ifdef RISCV_BINARY_TRANSLATION
-				if (entry.get_bytecode() == translator_op)
+				if (is_block_ending<W>(instruction, entry))
 					idxend = 0;
-			#endif
 				// Ends at *one instruction before* the block ends
 				entry.idxend = idxend;
 				// Increment after, idx becomes block count - 1
@@ -270,6 +276,330 @@ namespace riscv
 		}
 	}
 
+	// The decoder steps forward one entry at a time, so it ends
+	// at the first entry at or after the end of the execute segment
+	template <int W>
+	static address_type<W> decoding_end(address_type<W> addr, size_t len)
+	{
+		return addr + address_type<W>((len + DecoderCache<W>::DIVISOR - 1) & ~size_t(DecoderCache<W>::DIVISOR - 1));
+	}
+
+	// Decode and rewrite the instructions in [begin, end). When compressed
+	// instructions are enabled, the caller must tell if begin is the start
+	// of an instruction or the second half of a 32-bit instruction.
+	template <int W>
+	static void decode_range(DecodedExecuteSegment<W>& exec,
+		const uint8_t* exec_segment, DecoderData<W>* exec_decoder,
+		address_type<W> begin, address_type<W> end, address_type<W> end_addr,
+		bool was_full_instruction)
+	{
+		address_type<W> dst = begin;
+		for (; dst < end;)
+		{
+			auto& entry = exec_decoder[dst / DecoderCache<W>::DIVISOR];
+			entry.m_handler = 0;
+			entry.idxend = 0;
+
+			// Load unaligned instruction from execute segment
+			const auto instruction = read_instruction(
+				exec_segment, dst, end_addr);
+			rv32i_instruction rewritten = instruction;
+
+#ifdef RISCV_BINARY_TRANSLATION
+			// Translator activation uses a special bytecode
+			// but we must still validate the mapping index.
+			if (entry.get_bytecode() == RV32I_BC_TRANSLATOR && entry.is_invalid_handler() && entry.instr < exec.translator_mappings()) {
+				if constexpr (compressed_enabled) {
+					dst += 2;
+					if (was_full_instruction) {
+						was_full_instruction = (instruction.length() == 2);
+					} else {
+						was_full_instruction = true;
+					}
+				} else
+					dst += 4;
+				continue;
+			}
+#endif // RISCV_BINARY_TRANSLATION
+
+			if (was_full_instruction) {
+				// Cache the (modified) instruction bits
+				auto bytecode = CPU<W>::computed_index_for(instruction);
+				// Threaded rewrites are **always** enabled
+				bytecode = exec.threaded_rewrite(bytecode, dst, rewritten, entry.m_handler);
+				entry.set_bytecode(bytecode);
+				entry.instr = rewritten.whole;
+			} else {
+				// WARNING: If we don't ignore this instruction,
+				// it will get *wrong* idxend values, and cause *invalid jumps*
+				entry.m_handler = 0;
+				entry.set_bytecode(0);
+				// ^ Must be made invalid, even if technically possible to jump to!
+			}
+			if constexpr (VERBOSE_DECODER) {
+				if (entry.get_bytecode() >= RV32I_BC_BEQ && entry.get_bytecode() <= RV32I_BC_BGEU) {
+					fprintf(stderr, "Detected branch bytecode at 0x%lX\n", dst);
+				}
+				if (entry.get_bytecode() == RV32I_BC_BEQ_FW || entry.get_bytecode() == RV32I_BC_BNE_FW) {
+					fprintf(stderr, "Detected forward branch bytecode at 0x%lX\n", dst);
+				}
+			}
+
+			// Increment PC after everything
+			if constexpr (compressed_enabled) {
+				// With compressed we always step forward 2 bytes at a time
+				dst += 2;
+				if (was_full_instruction) {
+					// For it to be a full instruction again,
+					// the length needs to match.
+					was_full_instruction = (instruction.length() == 2);
+				} else {
+					// If it wasn't a full instruction last time, it
+					// will for sure be one now.
+					was_full_instruction = true;
+				}
+			} else
+				dst += 4;
+		}
+	}
+
+	// Large execute segments are decoded in page-aligned chunks of at least this size
+	static constexpr size_t PARALLEL_DECODE_CHUNK_MIN = 256 * 1024;
+
+	template <int W>
+	static unsigned decoder_workers_for(const MachineOptions<W>& options, size_t len)
+	{
+		size_t workers = options.decoder_cache_workers;
+		if (workers == 0)
+			workers = std::max(1u, std::thread::hardware_concurrency());
+		return std::max(size_t(1), std::min(workers, len / PARALLEL_DECODE_CHUNK_MIN));
+	}
+
+	// Run func(0) ... func(workers-1) concurrently, with func(0) on the
+	// calling thread. The first exception thrown by any worker is rethrown.
+	template <typename Func>
+	static void run_workers(unsigned workers, Func&& func)
+	{
+		std::vector<std::exception_ptr> errors(workers);
+		std::vector<std::thread> threads;
+		threads.reserve(workers - 1);
+		auto work = [&] (unsigned i) {
+			try {
+				func(i);
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
+		};
+		for (unsigned i = 1; i < workers; i++) {
+			try {
+				threads.emplace_back(work, i);
+			} catch (const std::system_error&) {
+				work(i); // Threads may be unavailable
+			}
+		}
+		work(0);
+		for (auto& thread : threads)
+			thread.join();
+		for (auto& error : errors) {
+			if (error)
+				std::rethrow_exception(error);
+		}
+	}
+
+	template <int W>
+	static address_type<W> parallel_chunk_begin(address_type<W> addr, address_type<W> dst, unsigned chunk, unsigned workers)
+	{
+		if (chunk == 0)
+			return addr;
+		if (chunk >= workers)
+			return dst;
+		const size_t chunk_size = ((dst - addr) / workers + Page::size() - 1) & ~size_t(Page::size() - 1);
+		const address_type<W> page_begin = addr & ~address_type<W>(Page::size() - 1);
+		// Keep the instruction alignment of the execute segment
+		const address_type<W> offset = addr & (DecoderCache<W>::DIVISOR - 1);
+		return std::min(dst, address_type<W>(page_begin + chunk * chunk_size + offset));
+	}
+
+	// With compressed instructions, find out if each of the given (sorted)
+	// addresses begins with a whole instruction, or the second half of a
+	// 32-bit instruction, by measuring instruction lengths from the beginning.
+	template <int W>
+	static std::vector<uint8_t> whole_instructions_at(const uint8_t* exec_segment,
+		address_type<W> addr, address_type<W> dst, address_type<W> end_addr,
+		const std::vector<address_type<W>>& points)
+	{
+		std::vector<uint8_t> whole_at(points.size(), true);
+		if constexpr (compressed_enabled) {
+			bool was_full_instruction = true;
+			size_t idx = 0;
+			while (idx < points.size() && points[idx] <= addr)
+				idx++;
+			for (address_type<W> pc = addr; pc < dst && idx < points.size(); pc += 2) {
+				while (idx < points.size() && pc == points[idx])
+					whole_at[idx++] = was_full_instruction;
+				if (was_full_instruction)
+					was_full_instruction = (read_instruction(exec_segment, pc, end_addr).length() == 2);
+				else
+					was_full_instruction = true;
+			}
+		}
+		return whole_at;
+	}
+
+	// Returns for each chunk whether it begins with a whole instruction.
+	template <int W>
+	static std::vector<uint8_t> parallel_decode(DecodedExecuteSegment<W>& exec,
+		const uint8_t* exec_segment, DecoderData<W>* exec_decoder,
+		address_type<W> addr, address_type<W> dst, address_type<W> end_addr, unsigned workers)
+	{
+		// The chunks are decoded independently, however with compressed
+		// instructions we must first find out where instructions begin.
+		std::vector<address_type<W>> chunk_begins(workers);
+		for (unsigned chunk = 0; chunk < workers; chunk++)
+			chunk_begins[chunk] = parallel_chunk_begin<W>(addr, dst, chunk, workers);
+		const auto whole_at_begin = whole_instructions_at<W>(exec_segment, addr, dst, end_addr, chunk_begins);
+
+		run_workers(workers, [&] (unsigned chunk) {
+			decode_range<W>(exec, exec_segment, exec_decoder,
+				parallel_chunk_begin<W>(addr, dst, chunk, workers),
+				parallel_chunk_begin<W>(addr, dst, chunk + 1, workers),
+				end_addr, whole_at_begin[chunk]);
+		});
+		return whole_at_begin;
+	}
+
+	// Find the first block boundary at or after pc, which must be the start
+	// of an instruction. Blocks always end at the first block-ending
+	// instruction after they begin, so the next block begins right after it.
+	template <int W>
+	static address_type<W> next_block_boundary(address_type<W> pc, address_type<W> last_pc,
+		const uint8_t* exec_segment, const DecoderData<W>* exec_decoder)
+	{
+		while (pc < last_pc) {
+			const auto instruction = read_instruction(exec_segment, pc, last_pc);
+			const auto& entry = exec_decoder[pc / DecoderCache<W>::DIVISOR];
+			pc += compressed_enabled ? instruction.length() : 4;
+			if (is_block_ending<W>(instruction, entry))
+				break;
+		}
+		return std::min(pc, last_pc);
+	}
+
+	template <int W>
+	static void parallel_realize_fastsim(
+		const uint8_t* exec_segment, DecoderData<W>* exec_decoder,
+		address_type<W> addr, address_type<W> dst, unsigned workers,
+		const std::vector<uint8_t>& whole_at_begin)
+	{
+		// Stitch the chunks together at block boundaries, so that no
+		// block crosses from one worker to another, and every worker
+		// produces the same idxend and icount as a sequential pass.
+		std::vector<address_type<W>> boundaries(workers + 1);
+		boundaries[0] = addr;
+		boundaries[workers] = dst;
+		for (unsigned chunk = 1; chunk < workers; chunk++) {
+			address_type<W> pc = parallel_chunk_begin<W>(addr, dst, chunk, workers);
+			if (!whole_at_begin[chunk])
+				pc += 2; // Second half of a 32-bit instruction
+			boundaries[chunk] = std::max(boundaries[chunk - 1],
+				next_block_boundary<W>(pc, dst, exec_segment, exec_decoder));
+		}
+
+		run_workers(workers, [&] (unsigned chunk) {
+			if (boundaries[chunk] < boundaries[chunk + 1])
+				realize_fastsim<W>(boundaries[chunk], boundaries[chunk + 1], dst,
+					exec_segment, exec_decoder);
+		});
+	}
+
+	template <int W>
+	static size_t fuse_superinstructions_in(DecoderData<W>* exec_decoder, address_type<W> begin, address_type<W> end)
+	{
+		size_t fused = 0;
+		// The first half of a superinstruction is always a full-length
+		// instruction, so the second half is always 4 bytes later.
+		for (address_type<W> pc = begin; pc + 4 < end; pc += DecoderCache<W>::DIVISOR)
+		{
+			auto& first  = exec_decoder[pc / DecoderCache<W>::DIVISOR];
+			auto& second = exec_decoder[(pc + 4) / DecoderCache<W>::DIVISOR];
+			// Both instructions must be in the same block
+			if (first.block_bytes() != second.block_bytes() + 4)
+				continue;
+
+			for (const auto& si : superinstructions) {
+				if (first.get_bytecode() == si.first && second.get_bytecode() == si.second) {
+					first.set_bytecode(si.fused);
+					fused++;
+					break;
+				}
+			}
+		}
+		return fused;
+	}
+
+	// The first entry of a page of a lazily decoded execute segment,
+	// keeping the instruction alignment of the execute segment
+	template <int W>
+	static address_type<W> lazy_page_begin(const DecodedExecuteSegment<W>& exec, size_t page)
+	{
+		const address_type<W> page_begin = exec.pagedata_base() + page * Page::size();
+		const address_type<W> offset = exec.exec_begin() & (DecoderCache<W>::DIVISOR - 1);
+		return std::max(exec.exec_begin(), address_type<W>(page_begin + offset));
+	}
+
+	template <int W>
+	static void decode_lazy_page_at(DecodedExecuteSegment<W>& exec, size_t page,
+		bool whole_at_begin, bool superinstructions)
+	{
+		const address_type<W> addr = exec.exec_begin();
+		const size_t len = exec.exec_end() - addr;
+		const address_type<W> dst = decoding_end<W>(addr, len);
+		const address_type<W> page_end = exec.pagedata_base() + (page + 1) * Page::size();
+		const address_type<W> begin = lazy_page_begin(exec, page);
+		const address_type<W> end   = std::min(dst, page_end);
+		if (begin >= end)
+			return;
+		const uint8_t* exec_segment = exec.exec_data();
+
+		// Decode into a separate page first, and then publish the entries
+		// in reverse order, so that a block is complete when its first entry
+		// appears. Pages are only decoded while no other machine shares the
+		// segment, see Memory::fork_state().
+		std::unique_ptr<DecoderCache<W>> cache(new DecoderCache<W>());
+		auto* page_decoder = cache->get_base() - (page_end - Page::size()) / DecoderCache<W>::DIVISOR;
+		decode_range<W>(exec, exec_segment, page_decoder, begin, end, addr + len, whole_at_begin);
+
+		const address_type<W> first = begin + (whole_at_begin ? 0 : 2);
+		if (first < end) {
+			// Blocks must not continue into the next page, which may
+			// not be decoded yet, so the last instruction ends the block.
+			if (end < dst) {
+				address_type<W> last = first;
+				for (address_type<W> pc = first; pc < end; ) {
+					last = pc;
+					pc += compressed_enabled ? read_instruction(exec_segment, pc, dst).length() : 4;
+				}
+				auto& entry = page_decoder[last / DecoderCache<W>::DIVISOR];
+				const auto instruction = read_instruction(exec_segment, last, dst);
+				if (!is_block_ending<W>(instruction, entry)) {
+					entry.set_bytecode(RV32I_BC_FUNCBLOCK);
+					entry.set_handler(CPU<W>::decode(instruction));
+					entry.instr = instruction.whole;
+				}
+			}
+			realize_fastsim<W>(first, end, dst, exec_segment, page_decoder);
+			if (superinstructions)
+				fuse_superinstructions_in<W>(page_decoder, first, end);
+		}
+
+		auto* exec_decoder = exec.decoder_cache();
+		for (address_type<W> pc = end; pc > begin; ) {
+			pc -= DecoderCache<W>::DIVISOR;
+			exec_decoder[pc / DecoderCache<W>::DIVISOR].atomic_overwrite(
+				page_decoder[pc / DecoderCache<W>::DIVISOR]);
+		}
+	}
+
 	// The decoder cache is a sequential array of DecoderData<W> entries
 	// each of which (currently) serves a dual purpose of enabling
 	// threaded dispatch (m_bytecode) and fallback to callback function
@@ -311,13 +641,6 @@ namespace riscv
 			throw MachineException(INVALID_PROGRAM,
 				"Program produced empty decoder cache");
 		}
-		// Here we allocate the decoder cache which is page-sized
-		auto* decoder_cache = exec.create_decoder_cache(
-			new DecoderCache<W> [n_pages], n_pages);
-		auto* exec_decoder = 
-			decoder_cache[0].get_base() - pbase / DecoderCache<W>::DIVISOR;
-		exec.set_decoder(exec_decoder);
-
 		DecoderData<W> invalid_op;
 		invalid_op.set_handler(this->machine().cpu.decode({0}));
 		if (UNLIKELY(invalid_op.m_handler != 0)) {
@@ -325,104 +648,111 @@ namespace riscv
 				"The invalid instruction did not have the index zero", invalid_op.m_handler);
 		}
 
+		// Debugging changes the decoder cache, so those are never stored
+		const bool persistent_cache = options.persistent_decoder_cache
+			&& options.ebreak_locations.empty() && !exec.is_likely_jit();
+#ifdef RISCV_BINARY_TRANSLATION
+		// We do not support binary translation for RV128I
+		// Also, avoid binary translation for execute segments that are likely JIT-compiled
+		const bool allow_translation = (is_initial || options.translate_future_segments)
+			&& !exec.is_binary_translated() && !exec.is_likely_jit();
+		const bool may_translate = allow_translation
+			&& (options.translate_enabled || options.translate_enable_embedded) && options.translate_blocks_max != 0;
+		bool translation_invoked = false;
+#else
+		const bool may_translate = false;
+#endif
+		// A stored decoder cache can be mapped in directly, unless
+		// translator mappings are applied before decoding.
+		if (persistent_cache && !may_translate
+			&& load_decoder_cache_file(options, exec, n_pages))
+			return;
+
+		// Lazy decoding: Pages are decoded when execution first enters them.
+		// Only private segments are decoded lazily, as the decoder cache must
+		// not change while other machines are executing it.
+		if (options.use_lazy_decoding && !persistent_cache && !may_translate
+			&& !options.use_shared_execute_segments
+			&& options.ebreak_locations.empty() && !exec.is_likely_jit())
+		{
+			// Pages of a zeroed mapping use no memory until they are decoded
+			const size_t cache_bytes = n_pages * sizeof(DecoderCache<W>);
+			DecoderCache<W>* decoder_cache = nullptr;
+			if (void* mapping = decoder_cache_map_zeroed(cache_bytes); mapping != nullptr) {
+				decoder_cache = exec.create_mapped_decoder_cache(
+					(DecoderCache<W> *)mapping, n_pages, mapping, cache_bytes);
+			} else {
+				decoder_cache = exec.create_decoder_cache(
+					new DecoderCache<W> [n_pages](), n_pages);
+			}
+			exec.set_decoder(decoder_cache[0].get_base() - pbase / DecoderCache<W>::DIVISOR);
+
+			std::vector<address_t> page_begins(n_pages);
+			for (size_t page = 0; page < n_pages; page++)
+				page_begins[page] = lazy_page_begin(exec, page);
+			exec.enable_lazy_decoding(
+				whole_instructions_at<W>(exec.exec_data(), addr, decoding_end<W>(addr, len), addr + len, page_begins),
+				options.use_superinstructions);
+			if (options.verbose_loader) {
+				printf("libriscv: Lazy decoding of %zu pages\n", n_pages);
+			}
+			return;
+		}
+
+		// Here we allocate the decoder cache which is page-sized.
+		// It must be zeroed, as translator mappings are applied before decoding.
+		auto* decoder_cache = exec.create_decoder_cache(
+			new DecoderCache<W> [n_pages](), n_pages);
+		auto* exec_decoder = 
+			decoder_cache[0].get_base() - pbase / DecoderCache<W>::DIVISOR;
+		exec.set_decoder(exec_decoder);
+
 		// PC-relative pointer to instruction bits
 		auto* exec_segment = exec.exec_data();
 		TIME_POINT(t1);
 
 #ifdef RISCV_BINARY_TRANSLATION
-		// We do not support binary translation for RV128I
-		// Also, avoid binary translation for execute segments that are likely JIT-compiled
-		const bool allow_translation = is_initial || options.translate_future_segments;
-		if (!exec.is_binary_translated() && allow_translation && !exec.is_likely_jit()) {
+		if (allow_translation && options.record_translation_profile) {
+			// Profiling run: Interpret the segment, counting blocks and branches
+			exec.enable_profile_counters();
+		}
+		else if (allow_translation) {
 			// Attempt to load binary translation
 			// Also, fill out the binary translation SO filename for later
 			std::string bintr_filename;
 			int result = machine().cpu.load_translation(options, &bintr_filename, exec);
 			const bool must_translate = result > 0;
-			if (must_translate)
+			if (must_translate && options.translate_hot_threshold > 0
+				&& options.translate_invoke_compiler && !exec.is_binary_translated())
+			{
+				// Tiered execution: Interpret until parts of the segment become hot
+				exec.enable_hot_counters(options.translate_hot_threshold, std::move(bintr_filename));
+			}
+			else if (must_translate)
 			{
 				machine().cpu.try_translate(
 					options, bintr_filename, shared_segment);
+				translation_invoked = true;
 			}
 		}
+		// Without a translation there is nothing to apply before decoding
+		if (persistent_cache && may_translate && !translation_invoked && !exec.is_binary_translated()
+			&& load_decoder_cache_file(options, exec, n_pages))
+			return;
 	#endif
 
-		// When compressed instructions are enabled, many decoder
-		// entries are illegal because they are between instructions.
-		bool was_full_instruction = true;
-
 		/* Generate all instruction pointers for executable code.
 		   Cannot step outside of this area when pregen is enabled,
 		   so it's fine to leave the boundries alone. */
 		TIME_POINT(t2);
-		address_t dst = addr;
 		const address_t end_addr = addr + len;
-		for (; dst < addr + len;)
-		{
-			auto& entry = exec_decoder[dst / DecoderCache<W>::DIVISOR];
-			entry.m_handler = 0;
-			entry.idxend = 0;
-
-			// Load unaligned instruction from execute segment
-			const auto instruction = read_instruction(
-				exec_segment, dst, end_addr);
-			rv32i_instruction rewritten = instruction;
-
-#ifdef RISCV_BINARY_TRANSLATION
-			// Translator activation uses a special bytecode
-			// but we must still validate the mapping index.
-			if (entry.get_bytecode() == RV32I_BC_TRANSLATOR && entry.is_invalid_handler() && entry.instr < exec.translator_mappings()) {
-				if constexpr (compressed_enabled) {
-					dst += 2;
-					if (was_full_instruction) {
-						was_full_instruction = (instruction.length() == 2);
-					} else {
-						was_full_instruction = true;
-					}
-				} else
-					dst += 4;
-				continue;
-			}
-#endif // RISCV_BINARY_TRANSLATION
-
-			if (was_full_instruction) {
-				// Cache the (modified) instruction bits
-				auto bytecode = CPU<W>::computed_index_for(instruction);
-				// Threaded rewrites are **always** enabled
-				bytecode = exec.threaded_rewrite(bytecode, dst, rewritten, entry.m_handler);
-				entry.set_bytecode(bytecode);
-				entry.instr = rewritten.whole;
-			} else {
-				// WARNING: If we don't ignore this instruction,
-				// it will get *wrong* idxend values, and cause *invalid jumps*
-				entry.m_handler = 0;
-				entry.set_bytecode(0);
-				// ^ Must be made invalid, even if technically possible to jump to!
-			}
-			if constexpr (VERBOSE_DECODER) {
-				if (entry.get_bytecode() >= RV32I_BC_BEQ && entry.get_bytecode() <= RV32I_BC_BGEU) {
-					fprintf(stderr, "Detected branch bytecode at 0x%lX\n", dst);
-				}
-				if (entry.get_bytecode() == RV32I_BC_BEQ_FW || entry.get_bytecode() == RV32I_BC_BNE_FW) {
-					fprintf(stderr, "Detected forward branch bytecode at 0x%lX\n", dst);
-				}
-			}
-
-			// Increment PC after everything
-			if constexpr (compressed_enabled) {
-				// With compressed we always step forward 2 bytes at a time
-				dst += 2;
-				if (was_full_instruction) {
-					// For it to be a full instruction again,
-					// the length needs to match.
-					was_full_instruction = (instruction.length() == 2);
-				} else {
-					// If it wasn't a full instruction last time, it
-					// will for sure be one now.
-					was_full_instruction = true;
-				}
-			} else
-				dst += 4;
+		const address_t dst = decoding_end<W>(addr, len);
+		const unsigned workers = decoder_workers_for(options, len);
+		std::vector<uint8_t> whole_at_begin;
+		if (workers > 1) {
+			whole_at_begin = parallel_decode<W>(exec, exec_segment, exec_decoder, addr, dst, end_addr, workers);
+		} else {
+			decode_range<W>(exec, exec_segment, exec_decoder, addr, dst, end_addr, true);
 		}
 		// Make sure the last entry is an invalid instruction
 		// This simplifies many other sub-systems
@@ -432,7 +762,11 @@ namespace riscv
 		entry.idxend = 0;
 		TIME_POINT(t3);
 
-		realize_fastsim<W>(addr, dst, exec_segment, exec_decoder);
+		if (workers > 1) {
+			parallel_realize_fastsim<W>(exec_segment, exec_decoder, addr, dst, workers, whole_at_begin);
+		} else {
+			realize_fastsim<W>(addr, dst, dst, exec_segment, exec_decoder);
+		}
 
 		// Debugging: EBREAK locations
 		for (auto& loc : options.ebreak_locations) {
@@ -450,6 +784,24 @@ namespace riscv
 			}
 		}
 
+		// Superinstructions must be fused after all block-ending
+		// instructions have been installed (eg. ebreak locations)
+		if (options.use_superinstructions) {
+			const size_t fused = exec.fuse_superinstructions();
+			if (options.verbose_loader) {
+				printf("libriscv: Fused %zu superinstructions\n", fused);
+			}
+		}
+
+		// Translations may be live-patched into the decoder cache at any time
+		// after being invoked, so only untranslated decoder caches are stored
+		bool store_cache = persistent_cache && !exec.is_binary_translated();
+#ifdef RISCV_BINARY_TRANSLATION
+		store_cache = store_cache && !translation_invoked;
+#endif
+		if (store_cache)
+			store_decoder_cache_file(options, exec);
+
 		TIME_POINT(t4);
 #ifdef ENABLE_TIMINGS
 		const long t1t0 = nanodiff(t0, t1);
@@ -465,19 +817,135 @@ namespace riscv
 #endif
 	}
 
+	template <int W> RISCV_INTERNAL
+	size_t DecodedExecuteSegment<W>::fuse_superinstructions()
+	{
+		this->m_has_superinstructions = true;
+		return fuse_superinstructions_in<W>(this->decoder_cache(), exec_begin(), exec_end());
+	}
+
+	template <int W> RISCV_INTERNAL
+	void DecodedExecuteSegment<W>::enable_lazy_decoding(std::vector<uint8_t> whole_at_begin, bool superinstructions)
+	{
+		m_lazy = std::make_unique<LazyDecoding>();
+		m_lazy->decoded.reset(new std::atomic<bool>[m_decoder_cache_size]());
+		m_lazy->whole_at_begin = std::move(whole_at_begin);
+		m_lazy->superinstructions = superinstructions;
+		m_has_superinstructions = superinstructions;
+	}
+
+	template <int W>
+	bool DecodedExecuteSegment<W>::decode_lazy_page(address_t pc)
+	{
+		const size_t page = (pc - m_exec_pagedata_base) / Page::size();
+		if (page >= m_decoder_cache_size)
+			return false;
+		if (!m_lazy->decoded[page].load(std::memory_order_acquire))
+		{
+			std::scoped_lock lock(m_lazy->mutex);
+			if (!m_lazy->decoded[page].load(std::memory_order_relaxed)) {
+				decode_lazy_page_at(*this, page, m_lazy->whole_at_begin[page], m_lazy->superinstructions);
+				m_lazy->decoded[page].store(true, std::memory_order_release);
+			}
+		}
+		// The page may also have been decoded by another thread
+		return m_exec_decoder[pc / DecoderCache<W>::DIVISOR].get_bytecode() != RV32I_BC_INVALID;
+	}
+
+	template <int W>
+	void DecodedExecuteSegment<W>::decode_all_lazy_pages()
+	{
+		if (m_lazy == nullptr)
+			return;
+		for (size_t page = 0; page < m_decoder_cache_size; page++)
+			decode_lazy_page(lazy_page_begin(*this, page));
+	}
+
+	template <int W>
+	std::vector<BytecodeSequence> DecodedExecuteSegment<W>::profile_bytecode_sequences(size_t max_results) const
+	{
+		const auto* exec_decoder = this->decoder_cache();
+		// Key: length << 24 | bytecode0 << 16 | bytecode1 << 8 | bytecode2
+		std::unordered_map<uint32_t, size_t> counts;
+		uint32_t window = 0;
+		unsigned window_size = 0;
+
+		for (address_t pc = exec_begin(); pc < exec_end(); )
+		{
+			const auto& entry = exec_decoder[pc / DecoderCache<W>::DIVISOR];
+			const uint8_t bytecode = superinstruction_first(entry.get_bytecode());
+			if (bytecode != RV32I_BC_INVALID) {
+				window = ((window << 8) | bytecode) & 0xFFFFFF;
+				window_size++;
+				if (window_size >= 2)
+					counts[(2u << 24) | ((window & 0xFFFF) << 8)]++;
+				if (window_size >= 3)
+					counts[(3u << 24) | window]++;
+			}
+			// Sequences never cross block boundaries (or padding)
+			if (entry.idxend == 0 || bytecode == RV32I_BC_INVALID)
+				window_size = 0;
+
+			if constexpr (compressed_enabled)
+				pc += read_instruction(exec_data(), pc, exec_end()).length();
+			else
+				pc += 4;
+		}
+
+		std::vector<BytecodeSequence> results;
+		results.reserve(counts.size());
+		for (const auto& [key, count] : counts) {
+			BytecodeSequence seq;
+			seq.bytecodes = { uint8_t(key >> 16), uint8_t(key >> 8), uint8_t(key) };
+			seq.length = key >> 24;
+			seq.count  = count;
+			results.push_back(seq);
+		}
+		std::sort(results.begin(), results.end(),
+			[] (const BytecodeSequence& a, const BytecodeSequence& b) {
+				if (a.count != b.count)
+					return a.count > b.count;
+				return std::tie(a.length, a.bytecodes) < std::tie(b.length, b.bytecodes);
+			});
+		if (results.size() > max_results)
+			results.resize(max_results);
+		return results;
+	}
+
 	template <int W> RISCV_INTERNAL
 	size_t DecoderData<W>::handler_index_for(Handler new_handler)
 	{
-		auto it = handler_cache.find(new_handler);
-		if (it != handler_cache.end())
-			return it->second;
+		const uint64_t hash = uint64_t(reinterpret_cast<uintptr_t>(new_handler) >> 4) * 0x9E3779B97F4A7C15ull;
+		const size_t first = size_t(hash >> 32);
+		// Handlers that are already known are found without locking
+		for (size_t i = 0; i < HANDLER_SLOTS; i++) {
+			auto& slot = handler_slots[(first + i) % HANDLER_SLOTS];
+			const Handler handler = slot.handler.load(std::memory_order_acquire);
+			if (handler == new_handler)
+				return slot.index;
+			if (handler == nullptr)
+				break;
+		}
 
-		if (UNLIKELY(handler_count >= instr_handlers.size()))
-			throw MachineException(INVALID_PROGRAM, "Too many instruction handlers");
-		instr_handlers[handler_count] = new_handler;
-		const size_t idx = handler_count++;
-		handler_cache.try_emplace(new_handler, idx);
-		return idx;
+		// Execute segments may be decoded by several threads at once
+		static std::mutex handler_mutex;
+		std::scoped_lock lock(handler_mutex);
+		for (size_t i = 0; i < HANDLER_SLOTS; i++) {
+			auto& slot = handler_slots[(first + i) % HANDLER_SLOTS];
+			const Handler handler = slot.handler.load(std::memory_order_relaxed);
+			if (handler == new_handler)
+				return slot.index;
+			if (handler != nullptr)
+				continue;
+
+			if (UNLIKELY(handler_count >= instr_handlers.size()))
+				break;
+			instr_handlers[handler_count] = new_handler;
+			slot.index = handler_count;
+			slot.handler.store(new_handler, std::memory_order_release);
+			return handler_count++;
+		}
+		throw MachineException(INVALID_PROGRAM, "Too many instruction handlers");
 	}
 
 	// An execute segment contains a sequential array of raw instruction bits
@@ -540,7 +1008,8 @@ namespace riscv
 		{
 			// In order to prevent others from creating the same execute segment
 			// we need to lock the shared execute segments mutex.
-			auto& segment = shared_execute_segments<W>.get_segment(hash);
+			const uint32_t key = shared_segment_key(hash, options.use_superinstructions);
+			auto& segment = shared_execute_segments<W>.get_segment(key);
 			std::scoped_lock lock(segment.mutex);
 
 			if (segment.segment != nullptr) {
@@ -561,7 +1030,7 @@ namespace riscv
 			this->generate_decoder_cache(options, free_slot, is_initial);
 
 			// Share the execute segment
-			shared_execute_segments<W>.get_segment(hash).unlocked_set(free_slot);
+			shared_execute_segments<W>.get_segment(key).unlocked_set(free_slot);
 		}
 		else
 		{
@@ -609,9 +1078,10 @@ namespace riscv
 			try {
 				auto& segment = m_exec.at(m_exec_segs);
 				if (segment) {
-					const uint32_t hash = segment->crc32c_hash();
+					const uint32_t key = shared_segment_key(
+						segment->crc32c_hash(), segment->has_superinstructions());
 					segment = nullptr;
-					shared_execute_segments<W>.remove_if_unique(hash);
+					shared_execute_segments<W>.remove_if_unique(key);
 				}
 			} catch (...) {
 				// Ignore exceptions
@@ -622,7 +1092,8 @@ namespace riscv
 	template <int W>
 	void Memory<W>::evict_execute_segment(DecodedExecuteSegment<W>& segment)
 	{
-		const uint32_t hash = segment.crc32c_hash();
+		const uint32_t key = shared_segment_key(
+			segment.crc32c_hash(), segment.has_superinstructions());
 		for (size_t i = 0; i < m_exec_segs; i++) {
 			if (m_exec[i].get() == &segment) {
 				m_exec[i] = nullptr;
@@ -631,7 +1102,7 @@ namespace riscv
 				break;
 			}
 		}
-		shared_execute_segments<W>.remove_if_unique(hash);
+		shared_execute_segments<W>.remove_if_unique(key);
 	}
 
 #ifdef RISCV_BINARY_TRANSLATION
@@ -655,6 +1126,34 @@ namespace riscv
 			result.push_back(addr);
 		return result;
 	}
+
+	template <int W>
+	TranslationProfile<W> Memory<W>::gather_translation_profile() const
+	{
+		TranslationProfile<W> profile = machine().options().translation_profile;
+		for (size_t i = 0; i < m_exec_segs; i++) {
+			auto& segment = m_exec[i];
+			if (!segment || !segment->is_profiling())
+				continue;
+			const auto* counters = segment->profile_counters();
+			for (size_t idx = 0; idx < counters->size; idx++) {
+				// Other machines sharing the segment may still be counting
+				const auto& slot = counters->slots[idx];
+				const uint32_t entries = slot.entries.load(std::memory_order_relaxed);
+				const uint32_t taken = slot.taken.load(std::memory_order_relaxed);
+				const uint32_t not_taken = slot.not_taken.load(std::memory_order_relaxed);
+				const address_t addr = segment->exec_begin() + (idx << 1);
+				if (entries != 0)
+					profile.blocks[addr] += entries;
+				if (taken != 0 || not_taken != 0) {
+					auto& branch = profile.branches[addr];
+					branch.taken += taken;
+					branch.not_taken += not_taken;
+				}
+			}
+		}
+		return profile;
+	}
 #endif
 
 #ifdef ENABLE_TIMINGS
@@ -671,9 +1170,12 @@ namespace riscv
 #endif
 
 	INSTANTIATE_32_IF_ENABLED(DecoderData);
+	INSTANTIATE_32_IF_ENABLED(DecodedExecuteSegment);
 	INSTANTIATE_32_IF_ENABLED(Memory);
 	INSTANTIATE_64_IF_ENABLED(DecoderData);
+	INSTANTIATE_64_IF_ENABLED(DecodedExecuteSegment);
 	INSTANTIATE_64_IF_ENABLED(Memory);
 	INSTANTIATE_128_IF_ENABLED(DecoderData);
+	INSTANTIATE_128_IF_ENABLED(DecodedExecuteSegment);
 	INSTANTIATE_128_IF_ENABLED(Memory);
 } // riscv
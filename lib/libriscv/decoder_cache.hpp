@@ -1,6 +1,7 @@
 #pragma once
 #include "common.hpp"
 #include "types.hpp"
+#include <atomic>
 #include <unordered_map>
 #include <vector>
 
@@ -92,7 +93,14 @@ struct DecoderData {
 private:
 	static inline std::array<Handler, 256> instr_handlers;
 	static inline std::size_t handler_count = 0;
-	static inline std::unordered_map<Handler, size_t> handler_cache;
+	// Open-addressed handler lookup table, which is read without locking.
+	// A slot is published by storing its handler after its index.
+	struct HandlerSlot {
+		std::atomic<Handler> handler = nullptr;
+		uint8_t index = 0;
+	};
+	static constexpr size_t HANDLER_SLOTS = 2 * std::tuple_size_v<decltype(instr_handlers)>;
+	static inline std::array<HandlerSlot, HANDLER_SLOTS> handler_slots;
 };
 
 template <int W>
@@ -112,4 +120,14 @@ struct alignas(64) DecoderCache
 	std::array<DecoderData<W>, PageSize / DIVISOR> cache;
 };
 
+// Persistent decoder caches, see MachineOptions::persistent_decoder_cache
+template <int W> struct DecodedExecuteSegment;
+template <int W>
+bool load_decoder_cache_file(const MachineOptions<W>&, DecodedExecuteSegment<W>&, size_t n_pages);
+template <int W>
+void store_decoder_cache_file(const MachineOptions<W>&, const DecodedExecuteSegment<W>&);
+// Zero-initialized decoder cache memory that is only committed when written to,
+// or nullptr when unavailable. Released with decoder_cache_unmap().
+void* decoder_cache_map_zeroed(size_t size);
+
 }
@@ -0,0 +1,379 @@
+#include "machine.hpp"
+#include "decoder_cache.hpp"
+#include "rv32i_instr.hpp"
+#include "threaded_bytecodes.hpp"
+#include "util/crc32.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * A persistent decoder cache file is a header page followed by the
+ * DecoderCache<W> pages of an execute segment, exactly as they are laid
+ * out in memory. On Linux the file is mapped copy-on-write, so that all
+ * machines (and processes) loading the same program share the decoded
+ * pages until they are modified.
+**/
+
+namespace riscv
+{
+	static constexpr uint32_t DECODER_CACHE_MAGIC   = 0x43445652; // RVDC
+	// Bump the version whenever bytecodes or the rewriter changes
+	static constexpr uint32_t DECODER_CACHE_VERSION = 4;
+	static constexpr size_t   DECODER_CACHE_HEADER  = 4096;
+
+	struct DecoderCacheFileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t key;
+		uint32_t payload_crc32c;
+		uint64_t exec_begin;
+		uint64_t exec_end;
+		uint64_t pagedata_base;
+		uint64_t n_pages;
+	};
+	static_assert(sizeof(DecoderCacheFileHeader) <= DECODER_CACHE_HEADER);
+
+	// The key covers the execute segment and the emulator settings
+	// that change the contents of the decoder cache.
+	template <int W>
+	static uint32_t decoder_cache_key(const MachineOptions<W>& options, const DecodedExecuteSegment<W>& exec)
+	{
+		const uint32_t settings[] = {
+			DECODER_CACHE_VERSION,
+			uint32_t(W),
+			uint32_t(sizeof(DecoderData<W>)),
+			uint32_t(BYTECODES_MAX),
+			uint32_t(compressed_enabled),
+			uint32_t(atomics_enabled),
+			uint32_t(vector_extension),
+			uint32_t(binary_translation_enabled),
+			uint32_t(options.use_superinstructions),
+			uint32_t(exec.exec_begin()),
+			uint32_t(exec.exec_end() - exec.exec_begin()),
+		};
+		return crc32c(exec.crc32c_hash(), settings, sizeof(settings));
+	}
+
+	template <int W>
+	static std::string decoder_cache_filename(const MachineOptions<W>& options, uint32_t key)
+	{
+		char buffer[512];
+		const int len = snprintf(buffer, sizeof(buffer), "%s%08X",
+			options.decoder_cache_prefix.c_str(), key);
+		if (len <= 0 || size_t(len) >= sizeof(buffer))
+			return "";
+		return std::string(buffer, len);
+	}
+
+	template <int W>
+	static bool validate_header(const DecoderCacheFileHeader& header,
+		const DecodedExecuteSegment<W>& exec, uint32_t key, size_t n_pages)
+	{
+		return header.magic == DECODER_CACHE_MAGIC
+			&& header.version == DECODER_CACHE_VERSION
+			&& header.key == key
+			&& header.exec_begin == exec.exec_begin()
+			&& header.exec_end == exec.exec_end()
+			&& header.pagedata_base == exec.pagedata_base()
+			&& header.n_pages == n_pages;
+	}
+
+	// Direct branches and jumps were rewritten to PC-relative offsets,
+	// which dispatch follows without a range check. Returns false for
+	// bytecodes that do not carry such an offset.
+	template <int W>
+	static bool direct_jump_offset(const DecoderData<W>& entry, uint8_t bytecode, int32_t& offset)
+	{
+		switch (bytecode) {
+		case RV32I_BC_BEQ:
+		case RV32I_BC_BNE:
+		case RV32I_BC_BLT:
+		case RV32I_BC_BGE:
+		case RV32I_BC_BLTU:
+		case RV32I_BC_BGEU:
+		case RV32I_BC_BEQ_FW:
+		case RV32I_BC_BNE_FW:
+#ifdef RISCV_EXT_COMPRESSED
+		case RV32C_BC_BEQZ:
+		case RV32C_BC_BNEZ:
+		case RV32C_BC_JMP:
+#endif
+			offset = FasterItype{entry.instr}.signed_imm();
+			return true;
+#ifdef RISCV_EXT_COMPRESSED
+		case RV32C_BC_JAL_ADDIW:
+			// C.ADDIW on RV64, C.JAL on RV32
+			if constexpr (W >= 8)
+				return false;
+			offset = FasterItype{entry.instr}.signed_imm();
+			return true;
+#endif
+		case RV32I_BC_JAL:
+			offset = FasterJtype{entry.instr}.signed_imm();
+			return true;
+		case RV32I_BC_FAST_JAL:
+		case RV32I_BC_FAST_CALL:
+			offset = int32_t(entry.instr);
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// The file is computed by whoever could write it, so every entry is
+	// checked before dispatch may use it: Bytecodes index the dispatch
+	// table, idxend/icount move PC and the instruction counter, and
+	// direct jumps move the decoder pointer.
+	template <int W>
+	static bool validate_entries(const DecoderCache<W>* cache, size_t n_pages,
+		const DecodedExecuteSegment<W>& exec)
+	{
+		const auto* entries = &cache[0].cache[0];
+		const size_t n_entries = n_pages * (PageSize / DecoderCache<W>::DIVISOR);
+		// Blocks may span decoder pages, but never the end of the segment
+		const size_t segment_entries =
+			(exec.exec_end() - exec.pagedata_base() + DecoderCache<W>::DIVISOR - 1) / DecoderCache<W>::DIVISOR;
+		// Jump targets are relative to the first decoder page
+		const int64_t exec_first = int64_t(exec.exec_begin() - exec.pagedata_base());
+		const int64_t exec_last  = int64_t(exec.exec_end() - exec.pagedata_base());
+		for (size_t i = 0; i < n_entries; i++) {
+			const auto& entry = entries[i];
+			const auto bytecode = entry.get_bytecode();
+			if (bytecode >= BYTECODES_MAX)
+				return false;
+			// Translations and live-patching are never stored
+			if (bytecode == RV32I_BC_LIVEPATCH)
+				return false;
+#ifdef RISCV_BINARY_TRANSLATION
+			if (bytecode == RV32I_BC_TRANSLATOR)
+				return false;
+#endif
+			// Handler-based bytecodes are always stored as unresolved
+			if ((bytecode == RV32I_BC_FUNCTION || bytecode == RV32I_BC_FUNCBLOCK) && !entry.is_invalid_handler())
+				return false;
+#ifdef RISCV_EXT_COMPRESSED
+			if (bytecode == RV32C_BC_FUNCTION && !entry.is_invalid_handler())
+				return false;
+			if (entry.icount > entry.idxend)
+				return false;
+#endif
+			if (entry.idxend != 0 && i + entry.idxend >= segment_entries)
+				return false;
+			// A fused ADDI+BNE reads its branch from the next entry
+			if (bytecode == RV32I_BC_ADDI_BNE) {
+				const size_t next = i + 4 / DecoderCache<W>::DIVISOR;
+				if (next >= n_entries)
+					return false;
+				const auto second = entries[next].get_bytecode();
+				if (second != RV32I_BC_BNE && second != RV32I_BC_BNE_FW)
+					return false;
+			}
+			int32_t offset = 0;
+			if (direct_jump_offset(entry, bytecode, offset)) {
+				const int64_t target = int64_t(i * DecoderCache<W>::DIVISOR) + offset;
+				if (target < exec_first || target >= exec_last
+					|| target % int64_t(DecoderCache<W>::DIVISOR) != 0)
+					return false;
+			}
+		}
+		return true;
+	}
+
+#ifdef __linux__
+	static bool owned_by_us(const struct stat& st)
+	{
+		// Only trust regular files that nobody else could have written
+		return S_ISREG(st.st_mode) && st.st_uid == geteuid()
+			&& (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+	}
+#endif
+
+	void* decoder_cache_map_zeroed(size_t size)
+	{
+#ifdef __linux__
+		void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		return (mapping != MAP_FAILED) ? mapping : nullptr;
+#else
+		(void)size;
+		return nullptr;
+#endif
+	}
+
+	void decoder_cache_unmap(void* mapping, size_t size)
+	{
+#ifdef __linux__
+		munmap(mapping, size);
+#else
+		(void)mapping;
+		(void)size;
+#endif
+	}
+
+	template <int W>
+	bool load_decoder_cache_file(const MachineOptions<W>& options, DecodedExecuteSegment<W>& exec, size_t n_pages)
+	{
+		const uint32_t key = decoder_cache_key(options, exec);
+		const std::string filename = decoder_cache_filename(options, key);
+		if (filename.empty())
+			return false;
+		const size_t payload_size = n_pages * sizeof(DecoderCache<W>);
+		DecoderCache<W>* cache = nullptr;
+
+#ifdef __linux__
+		const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || !owned_by_us(st)
+			|| size_t(st.st_size) != DECODER_CACHE_HEADER + payload_size) {
+			close(fd);
+			return false;
+		}
+		// Private mapping: The dispatch may live-patch entries later on
+		void* mapping = mmap(nullptr, DECODER_CACHE_HEADER + payload_size,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED)
+			return false;
+
+		const auto& header = *(const DecoderCacheFileHeader *)mapping;
+		cache = (DecoderCache<W> *)((char *)mapping + DECODER_CACHE_HEADER);
+		if (!validate_header(header, exec, key, n_pages)
+			|| crc32c(cache, payload_size) != header.payload_crc32c
+			|| !validate_entries(cache, n_pages, exec))
+		{
+			munmap(mapping, DECODER_CACHE_HEADER + payload_size);
+			return false;
+		}
+		exec.create_mapped_decoder_cache(cache, n_pages, mapping, DECODER_CACHE_HEADER + payload_size);
+#else
+		FILE* f = fopen(filename.c_str(), "rb");
+		if (f == nullptr)
+			return false;
+		DecoderCacheFileHeader header;
+		std::unique_ptr<DecoderCache<W>[]> buffer(new DecoderCache<W>[n_pages]);
+		const bool read_ok = fread(&header, sizeof(header), 1, f) == 1
+			&& fseek(f, DECODER_CACHE_HEADER, SEEK_SET) == 0
+			&& fread(buffer.get(), payload_size, 1, f) == 1;
+		fclose(f);
+		if (!read_ok || !validate_header(header, exec, key, n_pages)
+			|| crc32c(buffer.get(), payload_size) != header.payload_crc32c
+			|| !validate_entries(buffer.get(), n_pages, exec))
+			return false;
+		cache = exec.create_decoder_cache(buffer.release(), n_pages);
+#endif
+
+		auto* exec_decoder = cache[0].get_base() - exec.pagedata_base() / DecoderCache<W>::DIVISOR;
+		exec.set_decoder(exec_decoder);
+		exec.set_has_superinstructions(options.use_superinstructions);
+
+		if (options.verbose_loader) {
+			printf("libriscv: Loaded decoder cache %s\n", filename.c_str());
+		}
+		return true;
+	}
+
+	template <int W>
+	void store_decoder_cache_file(const MachineOptions<W>& options, const DecodedExecuteSegment<W>& exec)
+	{
+		const uint32_t key = decoder_cache_key(options, exec);
+		const std::string filename = decoder_cache_filename(options, key);
+		if (filename.empty())
+			return;
+		const size_t n_pages = exec.decoder_cache_size();
+
+		// Handler indices are process-local, so every bytecode that dispatches
+		// through m_handler is stored as unresolved, and resolved on first use.
+		// This way loading never writes to the (private) mapping, and untouched
+		// pages stay shared with the file.
+		std::vector<DecoderCache<W>> payload(exec.decoder_cache_base(), exec.decoder_cache_base() + n_pages);
+		for (auto& page : payload) {
+			for (auto& entry : page.cache) {
+				const auto bytecode = entry.get_bytecode();
+				if (bytecode == RV32I_BC_FUNCTION || bytecode == RV32I_BC_FUNCBLOCK)
+					entry.set_invalid_handler();
+#ifdef RISCV_EXT_COMPRESSED
+				if (bytecode == RV32C_BC_FUNCTION)
+					entry.set_invalid_handler();
+#endif
+			}
+		}
+		const size_t payload_size = n_pages * sizeof(DecoderCache<W>);
+
+		std::array<char, DECODER_CACHE_HEADER> header_page {};
+		DecoderCacheFileHeader header {
+			.magic = DECODER_CACHE_MAGIC,
+			.version = DECODER_CACHE_VERSION,
+			.key = key,
+			.payload_crc32c = crc32c(payload.data(), payload_size),
+			.exec_begin = uint64_t(exec.exec_begin()),
+			.exec_end   = uint64_t(exec.exec_end()),
+			.pagedata_base = uint64_t(exec.pagedata_base()),
+			.n_pages = n_pages,
+		};
+		std::memcpy(header_page.data(), &header, sizeof(header));
+
+		// Write to a temporary file first, and then rename it, so that
+		// concurrent loaders never observe a partially written file.
+		const size_t unique = std::hash<std::thread::id>{}(std::this_thread::get_id())
+			^ size_t(std::chrono::steady_clock::now().time_since_epoch().count());
+		const std::string tmpname = filename + ".tmp" + std::to_string(unique);
+#ifdef __linux__
+		// Loaders reject files that others could write to, regardless of umask
+		const int fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return;
+		if (fchmod(fd, 0644) != 0) {
+			close(fd);
+			std::remove(tmpname.c_str());
+			return;
+		}
+		FILE* f = fdopen(fd, "wb");
+		if (f == nullptr) {
+			close(fd);
+			std::remove(tmpname.c_str());
+			return;
+		}
+#else
+		FILE* f = fopen(tmpname.c_str(), "wb");
+		if (f == nullptr)
+			return;
+#endif
+		bool ok = fwrite(header_page.data(), header_page.size(), 1, f) == 1
+			&& fwrite(payload.data(), payload_size, 1, f) == 1;
+		ok = (fclose(f) == 0) && ok;
+		if (!ok || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+			std::remove(tmpname.c_str());
+			return;
+		}
+
+		if (options.verbose_loader) {
+			printf("libriscv: Stored decoder cache %s\n", filename.c_str());
+		}
+	}
+
+#ifdef RISCV_32I
+	template bool load_decoder_cache_file<4>(const MachineOptions<4>&, DecodedExecuteSegment<4>&, size_t);
+	template void store_decoder_cache_file<4>(const MachineOptions<4>&, const DecodedExecuteSegment<4>&);
+#endif
+#ifdef RISCV_64I
+	template bool load_decoder_cache_file<8>(const MachineOptions<8>&, DecodedExecuteSegment<8>&, size_t);
+	template void store_decoder_cache_file<8>(const MachineOptions<8>&, const DecodedExecuteSegment<8>&);
+#endif
+#ifdef RISCV_128I
+	template bool load_decoder_cache_file<16>(const MachineOptions<16>&, DecodedExecuteSegment<16>&, size_t);
+	template void store_decoder_cache_file<16>(const MachineOptions<16>&, const DecodedExecuteSegment<16>&);
+#endif
+} // riscv
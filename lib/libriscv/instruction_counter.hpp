@@ -60,8 +60,17 @@ namespace riscv
 		bool overflowed() const noexcept {
 			return m_counter >= m_max;
 		}
+		// Tiered execution: Whether the current execute segment
+		// counts hot blocks, read once when entering the dispatch
+		bool is_counting_hot_blocks() const noexcept {
+			return m_count_hot_blocks;
+		}
+		void set_counting_hot_blocks(bool counting) noexcept {
+			m_count_hot_blocks = counting;
+		}
 	private:
 		uint64_t m_counter;
 		uint64_t m_max;
+		bool     m_count_hot_blocks = false;
 	};
 } // riscv
@@ -37,7 +37,8 @@ namespace riscv
 	inline Machine<W>::Machine(const Machine& other, const MachineOptions<W>& options)
 		: cpu(*this, options.cpu_id, other),
 		  memory(*this, other, options),
-		  m_arena(nullptr)
+		  m_arena(nullptr),
+		  m_main(&other)
 	{
 		this->m_counter = other.m_counter;
 		this->m_max_counter = other.m_max_counter;
@@ -47,6 +48,34 @@ namespace riscv
 		// TODO: transfer arena?
 	}
 
+	template <int W>
+	void Machine<W>::rewind()
+	{
+		if (UNLIKELY(m_main == nullptr))
+			throw MachineException(ILLEGAL_OPERATION, "Only forked machines can be rewound");
+		const Machine& main = *m_main;
+
+		memory.rewind(main.memory);
+		cpu.rewind(main.cpu);
+		this->m_counter = main.m_counter;
+		this->m_max_counter = main.m_max_counter;
+		if (main.m_mt) {
+			m_mt.reset(new MultiThreading {*this, *main.m_mt});
+		} else {
+			m_mt.reset();
+		}
+		// The native heap describes guest memory, which was just restored
+		if (m_arena != nullptr) {
+			if (main.m_arena != nullptr) {
+				main.m_arena->transfer(*m_arena);
+			} else {
+				// A heap created after forking is removed. The mmap address
+				// was rewound, so its memory will be handed out again.
+				m_arena.reset();
+			}
+		}
+	}
+
 	template <int W>
 	inline Machine<W>::Machine(const std::vector<uint8_t>& bin, const MachineOptions<W>& opts)
 		: Machine(std::string_view{(char*) bin.data(), bin.size()}, opts) {}
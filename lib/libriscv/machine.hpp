@@ -437,6 +437,18 @@ namespace riscv
 		// quickly creating and destroying a machine.
 		void reset();
 
+		/// @brief Return a fork to its state right after it was forked, so that
+		/// it can be reused instead of creating a new fork.
+		/// @details Only the pages that the fork has written to or changed
+		/// are restored, while the execute segments and page caches stay warm.
+		/// Registers, counters, the mmap state and threads are restored from
+		/// the main machine, which must not have been modified since the fork.
+		/// A native heap is restored from the main machine, or removed if the
+		/// main machine has none. Requires a fork with no memory arena, or with
+		/// a private memfd arena (see use_memfd_arena). File descriptors and
+		/// signals are kept.
+		void rewind();
+
 		/// @brief Serializes the current machine state into a vector
 		/// @param vec The vector to serialize into (append)
 		/// @return Returns the total number of serialized bytes
@@ -468,6 +480,7 @@ namespace riscv
 		mutable rdtime_func  m_rdtime = default_rdtime;
 		std::unique_ptr<Arena> m_arena;
 		std::unique_ptr<MultiThreading<W>> m_mt = nullptr;
+		const Machine* m_main = nullptr; // The machine this was forked from
 		std::unique_ptr<FileDescriptors> m_fds = nullptr;
 		std::unique_ptr<Multiprocessing<W>> m_smp = nullptr;
 		std::unique_ptr<Signals<W>> m_signals = nullptr;
@@ -0,0 +1,266 @@
+#pragma once
+#include "machine.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace riscv
+{
+	/**
+	 * A pool of pre-made forks of a main machine. Forks are handed out
+	 * through a lock-free queue, and rewound when they are returned, so
+	 * that creating a fork is no longer on the request path:
+	 *
+	 * riscv::MachinePool<RISCV64> pool { machine, 16 };
+	 * if (auto fork = pool.acquire()) {
+	 *     fork->vmcall("on_request", ...);
+	 * } // Rewound and returned to the pool here
+	 *
+	 * Forks are rewound with Machine::rewind(), so the main machine must
+	 * not be modified while the pool exists. When the main machine has a
+	 * flat arena, it must be backed by a memfd (see use_memfd_arena), as
+	 * forks sharing the arena could not be rewound otherwise. The pool is
+	 * safe to use from many threads, while each fork is used by one
+	 * thread at a time.
+	**/
+	template <int W>
+	struct MachinePool
+	{
+		using setup_func_t = std::function<void(Machine<W>&)>;
+
+		struct Lease
+		{
+			Machine<W>* operator-> () const noexcept { return m_machine; }
+			Machine<W>& operator* () const noexcept { return *m_machine; }
+			explicit operator bool() const noexcept { return m_machine != nullptr; }
+			/// @brief Rewind the fork and return it to the pool early.
+			void release() { if (m_machine) { m_pool->release(m_index, false); m_machine = nullptr; } }
+			/// @brief Replace the fork with a new one instead of rewinding it,
+			/// eg. when it was left in a state that should not be reused.
+			void discard() { if (m_machine) { m_pool->release(m_index, true); m_machine = nullptr; } }
+
+			Lease() = default;
+			Lease(Lease&& other) noexcept
+				: m_pool(other.m_pool), m_machine(other.m_machine), m_index(other.m_index) { other.m_machine = nullptr; }
+			Lease& operator= (Lease&& other) noexcept {
+				if (this != &other) {
+					release();
+					m_pool = other.m_pool; m_machine = other.m_machine; m_index = other.m_index;
+					other.m_machine = nullptr;
+				}
+				return *this;
+			}
+			~Lease() { release(); }
+		private:
+			Lease(MachinePool* pool, Machine<W>* machine, unsigned index) noexcept
+				: m_pool(pool), m_machine(machine), m_index(index) {}
+			MachinePool* m_pool = nullptr;
+			Machine<W>* m_machine = nullptr;
+			unsigned m_index = 0;
+			friend struct MachinePool;
+		};
+
+		/// @brief Occupancy metrics of the pool.
+		struct Stats {
+			size_t   capacity;
+			size_t   in_use;
+			size_t   peak_in_use;
+			uint64_t acquired;  // Successful acquisitions
+			uint64_t exhausted; // Acquisitions that found no idle fork
+			uint64_t recreated; // Forks that were discarded or failed to rewind, and were replaced
+			uint64_t retired;   // Forks that could not be replaced, and were removed
+		};
+
+		/// @brief Create a pool of forks of a main machine.
+		/// @param main The main machine, which must outlive the pool
+		/// @param count The number of forks to create up-front
+		/// @param options Machine options for the forks
+		/// @param setup Called once for each new fork, eg. to set a printer
+		MachinePool(const Machine<W>& main, unsigned count,
+			const MachineOptions<W>& options = {}, setup_func_t setup = nullptr);
+
+		/// @brief Take an idle fork from the pool.
+		/// @return A lease on the fork, which is empty when all forks are in use
+		Lease acquire();
+
+		Stats stats() const noexcept;
+		/// @brief The number of forks, excluding retired forks.
+		size_t capacity() const noexcept { return m_forks.size() - m_retired.load(std::memory_order_relaxed); }
+		size_t in_use() const noexcept { return m_in_use.load(std::memory_order_relaxed); }
+
+	private:
+		void release(unsigned index, bool discard) noexcept;
+		std::unique_ptr<Machine<W>> create_fork();
+
+		// Bounded multi-producer multi-consumer queue of fork indices
+		// (Dmitry Vyukov's algorithm). Each cell has a sequence number
+		// that tells producers and consumers whose turn it is.
+		struct IndexQueue
+		{
+			explicit IndexQueue(size_t capacity);
+			bool try_push(unsigned index) noexcept;
+			bool try_pop(unsigned& index) noexcept;
+		private:
+			struct Cell {
+				std::atomic<size_t> sequence;
+				unsigned index;
+			};
+			std::unique_ptr<Cell[]> m_cells;
+			const size_t m_mask;
+			alignas(64) std::atomic<size_t> m_push_pos { 0 };
+			alignas(64) std::atomic<size_t> m_pop_pos { 0 };
+		};
+
+		const Machine<W>& m_main;
+		MachineOptions<W> m_options;
+		setup_func_t m_setup;
+		std::vector<std::unique_ptr<Machine<W>>> m_forks;
+		IndexQueue m_idle;
+		std::atomic<size_t>   m_in_use { 0 };
+		std::atomic<size_t>   m_peak_in_use { 0 };
+		std::atomic<uint64_t> m_acquired { 0 };
+		std::atomic<uint64_t> m_exhausted { 0 };
+		std::atomic<uint64_t> m_recreated { 0 };
+		std::atomic<uint64_t> m_retired { 0 };
+	};
+
+	template <int W>
+	inline MachinePool<W>::IndexQueue::IndexQueue(size_t capacity)
+		: m_cells(new Cell[std::bit_ceil(std::max(capacity, size_t(2)))]),
+		  m_mask(std::bit_ceil(std::max(capacity, size_t(2))) - 1)
+	{
+		for (size_t i = 0; i <= m_mask; i++)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	template <int W>
+	inline bool MachinePool<W>::IndexQueue::try_push(unsigned index) noexcept
+	{
+		size_t pos = m_push_pos.load(std::memory_order_relaxed);
+		while (true) {
+			Cell& cell = m_cells[pos & m_mask];
+			const size_t seq = cell.sequence.load(std::memory_order_acquire);
+			const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+			if (diff == 0) {
+				if (m_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell.index = index;
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false; // Full
+			} else {
+				pos = m_push_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	template <int W>
+	inline bool MachinePool<W>::IndexQueue::try_pop(unsigned& index) noexcept
+	{
+		size_t pos = m_pop_pos.load(std::memory_order_relaxed);
+		while (true) {
+			Cell& cell = m_cells[pos & m_mask];
+			const size_t seq = cell.sequence.load(std::memory_order_acquire);
+			const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+			if (diff == 0) {
+				if (m_pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					index = cell.index;
+					cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false; // Empty
+			} else {
+				pos = m_pop_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	template <int W>
+	inline MachinePool<W>::MachinePool(const Machine<W>& main, unsigned count,
+		const MachineOptions<W>& options, setup_func_t setup)
+		: m_main(main), m_options(options), m_setup(std::move(setup)), m_idle(count)
+	{
+		// Forks sharing the main machine's arena cannot be rewound, and forks
+		// without an arena cannot run code translated for the main machine
+		if (main.memory.uses_flat_memory_arena() && !main.memory.uses_memfd_arena())
+			throw MachineException(FEATURE_DISABLED,
+				"MachinePool requires a memfd-backed arena (see use_memfd_arena)");
+
+		m_forks.reserve(count);
+		for (unsigned i = 0; i < count; i++) {
+			m_forks.push_back(create_fork());
+			m_idle.try_push(i);
+		}
+	}
+
+	template <int W>
+	inline std::unique_ptr<Machine<W>> MachinePool<W>::create_fork()
+	{
+		auto fork = std::make_unique<Machine<W>>(m_main, m_options);
+		if (m_setup)
+			m_setup(*fork);
+		return fork;
+	}
+
+	template <int W>
+	inline typename MachinePool<W>::Lease MachinePool<W>::acquire()
+	{
+		unsigned index;
+		if (!m_idle.try_pop(index)) {
+			m_exhausted.fetch_add(1, std::memory_order_relaxed);
+			return {};
+		}
+		m_acquired.fetch_add(1, std::memory_order_relaxed);
+		const size_t in_use = m_in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+		size_t peak = m_peak_in_use.load(std::memory_order_relaxed);
+		while (in_use > peak && !m_peak_in_use.compare_exchange_weak(peak, in_use, std::memory_order_relaxed));
+		return Lease{this, m_forks[index].get(), index};
+	}
+
+	template <int W>
+	inline void MachinePool<W>::release(unsigned index, bool discard) noexcept
+	{
+		if (!discard) {
+			try {
+				m_forks[index]->rewind();
+			} catch (...) {
+				// A fork that cannot be rewound is replaced with a new one
+				discard = true;
+			}
+		}
+		if (discard) {
+			try {
+				m_forks[index] = create_fork();
+				m_recreated.fetch_add(1, std::memory_order_relaxed);
+			} catch (...) {
+				// Without a replacement, eg. when out of memory, the
+				// slot is retired and never handed out again
+				m_forks[index] = nullptr;
+				m_retired.fetch_add(1, std::memory_order_relaxed);
+				m_in_use.fetch_sub(1, std::memory_order_relaxed);
+				return;
+			}
+		}
+		m_in_use.fetch_sub(1, std::memory_order_relaxed);
+		m_idle.try_push(index);
+	}
+
+	template <int W>
+	inline typename MachinePool<W>::Stats MachinePool<W>::stats() const noexcept
+	{
+		return Stats {
+			.capacity    = capacity(),
+			.in_use      = in_use(),
+			.peak_in_use = m_peak_in_use.load(std::memory_order_relaxed),
+			.acquired    = m_acquired.load(std::memory_order_relaxed),
+			.exhausted   = m_exhausted.load(std::memory_order_relaxed),
+			.recreated   = m_recreated.load(std::memory_order_relaxed),
+			.retired     = m_retired.load(std::memory_order_relaxed),
+		};
+	}
+} // riscv
@@ -2,10 +2,16 @@
 
 #include "decoder_cache.hpp"
 #include "internal_common.hpp"
+#include "util/crc32.hpp"
+#include <algorithm>
 #include <inttypes.h>
+#include <mutex>
+#include <unordered_map>
 #ifdef __linux__
 #define DEMANGLE_ENABLED
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 extern "C" char *
 __cxa_demangle(const char *name, char *buf, size_t *n, int *status);
 #endif
@@ -14,6 +20,83 @@ namespace riscv
 {
 	static constexpr uint64_t UNBOUNDED_ARENA_SIZE = (1ULL << encompassing_Nbit_arena) + Page::size();
 
+#ifdef __linux__
+	static constexpr size_t HUGE_PAGE_SIZE = 2ul << 20;
+	static size_t arena_map_size(size_t len, bool huge_pages) {
+		return huge_pages ? (len + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1) : len;
+	}
+
+	// Map a new arena, optionally backed by a memfd that forks can map
+	// privately. Falls back to anonymous memory if the memfd fails.
+	// With huge pages, explicit (hugetlbfs) pages are tried first when
+	// allowed, and otherwise transparent huge pages are requested.
+	static void* map_arena(size_t len, bool use_memfd, bool huge_pages, bool try_hugetlb, int& fd)
+	{
+		len = arena_map_size(len, huge_pages);
+		void* data = MAP_FAILED;
+		if (use_memfd) {
+			fd = memfd_create("libriscv-arena", MFD_CLOEXEC);
+			if (fd >= 0 && ftruncate(fd, len) == 0) {
+				data = mmap(NULL, len, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_NORESERVE, fd, 0);
+			}
+			if (data == MAP_FAILED && fd >= 0) {
+				close(fd);
+				fd = -1;
+			}
+		}
+		if (data == MAP_FAILED && huge_pages && try_hugetlb) {
+			// Without MAP_NORESERVE the huge pages are reserved up-front,
+			// so a shortage fails here instead of with SIGBUS later on.
+			data = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+			if (data != MAP_FAILED)
+				return data;
+		}
+		if (data == MAP_FAILED) {
+			data = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+		}
+		if (data != MAP_FAILED && huge_pages) {
+			// Best effort: ignored when THP is disabled on the host
+			madvise(data, len, MADV_HUGEPAGE);
+		}
+		return data;
+	}
+#endif
+
+	// Initial pages of programs, shared between all machines that load
+	// them. Pages are found by the CRC32-C of their contents, and live
+	// for as long as a machine refers to them.
+	struct SharedInitialPages {
+		std::shared_ptr<const PageData> get(const char* data)
+		{
+			const uint32_t hash = crc32c(data, Page::size());
+			std::scoped_lock lock(m_mutex);
+			auto& entry = m_pages[hash];
+			if (auto page = entry.lock()) {
+				// Pages with colliding hashes are not shared
+				if (std::memcmp(page->buffer8.data(), data, Page::size()) == 0)
+					return page;
+				return nullptr;
+			}
+			auto* page = new PageData { PageData::UNINITIALIZED };
+			std::memcpy(page->buffer8.data(), data, Page::size());
+			std::shared_ptr<const PageData> result { page };
+			entry = result;
+			// Forget pages no longer used by any machine, now and then
+			if (++m_inserts % 1024 == 0)
+				std::erase_if(m_pages, [] (const auto& it) { return it.second.expired(); });
+			return result;
+		}
+
+	private:
+		std::unordered_map<uint32_t, std::weak_ptr<const PageData>> m_pages;
+		size_t m_inserts = 0;
+		std::mutex m_mutex;
+	};
+	static SharedInitialPages shared_initial_pages;
+
 	template <int W>
 	Memory<W>::Memory(Machine<W>& mach, std::string_view bin,
 					MachineOptions<W> options)
@@ -21,6 +104,7 @@ namespace riscv
 		  m_original_machine {true},
 		  m_binary {bin}
 	{
+		this->set_memory_quota(options.memory_quota);
 		if (options.page_fault_handler != nullptr)
 		{
 			this->m_page_fault_handler = std::move(options.page_fault_handler);
@@ -45,8 +129,9 @@ namespace riscv
 					// TODO: Allocate unpresent pages for the whole address space,
 					// and only allocate real memory according to pages_max. Then handle
 					// page faults for the rest of the address space using userfaultfd.
-					this->m_arena.data = (PageData *)mmap(NULL, UNBOUNDED_ARENA_SIZE, PROT_READ | PROT_WRITE,
-						MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+					this->m_arena.data = (PageData *)map_arena(UNBOUNDED_ARENA_SIZE,
+						options.use_memfd_arena, options.use_huge_pages, false, this->m_arena.fd);
+					this->m_arena.huge_pages = options.use_huge_pages;
 					if (UNLIKELY(this->m_arena.data == MAP_FAILED)) {
 						// We probably reached a limit on the number of mappings
 						this->m_arena.data = nullptr;
@@ -61,8 +146,9 @@ namespace riscv
 				} else {
 					// Over-allocate by 1 page in order to avoid bounds-checking with size
 					const size_t len = (pages_max + 1) * Page::size();
-					this->m_arena.data = (PageData *)mmap(NULL, len, PROT_READ | PROT_WRITE,
-						MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+					this->m_arena.data = (PageData *)map_arena(len,
+						options.use_memfd_arena, options.use_huge_pages, true, this->m_arena.fd);
+					this->m_arena.huge_pages = options.use_huge_pages;
 					this->m_arena.pages = pages_max;
 					// mmap() returns MAP_FAILED (-1) when mapping fails
 					if (UNLIKELY(this->m_arena.data == MAP_FAILED)) {
@@ -132,6 +218,7 @@ namespace riscv
 #ifdef RISCV_EXT_ATOMICS
 		this->m_atomics = other.memory.m_atomics;
 #endif
+		this->set_memory_quota(options.memory_quota);
 		this->machine_loader(other, options);
 	}
 
@@ -143,20 +230,26 @@ namespace riscv
 		} catch (...) {}
 		// Potentially deallocate execute segments that are no longer referenced
 		this->evict_execute_segments();
-		// only the original machine owns arena
-		if (this->m_arena.data != nullptr && !is_forked()) {
+		// only the original machine owns arena, unless the fork has a private mapping
+		if (this->m_arena.data != nullptr && (!is_forked() || m_arena.private_fork)) {
 #ifdef __linux__
 			if constexpr (riscv::encompassing_Nbit_arena != 0)
 			{
 				// munmap() the entire address space
-				munmap(this->m_arena.data, UNBOUNDED_ARENA_SIZE);
+				munmap(this->m_arena.data, arena_map_size(UNBOUNDED_ARENA_SIZE, m_arena.huge_pages));
 			} else {
-				munmap(this->m_arena.data, (this->m_arena.pages + 1) * Page::size());
+				munmap(this->m_arena.data,
+					arena_map_size((this->m_arena.pages + 1) * Page::size(), m_arena.huge_pages));
 			}
 #else
 			delete[] this->m_arena.data;
 #endif
 		}
+#ifdef __linux__
+		if (this->m_arena.fd >= 0 && !is_forked()) {
+			close(this->m_arena.fd);
+		}
+#endif
 	}
 
 	template <int W> RISCV_INTERNAL
@@ -170,6 +263,7 @@ namespace riscv
 	void Memory<W>::clear_all_pages()
 	{
 		this->m_pages.clear();
+		this->m_page_counts = {};
 		this->invalidate_reset_cache();
 	}
 
@@ -241,8 +335,20 @@ namespace riscv
 			}
 		}
 
-		// Load into virtual memory
-		this->memcpy(vaddr, src, len);
+		// Load into virtual memory. Whole pages of read-only segments
+		// may instead be mapped straight from the ELF file, or be shared
+		// with other machines that loaded the same program.
+		const address_t map_begin = (vaddr + Page::size()-1) & ~address_t(Page::size()-1);
+		const address_t map_end = (vaddr + len) & ~address_t(Page::size()-1);
+		if (map_begin < map_end && (
+			(!attr.write && binary_map_pages(options, hdr->p_offset + (map_begin - vaddr), map_begin, map_end, attr)) ||
+			(options.use_shared_initial_pages && binary_share_pages(src + (map_begin - vaddr), map_begin, map_end, attr))))
+		{
+			this->memcpy(vaddr, src, map_begin - vaddr);
+			this->memcpy(map_end, src + (map_end - vaddr), vaddr + len - map_end);
+		} else {
+			this->memcpy(vaddr, src, len);
+		}
 
 		if (options.protect_segments) {
 			this->set_page_attr(vaddr, len, attr);
@@ -255,6 +361,85 @@ namespace riscv
 		}
 	}
 
+	template <int W> RISCV_INTERNAL
+	bool Memory<W>::binary_map_pages(const MachineOptions<W>& options,
+		const size_t file_offset, const address_t begin, const address_t end, PageAttributes attr)
+	{
+#ifdef __linux__
+		if (options.binary_fd < 0 || file_offset % Page::size() != 0)
+			return false;
+		const size_t len = end - begin;
+
+		if (uses_flat_memory_arena() && end <= memory_arena_size())
+		{
+			// Forks of a memfd arena map only the memfd, and 4KB
+			// mappings cannot be placed inside of huge pages
+			if (uses_memfd_arena() || m_arena.huge_pages || sysconf(_SC_PAGESIZE) != long(Page::size()))
+				return false;
+			struct stat st;
+			if (fstat(options.binary_fd, &st) != 0 || size_t(st.st_size) < file_offset + len)
+				return false;
+			// Replace the (still untouched) arena pages with a private file mapping
+			auto* dst = &((char *)m_arena.data)[begin];
+			if (mmap(dst, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+					options.binary_fd, file_offset) != MAP_FAILED)
+			{
+				// Discarding these pages must not bring back the file contents
+				if (m_arena.file_pages_begin == m_arena.file_pages_end) {
+					m_arena.file_pages_begin = page_number(begin);
+					m_arena.file_pages_end = page_number(end);
+				} else {
+					m_arena.file_pages_begin = std::min(m_arena.file_pages_begin, page_number(begin));
+					m_arena.file_pages_end = std::max(m_arena.file_pages_end, page_number(end));
+				}
+				return true;
+			}
+			// A failed fixed mapping may have unmapped the range
+			if (mmap(dst, len, PROT_READ | PROT_WRITE,
+					MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, -1, 0) == MAP_FAILED)
+				throw MachineException(OUT_OF_MEMORY, "Unable to restore the memory arena", begin);
+			return false;
+		}
+		else if (!uses_flat_memory_arena() || begin >= memory_arena_size())
+		{
+			// Loan the pages from the binary, which is a mapping of the file
+			const char* src = m_binary.data() + file_offset;
+			if (uintptr_t(src) % Page::size() != 0)
+				return false;
+			this->insert_non_owned_memory(begin, (void *)src, len, attr);
+			return true;
+		}
+#else
+		(void)options; (void)file_offset; (void)begin; (void)end; (void)attr;
+#endif
+		return false;
+	}
+
+	template <int W> RISCV_INTERNAL
+	bool Memory<W>::binary_share_pages(const char* src,
+		const address_t begin, const address_t end, PageAttributes attr)
+	{
+		// Reads from the flat arena would not see the shared pages
+		if (uses_flat_memory_arena() && begin < memory_arena_size())
+			return false;
+
+		// Shared pages are never written to: writable pages are copy-on-write
+		attr.is_cow = attr.write;
+		attr.write = false;
+		attr.non_owning = true;
+		for (address_t addr = begin; addr < end; addr += Page::size(), src += Page::size())
+		{
+			auto data = shared_initial_pages.get(src);
+			if (data == nullptr) {
+				this->memcpy(addr, src, Page::size());
+				continue;
+			}
+			this->install_shared_page(page_number(addr), Page{attr, const_cast<PageData*> (data.get())});
+			this->m_shared_pages.push_back(std::move(data));
+		}
+		return true;
+	}
+
 	template <int W> RISCV_INTERNAL
 	void Memory<W>::serialize_execute_segment(
 		const MachineOptions<W>& options, const typename Elf::ProgramHeader* hdr, address_t vaddr)
@@ -462,53 +647,132 @@ namespace riscv
 		// Some machines don't need custom PF handlers
 		this->m_page_fault_handler = master.memory.m_page_fault_handler;
 
+		if (options.use_memory_arena) {
+			this->m_arena.data = master.memory.m_arena.data;
+			this->m_arena.pages = master.memory.m_arena.pages;
+			this->m_arena.read_boundary = master.memory.m_arena.read_boundary;
+			this->m_arena.write_boundary = master.memory.m_arena.write_boundary;
+			this->m_arena.initial_rodata_end = master.memory.m_arena.initial_rodata_end;
+			this->m_arena.file_pages_begin = master.memory.m_arena.file_pages_begin;
+			this->m_arena.file_pages_end = master.memory.m_arena.file_pages_end;
+#ifdef __linux__
+			if (master.memory.m_arena.fd >= 0) {
+				// The host kernel does copy-on-write for the whole arena
+				const size_t len = (m_arena.pages + 1) * Page::size();
+				void* data = mmap(NULL, len, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_NORESERVE, master.memory.m_arena.fd, 0);
+				if (UNLIKELY(data == MAP_FAILED)) {
+					this->m_arena.data = nullptr;
+					throw MachineException(OUT_OF_MEMORY, "Out of memory", len);
+				}
+				this->m_arena.data = (PageData *)data;
+				this->m_arena.private_fork = true;
+			}
+#endif
+		}
+
 		if (options.minimal_fork == false)
 		{
-			// Hardly any pages are dont_fork, so we estimate that
-			// all master pages will be loaned.
-			m_pages.reserve(master.memory.pages().size());
-
 			for (const auto& it : master.memory.pages())
 			{
-				const auto& page = it.second;
-				// Skip pages marked as dont_fork
-				if (page.attr.dont_fork) continue;
-				// Make every page non-owning
-				auto attr = page.attr;
-				if (attr.write) {
-					attr.write = false;
-					attr.is_cow = true;
-				}
-				attr.non_owning = true;
-				m_pages.try_emplace(
-					it.first,
-					attr, page.m_page.get()
-				);
+				this->fork_page(master.memory, it.first, it.second);
 			}
 		}
-		this->m_start_address = master.memory.m_start_address;
-		this->m_stack_address = master.memory.m_stack_address;
-		this->m_exit_address = master.memory.m_exit_address;
-		this->m_heap_address = master.memory.m_heap_address;
-		this->m_mmap_address = master.memory.m_mmap_address;
-		this->m_mmap_cache   = master.memory.m_mmap_cache;
+		this->fork_state(master.memory);
+
+		// invalidate all cached pages, because references are invalidated
+		this->invalidate_reset_cache();
+	}
+
+	template <int W>
+	void Memory<W>::fork_page(const Memory<W>& master, address_t pageno, const Page& page)
+	{
+		// Skip pages marked as dont_fork
+		if (page.attr.dont_fork) return;
+		// Pages in a private arena mapping are already copy-on-write
+		if (m_arena.private_fork && pageno < m_arena.pages
+			&& page.data() == master.m_arena.data[pageno].buffer8.data())
+		{
+			// Regular arena pages are created again on demand
+			if (page.attr.is_default()) return;
+			const auto res = m_pages.try_emplace(
+				pageno,
+				page.attr, &m_arena.data[pageno]
+			);
+			if (res.second)
+				this->page_counter(res.first->second)++;
+			return;
+		}
+		// Make every page non-owning
+		auto attr = page.attr;
+		if (attr.write) {
+			attr.write = false;
+			attr.is_cow = true;
+		}
+		attr.non_owning = true;
+		const auto res = m_pages.try_emplace(
+			pageno,
+			attr, page.m_page.get()
+		);
+		if (res.second)
+			this->page_counter(res.first->second)++;
+	}
+
+	template <int W>
+	void Memory<W>::fork_state(const Memory<W>& master)
+	{
+		this->m_start_address = master.m_start_address;
+		this->m_stack_address = master.m_stack_address;
+		this->m_exit_address = master.m_exit_address;
+		this->m_heap_address = master.m_heap_address;
+		this->m_mmap_address = master.m_mmap_address;
+		this->m_mmap_cache   = master.m_mmap_cache;
 
 		// Reference the same execute segments
-		this->m_exec_segs = master.memory.m_exec_segs;
+		for (size_t i = master.m_exec_segs; i < m_exec_segs; i++) {
+			this->m_exec[i] = nullptr;
+		}
+		this->m_exec_segs = master.m_exec_segs;
 		for (size_t i = 0; i < m_exec_segs; i++) {
-			this->m_exec[i] = master.memory.m_exec[i];
+			// Shared segments are never decoded while in use, so finish
+			// decoding lazily decoded segments before sharing them
+			if (master.m_exec[i] != nullptr)
+				master.m_exec[i]->decode_all_lazy_pages();
+			this->m_exec[i] = master.m_exec[i];
 		}
+	}
 
-		if (options.use_memory_arena) {
-			this->m_arena.data = master.memory.m_arena.data;
-			this->m_arena.pages = master.memory.m_arena.pages;
-			this->m_arena.read_boundary = master.memory.m_arena.read_boundary;
-			this->m_arena.write_boundary = master.memory.m_arena.write_boundary;
-			this->m_arena.initial_rodata_end = master.memory.m_arena.initial_rodata_end;
+	template <int W>
+	void Memory<W>::rewind(const Memory<W>& master)
+	{
+		if (m_arena.data != nullptr && m_arena.data == master.m_arena.data && flat_readwrite_arena) {
+			throw MachineException(FEATURE_DISABLED,
+				"Rewinding a fork requires that it has no arena, or a private (memfd) arena");
+		}
+#ifdef __linux__
+		// Drop the private copies, reverting the arena to the main machine
+		if (m_arena.private_fork) {
+			madvise(m_arena.data, (m_arena.pages + 1) * Page::size(), MADV_DONTNEED);
 		}
+#endif
+		// Restore the dirtied pages from the main machine. Other pages
+		// have not changed since the fork, and stay in the page caches.
+		for (const address_t pageno : m_dirty_pages)
+		{
+			m_rd_cache.invalidate(pageno);
+			m_wr_cache.invalidate(pageno);
+			this->erase_page(pageno);
 
-		// invalidate all cached pages, because references are invalidated
-		this->invalidate_reset_cache();
+			auto master_it = master.pages().find(pageno);
+			if (master_it != master.pages().end())
+				this->fork_page(master, pageno, master_it->second);
+		}
+		m_dirty_pages.clear();
+
+		this->fork_state(master);
+#ifdef RISCV_EXT_ATOMICS
+		this->m_atomics = master.m_atomics;
+#endif
 	}
 
 	template <int W>
@@ -5,8 +5,10 @@
 #include <cstring>
 #include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include "decoded_exec_segment.hpp"
 #include "mmap_cache.hpp"
+#include "page_table.hpp"
 #include "util/buffer.hpp" // <string>
 #include "util/function.hpp"
 #if RISCV_SPAN_AVAILABLE
@@ -108,6 +110,10 @@ namespace riscv
 		Machine<W>& machine() noexcept { return this->m_machine; }
 		const Machine<W>& machine() const noexcept { return this->m_machine; }
 		bool is_forked() const noexcept { return !this->m_original_machine; }
+		// Return a fork to the state of the main machine right after forking,
+		// by restoring only the pages that the fork has changed since then.
+		void rewind(const Memory& master);
+		size_t dirty_pages() const noexcept { return m_dirty_pages.size(); }
 
 #ifdef RISCV_EXT_ATOMICS
 		auto& atomics() noexcept { return this->m_atomics; }
@@ -139,8 +145,21 @@ namespace riscv
 		uint64_t memory_usage_total() const noexcept;
 		// Helpers for memory usage
 		size_t pages_active() const noexcept { return m_pages.size(); }
-		size_t owned_pages_active() const noexcept;
-		// Page handling
+		size_t owned_pages_active() const noexcept { return m_page_counts.owned; }
+		// Pages by kind, kept up to date as pages are created, copied and freed
+		struct PageCounts {
+			size_t owned  = 0; // Private page data
+			size_t cow    = 0; // Copy-on-write, not yet written to
+			size_t shared = 0; // Read-only data owned by someone else
+			size_t arena  = 0; // Touched pages in the memory arena
+			size_t resident() const noexcept { return owned + arena; }
+		};
+		const PageCounts& page_counts() const noexcept { return m_page_counts; }
+		// Limit the resident pages (owned and arena) of this machine. Zero removes the limit.
+		void set_memory_quota(uint64_t bytes) noexcept;
+		uint64_t memory_quota() const noexcept;
+		// Page handling. Adding or removing pages directly in the page table
+		// is not reflected in page_counts().
 		const auto& pages() const noexcept { return m_pages; }
 		auto& pages() noexcept { return m_pages; }
 		const Page& get_page(address_t) const;
@@ -201,6 +220,9 @@ namespace riscv
 		void evict_execute_segment(DecodedExecuteSegment<W>&);
 #ifdef RISCV_BINARY_TRANSLATION
 		std::vector<address_t> gather_jump_hints() const;
+		// Merge the counters of profiled execute segments into
+		// the profile given in the machine options
+		TranslationProfile<W> gather_translation_profile() const;
 #endif
 
 		const auto& binary() const noexcept { return m_binary; }
@@ -209,12 +231,17 @@ namespace riscv
 
 		bool uses_flat_memory_arena() const noexcept { return riscv::flat_readwrite_arena && this->m_arena.data != nullptr; }
 		bool uses_Nbit_encompassing_arena() const noexcept { return riscv::encompassing_Nbit_arena != 0 && this->m_arena.data != nullptr; }
+		bool uses_memfd_arena() const noexcept { return this->m_arena.fd >= 0; }
 		void* memory_arena_ptr() const noexcept { return (void *)this->m_arena.data; }
 		auto& memory_arena_ptr_ref() const noexcept { return this->m_arena.data; }
 		size_t memory_arena_size() const noexcept { return this->m_arena.pages * Page::size(); }
 		address_t memory_arena_read_boundary() const noexcept { return this->m_arena.read_boundary; }
 		address_t memory_arena_write_boundary() const noexcept { return this->m_arena.write_boundary; }
 		address_t initial_rodata_end() const noexcept { return this->m_arena.initial_rodata_end; }
+		// Host pointers to a complete range inside the flat read-write arena,
+		// using the same boundaries as regular reads and writes, or nullptr
+		const char* arena_readable_range(address_t addr, size_t len) const noexcept;
+		char* arena_writable_range(address_t addr, size_t len) noexcept;
 
 		// Serializes the current memory state to an existing vector
 		// Returns the final size of the serialized state
@@ -261,10 +288,42 @@ namespace riscv
 		// ELF loader
 		void binary_loader(const MachineOptions<W>&);
 		void binary_load_ph(const MachineOptions<W>&, const typename Elf::ProgramHeader*, address_t vaddr);
+		bool binary_map_pages(const MachineOptions<W>&, size_t file_offset, address_t begin, address_t end, PageAttributes);
+		bool binary_share_pages(const char* src, address_t begin, address_t end, PageAttributes);
 		void serialize_execute_segment(const MachineOptions<W>&, const typename Elf::ProgramHeader*, address_t vaddr);
 		void generate_decoder_cache(const MachineOptions<W>&, std::shared_ptr<DecodedExecuteSegment<W>>&, bool is_initial);
 		// Machine copy-on-write fork
 		void machine_loader(const Machine<W>&, const MachineOptions<W>&);
+		void fork_page(const Memory& master, address_t pageno, const Page&);
+		void fork_state(const Memory& master);
+		bool is_arena_page(const Page& page) const noexcept {
+			const PageData* data = &page.page();
+			return data >= m_arena.data && data < m_arena.data + m_arena.pages;
+		}
+		// MADV_DONTNEED only zeroes private anonymous memory in 4KB pages,
+		// while pages mapped from the program file would revert to the file
+		bool arena_discards_with_madvise(address_t pageno) const noexcept {
+			return m_arena.fd < 0 && !m_arena.private_fork && !m_arena.huge_pages
+				&& (pageno < m_arena.file_pages_begin || pageno >= m_arena.file_pages_end);
+		}
+		// The counter in m_page_counts that a page belongs to
+		size_t& page_counter(const Page& page) noexcept {
+			if (!page.attr.non_owning && !page.is_cow_page()) return m_page_counts.owned;
+			if (page.attr.is_cow) return m_page_counts.cow;
+			if (is_arena_page(page)) return m_page_counts.arena;
+			return m_page_counts.shared;
+		}
+		void check_memory_quota() const {
+			if (UNLIKELY(m_page_counts.resident() >= m_page_quota))
+				memory_quota_exceeded();
+		}
+		[[noreturn]] void memory_quota_exceeded() const;
+		void resolve_cow_page(address_t pageno, Page&);
+		bool erase_page(address_t pageno);
+		// Forks remember the pages they changed, so that they can be rewound
+		void track_dirty(address_t pageno) {
+			if (!m_original_machine) m_dirty_pages.insert(pageno);
+		}
 
 		address_t m_start_address = 0;
 		address_t m_stack_address = 0;
@@ -274,10 +333,15 @@ namespace riscv
 
 		Machine<W>& m_machine;
 
-		mutable CachedPage<W, const PageData> m_rd_cache;
-		mutable CachedPage<W, PageData> m_wr_cache;
+		mutable PageCache<W, const PageData> m_rd_cache;
+		mutable PageCache<W, PageData> m_wr_cache;
 
-		std::unordered_map<address_t, Page> m_pages;
+		PageTable<W> m_pages;
+		PageCounts m_page_counts;
+		size_t m_page_quota = SIZE_MAX;
+		std::unordered_set<address_t> m_dirty_pages;
+		// Initial pages shared with other machines loading the same program
+		std::vector<std::shared_ptr<const PageData>> m_shared_pages;
 
 		const bool m_original_machine;
 		bool m_is_dynamic = false;
@@ -308,6 +372,12 @@ namespace riscv
 			address_t write_boundary = 0;
 			address_t initial_rodata_end = 0;
 			size_t    pages = 0;
+			int       fd = -1; // memfd backing the arena, if any
+			bool      private_fork = false; // Private mapping of the main machine's memfd
+			bool      huge_pages = false; // Mapping is rounded up to huge pages
+			// Pages that are mapped from the program file (see binary_fd)
+			address_t file_pages_begin = 0;
+			address_t file_pages_end = 0;
 		} m_arena;
 
 		friend struct CPU<W>;
@@ -1,8 +1,35 @@
 #pragma once
 
+template <int W> inline
+const char* Memory<W>::arena_readable_range(address_t addr, size_t len) const noexcept
+{
+	if constexpr (flat_readwrite_arena) {
+		const address_t offset = addr - RWREAD_BEGIN;
+		if (offset < memory_arena_read_boundary() && len <= memory_arena_read_boundary() - offset)
+			return &((const char *)m_arena.data)[RISCV_SPECSAFE(addr)];
+	}
+	return nullptr;
+}
+
+template <int W> inline
+char* Memory<W>::arena_writable_range(address_t addr, size_t len) noexcept
+{
+	if constexpr (flat_readwrite_arena) {
+		const address_t offset = addr - initial_rodata_end();
+		if (offset < memory_arena_write_boundary() && len <= memory_arena_write_boundary() - offset)
+			return &((char *)m_arena.data)[RISCV_SPECSAFE(addr)];
+	}
+	return nullptr;
+}
+
 template <int W> inline
 void Memory<W>::memset(address_t dst, uint8_t value, size_t len)
 {
+	// Fast-path: The whole range is inside the arena
+	if (char* arena = arena_writable_range(dst, len)) {
+		std::memset(arena, value, len);
+		return;
+	}
 	while (len > 0)
 	{
 		const size_t offset = dst & (Page::size()-1); // offset within page
@@ -20,13 +47,18 @@ template <int W> inline
 void Memory<W>::memcpy(address_t dst, const void* vsrc, size_t len)
 {
 	auto* src = (uint8_t*) vsrc;
+	// Fast-path: The whole range is inside the arena
+	if (char* arena = arena_writable_range(dst, len)) {
+		std::memcpy(arena, src, len);
+		return;
+	}
 	while (len != 0)
 	{
 		const size_t offset = dst & (Page::size()-1); // offset within page
 		const size_t size = std::min(Page::size() - offset, len);
 		auto& page = this->create_writable_pageno(dst / Page::size(), size != Page::size());
 
-		std::copy(src, src + size, page.data() + offset);
+		std::memcpy(page.data() + offset, src, size);
 
 		dst += size;
 		src += size;
@@ -38,6 +70,11 @@ template <int W> inline
 void Memory<W>::memcpy_out(void* vdst, address_t src, size_t len) const
 {
 	auto* dst = (uint8_t*) vdst;
+	// Fast-path: The whole range is inside the arena
+	if (const char* arena = arena_readable_range(src, len)) {
+		std::memcpy(dst, arena, len);
+		return;
+	}
 	while (len != 0)
 	{
 		const size_t offset = src & (Page::size()-1);
@@ -46,7 +83,7 @@ void Memory<W>::memcpy_out(void* vdst, address_t src, size_t len) const
 		if (UNLIKELY(!page.attr.read))
 			protection_fault(src);
 
-		std::copy(page.data() + offset, page.data() + offset + size, dst);
+		std::memcpy(dst, page.data() + offset, size);
 
 		dst += size;
 		src += size;
@@ -223,6 +260,16 @@ size_t Memory<W>::strlen(address_t addr, size_t maxlen) const
 	return (len <= maxlen) ? len : maxlen;
 }
 
+// Compare equally long host ranges, returning the difference
+// of the first mismatching bytes, or zero
+static inline int memcmp_difference(const uint8_t* s1, const uint8_t* s2, size_t len)
+{
+	if (std::memcmp(s1, s2, len) == 0)
+		return 0;
+	const auto mismatch = std::mismatch(s1, s1 + len, s2);
+	return *mismatch.first - *mismatch.second;
+}
+
 template <int W> inline
 int Memory<W>::memcmp(address_t p1, address_t p2, size_t len) const
 {
@@ -231,37 +278,28 @@ int Memory<W>::memcmp(address_t p1, address_t p2, size_t len) const
 	if (UNLIKELY(p2 + len < p2))
 		protection_fault(p2);
 
-	// NOTE: fast implementation if no pointer crosses page boundary
-	const auto pageno1 = this->page_number(p1);
-	const auto pageno2 = this->page_number(p2);
-	if (pageno1 == ((p1 + len-1) / Page::size()) &&
-		pageno2 == ((p2 + len-1) / Page::size())) {
-		auto& page1 = this->get_readable_pageno(pageno1);
-		auto& page2 = this->get_readable_pageno(pageno2);
-
-		const uint8_t* s1 = page1.data() + p1 % Page::SIZE;
-		const uint8_t* s2 = page2.data() + p2 % Page::SIZE;
-		return std::memcmp(s1, s2, len);
-	}
-	else // slow path (optimizable)
-	{
-		uint8_t v1 = 0;
-		uint8_t v2 = 0;
-		while (len > 0) {
-			const auto pageno1 = this->page_number(p1);
-			const auto pageno2 = this->page_number(p2);
-			auto& page1 = this->get_readable_pageno(pageno1);
-			auto& page2 = this->get_readable_pageno(pageno2);
-
-			v1 = page1.data()[p1 % Page::SIZE];
-			v2 = page2.data()[p2 % Page::SIZE];
-			if (v1 != v2) break;
-			p1++;
-			p2++;
-			len--;
-		}
-		return len == 0 ? 0 : (v1 - v2);
+	// Fast-path: Both ranges are inside the arena
+	const char* a1 = arena_readable_range(p1, len);
+	const char* a2 = arena_readable_range(p2, len);
+	if (a1 != nullptr && a2 != nullptr)
+		return memcmp_difference((const uint8_t *)a1, (const uint8_t *)a2, len);
+
+	// Compare the largest chunks that don't cross a page boundary
+	while (len > 0) {
+		const size_t offset1 = p1 & (Page::size()-1);
+		const size_t offset2 = p2 & (Page::size()-1);
+		const size_t size = std::min({Page::size() - offset1, Page::size() - offset2, len});
+		auto& page1 = this->get_readable_pageno(this->page_number(p1));
+		auto& page2 = this->get_readable_pageno(this->page_number(p2));
+
+		const int diff = memcmp_difference(page1.data() + offset1, page2.data() + offset2, size);
+		if (diff != 0)
+			return diff;
+		p1 += size;
+		p2 += size;
+		len -= size;
 	}
+	return 0;
 }
 template <int W> inline
 int Memory<W>::memcmp(const void* ptr1, address_t p2, size_t len) const
@@ -269,36 +307,35 @@ int Memory<W>::memcmp(const void* ptr1, address_t p2, size_t len) const
 	if (UNLIKELY(p2 + len < p2))
 		protection_fault(p2);
 
-	const char* s1 = (const char*) ptr1;
-	// NOTE: fast implementation if no pointer crosses page boundary
-	const auto pageno2 = this->page_number(p2);
-	if (pageno2 == ((p2 + len-1) / Page::size())) {
-		auto& page2 = this->get_readable_pageno(pageno2);
+	const uint8_t* s1 = (const uint8_t*) ptr1;
+	// Fast-path: The whole range is inside the arena
+	if (const char* a2 = arena_readable_range(p2, len))
+		return memcmp_difference(s1, (const uint8_t *)a2, len);
 
-		const uint8_t* s2 = page2.data() + p2 % Page::SIZE;
-		return std::memcmp(s1, s2, len);
-	}
-	else // slow path (optimizable)
-	{
-		uint8_t v2 = 0;
-		while (len > 0) {
-			const auto pageno2 = this->page_number(p2);
-			auto& page2 = this->get_readable_pageno(pageno2);
-
-			v2 = page2.data()[p2 % Page::SIZE];
-			if (*s1 != v2) break;
-			s1++;
-			p2++;
-			len--;
-		}
-		return len == 0 ? 0 : (*s1 - v2);
+	while (len > 0) {
+		const size_t offset2 = p2 & (Page::size()-1);
+		const size_t size = std::min(Page::size() - offset2, len);
+		auto& page2 = this->get_readable_pageno(this->page_number(p2));
+
+		const int diff = memcmp_difference(s1, page2.data() + offset2, size);
+		if (diff != 0)
+			return diff;
+		s1 += size;
+		p2 += size;
+		len -= size;
 	}
+	return 0;
 }
 
 template <int W> inline
 void Memory<W>::memcpy(
 	address_t dst, Machine<W>& srcm, address_t src, address_t len)
 {
+	// Fast-path: The source range is inside the arena
+	if (const char* arena = srcm.memory.arena_readable_range(src, len)) {
+		this->memcpy(dst, arena, len);
+		return;
+	}
 	if ((dst & (W-1)) == (src & (W-1))) {
 		while ((src & (W-1)) != 0 && len > 0) {
 			this->template write<uint8_t> (dst++,
@@ -107,7 +107,7 @@ void Memory<W>::write(address_t address, T value)
 	}
 
 	const auto pageno = page_number(address);
-	auto& entry = m_wr_cache;
+	auto& entry = m_wr_cache[pageno];
 	if (entry.pageno == pageno) {
 		entry.page->template aligned_write<T>(offset, value);
 		return;
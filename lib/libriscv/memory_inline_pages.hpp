@@ -3,7 +3,7 @@ template <int W> inline
 const PageData& Memory<W>::cached_readable_page(address_t address, size_t len) const
 {
 	const auto pageno = page_number(address);
-	auto& entry = m_rd_cache;
+	auto& entry = m_rd_cache[pageno];
 	if (entry.pageno == pageno)
 		return *entry.page;
 
@@ -22,7 +22,7 @@ template <int W> inline
 PageData& Memory<W>::cached_writable_page(address_t address)
 {
 	const auto pageno = page_number(address);
-	auto& entry = m_wr_cache;
+	auto& entry = m_wr_cache[pageno];
 	if (entry.pageno == pageno)
 		return *entry.page;
 	auto& page = create_writable_pageno(pageno);
@@ -63,44 +63,35 @@ template <int W> inline void
 Memory<W>::invalidate_cache(address_t pageno, Page* page) const noexcept
 {
 	// NOTE: It is only possible to keep the write page as long as
-	// the page tables are node-based. In that case, we only have
+	// pages never move in the page table. In that case, we only have
 	// to invalidate the read page when it matches.
-	if (m_rd_cache.pageno == pageno) {
-		m_rd_cache.pageno = (address_t)-1;
-	}
+	m_rd_cache.invalidate(pageno);
 	(void)page;
 }
 template <int W> inline void
 Memory<W>::invalidate_reset_cache() const noexcept
 {
-	m_rd_cache.pageno = (address_t)-1;
-	m_wr_cache.pageno = (address_t)-1;
+	m_rd_cache.reset();
+	m_wr_cache.reset();
 }
 
 template <int W>
 template <typename... Args> inline
 Page& Memory<W>::allocate_page(const address_t page, Args&&... args)
 {
+	this->check_memory_quota();
 	const auto it = m_pages.try_emplace(
 		page,
 		std::forward<Args> (args)...
 	);
+	if (it.second)
+		this->page_counter(it.first->second)++;
 	// Invalidate only this page
 	this->invalidate_cache(page, &it.first->second);
 	// Return new default-writable page
 	return it.first->second;
 }
 
-template <int W>
-inline size_t Memory<W>::owned_pages_active() const noexcept
-{
-	size_t count = 0;
-	for (const auto& it : m_pages) {
-		if (!it.second.attr.non_owning) count++;
-	}
-	return count;
-}
-
 template <int W>
 inline void Memory<W>::trap(address_t page_addr, mmio_cb_t callback)
 {
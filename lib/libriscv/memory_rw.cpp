@@ -29,7 +29,7 @@ namespace riscv
 			if (LIKELY(page.attr.write)) {
 				return page;
 			} else if (page.attr.is_cow) {
-				m_page_write_handler(*this, pageno, page);
+				this->resolve_cow_page(pageno, page);
 				// The page may be read-cached at this time
 				// and the page data has likely changed now.
 				this->invalidate_cache(pageno, &page);
@@ -37,6 +37,7 @@ namespace riscv
 			}
 		} else {
 			// Handler must produce a new page, or throw
+			this->track_dirty(pageno);
 			Page& page = m_page_fault_handler(*this, pageno, init);
 			if (LIKELY(page.attr.write)) {
 				this->invalidate_cache(pageno, &page);
@@ -46,20 +47,44 @@ namespace riscv
 		this->protection_fault(pageno * Page::size());
 	}
 
+	template <int W>
+	void Memory<W>::resolve_cow_page(const address_t pageno, Page& page)
+	{
+		auto& counter = page_counter(page);
+		// Copying the page on write makes it resident
+		if (&counter != &m_page_counts.owned && &counter != &m_page_counts.arena)
+			this->check_memory_quota();
+		this->track_dirty(pageno);
+		m_page_write_handler(*this, pageno, page);
+		counter--;
+		this->page_counter(page)++;
+	}
+
 	template <int W>
 	void Memory<W>::set_pageno_attr(const address_t pageno, PageAttributes attr)
 	{
+		// The page caches only hold pages with the old permissions
+		m_rd_cache.invalidate(pageno);
+		m_wr_cache.invalidate(pageno);
+		this->track_dirty(pageno);
+
 		auto it = pages().find(pageno);
 		if (it != pages().end()) {
 			auto& page = it->second;
+			auto& counter = page_counter(page);
 			// Keep non-owning and is_cow attributes
 			const bool is_cow = page.attr.is_cow;
+			// Read-only pages loaned from outside of the arena (eg. mapped ELF segments)
+			const bool is_loaned = page.attr.non_owning && !page.attr.write && !is_arena_page(page);
 			page.attr.apply_regular_attributes(attr);
-			// If the page becomes writable and holds the CoW-page data, it's also copy-on-write
-			if (is_cow || (attr.write && page.is_cow_page())) {
+			// If the page becomes writable and holds the CoW-page data or loaned data,
+			// it's also copy-on-write
+			if (is_cow || (attr.write && (is_loaned || page.is_cow_page()))) {
 				page.attr.is_cow = true;
 				page.attr.write = false;
 			}
+			counter--;
+			this->page_counter(page)++;
 			return;
 		}
 
@@ -82,7 +107,8 @@ namespace riscv
 		attr.is_cow = attr.write;
 		attr.write = false;
 		attr.non_owning = true;
-		m_pages.try_emplace(pageno, attr, Page::cow_page().m_page.get());
+		const auto res = m_pages.try_emplace(pageno, attr, Page::cow_page().m_page.get());
+		this->page_counter(res.first->second)++;
 	}
 
 	template <int W>
@@ -107,13 +133,25 @@ namespace riscv
 					// This is the zero-page
 				} else {
 					if (page.attr.is_cow) {
-						m_page_write_handler(*this, pageno, page);
+						this->resolve_cow_page(pageno, page);
+					} else if (ignore_protections && !page.attr.write && page.attr.non_owning && !is_arena_page(page)) {
+						// Read-only pages loaned from eg. the program file
+						// are not ours to change, so make a private copy
+						auto& counter = page_counter(page);
+						if (&counter != &m_page_counts.owned)
+							this->check_memory_quota();
+						this->track_dirty(pageno);
+						page.make_writable();
+						page.attr.write = false;
+						counter--;
+						this->page_counter(page)++;
+						this->invalidate_cache(pageno, &page);
 					}
 					if (page.attr.write || ignore_protections) {
 
 						if constexpr (MADVISE_ENABLED) {
 							// madvise "fast-path" (XXX: doesn't scale on busy server)
-							if (offset == 0 && size == Page::size()) {
+							if (offset == 0 && size == Page::size() && arena_discards_with_madvise(pageno)) {
 								madvise(page.data(), Page::size(), MADV_DONTNEED);
 							} else {
 								std::memset(page.data() + offset, 0, size);
@@ -134,7 +172,7 @@ namespace riscv
 					// Fast-path using madvise
 					if constexpr (MADVISE_ENABLED) {
 						// XXX: doesn't scale on busy server
-						if (offset == 0 && size == Page::size()) {
+						if (offset == 0 && size == Page::size() && arena_discards_with_madvise(pageno)) {
 							address_t new_dst = dst + (len & ~address_t(Page::size()-1));
 							new_dst = std::min(new_dst, (address_t)memory_arena_size());
 							const size_t new_size = new_dst - dst;
@@ -170,7 +208,21 @@ namespace riscv
 	template <int W>
 	bool Memory<W>::free_pageno(address_t pageno)
 	{
-		return m_pages.erase(pageno) != 0;
+		m_rd_cache.invalidate(pageno);
+		m_wr_cache.invalidate(pageno);
+		this->track_dirty(pageno);
+		return this->erase_page(pageno);
+	}
+
+	template <int W>
+	bool Memory<W>::erase_page(address_t pageno)
+	{
+		auto it = m_pages.find(pageno);
+		if (it == m_pages.end())
+			return false;
+		this->page_counter(it->second)--;
+		m_pages.erase(pageno);
+		return true;
 	}
 
 	template <int W>
@@ -256,6 +308,7 @@ namespace riscv
 
 		auto attr = shared_page.attr;
 		attr.non_owning = true;
+		this->track_dirty(pageno);
 		// NOTE: If you insert a const Page, DON'T modify it! The machine
 		// won't, unless system-calls do or manual intervention happens!
 		auto res = m_pages.try_emplace(
@@ -267,9 +320,10 @@ namespace riscv
 		// try overwriting instead, if emplace failed
 		if (res.second == false) {
 			Page& page = res.first->second;
+			this->page_counter(page)--;
 			new (&page) Page{attr, const_cast<PageData*> (shared_page.m_page.get())};
-			return page;
 		}
+		this->page_counter(res.first->second)++;
 		return res.first->second;
 	}
 
@@ -285,10 +339,13 @@ namespace riscv
 		{
 			const auto pageno = (dst + i) / Page::size();
 			PageData* pdata = reinterpret_cast<PageData*> ((char*) src + i);
-			m_pages.try_emplace(
+			this->track_dirty(pageno);
+			const auto res = m_pages.try_emplace(
 				pageno,
 				attr, pdata
 			);
+			if (res.second)
+				this->page_counter(res.first->second)++;
 		}
 		// TODO: Can be improved by invalidating more intelligently
 		this->invalidate_reset_cache();
@@ -314,17 +371,9 @@ namespace riscv
 	{
 		uint64_t total = 0;
 		total += sizeof(Machine<W>);
-		// Pages
-		for (const auto& it : m_pages) {
-			const auto page_number = it.first;
-			const auto& page = it.second;
-			total += sizeof(page);
-			// Regular owned page (that is not the shared zero-page)
-			if ((!page.attr.non_owning && !page.is_cow_page()) ||
-				// Arena page
-				(page.attr.non_owning && page_number < m_arena.pages))
-					total += Page::size();
-		}
+		// Pages, and owned or arena page data
+		total += m_pages.memory_usage();
+		total += m_page_counts.resident() * Page::size();
 
 		for (const auto& exec : m_exec) {
 			if (exec)
@@ -334,6 +383,24 @@ namespace riscv
 		return total;
 	}
 
+	template <int W>
+	void Memory<W>::set_memory_quota(uint64_t bytes) noexcept
+	{
+		const uint64_t pages = bytes / Page::size();
+		this->m_page_quota = (pages != 0 && pages < SIZE_MAX) ? pages : SIZE_MAX;
+	}
+	template <int W>
+	uint64_t Memory<W>::memory_quota() const noexcept
+	{
+		return (m_page_quota != SIZE_MAX) ? uint64_t(m_page_quota) * Page::size() : 0;
+	}
+
+	template <int W> RISCV_COLD_PATH()
+	void Memory<W>::memory_quota_exceeded() const
+	{
+		throw MachineException(MEMORY_QUOTA_EXCEEDED, "Memory quota exceeded", memory_quota());
+	}
+
 	INSTANTIATE_32_IF_ENABLED(Memory);
 	INSTANTIATE_64_IF_ENABLED(Memory);
 	INSTANTIATE_128_IF_ENABLED(Memory);
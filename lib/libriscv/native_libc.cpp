@@ -187,6 +187,14 @@ void Machine<W>::setup_native_memory(const size_t syscall_base)
 		{
 			if (UNLIKELY(len > MEMCPY_MAX))
 				throw MachineException(SYSTEM_CALL_FAILED, "memmove length too large", len);
+			// Overlapping ranges inside the arena are moved in one go
+			const char* arena_src = m.memory.arena_readable_range(src, len);
+			char* arena_dst = m.memory.arena_writable_range(dst, len);
+			if (arena_src != nullptr && arena_dst != nullptr) {
+				std::memmove(arena_dst, arena_src, len);
+				m.penalize(2 * len);
+				return;
+			}
 			constexpr size_t wordsize = sizeof(address_type<W>);
 			if (dst % wordsize == 0 && src % wordsize == 0 && len % wordsize == 0)
 			{
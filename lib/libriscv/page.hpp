@@ -234,4 +234,28 @@ template <int W, typename T> struct CachedPage {
 	void reset() { pageno = (address_type<W>)-1; page = nullptr; }
 };
 
+// A small direct-mapped cache of pages, indexed by page number. Unlike a
+// single entry, it keeps working when accesses alternate between pages,
+// like a memcpy between two buffers or a stack and a heap.
+template <int W, typename T, unsigned N = RISCV_PAGE_CACHE_SIZE> struct PageCache {
+	static_assert(N > 0 && (N & (N-1)) == 0, "The page cache size must be a power of two");
+
+	CachedPage<W, T>& operator[] (address_type<W> pageno) noexcept {
+		return m_entries[pageno & (N-1)];
+	}
+	// Forget pageno, if it is cached
+	void invalidate(address_type<W> pageno) noexcept {
+		auto& entry = (*this)[pageno];
+		if (entry.pageno == pageno)
+			entry.reset();
+	}
+	void reset() noexcept {
+		for (auto& entry : m_entries)
+			entry.reset();
+	}
+
+private:
+	std::array<CachedPage<W, T>, N> m_entries;
+};
+
 }
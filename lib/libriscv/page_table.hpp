@@ -0,0 +1,246 @@
+#pragma once
+#include "page.hpp"
+#include <algorithm>
+#include <bit>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace riscv
+{
+	// A radix page table indexed by page number. The page number is split
+	// into a region (the sparse top level), a directory index and a leaf
+	// index. Regions are kept in a small sorted array, so that typical
+	// programs with a handful of regions (ELF, heap, mmap, stack) find
+	// theirs with one or two comparisons, while 64- and 128-bit programs
+	// may place them anywhere. Each region has a directory of leaves, and
+	// each leaf is a contiguous array of pages with a presence bitmap.
+	// Pages never move once inserted, so references to them stay valid
+	// until they are erased, just like with a node-based map.
+	// The interface is the subset of std::unordered_map used by Memory,
+	// and iteration yields pairs of (page number, page) in order.
+	template <int W>
+	struct PageTable
+	{
+		using address_t  = address_type<W>;
+		using key_type   = address_t;
+		using mapped_type = Page;
+		using value_type = std::pair<const address_t, Page>;
+		static constexpr unsigned LEAF_BITS = 6;
+		static constexpr unsigned DIR_BITS  = 9;
+		static constexpr unsigned LEAF_SIZE = 1u << LEAF_BITS;
+		static constexpr unsigned DIR_SIZE  = 1u << DIR_BITS;
+		static constexpr unsigned REGION_SHIFT = LEAF_BITS + DIR_BITS;
+
+		template <bool Const>
+		struct basic_iterator
+		{
+			using table_t = std::conditional_t<Const, const PageTable, PageTable>;
+			using value_type = std::conditional_t<Const, const PageTable::value_type, PageTable::value_type>;
+			using reference  = value_type&;
+			using pointer    = value_type*;
+			using difference_type = std::ptrdiff_t;
+			using iterator_category = std::forward_iterator_tag;
+
+			basic_iterator() = default;
+			basic_iterator(table_t* table, pointer entry) noexcept : m_table(table), m_entry(entry) {}
+			operator basic_iterator<true>() const noexcept requires (!Const) { return {m_table, m_entry}; }
+
+			reference operator* () const noexcept { return *m_entry; }
+			pointer operator-> () const noexcept { return m_entry; }
+			basic_iterator& operator++ () noexcept {
+				m_entry = m_table->find_next(m_entry->first + 1);
+				return *this;
+			}
+			basic_iterator operator++ (int) noexcept { auto it = *this; ++*this; return it; }
+			bool operator== (const basic_iterator& other) const noexcept { return m_entry == other.m_entry; }
+			bool operator!= (const basic_iterator& other) const noexcept { return m_entry != other.m_entry; }
+
+		private:
+			table_t* m_table = nullptr;
+			pointer  m_entry = nullptr;
+		};
+		using iterator = basic_iterator<false>;
+		using const_iterator = basic_iterator<true>;
+
+		PageTable() = default;
+		PageTable(const PageTable&) = delete;
+		PageTable& operator= (const PageTable&) = delete;
+
+		iterator find(address_t pageno) noexcept { return {this, lookup(pageno)}; }
+		const_iterator find(address_t pageno) const noexcept { return {this, lookup(pageno)}; }
+		bool contains(address_t pageno) const noexcept { return lookup(pageno) != nullptr; }
+
+		iterator begin() noexcept { return {this, find_next(0)}; }
+		iterator end() noexcept { return {this, nullptr}; }
+		const_iterator begin() const noexcept { return {this, find_next(0)}; }
+		const_iterator end() const noexcept { return {this, nullptr}; }
+
+		size_t size() const noexcept { return m_size; }
+		bool empty() const noexcept { return m_size == 0; }
+
+		template <typename... Args>
+		std::pair<iterator, bool> try_emplace(address_t pageno, Args&&... args);
+		size_t erase(address_t pageno);
+		void clear() noexcept;
+
+		// Bytes used by the table itself, excluding page data
+		size_t memory_usage() const noexcept;
+
+	private:
+		struct Leaf {
+			uint64_t present = 0;
+			unsigned count = 0;
+			alignas(value_type) unsigned char storage[LEAF_SIZE * sizeof(value_type)];
+
+			value_type* slot(unsigned i) noexcept {
+				return std::launder(reinterpret_cast<value_type*>(&storage[i * sizeof(value_type)]));
+			}
+			bool has(unsigned i) const noexcept { return (present >> i) & 1; }
+			~Leaf() {
+				for (uint64_t bits = present; bits != 0; bits &= bits - 1)
+					slot(std::countr_zero(bits))->~value_type();
+			}
+		};
+		static_assert(LEAF_SIZE <= 64, "The presence bitmap is a single word");
+		struct Directory {
+			std::unique_ptr<Leaf> leaves[DIR_SIZE];
+		};
+
+		static address_t region_of(address_t pageno) noexcept { return pageno >> REGION_SHIFT; }
+		static unsigned leaf_index(address_t pageno) noexcept { return (pageno >> LEAF_BITS) & (DIR_SIZE - 1); }
+		static unsigned slot_index(address_t pageno) noexcept { return pageno & (LEAF_SIZE - 1); }
+
+		Directory* find_directory(address_t region) const noexcept {
+			const auto it = std::lower_bound(m_regions.begin(), m_regions.end(), region);
+			if (it != m_regions.end() && *it == region)
+				return m_directories[it - m_regions.begin()].get();
+			return nullptr;
+		}
+		Leaf* find_leaf(address_t pageno) const noexcept {
+			auto* dir = find_directory(region_of(pageno));
+			return (dir != nullptr) ? dir->leaves[leaf_index(pageno)].get() : nullptr;
+		}
+		value_type* lookup(address_t pageno) const noexcept {
+			auto* leaf = find_leaf(pageno);
+			const unsigned i = slot_index(pageno);
+			if (leaf != nullptr && leaf->has(i))
+				return leaf->slot(i);
+			return nullptr;
+		}
+		Leaf& create_leaf(address_t pageno);
+		// The first page at or after pageno, or nullptr
+		value_type* find_next(address_t pageno) const noexcept;
+
+		// Sorted region numbers, and their directories
+		std::vector<address_t> m_regions;
+		std::vector<std::unique_ptr<Directory>> m_directories;
+		size_t m_size = 0;
+		size_t m_leaves = 0;
+	};
+
+	template <int W>
+	template <typename... Args> inline
+	std::pair<typename PageTable<W>::iterator, bool> PageTable<W>::try_emplace(address_t pageno, Args&&... args)
+	{
+		Leaf& leaf = create_leaf(pageno);
+		const unsigned i = slot_index(pageno);
+		if (leaf.has(i))
+			return {{this, leaf.slot(i)}, false};
+
+		auto* entry = new (&leaf.storage[i * sizeof(value_type)]) value_type(
+			std::piecewise_construct,
+			std::forward_as_tuple(pageno),
+			std::forward_as_tuple(std::forward<Args>(args)...));
+		leaf.present |= uint64_t(1) << i;
+		leaf.count++;
+		m_size++;
+		return {{this, entry}, true};
+	}
+
+	template <int W>
+	inline typename PageTable<W>::Leaf& PageTable<W>::create_leaf(address_t pageno)
+	{
+		const address_t region = region_of(pageno);
+		auto it = std::lower_bound(m_regions.begin(), m_regions.end(), region);
+		const size_t index = it - m_regions.begin();
+		if (it == m_regions.end() || *it != region) {
+			m_regions.insert(it, region);
+			m_directories.insert(m_directories.begin() + index, std::make_unique<Directory>());
+		}
+		auto& leaf = m_directories[index]->leaves[leaf_index(pageno)];
+		if (leaf == nullptr) {
+			leaf = std::make_unique<Leaf>();
+			m_leaves++;
+		}
+		return *leaf;
+	}
+
+	template <int W>
+	inline size_t PageTable<W>::erase(address_t pageno)
+	{
+		auto* dir = find_directory(region_of(pageno));
+		if (dir == nullptr)
+			return 0;
+		auto& leaf = dir->leaves[leaf_index(pageno)];
+		const unsigned i = slot_index(pageno);
+		if (leaf == nullptr || !leaf->has(i))
+			return 0;
+
+		leaf->slot(i)->~value_type();
+		leaf->present &= ~(uint64_t(1) << i);
+		m_size--;
+		// Release leaves as they become empty. Directories are kept,
+		// as regions are few and usually get repopulated.
+		if (--leaf->count == 0) {
+			leaf.reset();
+			m_leaves--;
+		}
+		return 1;
+	}
+
+	template <int W>
+	inline void PageTable<W>::clear() noexcept
+	{
+		m_regions.clear();
+		m_directories.clear();
+		m_size = 0;
+		m_leaves = 0;
+	}
+
+	template <int W>
+	inline typename PageTable<W>::value_type* PageTable<W>::find_next(address_t pageno) const noexcept
+	{
+		const address_t first_region = region_of(pageno);
+		auto it = std::lower_bound(m_regions.begin(), m_regions.end(), first_region);
+		for (; it != m_regions.end(); ++it)
+		{
+			const auto& dir = *m_directories[it - m_regions.begin()];
+			// Only the first region is entered part-way
+			const bool partial = (*it == first_region);
+			for (unsigned l = partial ? leaf_index(pageno) : 0; l < DIR_SIZE; l++)
+			{
+				auto* leaf = dir.leaves[l].get();
+				if (leaf == nullptr)
+					continue;
+				uint64_t bits = leaf->present;
+				if (partial && l == leaf_index(pageno))
+					bits &= ~uint64_t(0) << slot_index(pageno);
+				if (bits != 0)
+					return leaf->slot(std::countr_zero(bits));
+			}
+		}
+		return nullptr;
+	}
+
+	template <int W>
+	inline size_t PageTable<W>::memory_usage() const noexcept
+	{
+		return m_regions.capacity() * sizeof(address_t)
+			+ m_directories.capacity() * sizeof(std::unique_ptr<Directory>)
+			+ m_directories.size() * sizeof(Directory)
+			+ m_leaves * sizeof(Leaf);
+	}
+} // riscv
@@ -0,0 +1,48 @@
+#pragma once
+#include "types.hpp"
+
+namespace riscv
+{
+	template <int W> struct DecoderData;
+
+	// A shadow stack of return addresses, pushed by calls and popped by
+	// returns in the dispatch loops. Each entry remembers the decoder
+	// entry of the return address, so that a predicted return can begin
+	// the next block without looking it up. Entries are only valid for
+	// the execute segment they were pushed in, and a return must always
+	// compare its real target against the prediction.
+	template <int W>
+	struct ReturnStack
+	{
+		using address_t = address_type<W>;
+		static constexpr unsigned SIZE = 16;
+
+		void push(address_t pc, DecoderData<W>* entry) noexcept {
+			m_top = (m_top + 1) % SIZE;
+			m_stack[m_top] = { pc, entry };
+		}
+
+		// Returns the decoder entry of the predicted return address,
+		// or nullptr when the prediction does not match.
+		DecoderData<W>* pop(address_t pc) noexcept {
+			const auto& top = m_stack[m_top];
+			if (top.pc != pc || top.entry == nullptr)
+				return nullptr;
+			m_top = (m_top + SIZE - 1) % SIZE;
+			return top.entry;
+		}
+
+		void clear() noexcept {
+			for (auto& e : m_stack)
+				e = {};
+		}
+
+	private:
+		struct Entry {
+			address_t pc = 0;
+			DecoderData<W>* entry = nullptr;
+		};
+		Entry m_stack[SIZE] {};
+		unsigned m_top = 0;
+	};
+} // riscv
@@ -667,11 +667,15 @@ static inline uint64_t MUL128(
 					// division of -9223372036854775808 by -1 cannot be represented in type 'long'
 					if (LIKELY(!((int64_t)src1 == INT64_MIN && (int64_t)src2 == -1ll)))
 						dst = RVTOSIGNED(src1) / RVTOSIGNED(src2);
+					else
+						dst = src1; // Overflow: The quotient is the dividend
 				} else {
 					// rv32i_instr.cpp:301:2: runtime error:
 					// division of -2147483648 by -1 cannot be represented in type 'int'
 					if (LIKELY(!(src1 == 2147483648 && src2 == 4294967295)))
 						dst = RVTOSIGNED(src1) / RVTOSIGNED(src2);
+					else
+						dst = src1;
 				}
 			} else {
 				dst = (RVREGTYPE(cpu)) -1;
@@ -689,6 +693,8 @@ static inline uint64_t MUL128(
 				if constexpr(RVIS32BIT(cpu)) {
 					if (LIKELY(!(src1 == 2147483648 && src2 == 4294967295)))
 						dst = RVTOSIGNED(src1) % RVTOSIGNED(src2);
+					else
+						dst = 0; // Overflow: The remainder is zero
 				} else if constexpr (RVIS64BIT(cpu)) {
 					if (LIKELY(!((int64_t)src1 == INT64_MIN && (int64_t)src2 == -1ll)))
 						dst = RVTOSIGNED(src1) % RVTOSIGNED(src2);
@@ -1085,6 +1091,8 @@ static inline uint64_t MUL128(
 				// division of -2147483648 by -1 cannot be represented in type 'int'
 				if (LIKELY(!((int32_t)src1 == -2147483648 && (int32_t)src2 == -1))) {
 					dst = (int32_t) ((int32_t)src1 / (int32_t)src2);
+				} else {
+					dst = int32_t(src1); // Overflow: The quotient is the dividend
 				}
 			} else {
 				dst = (RVREGTYPE(cpu)) -1;
@@ -1101,6 +1109,8 @@ static inline uint64_t MUL128(
 			if (LIKELY(src2 != 0)) {
 				if (LIKELY(!((int32_t)src1 == -2147483648 && (int32_t)src2 == -1))) {
 					dst = (int32_t) ((int32_t)src1 % (int32_t)src2);
+				} else {
+					dst = 0; // Overflow: The remainder is zero
 				}
 			} else {
 				dst = int32_t(src1);
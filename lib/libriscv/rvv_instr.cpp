@@ -1,4 +1,5 @@
 #include "rvv.hpp"
+#include "rvv_kernels.hpp"
 #include "instr_helpers.hpp"
 
 namespace riscv
@@ -65,19 +66,37 @@ namespace riscv
 	{
 		const rv32v_instruction vi { instr };
 		const auto addr = cpu.reg(vi.VLS.rs1);
-		if (riscv::force_align_memory || addr % VectorLane::size() == 0) {
-			auto& rvv = cpu.registers().rvv();
-			rvv.get(vi.VLS.vd) = cpu.machine().memory.template read<VectorLane> (addr);
-		} else {
-			cpu.trigger_exception(INVALID_ALIGNMENT, addr);
+		auto& rvv = cpu.registers().rvv();
+		if (vi.VLS.mop == 0 && vi.VLS.vm) { // Unit-stride
+			if (riscv::force_align_memory || addr % VectorLane::size() == 0) {
+				rvv.get(vi.VLS.vd) = cpu.machine().memory.template read<VectorLane> (addr);
+			} else {
+				cpu.trigger_exception(INVALID_ALIGNMENT, addr);
+			}
+			return;
+		}
+		if (vi.VLS.mop != 0 && vi.VLS.mop != 2) // Indexed
+			cpu.trigger_exception(UNIMPLEMENTED_INSTRUCTION);
+		// Strided and masked loads, one element at a time
+		const auto stride = (vi.VLS.mop == 2) ? cpu.reg(vi.VLS.rs2) : 4;
+		auto& vd = rvv.u32(vi.VLS.vd);
+		for (size_t i = 0; i < vd.size(); i++) {
+			if (vi.VLS.vm || rvv::mask_bit(rvv.get(0), i))
+				vd[i] = cpu.machine().memory.template read<uint32_t> (addr + i * stride);
 		}
 	},
 	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) RVPRINTR_ATTR {
 		const rv32v_instruction vi { instr };
-		return snprintf(buffer, len, "VLE32.V %s, %s, %s",
+		if (vi.VLS.mop == 2)
+			return snprintf(buffer, len, "VLSE32.V %s, %s, %s%s",
+							RISCV::vecname(vi.VLS.vd),
+							RISCV::regname(vi.VLS.rs1),
+							RISCV::regname(vi.VLS.rs2),
+							vi.VLS.vm ? "" : ", v0.t");
+		return snprintf(buffer, len, "VLE32.V %s, %s%s",
 						RISCV::vecname(vi.VLS.vd),
 						RISCV::regname(vi.VLS.rs1),
-						RISCV::regname(vi.VLS.rs2));
+						vi.VLS.vm ? "" : ", v0.t");
 	});
 
 	VECTOR_INSTR(VSE32,
@@ -85,19 +104,37 @@ namespace riscv
 	{
 		const rv32v_instruction vi { instr };
 		const auto addr = cpu.reg(vi.VLS.rs1);
-		if (riscv::force_align_memory || addr % VectorLane::size() == 0) {
-			auto& rvv = cpu.registers().rvv();
-			cpu.machine().memory.template write<VectorLane> (addr, rvv.get(vi.VLS.vd));
-		} else {
-			cpu.trigger_exception(INVALID_ALIGNMENT, addr);
+		auto& rvv = cpu.registers().rvv();
+		if (vi.VLS.mop == 0 && vi.VLS.vm) { // Unit-stride
+			if (riscv::force_align_memory || addr % VectorLane::size() == 0) {
+				cpu.machine().memory.template write<VectorLane> (addr, rvv.get(vi.VLS.vd));
+			} else {
+				cpu.trigger_exception(INVALID_ALIGNMENT, addr);
+			}
+			return;
+		}
+		if (vi.VLS.mop != 0 && vi.VLS.mop != 2) // Indexed
+			cpu.trigger_exception(UNIMPLEMENTED_INSTRUCTION);
+		// Strided and masked stores, one element at a time
+		const auto stride = (vi.VLS.mop == 2) ? cpu.reg(vi.VLS.rs2) : 4;
+		const auto& vs3 = rvv.u32(vi.VLS.vd);
+		for (size_t i = 0; i < vs3.size(); i++) {
+			if (vi.VLS.vm || rvv::mask_bit(rvv.get(0), i))
+				cpu.machine().memory.template write<uint32_t> (addr + i * stride, vs3[i]);
 		}
 	},
 	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) RVPRINTR_ATTR {
 		const rv32v_instruction vi { instr };
-		return snprintf(buffer, len, "VSE32.V %s, %s, %s",
+		if (vi.VLS.mop == 2)
+			return snprintf(buffer, len, "VSSE32.V %s, %s, %s%s",
+							RISCV::vecname(vi.VLS.vd),
+							RISCV::regname(vi.VLS.rs1),
+							RISCV::regname(vi.VLS.rs2),
+							vi.VLS.vm ? "" : ", v0.t");
+		return snprintf(buffer, len, "VSE32.V %s, %s%s",
 						RISCV::vecname(vi.VLS.vd),
 						RISCV::regname(vi.VLS.rs1),
-						RISCV::regname(vi.VLS.rs2));
+						vi.VLS.vm ? "" : ", v0.t");
 	});
 
 	VECTOR_INSTR(VOPI_VV,
@@ -105,41 +142,42 @@ namespace riscv
 	{
 		const rv32v_instruction vi { instr };
 		auto& rvv = cpu.registers().rvv();
+		const auto& vs1 = rvv.get(vi.OPVV.vs1);
+		const auto& vs2 = rvv.get(vi.OPVV.vs2);
 		switch (vi.OPVV.funct6) {
 		case 0b000000: // VADD
-			for (size_t i = 0; i < rvv.u32(0).size(); i++) {
-				rvv.u32(vi.OPVV.vd)[i] = rvv.u32(vi.OPVV.vs1)[i] + rvv.u32(vi.OPVV.vs2)[i];
-			}
-			break;
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<uint32_t>(vs2, vs1, rvv::add));
+			return;
 		case 0b000010: // VSUB
-			for (size_t i = 0; i < rvv.u32(0).size(); i++) {
-				rvv.u32(vi.OPVV.vd)[i] = rvv.u32(vi.OPVV.vs1)[i] - rvv.u32(vi.OPVV.vs2)[i];
-			}
-			break;
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<uint32_t>(vs2, vs1, rvv::sub));
+			return;
 		case 0b001001: // VAND
-			for (size_t i = 0; i < rvv.u32(0).size(); i++) {
-				rvv.u32(vi.OPVV.vd)[i] = rvv.u32(vi.OPVV.vs1)[i] & rvv.u32(vi.OPVV.vs2)[i];
-			}
-			break;
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<uint32_t>(vs2, vs1, rvv::bit_and));
+			return;
 		case 0b001010: // VOR
-			for (size_t i = 0; i < rvv.u32(0).size(); i++) {
-				rvv.u32(vi.OPVV.vd)[i] = rvv.u32(vi.OPVV.vs1)[i] | rvv.u32(vi.OPVV.vs2)[i];
-			}
-			break;
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<uint32_t>(vs2, vs1, rvv::bit_or));
+			return;
 		case 0b001011: // VXOR
-			for (size_t i = 0; i < rvv.u32(0).size(); i++) {
-				rvv.u32(vi.OPVV.vd)[i] = rvv.u32(vi.OPVV.vs1)[i] ^ rvv.u32(vi.OPVV.vs2)[i];
-			}
-			break;
-		case 0b001100: // VRGATHER
-			for (size_t i = 0; i < rvv.u32(0).size(); i++) {
-				const auto vs1 = rvv.u32(vi.OPVV.vs1)[i];
-				rvv.u32(vi.OPVV.vd)[i] = (vs1 >= rvv.u32(0).size()) ? 0 : rvv.u32(vi.OPVV.vs2)[vs1];
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<uint32_t>(vs2, vs1, rvv::bit_xor));
+			return;
+		case 0b001100: { // VRGATHER
+			VectorLane result;
+			for (size_t i = 0; i < result.u32.size(); i++) {
+				const auto index = vs1.u32[i];
+				result.u32[i] = (index >= result.u32.size()) ? 0 : vs2.u32[index];
 			}
-			break;
-		default:
-			cpu.trigger_exception(UNIMPLEMENTED_INSTRUCTION);
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, result);
+			} return;
+		case 0b010111: // VMERGE.VVM
+			if (vi.OPVV.vm == 0) {
+				rvv.get(vi.OPVV.vd) = rvv::merge(rvv.get(0), vs1, vs2);
+				return;
+			} else if (vi.OPVV.vs2 == 0) { // VMV.V.V
+				rvv.get(vi.OPVV.vd) = vs1;
+				return;
+			} break;
 		}
+		cpu.trigger_exception(UNIMPLEMENTED_INSTRUCTION);
 	},
 	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) RVPRINTR_ATTR {
 		const rv32v_instruction vi { instr };
@@ -155,44 +193,42 @@ namespace riscv
 	{
 		const rv32v_instruction vi { instr };
 		auto& rvv = cpu.registers().rvv();
+		const auto& vs1 = rvv.get(vi.OPVV.vs1);
+		const auto& vs2 = rvv.get(vi.OPVV.vs2);
 		switch (vi.OPVV.funct6) {
 		case 0b000000: // VFADD.VV
-			for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-				rvv.f32(vi.OPVV.vd)[i] = rvv.f32(vi.OPVV.vs1)[i] + rvv.f32(vi.OPVV.vs2)[i];
-			}
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<float>(vs2, vs1, rvv::add));
 			return;
 		case 0b000001:   // VFREDUSUM
 		case 0b000011: { // VFREDOSUM
-			float sum = 0.0f;
-			for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-				sum += rvv.f32(vi.OPVV.vs1)[i] + rvv.f32(vi.OPVV.vs2)[i];
-			}
-			rvv.f32(vi.OPVV.vd)[0] = sum;
+			// Masked-off elements do not contribute to the sum
+			const auto& elements = vi.OPVV.vm ? vs2 : rvv::merge(rvv.get(0), vs2, VectorLane{});
+			if (vi.OPVV.funct6 == 0b000001)
+				rvv.f32(vi.OPVV.vd)[0] = vs1.f32[0] + rvv::reduce_sum<float>(elements);
+			else
+				rvv.f32(vi.OPVV.vd)[0] = rvv::reduce_ordered_sum<float>(elements, vs1.f32[0]);
 			} return;
 		case 0b010000: // VWUNARY0.VV
 			if (vi.OPVV.vs1 == 0b00000) { // VFMV.F.S
-				cpu.registers().getfl(vi.OPVV.vd).set_float(rvv.f32(vi.OPVV.vs2)[0]);
+				cpu.registers().getfl(vi.OPVV.vd).set_float(vs2.f32[0]);
 				return;
 			} break;
 		case 0b000010: // VFSUB.VV
-			for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-				rvv.f32(vi.OPVV.vd)[i] = rvv.f32(vi.OPVV.vs1)[i] - rvv.f32(vi.OPVV.vs2)[i];
-			}
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<float>(vs2, vs1, rvv::sub));
+			return;
+		case 0b100000: // VFDIV.VV
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<float>(vs2, vs1, rvv::div));
 			return;
 		case 0b100100: // VFMUL.VV
-			for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-				rvv.f32(vi.OPVV.vd)[i] = rvv.f32(vi.OPVV.vs1)[i] * rvv.f32(vi.OPVV.vs2)[i];
-			}
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<float>(vs2, vs1, rvv::mul));
 			return;
 		case 0b101000: // VFMADD.VV: Multiply-add (overwrites multiplicand)
-			for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-				rvv.f32(vi.OPVV.vd)[i] = (rvv.f32(vi.OPVV.vs1)[i] * rvv.f32(vi.OPVV.vd)[i]) + rvv.f32(vi.OPVV.vs2)[i];
-			}
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm,
+				rvv::lanewise<float>(vs1, rvv.get(vi.OPVV.vd), vs2, rvv::mul_add));
 			return;
 		case 0b101100: // VFMACC.VV: Multiply-accumulate (overwrites addend)
-			for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-				rvv.f32(vi.OPVV.vd)[i] = (rvv.f32(vi.OPVV.vs1)[i] * rvv.f32(vi.OPVV.vs2)[i]) + rvv.f32(vi.OPVV.vd)[i];
-			}
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm,
+				rvv::lanewise<float>(vs1, vs2, rvv.get(vi.OPVV.vd), rvv::mul_add));
 			return;
 		}
 		cpu.trigger_exception(UNIMPLEMENTED_INSTRUCTION);
@@ -210,6 +246,40 @@ namespace riscv
 	[] (auto& cpu, rv32i_instruction instr) RVINSTR_ATTR
 	{
 		const rv32v_instruction vi { instr };
+		auto& rvv = cpu.registers().rvv();
+		const auto& vs1 = rvv.get(vi.OPVV.vs1);
+		const auto& vs2 = rvv.get(vi.OPVV.vs2);
+		if (vi.OPVV.funct6 < 0b001000) { // Integer reductions
+			// Masked-off elements are replaced by the identity of the operation
+			const uint32_t identity = (vi.OPVV.funct6 == 0b000001 || vi.OPVV.funct6 == 0b000100) ? ~0u : 0u;
+			const auto& elements = vi.OPVV.vm ? vs2 : rvv::merge(rvv.get(0), vs2, rvv::splat<uint32_t>(identity));
+			auto& dst = rvv.u32(vi.OPVV.vd)[0];
+			switch (vi.OPVV.funct6) {
+			case 0b000000: // VREDSUM
+				dst = vs1.u32[0] + rvv::reduce_sum<uint32_t>(elements);
+				return;
+			case 0b000001: // VREDAND
+				dst = rvv::reduce<uint32_t>(elements, vs1.u32[0], rvv::bit_and);
+				return;
+			case 0b000010: // VREDOR
+				dst = rvv::reduce<uint32_t>(elements, vs1.u32[0], rvv::bit_or);
+				return;
+			case 0b000011: // VREDXOR
+				dst = rvv::reduce<uint32_t>(elements, vs1.u32[0], rvv::bit_xor);
+				return;
+			case 0b000100: // VREDMINU
+				dst = rvv::reduce<uint32_t>(elements, vs1.u32[0],
+					[] (uint32_t a, uint32_t b) { return a < b ? a : b; });
+				return;
+			case 0b000110: // VREDMAXU
+				dst = rvv::reduce<uint32_t>(elements, vs1.u32[0],
+					[] (uint32_t a, uint32_t b) { return a > b ? a : b; });
+				return;
+			}
+		} else if (vi.OPVV.funct6 == 0b100101) { // VMUL
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<uint32_t>(vs2, vs1, rvv::mul));
+			return;
+		}
 		cpu.trigger_exception(UNIMPLEMENTED_INSTRUCTION);
 	},
 	[] (char* buffer, size_t len, auto&, rv32i_instruction instr) RVPRINTR_ATTR {
@@ -225,13 +295,19 @@ namespace riscv
 	{
 		const rv32v_instruction vi { instr };
 		auto& rvv = cpu.registers().rvv();
-		const uint32_t scalar = vi.OPVI.imm;
+		// The 5-bit immediate is sign-extended
+		const uint32_t scalar = int32_t(vi.OPVI.imm << 27) >> 27;
 		switch (vi.OPVV.funct6) {
-		case 0b010111: // VMERGE.VI
-			if (vi.OPVI.vs2 == 0) {
-				for (size_t i = 0; i < rvv.u32(0).size(); i++) {
-					rvv.u32(vi.OPVI.vd)[i] = scalar;
-				}
+		case 0b000000: // VADD.VI
+			rvv::write(rvv, vi.OPVI.vd, vi.OPVI.vm,
+				rvv::lanewise_scalar<uint32_t>(rvv.get(vi.OPVI.vs2), scalar, rvv::add));
+			return;
+		case 0b010111: // VMERGE.VIM
+			if (vi.OPVI.vm == 0) {
+				rvv.get(vi.OPVI.vd) = rvv::merge(rvv.get(0), rvv::splat<uint32_t>(scalar), rvv.get(vi.OPVI.vs2));
+				return;
+			} else if (vi.OPVI.vs2 == 0) { // VMV.V.I
+				rvv.get(vi.OPVI.vd) = rvv::splat<uint32_t>(scalar);
 				return;
 			}
 		}
@@ -253,11 +329,10 @@ namespace riscv
 		auto& rvv = cpu.registers().rvv();
 		const float scalar = cpu.registers().getfl(vi.OPVV.vs1).f32[0];
 		const auto vector = vi.OPVV.vs2;
+		const auto& vs2 = rvv.get(vector);
 		switch (vi.OPVV.funct6) {
 		case 0b000000: // VFADD.VF
-			for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-				rvv.f32(vi.OPVV.vd)[i] = rvv.f32(vector)[i] + scalar;
-			}
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise_scalar<float>(vs2, scalar, rvv::add));
 			return;
 		case 0b000001:   // VFREDUSUM.VF
 		case 0b000011: { // VFREDOSUM.VF
@@ -268,9 +343,7 @@ namespace riscv
 			rvv.f32(vi.OPVV.vd)[0] = sum;
 			} return;
 		case 0b000010: // VFSUB.VF
-			for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-				rvv.f32(vi.OPVV.vd)[i] = rvv.f32(vector)[i] - scalar;
-			}
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise_scalar<float>(vs2, scalar, rvv::sub));
 			return;
 		case 0b010000: // VRFUNARY0.VF
 			if (vector == 0) { // VFMV.S.F
@@ -279,10 +352,35 @@ namespace riscv
 				}
 				return;
 			} break;
+		case 0b010111: // VFMERGE.VFM
+			if (vi.OPVV.vm == 0) {
+				rvv.get(vi.OPVV.vd) = rvv::merge(rvv.get(0), rvv::splat<float>(scalar), vs2);
+				return;
+			} else if (vector == 0) { // VFMV.V.F
+				rvv.get(vi.OPVV.vd) = rvv::splat<float>(scalar);
+				return;
+			} break;
+		case 0b100000: // VFDIV.VF
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise_scalar<float>(vs2, scalar, rvv::div));
+			return;
+		case 0b100001: // VFRDIV.VF
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise_scalar<float>(vs2, scalar,
+				[] (auto a, auto b) { return b / a; }));
+			return;
 		case 0b100100: // VFMUL.VF
-			for (size_t i = 0; i < rvv.f32(0).size(); i++) {
-				rvv.f32(vi.OPVV.vd)[i] = rvv.f32(vector)[i] * scalar;
-			}
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise_scalar<float>(vs2, scalar, rvv::mul));
+			return;
+		case 0b100111: // VFRSUB.VF
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise_scalar<float>(vs2, scalar,
+				[] (auto a, auto b) { return b - a; }));
+			return;
+		case 0b101000: // VFMADD.VF: Multiply-add (overwrites multiplicand)
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm, rvv::lanewise<float>(rvv.get(vi.OPVV.vd), vs2,
+				rvv::splat<float>(scalar), [] (auto vd, auto vs2, auto f) { return f * vd + vs2; }));
+			return;
+		case 0b101100: // VFMACC.VF: Multiply-accumulate (overwrites addend)
+			rvv::write(rvv, vi.OPVV.vd, vi.OPVV.vm,
+				rvv::lanewise<float>(rvv::splat<float>(scalar), vs2, rvv.get(vi.OPVV.vd), rvv::mul_add));
 			return;
 		}
 		cpu.trigger_exception(UNIMPLEMENTED_INSTRUCTION);
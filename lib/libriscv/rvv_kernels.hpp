@@ -0,0 +1,183 @@
+#pragma once
+#include "common.hpp"
+#include "rvv_registers.hpp"
+#include <cstring>
+
+// Host kernels for the vector extension. Each kernel operates on whole
+// vector registers. With GCC and Clang the lanes are host vectors, which
+// the compiler lowers to the SIMD instructions of the build target
+// (SSE2 on any x86-64, AVX2 with -mavx2, NEON on AArch64). Elsewhere the
+// same operations fall back to loops over the lanes.
+#if defined(__GNUC__) || defined(__clang__)
+#define RISCV_VECTOR_KERNELS_SIMD
+#endif
+
+namespace riscv::rvv
+{
+	static constexpr unsigned VSIZE = VectorLane::VSIZE;
+
+	template <typename T> inline auto& lanes(VectorLane& v) noexcept;
+	template <> inline auto& lanes<uint32_t>(VectorLane& v) noexcept { return v.u32; }
+	template <> inline auto& lanes<float>(VectorLane& v) noexcept { return v.f32; }
+	template <typename T> inline const auto& lanes(const VectorLane& v) noexcept {
+		return lanes<T>(const_cast<VectorLane&>(v));
+	}
+
+	// Masked instructions are controlled by one bit per element in v0
+	inline bool mask_bit(const VectorLane& v0, unsigned i) noexcept {
+		return (v0.u8[i / 8] >> (i % 8)) & 1;
+	}
+
+	// Element operations, usable on both host vectors and scalars
+	static constexpr auto add = [] (auto a, auto b) { return a + b; };
+	static constexpr auto sub = [] (auto a, auto b) { return a - b; };
+	static constexpr auto mul = [] (auto a, auto b) { return a * b; };
+	static constexpr auto div = [] (auto a, auto b) { return a / b; };
+	static constexpr auto bit_and = [] (auto a, auto b) { return a & b; };
+	static constexpr auto bit_or  = [] (auto a, auto b) { return a | b; };
+	static constexpr auto bit_xor = [] (auto a, auto b) { return a ^ b; };
+	static constexpr auto mul_add = [] (auto a, auto b, auto c) { return a * b + c; };
+
+#ifdef RISCV_VECTOR_KERNELS_SIMD
+	// 16-byte host vectors are SIMD registers on every common target
+	// without changing the calling convention. Vector registers are
+	// processed as a sequence of them.
+	static constexpr unsigned HSIZE = 16;
+	static_assert(VSIZE % HSIZE == 0, "Vector registers must be a multiple of 16 bytes");
+	template <typename T> struct host_vector;
+	template <> struct host_vector<uint32_t> {
+		typedef uint32_t type __attribute__((vector_size(HSIZE)));
+	};
+	template <> struct host_vector<float> {
+		typedef float type __attribute__((vector_size(HSIZE)));
+	};
+
+	template <typename T>
+	RISCV_ALWAYS_INLINE inline typename host_vector<T>::type load(const VectorLane& lane, unsigned offset) noexcept {
+		typename host_vector<T>::type v;
+		std::memcpy(&v, &lane.u8[offset], sizeof(v));
+		return v;
+	}
+	template <typename V>
+	RISCV_ALWAYS_INLINE inline void store(VectorLane& lane, unsigned offset, const V& v) noexcept {
+		std::memcpy(&lane.u8[offset], &v, sizeof(v));
+	}
+#endif
+
+	/// @brief Apply op to every element of a and b.
+	template <typename T, typename Op>
+	RISCV_ALWAYS_INLINE inline VectorLane lanewise(const VectorLane& a, const VectorLane& b, Op op) noexcept
+	{
+		VectorLane result;
+#ifdef RISCV_VECTOR_KERNELS_SIMD
+		for (unsigned i = 0; i < VSIZE; i += HSIZE)
+			store(result, i, op(load<T>(a, i), load<T>(b, i)));
+#else
+		for (size_t i = 0; i < lanes<T>(a).size(); i++)
+			lanes<T>(result)[i] = op(lanes<T>(a)[i], lanes<T>(b)[i]);
+#endif
+		return result;
+	}
+
+	/// @brief Apply op to every element of a, b and c.
+	template <typename T, typename Op>
+	RISCV_ALWAYS_INLINE inline VectorLane lanewise(const VectorLane& a, const VectorLane& b, const VectorLane& c, Op op) noexcept
+	{
+		VectorLane result;
+#ifdef RISCV_VECTOR_KERNELS_SIMD
+		for (unsigned i = 0; i < VSIZE; i += HSIZE)
+			store(result, i, op(load<T>(a, i), load<T>(b, i), load<T>(c, i)));
+#else
+		for (size_t i = 0; i < lanes<T>(a).size(); i++)
+			lanes<T>(result)[i] = op(lanes<T>(a)[i], lanes<T>(b)[i], lanes<T>(c)[i]);
+#endif
+		return result;
+	}
+
+	/// @brief Apply op to every element of a and a scalar.
+	template <typename T, typename Op>
+	RISCV_ALWAYS_INLINE inline VectorLane lanewise_scalar(const VectorLane& a, T scalar, Op op) noexcept
+	{
+		VectorLane result;
+#ifdef RISCV_VECTOR_KERNELS_SIMD
+		// Subtracting +0 (instead of adding it) preserves the sign of -0.0
+		const typename host_vector<T>::type splat = scalar - typename host_vector<T>::type{};
+		for (unsigned i = 0; i < VSIZE; i += HSIZE)
+			store(result, i, op(load<T>(a, i), splat));
+#else
+		for (size_t i = 0; i < lanes<T>(a).size(); i++)
+			lanes<T>(result)[i] = op(lanes<T>(a)[i], scalar);
+#endif
+		return result;
+	}
+
+	template <typename T>
+	RISCV_ALWAYS_INLINE inline VectorLane splat(T scalar) noexcept
+	{
+		VectorLane result;
+		for (auto& lane : lanes<T>(result))
+			lane = scalar;
+		return result;
+	}
+
+	/// @brief Select elements from active where the mask bit in v0 is set,
+	/// and from inactive where it is clear. Works on 32-bit elements.
+	RISCV_ALWAYS_INLINE inline VectorLane merge(const VectorLane& v0, const VectorLane& active, const VectorLane& inactive) noexcept
+	{
+		VectorLane result;
+#ifdef RISCV_VECTOR_KERNELS_SIMD
+		using V = host_vector<uint32_t>::type;
+		static constexpr unsigned N = HSIZE / 4; // Elements per host vector
+		const V index { 0, 1, 2, 3 };
+		for (unsigned i = 0; i < VSIZE; i += HSIZE) {
+			const uint32_t bits = v0.u8[i / HSIZE / 2] >> (i / HSIZE % 2 * N);
+			const V mask = (V)(((bits - V{}) >> index & 1) != 0);
+			store(result, i, (load<uint32_t>(active, i) & mask) | (load<uint32_t>(inactive, i) & ~mask));
+		}
+#else
+		for (size_t i = 0; i < result.u32.size(); i++)
+			result.u32[i] = mask_bit(v0, i) ? active.u32[i] : inactive.u32[i];
+#endif
+		return result;
+	}
+
+	/// @brief Write a result to vd, leaving masked-off elements undisturbed
+	/// when the instruction is masked (vm = 0).
+	template <typename Registers>
+	RISCV_ALWAYS_INLINE inline void write(Registers& rvv, unsigned vd, bool vm, const VectorLane& result) noexcept
+	{
+		if (vm)
+			rvv.get(vd) = result;
+		else
+			rvv.get(vd) = merge(rvv.get(0), result, rvv.get(vd));
+	}
+
+	/// @brief Unordered sum of all elements, added pairwise.
+	template <typename T>
+	inline T reduce_sum(const VectorLane& v) noexcept
+	{
+		auto tmp = lanes<T>(v);
+		for (size_t width = tmp.size() / 2; width > 0; width /= 2)
+			for (size_t i = 0; i < width; i++)
+				tmp[i] += tmp[i + width];
+		return tmp[0];
+	}
+
+	/// @brief Ordered sum of all elements, starting with init.
+	template <typename T>
+	inline T reduce_ordered_sum(const VectorLane& v, T init) noexcept
+	{
+		for (const auto lane : lanes<T>(v))
+			init += lane;
+		return init;
+	}
+
+	template <typename T, typename Op>
+	inline T reduce(const VectorLane& v, T init, Op op) noexcept
+	{
+		for (const auto lane : lanes<T>(v))
+			init = op(init, lane);
+		return init;
+	}
+
+} // riscv::rvv
@@ -204,6 +204,8 @@ namespace riscv
 						page.addr,
 						new_attr, &this->m_arena.data[page.addr]
 					);
+					if (!result.second)
+						throw MachineException(INVALID_PROGRAM, "Serialized machine state has a duplicate page", page.addr);
 					new_page = &result.first->second;
 				}
 				else
@@ -213,18 +215,24 @@ namespace riscv
 						page.addr,
 						new_attr, PageData::UNINITIALIZED
 					);
+					if (!result.second)
+						throw MachineException(INVALID_PROGRAM, "Serialized machine state has a duplicate page", page.addr);
 					new_page = &result.first->second;
 				}
+				this->page_counter(*new_page)++;
 				// Copy unaligned data into new PageData
 				const auto* data = &vec[off];
 				std::copy(data, data + sizeof(PageData), new_page->data());
 				off += sizeof(PageData);
 			} else {
 				// Pages without data
-				m_pages.try_emplace(
+				const auto result = m_pages.try_emplace(
 					page.addr,
 					new_attr, Page::cow_page().m_page.get()
 				);
+				if (!result.second)
+					throw MachineException(INVALID_PROGRAM, "Serialized machine state has a duplicate page", page.addr);
+				this->page_counter(result.first->second)++;
 			}
 		}
 		// page tables have been changed
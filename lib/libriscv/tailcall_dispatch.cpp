@@ -10,6 +10,7 @@
 #endif
 #ifdef RISCV_EXT_VECTOR
 #include "rvv.hpp"
+#include "rvv_kernels.hpp"
 #endif
 
 #define MUSTTAIL __attribute__((musttail))
@@ -36,6 +37,9 @@
 #define NEXT_C_INSTR() \
 	d += 1;            \
 	EXECUTE_CURRENT()
+// Step into the second half of a superinstruction
+#define ADVANCE_INSTR() \
+	d += (compressed_enabled ? 2 : 1);
 
 #define RETURN_VALUES()   \
 	{pc}
@@ -60,8 +64,27 @@
 	if (UNLIKELY(!(pc >= exec->exec_begin() && pc < exec->exec_end()))) \
 		MUSTTAIL return next_execute_segment(d, exec, cpu, pc, counter);
 
+#ifdef RISCV_BINARY_TRANSLATION
+// Tiered execution: Count entries into jump and loop targets.
+// Whether the segment is counting is read once per dispatch entry,
+// and carried by the counter, as handlers share no other state.
+#define COUNT_HOT_BLOCK(addr)                                                        \
+	if (UNLIKELY(counter.is_counting_hot_blocks()) && exec->count_hot_block(addr)) { \
+		cpu.promote_hot_segment(addr);                                               \
+		counter.set_counting_hot_blocks(exec->is_counting_hot_blocks());             \
+	}
+// Profiling: Count the outcome of the conditional branch at pc
+#define COUNT_BRANCH(taken)                          \
+	if (UNLIKELY(counter.is_counting_hot_blocks()))  \
+		exec->count_branch(pc, taken);
+#else
+#define COUNT_HOT_BLOCK(addr) /* */
+#define COUNT_BRANCH(taken) /* */
+#endif
+
 #define UNCHECKED_JUMP()                                       \
 	QUICK_EXEC_CHECK()                                         \
+	COUNT_HOT_BLOCK(pc)                                        \
 	d = &exec->decoder_cache()[pc >> DecoderCache<W>::SHIFT];  \
 	BEGIN_BLOCK()                                              \
 	EXECUTE_CURRENT()
@@ -74,6 +97,7 @@
 		printf("Branch from 0x%lX to 0x%lX\n", \
 			pc, pc + fi.signed_imm());  \
 	}                                   \
+	COUNT_HOT_BLOCK(pc + fi.signed_imm()) \
 	pc += fi.signed_imm();              \
 	d += fi.signed_imm() >> DecoderCache<W>::SHIFT; \
 	OVERFLOW_CHECK()                    \
@@ -90,6 +114,9 @@
 #define OVERFLOW_CHECKED_JUMP() \
 	OVERFLOW_CHECK(); \
 	UNCHECKED_JUMP();
+// The handlers do not share any state for a return-address stack
+#define PUSH_RETURN_ADDRESS(len) /* */
+#define POP_RETURN_ADDRESS() /* */
 
 
 namespace riscv
@@ -102,12 +129,17 @@ namespace riscv
 #endif
 
 	template <int W> static inline
-	DecodedExecuteSegment<W>* resolve_execute_segment(CPU<W>& cpu, address_type<W>& pc)
+	DecodedExecuteSegment<W>* resolve_execute_segment(CPU<W>& cpu, address_type<W>& pc, InstrCounter& counter)
 	{
 		// Change execute segment
 		auto results = cpu.next_execute_segment(pc);
 		// Restore PC
 		pc = results.pc;
+#ifdef RISCV_BINARY_TRANSLATION
+		counter.set_counting_hot_blocks(results.exec->is_counting_hot_blocks());
+#else
+		(void)counter;
+#endif
 		return results.exec;
 	}
 
@@ -167,6 +199,9 @@ namespace riscv
 		counter.set_counters(new_values.counter, new_values.max_counter);
 		pc = REGISTERS().pc;
 		OVERFLOW_CHECK();
+		// A system call may have changed the execute segment, eg. by evicting it
+		if (UNLIKELY(exec != &cpu.current_execute_segment()))
+			MUSTTAIL return next_execute_segment(d, exec, cpu, pc, counter);
 		UNCHECKED_JUMP();
 	}
 #endif
@@ -193,7 +228,7 @@ namespace riscv
 
 	INSTRUCTION(RV32I_BC_NOP, next_execute_segment) {
 		// A helper function to change execute segment
-		exec = resolve_execute_segment<W>(cpu, pc);
+		exec = resolve_execute_segment<W>(cpu, pc, counter);
 		d = &exec->decoder_cache()[pc >> DecoderCache<W>::SHIFT];
 		BEGIN_BLOCK();
 		EXECUTE_CURRENT();
@@ -203,6 +238,11 @@ namespace riscv
 	{
 		// Calculate the current PC (mid block)
 		pc = (d - exec->decoder_cache()) << DecoderCache<W>::SHIFT;
+		// Lazily decoded pages are decoded when first entered
+		if (exec->is_lazily_decoded() && exec->decode_lazy_page(pc)) {
+			counter.increment_counter(-1);
+			NEXT_BLOCK(0, false);
+		}
 		// Check if the instruction is still invalid
 		bool stale = false;
 		try {
@@ -212,7 +252,7 @@ namespace riscv
 			}
 		} catch (...) {}
 		if (stale) {
-			exec = resolve_execute_segment<W>(cpu, pc);
+			exec = resolve_execute_segment<W>(cpu, pc, counter);
 			d = &exec->decoder_cache()[pc >> DecoderCache<W>::SHIFT];
 			NEXT_BLOCK(0, true);
 		}
@@ -270,6 +310,11 @@ namespace riscv
 		[RV32I_BC_FAST_JAL] = rv32i_fast_jal,
 		[RV32I_BC_FAST_CALL] = rv32i_fast_call,
 
+		[RV32I_BC_LUI_ADDI]   = rv32i_lui_addi,
+		[RV32I_BC_AUIPC_ADDI] = rv32i_auipc_addi,
+		[RV32I_BC_AUIPC_JALR] = rv32i_auipc_jalr,
+		[RV32I_BC_ADDI_BNE]   = rv32i_addi_bne,
+
 		[RV32I_BC_OP_ADD]  = rv32i_op_add,
 		[RV32I_BC_OP_SUB]  = rv32i_op_sub,
 		[RV32I_BC_OP_SLL]  = rv32i_op_sll,
@@ -347,6 +392,11 @@ namespace riscv
 		[RV32V_BC_VSE32]   = rv32v_vse32,
 		[RV32V_BC_VFADD_VV] = rv32v_vfadd_vv,
 		[RV32V_BC_VFMUL_VF] = rv32v_vfmul_vf,
+		[RV32V_BC_VADD_VV]  = rv32v_vadd_vv,
+		[RV32V_BC_VFMUL_VV] = rv32v_vfmul_vv,
+		[RV32V_BC_VFMACC_VV] = rv32v_vfmacc_vv,
+		[RV32V_BC_VFMACC_VF] = rv32v_vfmacc_vf,
+		[RV32V_BC_VFREDUSUM_VS] = rv32v_vfredusum_vs,
 #endif
 		[RV32I_BC_FUNCTION] = execute_decoded_function,
 		[RV32I_BC_FUNCBLOCK] = execute_function_block,
@@ -372,6 +422,9 @@ namespace riscv
 			exec = results.exec;
 			pc   = results.pc;
 		}
+#ifdef RISCV_BINARY_TRANSLATION
+		counter.set_counting_hot_blocks(exec->is_counting_hot_blocks());
+#endif
 
 		DecoderData<W>* exec_decoder = exec->decoder_cache();
 		auto* d = &exec_decoder[pc >> DecoderCache<W>::SHIFT];
@@ -384,6 +437,15 @@ namespace riscv
 		cpu.registers().pc = new_pc;
 		MACHINE().set_instruction_counter(counter.value());
 
+#if defined(RISCV_BINARY_TRANSLATION) && (defined(RISCV_LIBTCC) || defined(RISCV_JIT))
+		// In-process translations report exceptions through the CPU
+		if (UNLIKELY(cpu.has_current_exception())) {
+			const auto except = cpu.current_exception();
+			cpu.clear_current_exception();
+			std::rethrow_exception(except);
+		}
+#endif
+
 		// Machine stopped normally?
 		return counter.max() == 0;
 
@@ -403,6 +465,9 @@ namespace riscv
 			exec = results.exec;
 			pc   = results.pc;
 		}
+#ifdef RISCV_BINARY_TRANSLATION
+		counter.set_counting_hot_blocks(exec->is_counting_hot_blocks());
+#endif
 
 		DecoderData<W>* exec_decoder = exec->decoder_cache();
 		auto* d = &exec_decoder[pc >> DecoderCache<W>::SHIFT];
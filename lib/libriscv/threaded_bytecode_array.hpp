@@ -44,6 +44,11 @@ static constexpr void *computed_opcode[] = {
 	[RV32I_BC_FAST_JAL] = &&rv32i_fast_jal,
 	[RV32I_BC_FAST_CALL] = &&rv32i_fast_call,
 
+	[RV32I_BC_LUI_ADDI] = &&rv32i_lui_addi,
+	[RV32I_BC_AUIPC_ADDI] = &&rv32i_auipc_addi,
+	[RV32I_BC_AUIPC_JALR] = &&rv32i_auipc_jalr,
+	[RV32I_BC_ADDI_BNE] = &&rv32i_addi_bne,
+
 	[RV32I_BC_OP_ADD] = &&rv32i_op_add,
 	[RV32I_BC_OP_SUB] = &&rv32i_op_sub,
 	[RV32I_BC_OP_SLL] = &&rv32i_op_sll,
@@ -121,6 +126,11 @@ static constexpr void *computed_opcode[] = {
 	[RV32V_BC_VSE32] = &&rv32v_vse32,
 	[RV32V_BC_VFADD_VV] = &&rv32v_vfadd_vv,
 	[RV32V_BC_VFMUL_VF] = &&rv32v_vfmul_vf,
+	[RV32V_BC_VADD_VV] = &&rv32v_vadd_vv,
+	[RV32V_BC_VFMUL_VV] = &&rv32v_vfmul_vv,
+	[RV32V_BC_VFMACC_VV] = &&rv32v_vfmacc_vv,
+	[RV32V_BC_VFMACC_VF] = &&rv32v_vfmacc_vf,
+	[RV32V_BC_VFREDUSUM_VS] = &&rv32v_vfredusum_vs,
 #endif
 	[RV32I_BC_FUNCTION]  = &&execute_decoded_function,
 	[RV32I_BC_FUNCBLOCK] = &&execute_function_block,
@@ -53,6 +53,11 @@ namespace riscv
 		RV32I_BC_FAST_JAL,
 		RV32I_BC_FAST_CALL,
 
+		RV32I_BC_LUI_ADDI,
+		RV32I_BC_AUIPC_ADDI,
+		RV32I_BC_AUIPC_JALR,
+		RV32I_BC_ADDI_BNE,
+
 		RV32I_BC_OP_ADD,
 		RV32I_BC_OP_SUB,
 		RV32I_BC_OP_SLL,
@@ -130,6 +135,11 @@ namespace riscv
 		RV32V_BC_VSE32,
 		RV32V_BC_VFADD_VV,
 		RV32V_BC_VFMUL_VF,
+		RV32V_BC_VADD_VV,
+		RV32V_BC_VFMUL_VV,
+		RV32V_BC_VFMACC_VV,
+		RV32V_BC_VFMACC_VF,
+		RV32V_BC_VFREDUSUM_VS,
 #endif
 		RV32I_BC_FUNCTION,
 		RV32I_BC_FUNCBLOCK,
@@ -142,6 +152,37 @@ namespace riscv
 	};
 	static_assert(BYTECODES_MAX <= 256, "A bytecode must fit in a byte");
 
+	// Superinstructions fuse two adjacent bytecodes in the same block.
+	// The fused entry keeps the (rewritten) operands of the first
+	// instruction and reads the operands of the second instruction
+	// from the next decoder entry, which is left untouched so that
+	// it remains a valid jump target. The first instruction is always
+	// a full-length instruction.
+	struct Superinstruction
+	{
+		uint8_t first;
+		uint8_t second;
+		uint8_t fused;
+	};
+	static constexpr Superinstruction superinstructions[] = {
+		{ RV32I_BC_LUI,   RV32I_BC_ADDI,   RV32I_BC_LUI_ADDI },   // li rd, imm32
+		{ RV32I_BC_AUIPC, RV32I_BC_ADDI,   RV32I_BC_AUIPC_ADDI }, // la rd, symbol
+		{ RV32I_BC_AUIPC, RV32I_BC_JALR,   RV32I_BC_AUIPC_JALR }, // call/tail symbol
+		{ RV32I_BC_ADDI,  RV32I_BC_BNE,    RV32I_BC_ADDI_BNE },   // loop tail
+		{ RV32I_BC_ADDI,  RV32I_BC_BNE_FW, RV32I_BC_ADDI_BNE },
+	};
+
+	// Returns the original bytecode of the first instruction
+	// in a superinstruction, or the bytecode itself if not fused.
+	inline constexpr uint8_t superinstruction_first(uint8_t bytecode) noexcept
+	{
+		for (const auto& si : superinstructions) {
+			if (si.fused == bytecode)
+				return si.first;
+		}
+		return bytecode;
+	}
+
 	union FasterItype
 	{
 		uint32_t whole;
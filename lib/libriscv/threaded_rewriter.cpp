@@ -315,7 +315,12 @@ namespace riscv
 				return bytecode;
 			}
 			case RV32V_BC_VFADD_VV:
-			case RV32V_BC_VFMUL_VF: {
+			case RV32V_BC_VFMUL_VF:
+			case RV32V_BC_VADD_VV:
+			case RV32V_BC_VFMUL_VV:
+			case RV32V_BC_VFMACC_VV:
+			case RV32V_BC_VFMACC_VF:
+			case RV32V_BC_VFREDUSUM_VS: {
 				const rv32v_instruction vi{instr};
 				FasterOpType rewritten;
 				rewritten.rd  = vi.OPVV.vd;
@@ -46,6 +46,7 @@ namespace riscv {
 
 #ifdef __TINYC__
 #define UNREACHABLE() /**/
+#define COLD_FUNC /**/
 static inline float fminf(float x, float y) {
 	return (x < y) ? x : y;
 }
@@ -72,6 +73,7 @@ static inline float fmax(double x, double y) {
 #define do_cpopl(x) api.cpopl(x)
 #else
 #define UNREACHABLE() __builtin_unreachable()
+#define COLD_FUNC __attribute__((cold))
 #define do_bswap32(x) __builtin_bswap32(x)
 #define do_bswap64(x) __builtin_bswap64(x)
 #define do_clz(x) __builtin_clz(x)
@@ -151,7 +153,7 @@ typedef struct {
 typedef void (*syscall_t) (CPU*);
 typedef void (*handler) (CPU*, uint32_t);
 
-static struct CallbackTable {
+struct CallbackTable {
 	addr_t (*mem_ld) (const CPU*, addr_t, unsigned);
 	void (*mem_st) (const CPU*, addr_t, addr_t, unsigned);
 	void (*vec_load)(const CPU*, int, addr_t);
@@ -173,9 +175,32 @@ static struct CallbackTable {
 	int (*ctzl) (uint64_t);
 	int (*cpop) (uint32_t);
 	int (*cpopl) (uint64_t);
-} api;
+};
+// Translations compiled in several parts share one callback table, and
+// call each other's block functions. The first part owns the table.
+#if defined(RISCV_TRANSLATION_SHARD)
+#  if RISCV_TRANSLATION_SHARD == 0
+INTERNAL struct CallbackTable api;
+#  else
+extern INTERNAL struct CallbackTable api;
+#  endif
+#  define BLOCK_FUNC INTERNAL
+#else
+static struct CallbackTable api;
+#  define BLOCK_FUNC static
+#endif
 #define INS_COUNTER(cpu) (*(uint64_t *)((uintptr_t)cpu + RISCV_INS_COUNTER_OFF))
 #define MAX_COUNTER(cpu) (*(uint64_t *)((uintptr_t)cpu + RISCV_MAX_COUNTER_OFF))
+#define EXEC_SEGMENT(cpu) (*(const void **)((uintptr_t)cpu + RISCV_EXEC_SEGMENT_OFF))
+#define DECODER_PATCHED(exec) (*(const volatile char *)((uintptr_t)exec + RISCV_DECODER_PATCHED_OFF))
+// With block chaining, blocks tail-call the blocks of statically known
+// successors. Only an optimizing compiler turns these calls into jumps,
+// and embeddable code is not chained.
+#if defined(RISCV_BLOCK_CHAINING) && defined(__OPTIMIZE__) && !defined(__TINYC__) && !defined(EMBEDDABLE_CODE)
+#define CHAIN_DIRECT(cpu) (!DECODER_PATCHED(EXEC_SEGMENT(cpu)))
+#else
+#define CHAIN_DIRECT(cpu) 0
+#endif
 #define ARENA_READ_BOUNDARY  (RISCV_ARENA_END - 0x1000)
 #define ARENA_WRITE_BOUNDARY (RISCV_ARENA_END - RISCV_ARENA_ROEND)
 #define ARENA_READABLE(x) ((x) - 0x1000 < ARENA_READ_BOUNDARY)
@@ -193,12 +218,13 @@ static inline int do_syscall(CPU* cpu, uint64_t counter, uint64_t max_counter, a
 	return api.system_call(cpu, sysno);
 #else
 	addr_t old_pc = cpu->pc;
+	const void* old_exec = EXEC_SEGMENT(cpu);
 	if (LIKELY(sysno < RISCV_MAX_SYSCALLS))
 		api.syscalls[SPECSAFE(sysno)](cpu);
 	else
 		api.unknown_syscall(cpu, sysno);
-	// Resume if the system call did not modify PC, or hit a limit
-	return (cpu->pc != old_pc || counter >= MAX_COUNTER(cpu));
+	// Resume if the system call did not modify PC or the execute segment, or hit a limit
+	return (cpu->pc != old_pc || counter >= MAX_COUNTER(cpu) || EXEC_SEGMENT(cpu) != old_exec);
 #endif
 }
 
@@ -227,7 +253,26 @@ static inline uint64_t MUL128(
 	return (middle << 32) | (uint32_t)p00;
 }
 
-#ifndef EMBEDDABLE_CODE
+// Signed high parts, derived from the unsigned product
+static inline void MULH128(
+	uint64_t* r_hi,
+	const uint64_t x,
+	const uint64_t y)
+{
+	MUL128(r_hi, x, y);
+	*r_hi -= ((int64_t)x < 0) ? y : 0;
+	*r_hi -= ((int64_t)y < 0) ? x : 0;
+}
+static inline void MULHSU128(
+	uint64_t* r_hi,
+	const uint64_t x,
+	const uint64_t y)
+{
+	MUL128(r_hi, x, y);
+	*r_hi -= ((int64_t)x < 0) ? y : 0;
+}
+
+#if !defined(EMBEDDABLE_CODE) && !(RISCV_TRANSLATION_SHARD > 0)
 extern VISIBLE void init(struct CallbackTable* table, char* arena)
 {
 	api = *table;
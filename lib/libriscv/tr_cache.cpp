@@ -0,0 +1,200 @@
+#include "common.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * The translation cache is a directory of shared objects named by the
+ * translation hash, eg. /tmp/rvbintr-1234ABCD. Many processes may share it:
+ *  - Producing a translation is serialized with a lock file next to it,
+ *    so that each translation is compiled once, and the others load it.
+ *  - Translations are written to a temporary file and published with
+ *    rename(), so a translation is never seen half-written.
+ *  - The modification time of a translation is its last use, and the
+ *    least recently used translations are evicted to limit the size.
+ *    Temporary files count towards the size, and are removed once stale.
+ *    Lock files are never removed, as other processes may be waiting on them.
+ *  - Translations can be copied in from a directory produced ahead of time.
+**/
+
+namespace riscv
+{
+	static std::string basename_of(const std::string& filename)
+	{
+		const size_t slash = filename.find_last_of('/');
+		return (slash == std::string::npos) ? filename : filename.substr(slash + 1);
+	}
+	static std::string dirname_of(const std::string& filename)
+	{
+		const size_t slash = filename.find_last_of('/');
+		if (slash == std::string::npos)
+			return ".";
+		return (slash == 0) ? "/" : filename.substr(0, slash);
+	}
+
+	// Wait for and take the lock for producing the translation in filename
+	int translation_cache_lock(const std::string& filename)
+	{
+		const std::string lockfile = filename + ".lock";
+		const int fd = open(lockfile.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return -1;
+		while (flock(fd, LOCK_EX) < 0) {
+			if (errno != EINTR) {
+				close(fd);
+				return -1;
+			}
+		}
+		return fd;
+	}
+
+	// Check if a process is producing the translation in filename
+	static bool translation_cache_is_locked(const std::string& filename)
+	{
+		const std::string lockfile = filename + ".lock";
+		const int fd = open(lockfile.c_str(), O_RDWR | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+		const bool locked = flock(fd, LOCK_EX | LOCK_NB) < 0 && errno == EWOULDBLOCK;
+		close(fd); // Also releases the lock
+		return locked;
+	}
+
+	void translation_cache_unlock(int lock)
+	{
+		if (lock >= 0)
+			close(lock); // Also releases the lock
+	}
+
+	// Reserve a temporary file next to filename, which can be published later
+	std::string translation_cache_tmpname(const std::string& filename)
+	{
+		std::string tmpname = filename + ".XXXXXX";
+		const int fd = mkstemp(tmpname.data());
+		if (fd < 0)
+			return filename + ".tmp" + std::to_string(getpid());
+		close(fd);
+		return tmpname;
+	}
+
+	bool translation_cache_publish(const std::string& tmpfile, const std::string& filename)
+	{
+		// The translations are not supposed to be modified after publishing
+		chmod(tmpfile.c_str(), 0644);
+		if (rename(tmpfile.c_str(), filename.c_str()) < 0) {
+			unlink(tmpfile.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	void translation_cache_touch(const std::string& filename)
+	{
+		utimensat(AT_FDCWD, filename.c_str(), nullptr, 0);
+	}
+
+	bool translation_cache_seed(const std::string& seed_dir, const std::string& filename)
+	{
+		const std::string seedfile = seed_dir + "/" + basename_of(filename);
+		const int in = open(seedfile.c_str(), O_RDONLY | O_CLOEXEC);
+		if (in < 0)
+			return false;
+
+		const std::string tmpfile = translation_cache_tmpname(filename);
+		const int out = open(tmpfile.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+		bool success = out >= 0;
+		char buffer[65536];
+		while (success) {
+			const ssize_t len = read(in, buffer, sizeof(buffer));
+			if (len <= 0) {
+				success = (len == 0);
+				break;
+			}
+			success = write(out, buffer, len) == len;
+		}
+		close(in);
+		if (out >= 0)
+			close(out);
+		if (!success) {
+			unlink(tmpfile.c_str());
+			return false;
+		}
+		return translation_cache_publish(tmpfile, filename);
+	}
+
+	void translation_cache_evict(const std::string& prefix, const std::string& suffix,
+		uint64_t max_bytes, const std::string& keep)
+	{
+		// Temporary files left behind by eg. a killed compiler are removed
+		// when no process holds their lock, after this many seconds
+		static constexpr time_t STALE_TMPFILE_SECONDS = 3600;
+		struct Entry {
+			std::string filename;
+			time_t   mtime;
+			uint64_t size;
+		};
+		const std::string directory = dirname_of(prefix);
+		const std::string name_prefix = basename_of(prefix);
+		DIR* dir = opendir(directory.c_str());
+		if (dir == nullptr)
+			return;
+
+		// Translations are named prefix + 8 hex digits + suffix, and
+		// temporary files have another extension after that
+		const size_t name_length = name_prefix.size() + 8 + suffix.size();
+		std::vector<Entry> entries;
+		std::vector<Entry> tmpfiles;
+		uint64_t total = 0;
+		while (struct dirent* ent = readdir(dir)) {
+			const std::string name = ent->d_name;
+			if (name.size() < name_length
+				|| name.compare(0, name_prefix.size(), name_prefix) != 0
+				|| name.compare(name_length - suffix.size(), suffix.size(), suffix) != 0)
+				continue;
+			const std::string hash = name.substr(name_prefix.size(), 8);
+			if (hash.find_first_not_of("0123456789ABCDEF") != std::string::npos)
+				continue;
+			const bool is_tmpfile = name.size() > name_length;
+			if (is_tmpfile && (name[name_length] != '.' || name.compare(name_length, std::string::npos, ".lock") == 0))
+				continue;
+			const std::string filename = directory + "/" + name;
+			struct stat st;
+			if (stat(filename.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+				continue;
+			(is_tmpfile ? tmpfiles : entries).push_back({ filename, st.st_mtime, uint64_t(st.st_size) });
+			total += st.st_size;
+		}
+		closedir(dir);
+
+		// Temporary files are only in use while their translation is being produced
+		const time_t now = time(nullptr);
+		for (const auto& tmpfile : tmpfiles) {
+			const std::string translation = tmpfile.filename.substr(0, directory.size() + 1 + name_length);
+			if (now - tmpfile.mtime >= STALE_TMPFILE_SECONDS && !translation_cache_is_locked(translation)
+				&& unlink(tmpfile.filename.c_str()) == 0)
+				total -= tmpfile.size;
+		}
+		if (total <= max_bytes)
+			return;
+
+		std::sort(entries.begin(), entries.end(), [] (const Entry& a, const Entry& b) {
+			return a.mtime < b.mtime;
+		});
+		// Processes that have already loaded an evicted translation keep using it
+		for (const auto& entry : entries) {
+			if (total <= max_bytes)
+				break;
+			if (basename_of(entry.filename) == basename_of(keep))
+				continue;
+			if (unlink(entry.filename.c_str()) == 0)
+				total -= entry.size;
+		}
+	}
+}
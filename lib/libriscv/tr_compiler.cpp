@@ -1,6 +1,9 @@
 #include "common.hpp"
 
+#include <atomic>
 #include <cstring>
+#include <thread>
+#include <vector>
 #if defined(__MINGW32__) || defined(__MINGW64__) || defined(_MSC_VER)
 #include "win32/dlfcn.h"
 #else
@@ -51,38 +54,33 @@ namespace riscv
 			" -pipe " + extra_cflags();
 	}
 
-	void*
-	compile(const std::string& code, int arch, const std::string& cflags,
-		const std::string& outfile)
+	// Write code to a new temporary file, and return its name
+	static bool write_code_file(const std::string& code, char (&namebuffer)[64])
 	{
-		// create temporary filename
-		char namebuffer[64];
 		strncpy(namebuffer, "/tmp/rvtrcode-XXXXXX", sizeof(namebuffer));
 		// open a temporary file with owner privs
 		const int fd = mkstemp(namebuffer);
 		if (fd < 0) {
-			return nullptr;
+			return false;
 		}
 		// write translated code to temp file
 		ssize_t len = write(fd, code.c_str(), code.size());
+		close(fd);
 		if (len < (ssize_t) code.size()) {
 			unlink(namebuffer);
-			return nullptr;
+			return false;
 		}
-		// system compiler invocation
-		const std::string command =
-			compile_command(arch, cflags) + " "
-			 + " -o " + outfile + " "
-			 + std::string(namebuffer) + " 2>&1"; // redirect stderr
+		return true;
+	}
 
-		// compile the translated code
+	static bool run_compiler(const std::string& command)
+	{
 		if (verbose()) {
 			printf("Command: %s\n", command.c_str());
 		}
 		FILE* f = popen(command.c_str(), "r");
 		if (f == nullptr) {
-			unlink(namebuffer);
-			return nullptr;
+			return false;
 		}
 		// get compiler output
 		char buffer[2048];
@@ -90,12 +88,93 @@ namespace riscv
 			if (verbose())
 				fprintf(stderr, "%s", buffer);
 		}
-		pclose(f);
+		return pclose(f) == 0;
+	}
+
+	void*
+	compile(const std::string& code, int arch, const std::string& cflags,
+		const std::string& outfile)
+	{
+		// create temporary filename
+		char namebuffer[64];
+		if (!write_code_file(code, namebuffer)) {
+			return nullptr;
+		}
+		// system compiler invocation
+		const std::string command =
+			compile_command(arch, cflags) + " "
+			 + " -o " + outfile + " "
+			 + std::string(namebuffer) + " 2>&1"; // redirect stderr
+
+		// compile the translated code
+		const bool success = run_compiler(command);
 
 		if (!keep_code()) {
 			// delete temporary code file
 			unlink(namebuffer);
 		}
+		if (!success) {
+			return nullptr;
+		}
+
+		return dlopen(outfile.c_str(), RTLD_LAZY);
+	}
+
+	void*
+	compile_units(const std::vector<std::string>& units, int arch, const std::string& cflags,
+		const std::string& outfile)
+	{
+		if (units.size() == 1)
+			return compile(units[0], arch, cflags, outfile);
+
+		// Compile each unit to an object file on a pool of workers
+		std::vector<std::string> objects(units.size());
+		std::vector<char> success(units.size(), false);
+		std::atomic<size_t> next_unit = 0;
+		auto worker = [&] {
+			for (size_t i = next_unit++; i < units.size(); i = next_unit++)
+			{
+				char namebuffer[64];
+				if (!write_code_file(units[i], namebuffer))
+					continue;
+				objects[i] = std::string(namebuffer) + ".o";
+				const std::string command =
+					compile_command(arch, cflags) + " -c "
+					 + " -o " + objects[i] + " "
+					 + std::string(namebuffer) + " 2>&1"; // redirect stderr
+				success[i] = run_compiler(command);
+				if (!keep_code()) {
+					unlink(namebuffer);
+				}
+			}
+		};
+		const size_t workers = std::min<size_t>(units.size(),
+			std::max(1u, std::thread::hardware_concurrency()));
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < workers; i++)
+			threads.emplace_back(worker);
+		worker();
+		for (auto& thread : threads)
+			thread.join();
+
+		// Link the object files into one shared object
+		std::string command = compiler() + " -shared -s " + extra_cflags() + " -o " + outfile;
+		bool linkable = true;
+		for (size_t i = 0; i < units.size(); i++) {
+			linkable = linkable && success[i];
+			command += " " + objects[i];
+		}
+		command += " 2>&1";
+		if (linkable) {
+			linkable = run_compiler(command);
+		}
+		for (size_t i = 0; i < units.size(); i++) {
+			if (!objects[i].empty() && !keep_code())
+				unlink(objects[i].c_str());
+		}
+		if (!linkable) {
+			return nullptr;
+		}
 
 		return dlopen(outfile.c_str(), RTLD_LAZY);
 	}
@@ -117,16 +196,7 @@ namespace riscv
 	{
 		// create temporary filename
 		char namebuffer[64];
-		strncpy(namebuffer, "/tmp/rvtrcode-XXXXXX", sizeof(namebuffer));
-		// open a temporary file with owner privs
-		const int fd = mkstemp(namebuffer);
-		if (fd < 0) {
-			return false;
-		}
-		// write translated code to temp file
-		ssize_t len = write(fd, code.c_str(), code.size());
-		if (len < (ssize_t) code.size()) {
-			unlink(namebuffer);
+		if (!write_code_file(code, namebuffer)) {
 			return false;
 		}
 		// system compiler invocation
@@ -136,28 +206,14 @@ namespace riscv
 			 + std::string(namebuffer) + " 2>&1"; // redirect stderr
 
 		// compile the translated code
-		if (verbose()) {
-			printf("MinGW Command: %s\n", command.c_str());
-		}
-		FILE* f = popen(command.c_str(), "r");
-		if (f == nullptr) {
-			unlink(namebuffer);
-			return false;
-		}
-		// get compiler output
-		char buffer[2048];
-		while (fgets(buffer, sizeof(buffer), f) != NULL) {
-			if (verbose())
-				fprintf(stderr, "%s", buffer);
-		}
-		pclose(f);
+		const bool success = run_compiler(command);
 
 		if (!keep_code()) {
 			// delete temporary code file
 			unlink(namebuffer);
 		}
 
-		return true;
+		return success;
 	}
 
 	extern void  tcc_close(void* state);
@@ -170,6 +170,30 @@ struct Emitter
 	void exit_function(const std::string& new_pc, bool add_bracket = false)
 	{
 		this->store_loaded_registers();
+		this->exit_function_stored(new_pc, add_bracket);
+	}
+	// Leave the block for a statically known PC. With block chaining, the
+	// block at the PC is tail-called directly, so that only indirect jumps
+	// need the lookup in the chaining trampoline.
+	void exit_function_to(address_t new_pc, bool add_bracket = false)
+	{
+		this->store_loaded_registers();
+		if (const auto target_funcaddr = this->find_block_base(new_pc); target_funcaddr != 0)
+			this->chain_to(target_funcaddr, new_pc);
+		this->exit_function_stored(STRADDR(new_pc), add_bracket);
+	}
+	// Tail-call the block function at target_funcaddr, with registers stored
+	void chain_to(address_t target_funcaddr, address_t dest_pc)
+	{
+		auto target_func = funclabel<W>("f", target_funcaddr);
+		add_forward(target_func);
+		if (!tinfo.ignore_instruction_limit)
+			add_code("if (" + LOOP_EXPRESSION + " && CHAIN_DIRECT(cpu)) return " + target_func + "(cpu, counter, max_counter, " + STRADDR(dest_pc) + ");");
+		else
+			add_code("if (max_counter && CHAIN_DIRECT(cpu)) return " + target_func + "(cpu, 0, max_counter, " + STRADDR(dest_pc) + ");");
+	}
+	void exit_function_stored(const std::string& new_pc, bool add_bracket)
+	{
 		const char* return_code = (tinfo.ignore_instruction_limit) ? "return (ReturnValues){0, max_counter};" : "return (ReturnValues){counter, max_counter};";
 		add_code(
 			(new_pc != "cpu->pc") ? "cpu->pc = " + new_pc + ";" : "",
@@ -230,6 +254,8 @@ struct Emitter
 	}
 
 	void emit_branch(const BranchInfo& binfo, const std::string& op);
+	// Branches that were strongly biased in the profile get hints
+	std::string branch_condition(const std::string& condition) const;
 
 	void emit_system_call(const std::string& syscall_reg);
 
@@ -445,7 +471,6 @@ struct Emitter
 
 	const std::string get_func() const noexcept { return this->func; }
 	void emit();
-	rv32i_instruction emit_rvc();
 
 private:
 	static std::string speculation_safe(const std::string& address) {
@@ -533,9 +558,9 @@ inline void Emitter<W>::emit_branch(const BranchInfo& binfo, const std::string&
 {
 	using address_t = address_type<W>;
 	if (binfo.sign == false)
-		code += "if (" + from_reg(instr.Btype.rs1) + op + from_reg(instr.Btype.rs2) + ")";
+		code += "if " + branch_condition(from_reg(instr.Btype.rs1) + op + from_reg(instr.Btype.rs2));
 	else
-		code += "if ((saddr_t)" + from_reg(instr.Btype.rs1) + op + " (saddr_t)" + from_reg(instr.Btype.rs2) + ")";
+		code += "if " + branch_condition("(saddr_t)" + from_reg(instr.Btype.rs1) + op + " (saddr_t)" + from_reg(instr.Btype.rs2));
 
 	if (UNLIKELY(PCRELA(instr.Btype.signed_imm()) & ALIGN_MASK))
 	{
@@ -566,7 +591,26 @@ inline void Emitter<W>::emit_branch(const BranchInfo& binfo, const std::string&
 		code += " {\n";
 	}
 	// else, exit binary translation
-	exit_function(PCRELS(instr.Btype.signed_imm()), true); // Bracket (NOTE: not actually ending the function)
+	exit_function_to(PCRELA(instr.Btype.signed_imm()), true); // Bracket (NOTE: not actually ending the function)
+}
+
+template <int W>
+inline std::string Emitter<W>::branch_condition(const std::string& condition) const
+{
+	static constexpr uint64_t MIN_BRANCHES = 64;
+	if (tinfo.profile != nullptr) {
+		auto it = tinfo.profile->branches.find(this->pc());
+		if (it != tinfo.profile->branches.end()) {
+			const auto& branch = it->second;
+			const uint64_t total = branch.taken + branch.not_taken;
+			// At least 90% of the branches went the same way
+			if (total >= MIN_BRANCHES && branch.taken * 10 >= total * 9)
+				return "(LIKELY(" + condition + "))";
+			if (total >= MIN_BRANCHES && branch.not_taken * 10 >= total * 9)
+				return "(UNLIKELY(" + condition + "))";
+		}
+	}
+	return "(" + condition + ")";
 }
 
 template <int W>
@@ -574,9 +618,11 @@ inline bool Emitter<W>::emit_function_call(address_t target_funcaddr, address_t
 {
 	// Store the registers
 	this->store_loaded_registers();
+	// A tail call, when chaining directly, so that calls never nest
+	// inside blocks that chain to each other
+	this->chain_to(target_funcaddr, dest_pc);
 
 	auto target_func = funclabel<W>("f", target_funcaddr);
-	add_forward(target_func);
 	if (!tinfo.ignore_instruction_limit) {
 		// Call the function and get the return values
 		add_code("{ReturnValues rv = " + target_func + "(cpu, counter, max_counter, " + STRADDR(dest_pc) + ");");
@@ -771,7 +817,7 @@ void Emitter<W>::emit()
 		if (instr.is_compressed()) {
 			// Compressed 16-bit instructions
 			auto original = instr.whole;
-			instr = this->emit_rvc();
+			instr = expand_rvc<W>(instr);
 
 			if (instr.is_compressed())
 			{
@@ -1040,7 +1086,7 @@ void Emitter<W>::emit()
 
 			// Because of forward jumps we can't end the function here
 			if (!already_exited)
-				exit_function(STRADDR(dest_pc), false);
+				exit_function_to(dest_pc, false);
 			if (add_reentry)
 				this->add_reentry_next();
 			} break;
@@ -1242,14 +1288,14 @@ void Emitter<W>::emit()
 				add_code(
 					(W == 4) ?
 					to_reg(instr.Rtype.rd) + " = (uint64_t)((int64_t)(saddr_t)" + from_reg(instr.Rtype.rs1) + " * (int64_t)(saddr_t)" + from_reg(instr.Rtype.rs2) + ") >> 32u;" :
-					"MUL128(&" + to_reg(instr.Rtype.rd) + ", " + from_reg(instr.Rtype.rs1) + ", " + from_reg(instr.Rtype.rs2) + ");"
+					"MULH128(&" + to_reg(instr.Rtype.rd) + ", " + from_reg(instr.Rtype.rs1) + ", " + from_reg(instr.Rtype.rs2) + ");"
 				);
 				break;
 			case 0x12: // MULHSU (signed x unsigned)
 				add_code(
 					(W == 4) ?
 					to_reg(instr.Rtype.rd) + " = (uint64_t)((int64_t)(saddr_t)" + from_reg(instr.Rtype.rs1) + " * (uint64_t)" + from_reg(instr.Rtype.rs2) + ") >> 32u;" :
-					"MUL128(&" + to_reg(instr.Rtype.rd) + ", " + from_reg(instr.Rtype.rs1) + ", " + from_reg(instr.Rtype.rs2) + ");"
+					"MULHSU128(&" + to_reg(instr.Rtype.rd) + ", " + from_reg(instr.Rtype.rs1) + ", " + from_reg(instr.Rtype.rs2) + ");"
 				);
 				break;
 			case 0x13: // MULHU (unsigned x unsigned)
@@ -1272,9 +1318,10 @@ void Emitter<W>::emit()
 					}
 					add_code(
 						"if (LIKELY(" + from_reg(instr.Rtype.rs2) + " != 0)) {",
-						"	if (LIKELY(!(" + from_reg(instr.Rtype.rs1) + " == -9223372036854775808ull && " + from_reg(instr.Rtype.rs2) + " == -1ull)))"
+						"	if (LIKELY(!(" + from_reg(instr.Rtype.rs1) + " == -9223372036854775808ull && " + from_reg(instr.Rtype.rs2) + " == -1ull)))",
 						"		" + to_reg(instr.Rtype.rd) + " = (int64_t)" + from_reg(instr.Rtype.rs1) + " / (int64_t)" + from_reg(instr.Rtype.rs2) + ";",
-						"}");
+						"	else " + to_reg(instr.Rtype.rd) + " = " + from_reg(instr.Rtype.rs1) + ";", // Overflow
+						"} else " + to_reg(instr.Rtype.rd) + " = (addr_t)-1;");
 				} else {
 					if (this->gpr_has_known_value(instr.Rtype.rs2))
 					{
@@ -1288,7 +1335,8 @@ void Emitter<W>::emit()
 						"if (LIKELY(" + from_reg(instr.Rtype.rs2) + " != 0)) {",
 						"	if (LIKELY(!(" + from_reg(instr.Rtype.rs1) + " == 2147483648 && " + from_reg(instr.Rtype.rs2) + " == 4294967295)))",
 						"		" + to_reg(instr.Rtype.rd) + " = (int32_t)" + from_reg(instr.Rtype.rs1) + " / (int32_t)" + from_reg(instr.Rtype.rs2) + ";",
-						"}");
+						"	else " + to_reg(instr.Rtype.rd) + " = " + from_reg(instr.Rtype.rs1) + ";", // Overflow
+						"} else " + to_reg(instr.Rtype.rd) + " = (addr_t)-1;");
 				}
 				break;
 			case 0x15: // DIVU
@@ -1302,7 +1350,8 @@ void Emitter<W>::emit()
 				}
 				add_code(
 					"if (LIKELY(" + from_reg(instr.Rtype.rs2) + " != 0))",
-					to_reg(instr.Rtype.rd) + " = " + from_reg(instr.Rtype.rs1) + " / " + from_reg(instr.Rtype.rs2) + ";"
+					to_reg(instr.Rtype.rd) + " = " + from_reg(instr.Rtype.rs1) + " / " + from_reg(instr.Rtype.rs2) + ";",
+					"else " + to_reg(instr.Rtype.rd) + " = (addr_t)-1;"
 				);
 				break;
 			case 0x16: // REM
@@ -1311,19 +1360,22 @@ void Emitter<W>::emit()
 					"if (LIKELY(" + from_reg(instr.Rtype.rs2) + " != 0)) {",
 					"	if (LIKELY(!(" + from_reg(instr.Rtype.rs1) + " == -9223372036854775808ull && " + from_reg(instr.Rtype.rs2) + " == -1ull)))",
 					"		" + to_reg(instr.Rtype.rd) + " = (int64_t)" + from_reg(instr.Rtype.rs1) + " % (int64_t)" + from_reg(instr.Rtype.rs2) + ";",
-					"}");
+					"	else " + to_reg(instr.Rtype.rd) + " = 0;", // Overflow
+					"} else " + to_reg(instr.Rtype.rd) + " = " + from_reg(instr.Rtype.rs1) + ";");
 				} else {
 					add_code(
 					"if (LIKELY(" + from_reg(instr.Rtype.rs2) + " != 0)) {",
 					"	if (LIKELY(!(" + from_reg(instr.Rtype.rs1) + " == 2147483648 && " + from_reg(instr.Rtype.rs2) + " == 4294967295)))",
 					"		" + to_reg(instr.Rtype.rd) + " = (int32_t)" + from_reg(instr.Rtype.rs1) + " % (int32_t)" + from_reg(instr.Rtype.rs2) + ";",
-					"}");
+					"	else " + to_reg(instr.Rtype.rd) + " = 0;", // Overflow
+					"} else " + to_reg(instr.Rtype.rd) + " = " + from_reg(instr.Rtype.rs1) + ";");
 				}
 				break;
 			case 0x17: // REMU
 				add_code(
 				"if (LIKELY(" + from_reg(instr.Rtype.rs2) + " != 0))",
-					to_reg(instr.Rtype.rd) + " = " + from_reg(instr.Rtype.rs1) + " % " + from_reg(instr.Rtype.rs2) + ";"
+					to_reg(instr.Rtype.rd) + " = " + from_reg(instr.Rtype.rs1) + " % " + from_reg(instr.Rtype.rs2) + ";",
+				"else " + to_reg(instr.Rtype.rd) + " = " + from_reg(instr.Rtype.rs1) + ";"
 				);
 				break;
 			case 0x44: // ZEXT.H: Zero-extend 16-bit
@@ -1588,25 +1640,31 @@ void Emitter<W>::emit()
 			case 0x14: // DIVW
 				// division by zero is not an exception
 				add_code(
-				"if (LIKELY(" + src2 + " != 0))",
+				"if (LIKELY(" + src2 + " != 0)) {",
 				"if (LIKELY(!((int32_t)" + src1 + " == -2147483648 && (int32_t)" + src2 + " == -1)))",
-				dst + " = " + SIGNEXTW + " ((int32_t)" + src1 + " / (int32_t)" + src2 + ");");
+				dst + " = " + SIGNEXTW + " ((int32_t)" + src1 + " / (int32_t)" + src2 + ");",
+				"else " + dst + " = " + SIGNEXTW + " " + src1 + ";", // Overflow
+				"} else " + dst + " = (addr_t)-1;");
 				break;
 			case 0x15: // DIVUW
 				add_code(
 				"if (LIKELY(" + src2 + " != 0))",
-				dst + " = " + SIGNEXTW + " (" + src1 + " / " + src2 + ");");
+				dst + " = " + SIGNEXTW + " (" + src1 + " / " + src2 + ");",
+				"else " + dst + " = (addr_t)-1;");
 				break;
 			case 0x16: // REMW
 				add_code(
-				"if (LIKELY(" + src2 + " != 0))",
+				"if (LIKELY(" + src2 + " != 0)) {",
 				"if (LIKELY(!((int32_t)" + src1 + " == -2147483648 && (int32_t)" + src2 + " == -1)))",
-				dst + " = " + SIGNEXTW + " ((int32_t)" + src1 + " % (int32_t)" + src2 + ");");
+				dst + " = " + SIGNEXTW + " ((int32_t)" + src1 + " % (int32_t)" + src2 + ");",
+				"else " + dst + " = 0;", // Overflow
+				"} else " + dst + " = " + SIGNEXTW + " " + src1 + ";");
 				break;
 			case 0x17: // REMUW
 				add_code(
 				"if (LIKELY(" + src2 + " != 0))",
-				dst + " = " + SIGNEXTW + " (" + src1 + " % " + src2 + ");");
+				dst + " = " + SIGNEXTW + " (" + src1 + " % " + src2 + ");",
+				"else " + dst + " = " + SIGNEXTW + " " + src1 + ";");
 				break;
 			case 0x40: // ADD.UW
 				add_code(dst + " = " + from_reg(instr.Rtype.rs2) + " + " + src1 + ";");
@@ -1656,6 +1714,11 @@ void Emitter<W>::emit()
 #ifdef RISCV_EXT_VECTOR
 			case 0x6: { // VLE32
 				const rv32v_instruction vi { instr };
+				if (vi.VLS.mop != 0 || !vi.VLS.vm) {
+					// Strided and masked loads use the interpreter
+					UNKNOWN_INSTRUCTION();
+					break;
+				}
 				this->memory_load<VectorLane>(from_rvvreg(vi.VLS.vd), "VectorLane", vi.VLS.rs1, 0);
 				break;
 			}
@@ -1677,6 +1740,10 @@ void Emitter<W>::emit()
 #ifdef RISCV_EXT_VECTOR
 			case 0x6: { // VSE32
 				const rv32v_instruction vi { instr };
+				if (vi.VLS.mop != 0 || !vi.VLS.vm) {
+					UNKNOWN_INSTRUCTION();
+					break;
+				}
 				this->memory_store("VectorLane", vi.VLS.rs1, 0, from_rvvreg(vi.VLS.vd));
 				break;
 			}
@@ -1887,6 +1954,11 @@ void Emitter<W>::emit()
 #ifdef RISCV_EXT_VECTOR
 			const rv32v_instruction vi{instr};
 			const unsigned vlen = RISCV_EXT_VECTOR / 4;
+			if (!vi.OPVV.vm) {
+				// Masked instructions use the interpreter
+				UNKNOWN_INSTRUCTION();
+				break;
+			}
 			switch (instr.vwidth()) {
 			case 0x1: // OPF.VV
 				switch (vi.OPVV.funct6)
@@ -1962,7 +2034,7 @@ void Emitter<W>::emit()
 	// If the function ends with an unimplemented instruction,
 	// we must gracefully finish, setting new PC and incrementing IC
 	this->increment_counter_so_far();
-	exit_function(STRADDR(this->end_pc()), true);
+	exit_function_to(this->end_pc(), true);
 }
 
 template <int W>
@@ -2020,11 +2092,13 @@ CPU<W>::emit(std::string& code, const TransInfo<W>& tinfo)
 
 	// Forward declarations
 	for (const auto& entry : e.get_forward_declared()) {
-		code += "static ReturnValues " + entry + "(CPU*, uint64_t, uint64_t, addr_t);\n";
+		code += "BLOCK_FUNC ReturnValues " + entry + "(CPU*, uint64_t, uint64_t, addr_t);\n";
 	}
 
-	// Function header
-	code += "static ReturnValues " + e.get_func() + "(CPU* cpu, uint64_t counter, uint64_t max_counter, addr_t pc) {\n";
+	// Function header, optimized for size when the block never ran in the profile
+	if (tinfo.profile != nullptr && tinfo.profile->heat(tinfo.basepc, tinfo.endpc) == 0)
+		code += "COLD_FUNC ";
+	code += "BLOCK_FUNC ReturnValues " + e.get_func() + "(CPU* cpu, uint64_t counter, uint64_t max_counter, addr_t pc) {\n";
 
 	// Function GPRs
 	if (tinfo.use_register_caching) {
@@ -1,7 +1,10 @@
 
+// Expand a compressed instruction into its 32-bit equivalent. Instructions
+// that cannot be expanded are returned unchanged (still compressed).
 template <int W>
-rv32i_instruction Emitter<W>::emit_rvc()
+static rv32i_instruction expand_rvc(rv32i_instruction instr)
 {
+	using address_t = address_type<W>;
 	#define CI_CODE(x, y) ((x << 13) | (y))
 	const rv32c_instruction ci { instr };
 
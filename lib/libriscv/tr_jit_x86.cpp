@@ -0,0 +1,1271 @@
+#include <chrono>
+#include <cstring>
+#include <sys/mman.h>
+#include "machine.hpp"
+#include "decoder_cache.hpp"
+#include "instruction_list.hpp"
+#include "rv32i_instr.hpp"
+#include "rvfd.hpp"
+#include "tr_types.hpp"
+#ifdef RISCV_EXT_C
+#include "rvc.hpp"
+#endif
+
+/**
+ * In-process x86-64 backend for the binary translator.
+ *
+ * Code blocks found by CPU::find_translation_blocks are assembled directly
+ * into executable memory, without generating C code or invoking a compiler.
+ * Every mapping gets a small entry stub that follows the bintr_block_func
+ * calling convention (System V ABI), after which all translated code shares
+ * the same stack frame and can jump freely between blocks.
+ *
+ * Guest registers stay in the CPU register file. Instructions without a
+ * native sequence (floating-point, atomics, vector, ...) are executed
+ * through their regular instruction handlers. Exceptions can not unwind
+ * through generated code, so they are stored in the CPU and rethrown by
+ * the dispatch loop, the same way as with libtcc.
+**/
+
+namespace riscv
+{
+#ifdef RISCV_EXT_C
+#include "tr_emit_rvc.cpp"
+#endif
+	static constexpr bool VERBOSE_JIT = false;
+
+	struct JitCode {
+		void*  memory = nullptr;
+		size_t size = 0;
+	};
+
+	void jit_close(void* jit)
+	{
+		auto* code = (JitCode *)jit;
+		munmap(code->memory, code->size);
+		delete code;
+	}
+
+namespace {
+	enum X64Reg : unsigned {
+		RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+		R8, R9, R10, R11, R12, R13, R14, R15
+	};
+	// Host registers that are live for the whole translated function
+	static constexpr unsigned REG_CPU     = RBX;
+	static constexpr unsigned REG_COUNTER = R12;
+	static constexpr unsigned REG_MAXCNT  = R13;
+	static constexpr unsigned REG_ARENA   = R14;
+
+	// Condition codes (the low nibble of Jcc and SETcc)
+	enum X64Cond : uint8_t {
+		CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+		CC_L = 0xC, CC_GE = 0xD,
+	};
+	// Group 1 and shift opcode extensions
+	enum X64Ext : unsigned {
+		EXT_ADD = 0, EXT_OR = 1, EXT_AND = 4, EXT_SUB = 5, EXT_XOR = 6, EXT_CMP = 7,
+		EXT_SHL = 4, EXT_SHR = 5, EXT_SAR = 7,
+		EXT_MUL = 4, EXT_IMUL = 5,
+	};
+	// ALU opcodes in the "op r/m, r" form
+	enum X64Op : uint8_t {
+		OP_ADD = 0x01, OP_OR = 0x09, OP_AND = 0x21, OP_SUB = 0x29,
+		OP_XOR = 0x31, OP_CMP = 0x39, OP_TEST = 0x85, OP_MOV = 0x89,
+	};
+
+	static inline bool fits_int32(int64_t value) noexcept {
+		return value == int64_t(int32_t(value));
+	}
+
+	struct X64Assembler
+	{
+		size_t pos() const noexcept { return code.size(); }
+		void byte(uint8_t b) { code.push_back(b); }
+		void dword(uint32_t v) {
+			for (int i = 0; i < 4; i++) byte(v >> (i * 8));
+		}
+		void qword(uint64_t v) {
+			for (int i = 0; i < 8; i++) byte(v >> (i * 8));
+		}
+
+		unsigned new_label() {
+			labels.push_back(-1);
+			return labels.size() - 1;
+		}
+		void bind(unsigned label) { labels.at(label) = pos(); }
+		void rel32(unsigned label) {
+			fixups.push_back({pos(), label});
+			dword(0);
+		}
+		void resolve()
+		{
+			for (const auto& fixup : fixups) {
+				const int64_t target = labels.at(fixup.label);
+				if (target < 0)
+					throw MachineException(INVALID_PROGRAM, "JIT: Unbound label", fixup.label);
+				const int32_t rel = target - int64_t(fixup.pos + 4);
+				std::memcpy(&code[fixup.pos], &rel, sizeof(rel));
+			}
+			fixups.clear();
+		}
+
+		// REX prefix, only emitted when needed. Byte access to
+		// SPL, BPL, SIL and DIL needs an empty REX prefix.
+		void rex(bool w, unsigned reg, unsigned index, unsigned base, bool force = false) {
+			const uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+			if (r != 0x40 || force)
+				byte(r);
+		}
+		void modrm_rr(unsigned reg, unsigned rm) {
+			byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+		}
+		// ModR/M for [base + disp]
+		void mem(unsigned reg, unsigned base, int32_t disp) {
+			const unsigned r = (reg & 7) << 3, b = base & 7;
+			if (disp == 0 && b != 5) {
+				byte(0x00 | r | b);
+				if (b == 4) byte(0x24);
+			} else if (disp >= -128 && disp <= 127) {
+				byte(0x40 | r | b);
+				if (b == 4) byte(0x24);
+				byte(disp);
+			} else {
+				byte(0x80 | r | b);
+				if (b == 4) byte(0x24);
+				dword(disp);
+			}
+		}
+		// ModR/M and SIB for [base + index]
+		void mem_index(unsigned reg, unsigned base, unsigned index) {
+			const unsigned r = (reg & 7) << 3, b = base & 7, x = (index & 7) << 3;
+			if (b == 5) {
+				byte(0x44 | r); byte(x | b); byte(0);
+			} else {
+				byte(0x04 | r); byte(x | b);
+			}
+		}
+
+		// op r/m, r
+		void alu_rr(uint8_t op, bool w, unsigned dst, unsigned src) {
+			rex(w, src, 0, dst);
+			byte(op);
+			modrm_rr(src, dst);
+		}
+		// op r/m, imm (sign-extended)
+		void alu_ri(unsigned ext, bool w, unsigned dst, int32_t imm) {
+			rex(w, 0, 0, dst);
+			if (imm >= -128 && imm <= 127) {
+				byte(0x83); modrm_rr(ext, dst); byte(imm);
+			} else {
+				byte(0x81); modrm_rr(ext, dst); dword(imm);
+			}
+		}
+		void load(bool w, unsigned dst, unsigned base, int32_t disp) {
+			rex(w, dst, 0, base);
+			byte(0x8B);
+			mem(dst, base, disp);
+		}
+		void store(bool w, unsigned base, int32_t disp, unsigned src) {
+			rex(w, src, 0, base);
+			byte(0x89);
+			mem(src, base, disp);
+		}
+		void store_imm(bool w, unsigned base, int32_t disp, int32_t imm) {
+			rex(w, 0, 0, base);
+			byte(0xC7);
+			mem(0, base, disp);
+			dword(imm);
+		}
+		void add_mem_imm(bool w, unsigned base, int32_t disp, int32_t imm) {
+			rex(w, 0, 0, base);
+			byte(0x81);
+			mem(EXT_ADD, base, disp);
+			dword(imm);
+		}
+		void mov_ri(unsigned dst, uint64_t imm) {
+			if (imm <= 0xFFFFFFFF) {
+				rex(false, 0, 0, dst);
+				byte(0xB8 + (dst & 7)); dword(imm);
+			} else if (fits_int32(imm)) {
+				rex(true, 0, 0, dst);
+				byte(0xC7); modrm_rr(0, dst); dword(imm);
+			} else {
+				rex(true, 0, 0, dst);
+				byte(0xB8 + (dst & 7)); qword(imm);
+			}
+		}
+		void shift_ri(unsigned ext, bool w, unsigned dst, uint8_t n) {
+			rex(w, 0, 0, dst);
+			byte(0xC1); modrm_rr(ext, dst); byte(n);
+		}
+		void shift_cl(unsigned ext, bool w, unsigned dst) {
+			rex(w, 0, 0, dst);
+			byte(0xD3); modrm_rr(ext, dst);
+		}
+		void imul_rr(bool w, unsigned dst, unsigned src) {
+			rex(w, dst, 0, src);
+			byte(0x0F); byte(0xAF); modrm_rr(dst, src);
+		}
+		// RDX:RAX = RAX * src
+		void mul_wide(unsigned ext, unsigned src) {
+			rex(true, 0, 0, src);
+			byte(0xF7); modrm_rr(ext, src);
+		}
+		void movsxd(unsigned dst, unsigned src) {
+			rex(true, dst, 0, src);
+			byte(0x63); modrm_rr(dst, src);
+		}
+		// Sign- or zero-extend the low 8 or 16 bits of src
+		void extend(bool is_signed, unsigned bits, bool w, unsigned dst, unsigned src) {
+			rex(w, dst, 0, src, bits == 8 && src >= 4);
+			byte(0x0F);
+			byte((is_signed ? 0xBE : 0xB6) | (bits == 16));
+			modrm_rr(dst, src);
+		}
+		void setcc(uint8_t cc, unsigned dst) {
+			rex(false, 0, 0, dst, dst >= 4);
+			byte(0x0F); byte(0x90 | cc); modrm_rr(0, dst);
+		}
+		void jcc(uint8_t cc, unsigned label) {
+			byte(0x0F); byte(0x80 | cc);
+			rel32(label);
+		}
+		void jmp(unsigned label) {
+			byte(0xE9);
+			rel32(label);
+		}
+		void call(const void* function) {
+			mov_ri(RAX, uintptr_t(function));
+			byte(0xFF); byte(0xD0);
+		}
+		void push(unsigned reg) { rex(false, 0, 0, reg); byte(0x50 + (reg & 7)); }
+		void pop(unsigned reg)  { rex(false, 0, 0, reg); byte(0x58 + (reg & 7)); }
+		void ret() { byte(0xC3); }
+
+		std::vector<uint8_t> code;
+	private:
+		struct Fixup {
+			size_t   pos;
+			unsigned label;
+		};
+		std::vector<int64_t> labels;
+		std::vector<Fixup> fixups;
+	};
+
+	// Slow-paths called from generated code. They never throw.
+	struct JitReturn {
+		uint64_t value;
+		uint64_t error;
+	};
+
+	template <int W>
+	JitReturn jit_mem_read(CPU<W>& cpu, address_type<W> addr, unsigned size) noexcept
+	{
+		try {
+			switch (size) {
+			case 1: return {cpu.machine().memory.template read<uint8_t>(addr), 0};
+			case 2: return {cpu.machine().memory.template read<uint16_t>(addr), 0};
+			case 4: return {cpu.machine().memory.template read<uint32_t>(addr), 0};
+			default: return {cpu.machine().memory.template read<uint64_t>(addr), 0};
+			}
+		} catch (...) {
+			cpu.set_current_exception(std::current_exception());
+			return {0, 1};
+		}
+	}
+
+	template <int W>
+	uint64_t jit_mem_write(CPU<W>& cpu, address_type<W> addr, address_type<W> value, unsigned size) noexcept
+	{
+		try {
+			switch (size) {
+			case 1: cpu.machine().memory.template write<uint8_t>(addr, value); break;
+			case 2: cpu.machine().memory.template write<uint16_t>(addr, value); break;
+			case 4: cpu.machine().memory.template write<uint32_t>(addr, value); break;
+			default: cpu.machine().memory.template write<uint64_t>(addr, value); break;
+			}
+			return 0;
+		} catch (...) {
+			cpu.set_current_exception(std::current_exception());
+			return 1;
+		}
+	}
+
+	template <int W>
+	uint64_t jit_execute(CPU<W>& cpu, instruction_handler<W> handler, uint32_t instr) noexcept
+	{
+		try {
+			handler(cpu, rv32i_instruction{instr});
+			return 0;
+		} catch (...) {
+			cpu.set_current_exception(std::current_exception());
+			return 1;
+		}
+	}
+
+	template <int W>
+	uint64_t jit_system(CPU<W>& cpu, uint32_t instr) noexcept
+	{
+		try {
+			cpu.machine().system(rv32i_instruction{instr});
+			return 0;
+		} catch (...) {
+			cpu.set_current_exception(std::current_exception());
+			return 1;
+		}
+	}
+
+	// Returns non-zero when the translated function must return to dispatch
+	template <int W>
+	uint64_t jit_syscall(CPU<W>& cpu, address_type<W> sysno, unsigned length) noexcept
+	{
+		try {
+			const auto old_tp = cpu.reg(REG_TP);
+			const auto old_pc = cpu.registers().pc;
+			const auto* old_exec = &cpu.current_execute_segment();
+			cpu.machine().system_call(sysno);
+			// Resume if the system call did not modify PC, TP or the execute segment,
+			// or hit a limit. A replaced execute segment may have freed this code.
+			if (cpu.registers().pc != old_pc || cpu.reg(REG_TP) != old_tp
+				|| &cpu.current_execute_segment() != old_exec
+				|| cpu.machine().instruction_counter() >= cpu.machine().max_instructions()) {
+				// Dispatch expects PC to point at the next instruction. System
+				// calls that jump leave PC 4 bytes before the target, while
+				// C.EBREAK is only 2 bytes long.
+				if (cpu.registers().pc != old_pc)
+					cpu.registers().pc += 4;
+				else
+					cpu.registers().pc += length;
+				return 1;
+			}
+			return 0;
+		} catch (...) {
+			cpu.set_current_exception(std::current_exception());
+			cpu.machine().stop();
+			return 1;
+		}
+	}
+
+	template <int W>
+	uint64_t jit_exception(CPU<W>& cpu, int type, address_type<W> data) noexcept
+	{
+		try {
+			cpu.trigger_exception(type, data);
+		} catch (...) {
+			cpu.set_current_exception(std::current_exception());
+		}
+		return 1;
+	}
+
+	// Where things are, relative to the CPU
+	struct JitLayout {
+		int32_t pc_off;
+		int32_t regs_off;
+		int32_t ins_counter_off;
+		int32_t max_counter_off;
+		int32_t arena_off;
+		bool     use_arena;
+		bool     ignore_instruction_limit;
+		// The same arena boundaries as used by Memory::read and Memory::write
+		uint64_t read_begin;
+		uint64_t read_boundary;
+		uint64_t write_begin;
+		uint64_t write_boundary;
+	};
+
+	template <int W>
+	struct JitEmitter
+	{
+		using address_t = address_type<W>;
+		using saddr_t   = signed_address_type<W>;
+		static constexpr bool Q = (W == 8); // 64-bit guest registers
+		static constexpr address_t ALIGN_MASK = (compressed_enabled) ? 0x1 : 0x3;
+
+		JitEmitter(X64Assembler& a, const JitLayout& l, const std::unordered_map<address_t, unsigned>& lbl,
+			unsigned epilogue, unsigned exception)
+			: as(a), layout(l), labels(lbl), epilogue_label(epilogue), exception_label(exception),
+			  illegal_label(a.new_label()) {}
+
+		void emit_block(const TransInfo<W>& block, const std::unordered_set<address_t>& ebreak_locations);
+		void emit_cold_paths();
+
+	private:
+		int32_t reg_off(unsigned reg) const noexcept { return layout.regs_off + reg * W; }
+
+		void load_reg(unsigned host, unsigned reg) {
+			if (reg == 0)
+				as.alu_rr(OP_XOR, false, host, host);
+			else
+				as.load(Q, host, REG_CPU, reg_off(reg));
+		}
+		void store_reg(unsigned reg, unsigned host) {
+			if (reg != 0)
+				as.store(Q, REG_CPU, reg_off(reg), host);
+		}
+		void store_value(int32_t off, address_t value) {
+			if constexpr (W == 4) {
+				as.store_imm(false, REG_CPU, off, int32_t(value));
+			} else if (fits_int32(int64_t(value))) {
+				as.store_imm(true, REG_CPU, off, int32_t(value));
+			} else {
+				as.mov_ri(R11, value);
+				as.store(true, REG_CPU, off, R11);
+			}
+		}
+		void store_reg_imm(unsigned reg, address_t value) {
+			if (reg != 0)
+				store_value(reg_off(reg), value);
+		}
+		void set_pc(address_t pc) { store_value(layout.pc_off, pc); }
+		// Compare a host register against a constant (unsigned)
+		void cmp_imm(unsigned host, uint64_t value) {
+			if (!Q || value <= 0x7FFFFFFF) {
+				as.alu_ri(EXT_CMP, Q, host, int32_t(value));
+			} else {
+				as.mov_ri(R11, value);
+				as.alu_rr(OP_CMP, Q, host, R11);
+			}
+		}
+		void sub_imm(unsigned host, uint64_t value) {
+			if (value == 0) return;
+			if (!Q || value <= 0x7FFFFFFF) {
+				as.alu_ri(EXT_SUB, Q, host, int32_t(value));
+			} else {
+				as.mov_ri(R11, value);
+				as.alu_rr(OP_SUB, Q, host, R11);
+			}
+		}
+
+		void flush_counter() {
+			if (m_pending > 0 && !layout.ignore_instruction_limit)
+				as.alu_ri(EXT_ADD, true, REG_COUNTER, m_pending);
+			m_pending = 0;
+		}
+		void exit_to(address_t pc) {
+			flush_counter();
+			set_pc(pc);
+			as.jmp(epilogue_label);
+		}
+		// Jump to translated code, if it exists. Backward and cross-block
+		// jumps check the instruction counter, and return to dispatch when
+		// the counter runs out.
+		void jump_to(address_t target, bool check_counter) {
+			flush_counter();
+			auto it = labels.find(target);
+			if (it == labels.end()) {
+				exit_to(target);
+				return;
+			}
+			if (!check_counter || layout.ignore_instruction_limit) {
+				as.jmp(it->second);
+				return;
+			}
+			as.alu_rr(OP_CMP, true, REG_COUNTER, REG_MAXCNT);
+			as.jcc(CC_B, it->second);
+			exit_to(target);
+		}
+		bool is_local_forward(address_t target) const noexcept {
+			return target > m_pc && target < m_block->endpc;
+		}
+		void call_prologue() {
+			as.alu_rr(OP_MOV, true, RDI, REG_CPU);
+		}
+		void reveal_counters() {
+			as.store(true, REG_CPU, layout.ins_counter_off, REG_COUNTER);
+			as.store(true, REG_CPU, layout.max_counter_off, REG_MAXCNT);
+		}
+		void restore_counters() {
+			as.load(true, REG_COUNTER, REG_CPU, layout.ins_counter_off);
+			as.load(true, REG_MAXCNT, REG_CPU, layout.max_counter_off);
+		}
+		// Jump to the exception exit when RAX is non-zero
+		void check_error(unsigned host = RAX) {
+			as.alu_rr(OP_TEST, true, host, host);
+			as.jcc(CC_NE, exception_label);
+		}
+
+		void emit_fallback(rv32i_instruction instr);
+		void emit_exception(int type, address_t data);
+		void emit_system_call(bool is_ebreak);
+		void emit_load(rv32i_instruction instr);
+		void emit_store(rv32i_instruction instr);
+		void emit_branch(rv32i_instruction instr);
+		bool emit_op_imm(rv32i_instruction instr);
+		bool emit_op(rv32i_instruction instr);
+		bool emit_op_imm32(rv32i_instruction instr);
+		bool emit_op32(rv32i_instruction instr);
+		// Compute guest address rs1 + imm into RAX, leaving the flags
+		// for a JAE to the slow-path when an arena check is needed.
+		bool emit_address(unsigned rs1, int32_t imm, uint64_t begin, uint64_t boundary);
+
+		X64Assembler& as;
+		const JitLayout& layout;
+		const std::unordered_map<address_t, unsigned>& labels;
+		const unsigned epilogue_label;
+		const unsigned exception_label;
+		// Shared by all illegal instructions, which are often padding
+		const unsigned illegal_label;
+		const TransInfo<W>* m_block = nullptr;
+		address_t m_pc = 0;
+		unsigned  m_len = 4;
+		int32_t   m_pending = 0;
+		bool      m_illegal_used = false;
+
+		struct ColdPath {
+			unsigned label;
+			unsigned resume;
+			address_t pc;
+			rv32i_instruction instr;
+			int32_t pending;
+			bool is_store;
+		};
+		std::vector<ColdPath> m_cold;
+	};
+
+	template <int W>
+	void JitEmitter<W>::emit_fallback(rv32i_instruction instr)
+	{
+		// Handlers may read the instruction counter (eg. RDINSTRET) or stop the machine
+		flush_counter();
+		set_pc(m_pc);
+		reveal_counters();
+		call_prologue();
+		as.mov_ri(RSI, uintptr_t(CPU<W>::decode(instr).handler));
+		as.mov_ri(RDX, instr.whole);
+		as.call((const void *)&jit_execute<W>);
+		restore_counters();
+		check_error();
+	}
+
+	template <int W>
+	void JitEmitter<W>::emit_exception(int type, address_t data)
+	{
+		flush_counter();
+		set_pc(m_pc);
+		call_prologue();
+		as.mov_ri(RSI, type);
+		as.mov_ri(RDX, data);
+		as.call((const void *)&jit_exception<W>);
+		as.jmp(exception_label);
+	}
+
+	template <int W>
+	void JitEmitter<W>::emit_system_call(bool is_ebreak)
+	{
+		flush_counter();
+		set_pc(m_pc);
+		reveal_counters();
+		call_prologue();
+		if (is_ebreak)
+			as.mov_ri(RSI, SYSCALL_EBREAK);
+		else
+			load_reg(RSI, REG_ECALL);
+		as.mov_ri(RDX, m_len);
+		as.call((const void *)&jit_syscall<W>);
+		restore_counters();
+		as.alu_rr(OP_TEST, true, RAX, RAX);
+		as.jcc(CC_NE, epilogue_label);
+	}
+
+	template <int W>
+	bool JitEmitter<W>::emit_address(unsigned rs1, int32_t imm, uint64_t begin, uint64_t boundary)
+	{
+		load_reg(RAX, rs1);
+		if (imm != 0)
+			as.alu_ri(EXT_ADD, Q, RAX, imm);
+		if constexpr (encompassing_Nbit_arena != 0) {
+			if constexpr (encompassing_Nbit_arena == 32)
+				as.alu_rr(OP_MOV, false, RAX, RAX); // Zero-extend
+			else if constexpr (encompassing_Nbit_arena < 32)
+				as.alu_ri(EXT_AND, false, RAX, int32_t(encompassing_arena_mask));
+			else {
+				as.mov_ri(R11, encompassing_arena_mask);
+				as.alu_rr(OP_AND, true, RAX, R11);
+			}
+			return false;
+		}
+		// Range check: addr - begin < boundary
+		as.alu_rr(OP_MOV, Q, RDX, RAX);
+		sub_imm(RDX, begin);
+		cmp_imm(RDX, boundary);
+		return true;
+	}
+
+	template <int W>
+	void JitEmitter<W>::emit_load(rv32i_instruction instr)
+	{
+		const unsigned f3 = instr.Itype.funct3;
+		if (f3 == 0x7 || (f3 == 0x3 && W < 8) || (f3 == 0x6 && W < 8)) {
+			emit_fallback(instr);
+			return;
+		}
+		const bool fast = (layout.use_arena && layout.read_boundary > 0)
+			|| encompassing_Nbit_arena != 0;
+		const unsigned slow = as.new_label();
+		const unsigned resume = as.new_label();
+		if (fast) {
+			if (emit_address(instr.Itype.rs1, instr.Itype.signed_imm(), layout.read_begin, layout.read_boundary))
+				as.jcc(CC_AE, slow);
+			// RCX = arena[RAX]
+			switch (f3) {
+			case 0x0: case 0x4: // LB, LBU
+			case 0x1: case 0x5: // LH, LHU
+				as.rex(Q, RCX, RAX, REG_ARENA);
+				as.byte(0x0F);
+				as.byte(((f3 & 0x4) ? 0xB6 : 0xBE) | (f3 & 0x1));
+				as.mem_index(RCX, REG_ARENA, RAX);
+				break;
+			case 0x2: // LW
+				as.rex(Q, RCX, RAX, REG_ARENA);
+				as.byte(Q ? 0x63 : 0x8B); // MOVSXD or MOV
+				as.mem_index(RCX, REG_ARENA, RAX);
+				break;
+			case 0x6: // LWU
+				as.rex(false, RCX, RAX, REG_ARENA);
+				as.byte(0x8B);
+				as.mem_index(RCX, REG_ARENA, RAX);
+				break;
+			case 0x3: // LD
+				as.rex(true, RCX, RAX, REG_ARENA);
+				as.byte(0x8B);
+				as.mem_index(RCX, REG_ARENA, RAX);
+				break;
+			}
+			as.bind(resume);
+			store_reg(instr.Itype.rd, RCX);
+			m_cold.push_back({slow, resume, m_pc, instr, m_pending, false});
+		} else {
+			load_reg(RAX, instr.Itype.rs1);
+			if (instr.Itype.signed_imm() != 0)
+				as.alu_ri(EXT_ADD, Q, RAX, instr.Itype.signed_imm());
+			as.jmp(slow);
+			as.bind(resume);
+			store_reg(instr.Itype.rd, RCX);
+			m_cold.push_back({slow, resume, m_pc, instr, m_pending, false});
+		}
+	}
+
+	template <int W>
+	void JitEmitter<W>::emit_store(rv32i_instruction instr)
+	{
+		const unsigned f3 = instr.Stype.funct3;
+		if (f3 > 0x3 || (f3 == 0x3 && W < 8)) {
+			emit_fallback(instr);
+			return;
+		}
+		const bool fast = (layout.use_arena && layout.write_boundary > 0)
+			|| encompassing_Nbit_arena != 0;
+		const unsigned slow = as.new_label();
+		const unsigned resume = as.new_label();
+		load_reg(RCX, instr.Stype.rs2);
+		if (fast) {
+			if (emit_address(instr.Stype.rs1, instr.Stype.signed_imm(), layout.write_begin, layout.write_boundary))
+				as.jcc(CC_AE, slow);
+			// arena[RAX] = RCX
+			if (f3 == 0x1)
+				as.byte(0x66);
+			as.rex(f3 == 0x3, RCX, RAX, REG_ARENA);
+			as.byte(f3 == 0x0 ? 0x88 : 0x89);
+			as.mem_index(RCX, REG_ARENA, RAX);
+		} else {
+			load_reg(RAX, instr.Stype.rs1);
+			if (instr.Stype.signed_imm() != 0)
+				as.alu_ri(EXT_ADD, Q, RAX, instr.Stype.signed_imm());
+			as.jmp(slow);
+		}
+		as.bind(resume);
+		m_cold.push_back({slow, resume, m_pc, instr, m_pending, true});
+	}
+
+	template <int W>
+	void JitEmitter<W>::emit_cold_paths()
+	{
+		if (m_illegal_used) {
+			as.bind(illegal_label);
+			call_prologue();
+			as.mov_ri(RSI, ILLEGAL_OPCODE);
+			as.mov_ri(RDX, 0);
+			as.call((const void *)&jit_exception<W>);
+			as.jmp(exception_label);
+		}
+		for (const auto& cold : m_cold)
+		{
+			as.bind(cold.label);
+			store_value(layout.pc_off, cold.pc);
+			// Memory traps may read the instruction counter or stop the
+			// machine, so the pending instructions are counted for the call.
+			// The fast path still has them pending, so they are taken back
+			// out again when resuming.
+			const bool pending = cold.pending > 0 && !layout.ignore_instruction_limit;
+			if (pending)
+				as.alu_ri(EXT_ADD, true, REG_COUNTER, cold.pending);
+			reveal_counters();
+			if (cold.is_store) {
+				const unsigned f3 = cold.instr.Stype.funct3;
+				as.alu_rr(OP_MOV, true, RDX, RCX);
+				as.alu_rr(OP_MOV, true, RSI, RAX);
+				as.mov_ri(RCX, 1u << f3);
+				call_prologue();
+				as.call((const void *)&jit_mem_write<W>);
+				restore_counters();
+				check_error();
+			} else {
+				const unsigned f3 = cold.instr.Itype.funct3;
+				as.alu_rr(OP_MOV, true, RSI, RAX);
+				as.mov_ri(RDX, 1u << (f3 & 0x3));
+				call_prologue();
+				as.call((const void *)&jit_mem_read<W>);
+				restore_counters();
+				check_error(RDX);
+				switch (f3) {
+				case 0x0: as.extend(true, 8, Q, RCX, RAX); break;
+				case 0x1: as.extend(true, 16, Q, RCX, RAX); break;
+				case 0x4: as.extend(false, 8, false, RCX, RAX); break;
+				case 0x5: as.extend(false, 16, false, RCX, RAX); break;
+				case 0x2:
+					if constexpr (Q) as.movsxd(RCX, RAX);
+					else as.alu_rr(OP_MOV, false, RCX, RAX);
+					break;
+				case 0x6: as.alu_rr(OP_MOV, false, RCX, RAX); break;
+				default:  as.alu_rr(OP_MOV, true, RCX, RAX); break;
+				}
+			}
+			if (pending)
+				as.alu_ri(EXT_SUB, true, REG_COUNTER, cold.pending);
+			as.jmp(cold.resume);
+		}
+		m_cold.clear();
+	}
+
+	template <int W>
+	void JitEmitter<W>::emit_branch(rv32i_instruction instr)
+	{
+		static constexpr uint8_t conditions[8] = {
+			CC_E, CC_NE, 0, 0, CC_L, CC_GE, CC_B, CC_AE
+		};
+		const unsigned f3 = instr.Btype.funct3;
+		if (f3 == 0x2 || f3 == 0x3) {
+			emit_fallback(instr);
+			return;
+		}
+		flush_counter();
+		const address_t target = m_pc + instr.Btype.signed_imm();
+		const uint8_t cc = conditions[f3];
+
+		load_reg(RAX, instr.Btype.rs1);
+		if (instr.Btype.rs2 == 0) {
+			as.alu_rr(OP_TEST, Q, RAX, RAX);
+		} else {
+			load_reg(RCX, instr.Btype.rs2);
+			as.alu_rr(OP_CMP, Q, RAX, RCX);
+		}
+
+		const bool forward = is_local_forward(target);
+		if (forward && labels.count(target) && !(target & ALIGN_MASK)) {
+			as.jcc(cc, labels.at(target));
+			return;
+		}
+		// Not taken: skip over the jump
+		const unsigned skip = as.new_label();
+		as.jcc(cc ^ 1, skip);
+		if (target & ALIGN_MASK)
+			emit_exception(MISALIGNED_INSTRUCTION, target);
+		else
+			jump_to(target, true);
+		as.bind(skip);
+	}
+
+	template <int W>
+	bool JitEmitter<W>::emit_op_imm(rv32i_instruction instr)
+	{
+		const unsigned rd = instr.Itype.rd;
+		const unsigned rs1 = instr.Itype.rs1;
+		const int32_t imm = instr.Itype.signed_imm();
+		if (rd == 0)
+			return true;
+
+		switch (instr.Itype.funct3) {
+		case 0x0: // ADDI
+			if (rs1 == 0) {
+				store_reg_imm(rd, address_t(saddr_t(imm)));
+				return true;
+			}
+			load_reg(RAX, rs1);
+			if (imm != 0)
+				as.alu_ri(EXT_ADD, Q, RAX, imm);
+			break;
+		case 0x1: // SLLI
+			if ((instr.Itype.imm & (Q ? 0xFC0 : 0xFE0)) != 0)
+				return false;
+			load_reg(RAX, rs1);
+			as.shift_ri(EXT_SHL, Q, RAX, instr.Itype.imm & (W * 8 - 1));
+			break;
+		case 0x2: // SLTI
+		case 0x3: // SLTIU
+			load_reg(RCX, rs1);
+			as.alu_rr(OP_XOR, false, RAX, RAX);
+			as.alu_ri(EXT_CMP, Q, RCX, imm);
+			as.setcc(instr.Itype.funct3 == 0x2 ? CC_L : CC_B, RAX);
+			break;
+		case 0x4: // XORI
+			load_reg(RAX, rs1);
+			as.alu_ri(EXT_XOR, Q, RAX, imm);
+			break;
+		case 0x5: { // SRLI, SRAI
+			const unsigned high = instr.Itype.imm & (Q ? 0xFC0 : 0xFE0);
+			if (high != 0 && high != 0x400)
+				return false;
+			load_reg(RAX, rs1);
+			as.shift_ri(high ? EXT_SAR : EXT_SHR, Q, RAX, instr.Itype.imm & (W * 8 - 1));
+			} break;
+		case 0x6: // ORI
+			load_reg(RAX, rs1);
+			as.alu_ri(EXT_OR, Q, RAX, imm);
+			break;
+		case 0x7: // ANDI
+			load_reg(RAX, rs1);
+			as.alu_ri(EXT_AND, Q, RAX, imm);
+			break;
+		}
+		store_reg(rd, RAX);
+		return true;
+	}
+
+	template <int W>
+	bool JitEmitter<W>::emit_op(rv32i_instruction instr)
+	{
+		const unsigned rd = instr.Rtype.rd;
+		const unsigned f3 = instr.Rtype.funct3;
+		const unsigned f7 = instr.Rtype.funct7;
+		if (rd == 0)
+			return true;
+
+		if (f7 == 0x1 && f3 >= 0x4)
+			return false; // DIV, DIVU, REM, REMU
+		if (f7 == 0x1 && f3 == 0x2 && Q)
+			return false; // MULHSU
+		if (f7 == 0x20 && f3 != 0x0 && f3 != 0x5)
+			return false;
+		if (f7 != 0x0 && f7 != 0x1 && f7 != 0x20)
+			return false;
+
+		load_reg(RAX, instr.Rtype.rs1);
+		load_reg(RCX, instr.Rtype.rs2);
+		if (f7 == 0x1) {
+			switch (f3) {
+			case 0x0: // MUL
+				as.imul_rr(Q, RAX, RCX);
+				break;
+			case 0x1: // MULH
+			case 0x2: // MULHSU
+			case 0x3: // MULHU
+				if constexpr (Q) {
+					as.mul_wide(f3 == 0x1 ? EXT_IMUL : EXT_MUL, RCX);
+					as.alu_rr(OP_MOV, true, RAX, RDX);
+				} else {
+					// 32x32 -> 64-bit product, using zero-extended operands
+					if (f3 != 0x3) as.movsxd(RAX, RAX);
+					if (f3 == 0x1) as.movsxd(RCX, RCX);
+					as.imul_rr(true, RAX, RCX);
+					as.shift_ri(EXT_SHR, true, RAX, 32);
+				}
+				break;
+			}
+			store_reg(rd, RAX);
+			return true;
+		}
+		switch (f3) {
+		case 0x0: // ADD, SUB
+			as.alu_rr(f7 ? OP_SUB : OP_ADD, Q, RAX, RCX);
+			break;
+		case 0x1: // SLL
+			as.shift_cl(EXT_SHL, Q, RAX);
+			break;
+		case 0x2: // SLT
+		case 0x3: // SLTU
+			as.alu_rr(OP_XOR, false, RDX, RDX);
+			as.alu_rr(OP_CMP, Q, RAX, RCX);
+			as.setcc(f3 == 0x2 ? CC_L : CC_B, RDX);
+			as.alu_rr(OP_MOV, Q, RAX, RDX);
+			break;
+		case 0x4: // XOR
+			as.alu_rr(OP_XOR, Q, RAX, RCX);
+			break;
+		case 0x5: // SRL, SRA
+			as.shift_cl(f7 ? EXT_SAR : EXT_SHR, Q, RAX);
+			break;
+		case 0x6: // OR
+			as.alu_rr(OP_OR, Q, RAX, RCX);
+			break;
+		case 0x7: // AND
+			as.alu_rr(OP_AND, Q, RAX, RCX);
+			break;
+		}
+		store_reg(rd, RAX);
+		return true;
+	}
+
+	template <int W>
+	bool JitEmitter<W>::emit_op_imm32(rv32i_instruction instr)
+	{
+		if constexpr (!Q) {
+			return false;
+		} else {
+			const unsigned rd = instr.Itype.rd;
+			if (rd == 0)
+				return true;
+			const unsigned high = instr.Itype.imm & 0xFE0;
+			switch (instr.Itype.funct3) {
+			case 0x0: // ADDIW
+				load_reg(RAX, instr.Itype.rs1);
+				as.alu_ri(EXT_ADD, false, RAX, instr.Itype.signed_imm());
+				break;
+			case 0x1: // SLLIW
+				if (high != 0)
+					return false;
+				load_reg(RAX, instr.Itype.rs1);
+				as.shift_ri(EXT_SHL, false, RAX, instr.Itype.shift_imm());
+				break;
+			case 0x5: // SRLIW, SRAIW
+				if (high != 0 && high != 0x400)
+					return false;
+				load_reg(RAX, instr.Itype.rs1);
+				as.shift_ri(high ? EXT_SAR : EXT_SHR, false, RAX, instr.Itype.shift_imm());
+				break;
+			default:
+				return false;
+			}
+			as.movsxd(RAX, RAX);
+			store_reg(rd, RAX);
+			return true;
+		}
+	}
+
+	template <int W>
+	bool JitEmitter<W>::emit_op32(rv32i_instruction instr)
+	{
+		if constexpr (!Q) {
+			return false;
+		} else {
+			const unsigned rd = instr.Rtype.rd;
+			const unsigned f3 = instr.Rtype.funct3;
+			const unsigned f7 = instr.Rtype.funct7;
+			if (rd == 0)
+				return true;
+			// ADDW, SUBW, SLLW, SRLW, SRAW and MULW
+			const bool supported = (f7 == 0x0 && (f3 == 0x0 || f3 == 0x1 || f3 == 0x5))
+				|| (f7 == 0x20 && (f3 == 0x0 || f3 == 0x5))
+				|| (f7 == 0x1 && f3 == 0x0);
+			if (!supported)
+				return false;
+			load_reg(RAX, instr.Rtype.rs1);
+			load_reg(RCX, instr.Rtype.rs2);
+			if (f7 == 0x1)
+				as.imul_rr(false, RAX, RCX);
+			else if (f3 == 0x0)
+				as.alu_rr(f7 ? OP_SUB : OP_ADD, false, RAX, RCX);
+			else if (f3 == 0x1)
+				as.shift_cl(EXT_SHL, false, RAX);
+			else
+				as.shift_cl(f7 ? EXT_SAR : EXT_SHR, false, RAX);
+			as.movsxd(RAX, RAX);
+			store_reg(rd, RAX);
+			return true;
+		}
+	}
+
+	template <int W>
+	void JitEmitter<W>::emit_block(const TransInfo<W>& block, const std::unordered_set<address_t>& ebreak_locations)
+	{
+		m_block = &block;
+		address_t pc = block.basepc;
+
+		for (const auto original : block.instr)
+		{
+			m_pc = pc;
+			m_len = (compressed_enabled) ? original.length() : 4;
+			pc += m_len;
+
+			// Labels are entered with the counter up to date
+			auto it = labels.find(m_pc);
+			if (it != labels.end()) {
+				flush_counter();
+				as.bind(it->second);
+			}
+			m_pending += 1;
+
+			if (ebreak_locations.count(m_pc)) {
+				emit_system_call(true);
+			}
+
+			if (original.is_illegal()) {
+				flush_counter();
+				set_pc(m_pc);
+				as.jmp(illegal_label);
+				m_illegal_used = true;
+				continue;
+			}
+
+			rv32i_instruction instr = original;
+#ifdef RISCV_EXT_C
+			if (instr.is_compressed()) {
+				instr = expand_rvc<W>(original);
+				if (instr.is_compressed()) {
+					// Unexpanded (or illegal) compressed instruction
+					emit_fallback(original);
+					continue;
+				}
+			}
+#endif
+
+			switch (instr.opcode()) {
+			case RV32I_LOAD:
+				emit_load(instr);
+				break;
+			case RV32I_STORE:
+				emit_store(instr);
+				break;
+			case RV32I_BRANCH:
+				emit_branch(instr);
+				break;
+			case RV32I_JAL: {
+				const address_t target = m_pc + instr.Jtype.jump_offset();
+				if (target & ALIGN_MASK) {
+					emit_exception(MISALIGNED_INSTRUCTION, target);
+					break;
+				}
+				store_reg_imm(instr.Jtype.rd, m_pc + m_len);
+				jump_to(target, !is_local_forward(target));
+				} break;
+			case RV32I_JALR:
+				load_reg(RAX, instr.Itype.rs1);
+				if (instr.Itype.signed_imm() != 0)
+					as.alu_ri(EXT_ADD, Q, RAX, instr.Itype.signed_imm());
+				as.alu_ri(EXT_AND, Q, RAX, ~int32_t(ALIGN_MASK));
+				store_reg_imm(instr.Itype.rd, m_pc + m_len);
+				flush_counter();
+				as.store(Q, REG_CPU, layout.pc_off, RAX);
+				as.jmp(epilogue_label);
+				break;
+			case RV32I_OP_IMM:
+				if (!emit_op_imm(instr))
+					emit_fallback(original);
+				break;
+			case RV32I_OP:
+				if (!emit_op(instr))
+					emit_fallback(original);
+				break;
+			case RV64I_OP_IMM32:
+				if (!emit_op_imm32(instr))
+					emit_fallback(original);
+				break;
+			case RV64I_OP32:
+				if (!emit_op32(instr))
+					emit_fallback(original);
+				break;
+			case RV32I_LUI:
+				store_reg_imm(instr.Utype.rd, address_t(saddr_t(instr.Utype.upper_imm())));
+				break;
+			case RV32I_AUIPC:
+				store_reg_imm(instr.Utype.rd, m_pc + address_t(saddr_t(instr.Utype.upper_imm())));
+				break;
+			case RV32I_FENCE:
+				break;
+			case RV32I_SYSTEM:
+				if (instr.Itype.funct3 == 0x0 && instr.Itype.imm < 2) {
+					// ECALL and EBREAK
+					emit_system_call(instr.Itype.imm == 1);
+				} else if (instr.Itype.funct3 == 0x0 && (instr.Itype.imm == 261 || instr.Itype.imm == 0x7FF)) {
+					// WFI and STOP: Immediate stop at PC + 4
+					as.alu_rr(OP_XOR, false, REG_MAXCNT, REG_MAXCNT);
+					exit_to(m_pc + 4);
+				} else {
+					// CSRs and other system functions
+					flush_counter();
+					set_pc(m_pc);
+					reveal_counters();
+					call_prologue();
+					as.mov_ri(RSI, instr.whole);
+					as.call((const void *)&jit_system<W>);
+					restore_counters();
+					check_error();
+				}
+				break;
+			default:
+				emit_fallback(original);
+			}
+		}
+		// Gracefully finish the block, setting the new PC
+		exit_to(block.endpc);
+	}
+} // anonymous
+
+template <int W>
+void CPU<W>::jit_translate(const MachineOptions<W>& options, const TransBlocks<W>& found, TransOutput<W>& output) const
+{
+	const auto t0 = std::chrono::high_resolution_clock::now();
+	const auto& blocks = found.blocks;
+
+	// Offsets from the CPU to registers, counters and the memory arena
+	auto counters = const_cast<Machine<W>&> (machine()).get_counters();
+	const auto cpu_base = uintptr_t(this);
+	const auto offset_of = [cpu_base] (const void* ptr) -> int32_t {
+		const intptr_t offset = intptr_t(ptr) - intptr_t(cpu_base);
+		if (!fits_int32(offset))
+			throw MachineException(INVALID_PROGRAM, "JIT: CPU offset out of range", offset);
+		return int32_t(offset);
+	};
+	JitLayout layout;
+	layout.pc_off   = offset_of(&this->registers().pc);
+	layout.regs_off = offset_of(&this->registers().get()[0]);
+	layout.ins_counter_off = offset_of(&counters.first);
+	layout.max_counter_off = offset_of(&counters.second);
+	layout.arena_off = offset_of(&machine().memory.memory_arena_ptr_ref());
+	layout.read_begin     = Memory<W>::RWREAD_BEGIN;
+	layout.read_boundary  = machine().memory.memory_arena_read_boundary();
+	layout.write_begin    = machine().memory.initial_rodata_end();
+	layout.write_boundary = machine().memory.memory_arena_write_boundary();
+	layout.ignore_instruction_limit = options.translate_ignore_instruction_limit;
+	layout.use_arena = flat_readwrite_arena && options.translation_use_arena
+		&& machine().memory.uses_flat_memory_arena();
+
+	// Find the labels in every block, and the mappings that enter them.
+	// Mappings are the start of each block, global jump locations and
+	// the instructions after returning calls and jumps.
+	X64Assembler as;
+	std::unordered_map<address_type<W>, unsigned> labels;
+	std::vector<address_type<W>> entries;
+	for (const auto& block : blocks)
+	{
+		std::unordered_set<address_type<W>> boundaries;
+		std::vector<address_type<W>> targets;
+		address_type<W> pc = block.basepc;
+		bool reentry = true;
+		for (const auto original : block.instr)
+		{
+			const unsigned len = (compressed_enabled) ? original.length() : 4;
+			boundaries.insert(pc);
+			if (reentry || found.global_jump_locations.count(pc))
+				entries.push_back(pc);
+			reentry = false;
+
+			rv32i_instruction instr = original;
+#ifdef RISCV_EXT_C
+			if (instr.is_compressed())
+				instr = expand_rvc<W>(original);
+#endif
+			if (instr.is_long()) {
+				switch (instr.opcode()) {
+				case RV32I_BRANCH:
+					targets.push_back(pc + instr.Btype.signed_imm());
+					break;
+				case RV32I_JAL:
+					targets.push_back(pc + instr.Jtype.jump_offset());
+					reentry = (instr.Jtype.rd != 0);
+					break;
+				case RV32I_JALR:
+					reentry = true;
+					break;
+				case RV32I_SYSTEM:
+					reentry = (instr.Itype.funct3 == 0x0 && (instr.Itype.imm == 261 || instr.Itype.imm == 0x7FF));
+					break;
+				}
+			}
+			pc += len;
+		}
+		for (auto target : targets) {
+			if (boundaries.count(target) && !labels.count(target))
+				labels.emplace(target, as.new_label());
+		}
+	}
+	for (auto addr : entries) {
+		if (!labels.count(addr))
+			labels.emplace(addr, as.new_label());
+	}
+
+	// Shared function exits
+	const unsigned epilogue_label = as.new_label();
+	const unsigned exception_label = as.new_label();
+	as.bind(exception_label);
+	as.alu_rr(OP_XOR, false, REG_MAXCNT, REG_MAXCNT);
+	as.bind(epilogue_label);
+	as.alu_rr(OP_MOV, true, RAX, REG_COUNTER);
+	as.alu_rr(OP_MOV, true, RDX, REG_MAXCNT);
+	as.pop(R15);
+	as.pop(REG_ARENA);
+	as.pop(REG_MAXCNT);
+	as.pop(REG_COUNTER);
+	as.pop(REG_CPU);
+	as.ret();
+
+	JitEmitter<W> emitter(as, layout, labels, epilogue_label, exception_label);
+	for (const auto& block : blocks) {
+		emitter.emit_block(block, found.ebreak_locations);
+	}
+	emitter.emit_cold_paths();
+
+	// Entry stubs: one bintr_block_func for each mapping
+	std::vector<size_t> stub_offsets;
+	stub_offsets.reserve(entries.size());
+	for (auto addr : entries) {
+		stub_offsets.push_back(as.pos());
+		as.push(REG_CPU);
+		as.push(REG_COUNTER);
+		as.push(REG_MAXCNT);
+		as.push(REG_ARENA);
+		as.push(R15); // Keeps the stack 16-byte aligned for calls
+		as.alu_rr(OP_MOV, true, REG_CPU, RDI);
+		as.alu_rr(OP_MOV, true, REG_COUNTER, RSI);
+		as.alu_rr(OP_MOV, true, REG_MAXCNT, RDX);
+		as.load(true, REG_ARENA, REG_CPU, layout.arena_off);
+		as.jmp(labels.at(addr));
+	}
+	as.resolve();
+
+	// Copy into executable memory
+	const size_t size = (as.code.size() + Page::size() - 1) & ~(Page::size() - 1);
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		if (options.verbose_loader)
+			fprintf(stderr, "libriscv: JIT could not allocate %zu bytes of code\n", size);
+		return;
+	}
+	std::memcpy(memory, as.code.data(), as.code.size());
+	if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(memory, size);
+		if (options.verbose_loader)
+			fprintf(stderr, "libriscv: JIT could not make code executable\n");
+		return;
+	}
+	output.jit_code = new JitCode{memory, size};
+
+	output.jit_mappings.reserve(entries.size());
+	output.jit_handlers.reserve(entries.size());
+	for (size_t i = 0; i < entries.size(); i++) {
+		output.jit_mappings.push_back({entries[i], unsigned(i)});
+		output.jit_handlers.push_back((bintr_block_func<W>)((uint8_t *)memory + stub_offsets[i]));
+	}
+
+	if constexpr (VERBOSE_JIT) {
+		for (auto addr : entries)
+			printf("JIT entry at 0x%lX\n", long(addr));
+	}
+	if (options.translate_timing) {
+		const auto t1 = std::chrono::high_resolution_clock::now();
+		printf(">> JIT code generation took %ld ns, %zu bytes\n",
+			long(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count()), as.code.size());
+	}
+	if (options.verbose_loader) {
+		printf("libriscv: JIT emitted %zu bytes for %zu instructions, %zu blocks and %zu mappings\n",
+			as.code.size(), found.icounter, blocks.size(), entries.size());
+	}
+}
+
+#ifdef RISCV_32I
+	template void CPU<4>::jit_translate(const MachineOptions<4>&, const TransBlocks<4>&, TransOutput<4>&) const;
+#endif
+#ifdef RISCV_64I
+	template void CPU<8>::jit_translate(const MachineOptions<8>&, const TransBlocks<8>&, TransOutput<8>&) const;
+#endif
+} // riscv
@@ -4,10 +4,12 @@
 #  define RISCV_HAS_BITOPS
 # endif
 #endif
+#include <cinttypes>
 #include <cmath>
 #include <chrono>
 #include <fstream>
 #include <mutex>
+#include <thread>
 #if defined(__MINGW32__) || defined(__MINGW64__) || defined(_MSC_VER)
 # define YEP_IS_WINDOWS 1
 # include "win32/dlfcn.h"
@@ -52,6 +54,14 @@ namespace riscv
 		}
 	extern void  dylib_close(void* dylib, bool is_libtcc);
 	extern void* dylib_lookup(void* dylib, const char*, bool is_libtcc);
+	// Translation cache directory, see tr_cache.cpp
+	extern int  translation_cache_lock(const std::string& filename);
+	extern void translation_cache_unlock(int lock);
+	extern std::string translation_cache_tmpname(const std::string& filename);
+	extern bool translation_cache_publish(const std::string& tmpfile, const std::string& filename);
+	extern void translation_cache_touch(const std::string& filename);
+	extern bool translation_cache_seed(const std::string& seed_dir, const std::string& filename);
+	extern void translation_cache_evict(const std::string& prefix, const std::string& suffix, uint64_t max_bytes, const std::string& keep);
 
 	template <int W>
 	using binary_translation_init_func = void (*)(const CallbackTable<W>&, void*);
@@ -62,12 +72,6 @@ namespace riscv
 	// file directly in the project, which allows it to run global constructors.
 	// The constructor will register the translation with the binary translator,
 	// and we can check against this list when loading translations.
-	template <int W>
-	struct Mapping {
-		address_type<W> addr;
-		unsigned mapping_index;
-	};
-
 	// This implementation is designed to make sure it's not a global constructor
 	// instead it will get zeroed from BSS
 	static constexpr size_t MAX_EMBEDDED = 12;
@@ -138,6 +142,10 @@ static std::unordered_map<std::string, std::string> create_defines_for(const Mac
 	const auto ins_counter_offset = uintptr_t(&counters.first) - uintptr_t(&machine);
 	const auto max_counter_offset = uintptr_t(&counters.second) - uintptr_t(&machine);
 	const auto arena_offset = uintptr_t(&machine.memory.memory_arena_ptr_ref()) - uintptr_t(&machine);
+	const auto exec_segment_offset = uintptr_t(&machine.cpu.current_execute_segment_ref()) - uintptr_t(&machine);
+	// Calculate offset from the execute segment to its decoder patched flag
+	const auto& exec = machine.cpu.current_execute_segment();
+	const auto decoder_patched_offset = uintptr_t(&exec.decoder_patched_ref()) - uintptr_t(&exec);
 
 	// Some executables are loaded at high-memory addresses, which is outside of the memory arena.
 	size_t arena_end                   = machine.memory.memory_arena_size();
@@ -171,6 +179,8 @@ static std::unordered_map<std::string, std::string> create_defines_for(const Mac
 	defines.emplace("RISCV_INS_COUNTER_OFF", std::to_string(ins_counter_offset));
 	defines.emplace("RISCV_MAX_COUNTER_OFF", std::to_string(max_counter_offset));
 	defines.emplace("RISCV_ARENA_OFF", std::to_string(arena_offset));
+	defines.emplace("RISCV_EXEC_SEGMENT_OFF", std::to_string(exec_segment_offset));
+	defines.emplace("RISCV_DECODER_PATCHED_OFF", std::to_string(decoder_patched_offset));
 	if constexpr (atomics_enabled) {
 		defines.emplace("RISCV_EXT_A", "1");
 	}
@@ -191,9 +201,28 @@ static std::unordered_map<std::string, std::string> create_defines_for(const Mac
 	if (options.translate_ignore_instruction_limit) {
 		defines.emplace("RISCV_IGNORE_INSTRUCTION_LIMIT", "1");
 	}
+	if (options.translate_block_chaining) {
+		defines.emplace("RISCV_BLOCK_CHAINING", "1");
+	}
+	if (options.translate_function_register_caching) {
+		defines.emplace("RISCV_FUNCTION_REGISTER_CACHING", "1");
+	}
 	if constexpr (encompassing_Nbit_arena != 0) {
 		defines.emplace("RISCV_NBIT_UNBOUNDED", std::to_string(encompassing_Nbit_arena));
 	}
+	if (!options.translation_profile.empty()) {
+		// Translations are specific to the profile they were made with
+		uint32_t profile_hash = 0;
+		for (const auto& [addr, count] : options.translation_profile.blocks) {
+			const uint64_t entry[2] = { uint64_t(addr), count };
+			profile_hash = crc32c(profile_hash, entry, sizeof(entry));
+		}
+		for (const auto& [addr, branch] : options.translation_profile.branches) {
+			const uint64_t entry[3] = { uint64_t(addr), branch.taken, branch.not_taken };
+			profile_hash = crc32c(profile_hash, entry, sizeof(entry));
+		}
+		defines.emplace("RISCV_TRANSLATION_PROFILE", std::to_string(profile_hash));
+	}
 	return defines;
 }
 
@@ -291,6 +320,17 @@ int CPU<W>::load_translation(const MachineOptions<W>& options,
 		static std::mutex dlopen_mutex;
 		std::lock_guard<std::mutex> lock(dlopen_mutex);
 		dylib = dlopen(filebuffer, RTLD_LAZY);
+		if (dylib == nullptr && !options.translation_cache_seed.empty()
+			&& translation_cache_seed(options.translation_cache_seed, filebuffer))
+		{
+			// Translations produced ahead of time are copied into the cache
+			dylib = dlopen(filebuffer, RTLD_LAZY);
+		}
+		else if (dylib != nullptr && options.translation_cache_max_bytes != 0)
+		{
+			// The modification time is the last use, for LRU eviction
+			translation_cache_touch(filebuffer);
+		}
 		if (options.translate_timing) {
 			TIME_POINT(t8);
 			printf(">> dlopen took %ld ns\n", nanodiff(t7, t8));
@@ -301,7 +341,7 @@ int CPU<W>::load_translation(const MachineOptions<W>& options,
 	// JIT-compilation with libtcc is secondary to high-performance
 	// pre-compiled translations. If no embedded translation is found,
 	// and no shared library is found we may JIT-compile the translation.
-	if constexpr (libtcc_enabled) {
+	if constexpr (libtcc_enabled || jit_enabled) {
 		if (must_compile)
 			return 1;
 	}
@@ -370,6 +410,16 @@ static bool is_stopping_instruction(rv32i_instruction instr) {
 	return false;
 }
 
+// Alignment fill that compilers emit between functions
+static bool is_padding_instruction(rv32i_instruction instr) {
+	if (instr.half[0] == 0x0000) // Zero fill (C.UNIMP)
+		return true;
+	if (instr.is_long())
+		return instr.whole == 0x00000013 // NOP
+			|| instr.whole == 0xC0001073; // UNIMP
+	return instr.half[0] == 0x0001; // C.NOP
+}
+
 template <int W>
 static void record_return_location(std::unordered_map<address_type<W>, address_type<W>>& single_return_locations, address_type<W> caller, address_type<W> callee)
 {
@@ -385,11 +435,46 @@ static void record_return_location(std::unordered_map<address_type<W>, address_t
 	}
 }
 
+// Profile-guided translation: Keep the hottest blocks within the translation
+// limits, and emit them hottest first so that hot code ends up together
 template <int W>
-void CPU<W>::binary_translate(const MachineOptions<W>& options, DecodedExecuteSegment<W>& exec,
-	TransOutput<W>& output) const
+static void select_profiled_blocks(const MachineOptions<W>& options, TransBlocks<W>& result)
 {
-	// Run with VERBOSE=1 to see command and output
+	const auto& profile = options.translation_profile;
+	auto& blocks = result.blocks;
+	std::vector<std::pair<uint64_t, size_t>> order; // Heat and block index
+	order.reserve(blocks.size());
+	for (size_t i = 0; i < blocks.size(); i++)
+		order.emplace_back(profile.heat(blocks[i].basepc, blocks[i].endpc), i);
+	std::stable_sort(order.begin(), order.end(),
+		[] (const auto& a, const auto& b) { return a.first > b.first; });
+
+	std::vector<TransInfo<W>> selected;
+	selected.reserve(std::min(blocks.size(), size_t(options.translate_blocks_max)));
+	size_t icounter = 0;
+	for (const auto& [heat, idx] : order) {
+		if (selected.size() >= options.translate_blocks_max)
+			break;
+		const size_t length = blocks[idx].instr.size();
+		if (icounter + length >= options.translate_instr_max)
+			continue;
+		icounter += length;
+		selected.push_back(std::move(blocks[idx]));
+		selected.back().profile = &profile;
+	}
+	if (options.verbose_loader) {
+		printf("libriscv: Translation profile selected %zu of %zu blocks\n",
+			selected.size(), blocks.size());
+	}
+	blocks.swap(selected);
+	result.icounter = icounter;
+}
+
+template <int W>
+void CPU<W>::find_translation_blocks(const MachineOptions<W>& options, DecodedExecuteSegment<W>& exec,
+	TransBlocks<W>& result) const
+{
+	TIME_POINT(t0);
 	const bool verbose = options.verbose_loader;
 	const bool trace_instructions = options.translate_trace;
 
@@ -399,7 +484,7 @@ void CPU<W>::binary_translate(const MachineOptions<W>& options, DecodedExecuteSe
 	const address_t arena_roend = machine().memory.initial_rodata_end();
 	const address_t arena_size  = machine().memory.memory_arena_size();
 
-	address_t gp = 0;
+	address_t& gp = result.gp;
 if constexpr (SCAN_FOR_GP) {
 	// We assume that GP is initialized with AUIPC,
 	// followed by OP_IMM (and maybe OP_IMM32)
@@ -431,12 +516,12 @@ if constexpr (SCAN_FOR_GP) {
 	} // iterator
 	if (options.translate_timing) {
 		TIME_POINT(t1);
-		printf(">> GP scan took %ld ns, GP=0x%lX\n", nanodiff(output.t0, t1), (long)gp);
+		printf(">> GP scan took %ld ns, GP=0x%lX\n", nanodiff(t0, t1), (long)gp);
 	}
 } // SCAN_FOR_GP
 
 	// EBREAK locations
-	std::unordered_set<address_type<W>> ebreak_locations;
+	auto& ebreak_locations = result.ebreak_locations;
 	for (auto& loc : options.ebreak_locations) {
 		address_t addr = 0;
 		if (std::holds_alternative<address_type<W>>(loc))
@@ -453,11 +538,13 @@ if constexpr (SCAN_FOR_GP) {
 
 	// Code block and loop detection
 	TIME_POINT(t2);
+	// With a profile, all blocks are found first, and the hottest are kept
+	const bool use_profile = !options.translation_profile.empty();
 	static constexpr size_t ITS_TIME_TO_SPLIT = (libtcc_enabled) ? 150'000 : 1'250;
-	size_t icounter = 0;
-	std::unordered_set<address_type<W>> global_jump_locations;
+	size_t& icounter = result.icounter;
+	auto& global_jump_locations = result.global_jump_locations;
 	std::unordered_map<address_type<W>, address_type<W>> single_return_locations;
-	std::vector<TransInfo<W>> blocks;
+	auto& blocks = result.blocks;
 
 	// Insert the ELF entry point as the first global jump location
 	const auto elf_entry = machine().memory.start_address();
@@ -472,10 +559,58 @@ if constexpr (SCAN_FOR_GP) {
 		}
 	}
 
-	for (address_t pc = basepc; pc < endbasepc && icounter < options.translate_instr_max; )
+	// Call analysis: The targets of calls are function entries. Blocks end
+	// where a function ends, so that a whole function is emitted as one C
+	// function, and its loops stay inside it, even across indirect jumps.
+	std::unordered_set<address_t> function_entries;
+	for (address_t pc = basepc; pc < endbasepc; ) {
+		const rv32i_instruction instruction
+			= read_instruction(exec.exec_data(), pc, endbasepc);
+		if (instruction.opcode() == RV32I_JAL && instruction.Jtype.rd != 0)
+			function_entries.insert(pc + instruction.Jtype.jump_offset());
+#ifdef RISCV_EXT_C
+		else if (W == 4 && instruction.is_compressed()
+			&& rv32c_instruction{instruction}.opcode() == CI_CODE(0b001, 0b01)) // C.JAL
+			function_entries.insert(pc + rv32c_instruction{instruction}.CJ.signed_imm());
+#endif
+		if constexpr (compressed_enabled)
+			pc += instruction.length();
+		else
+			pc += 4;
+	}
+	// Functions are often padded for alignment, so a function also ends
+	// where only padding separates it from the next function entry.
+	static constexpr address_t FUNCTION_PADDING_MAX = 64;
+	auto next_function_entry = [&] (address_t pc, address_t& entry) -> bool {
+		for (const address_t end = pc + FUNCTION_PADDING_MAX; pc < endbasepc && pc <= end; ) {
+			if (function_entries.count(pc)) {
+				entry = pc;
+				return true;
+			}
+			const rv32i_instruction instruction
+				= read_instruction(exec.exec_data(), pc, endbasepc);
+			if (!is_padding_instruction(instruction))
+				return false;
+			if constexpr (compressed_enabled)
+				pc += instruction.length();
+			else
+				pc += 4;
+		}
+		return false;
+	};
+	// Functions that are too large are split anyway
+	static constexpr size_t ITS_TIME_TO_FORCE_SPLIT = 4 * ITS_TIME_TO_SPLIT;
+
+	// Whether the next block begins where a function begins
+	bool at_function_boundary = !function_entries.empty();
+
+	for (address_t pc = basepc; pc < endbasepc && (use_profile || icounter < options.translate_instr_max); )
 	{
 		const auto block = pc;
 		std::size_t block_insns = 0;
+		// Blocks that hold whole functions keep registers in locals
+		const bool begins_with_function = at_function_boundary;
+		bool ends_with_function = true;
 
 		for (; pc < endbasepc; ) {
 			const rv32i_instruction instruction
@@ -488,11 +623,25 @@ if constexpr (SCAN_FOR_GP) {
 
 			// JALR and STOP are show-stoppers / code-block enders
 			if (block_insns >= ITS_TIME_TO_SPLIT && is_stopping_instruction(instruction)) {
-				break;
+				// Prefer the show-stopper right before the next function begins,
+				// and let the block cover the padding in between
+				if (function_entries.empty() || block_insns >= ITS_TIME_TO_FORCE_SPLIT) {
+					ends_with_function = false;
+					break;
+				}
+				if (address_t entry; next_function_entry(pc, entry)) {
+					pc = entry;
+					break;
+				}
 			}
 		}
 
 		auto block_end = pc;
+		at_function_boundary = ends_with_function && !function_entries.empty();
+		const bool whole_functions = begins_with_function && at_function_boundary;
+		// Tiered execution only translates blocks that have been warm
+		if (!exec.is_warm_region(block, block_end))
+			continue;
 		std::unordered_set<address_t> jump_locations;
 		std::vector<rv32i_instruction> block_instructions;
 		block_instructions.reserve(block_insns);
@@ -578,7 +727,7 @@ if constexpr (SCAN_FOR_GP) {
 
 		// Process block and add it for emission
 		const size_t length = block_instructions.size();
-		if (length > 0 && icounter + length < options.translate_instr_max)
+		if (length > 0 && (use_profile || icounter + length < options.translate_instr_max))
 		{
 			if constexpr (VERBOSE_BLOCKS) {
 				printf("Block found at %#lX -> %#lX. Length: %zu\n", long(block), long(block_end), length);
@@ -594,7 +743,8 @@ if constexpr (SCAN_FOR_GP) {
 				trace_instructions,
 				options.translate_ignore_instruction_limit,
 				options.use_shared_execute_segments,
-				options.translate_use_register_caching,
+				options.translate_use_register_caching
+					|| (options.translate_function_register_caching && whole_functions),
 				std::move(jump_locations),
 				std::move(single_return_locations),
 				nullptr, // blocks
@@ -608,48 +758,145 @@ if constexpr (SCAN_FOR_GP) {
 			icounter += length;
 			// we can't translate beyond this estimate, otherwise
 			// the compiler will never finish code generation
-			if (blocks.size() >= options.translate_blocks_max)
+			if (!use_profile && blocks.size() >= options.translate_blocks_max)
 				break;
 		}
 
 		pc = block_end;
 	}
 
+	if (use_profile)
+		select_profiled_blocks(options, result);
+
 	TIME_POINT(t3);
 	if (options.translate_timing) {
 		printf(">> Code block detection %ld ns\n", nanodiff(t2, t3));
 	}
+	for (auto& block : blocks)
+		block.blocks = &blocks;
+}
+
+// Block chaining: Each block function is wrapped in a function that keeps
+// calling the block at the new PC for as long as it can be found in an
+// open-addressing hash table of all mappings, and the instruction limit
+// has not been reached. Indirect jumps out of a block will then stay in
+// translated code instead of returning to the dispatcher. Static jumps
+// tail-call the next block directly (see CHAIN_DIRECT), and only end up
+// here when that is not possible. Returns the names of the wrappers,
+// which replace the handlers in the footer.
+template <int W>
+static std::vector<std::string> emit_block_chaining(std::string& footer,
+	const std::vector<TransMapping<W>>& mappings, const std::vector<const std::string*>& handlers)
+{
+	unsigned bits = 4;
+	while ((size_t(1) << bits) < 2 * mappings.size())
+		bits++;
+	const size_t mask = (size_t(1) << bits) - 1;
+	// Fibonacci hashing, as sequential PCs would cluster with a plain mask
+	auto slot_of = [bits] (address_type<W> addr) -> size_t {
+		return (uint64_t(addr) * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+	};
+
+	std::vector<const TransMapping<W>*> table(mask + 1, nullptr);
+	for (const auto& mapping : mappings)
+	{
+		size_t slot = slot_of(mapping.addr);
+		while (table[slot] != nullptr && table[slot]->addr != mapping.addr)
+			slot = (slot + 1) & mask;
+		if (table[slot] == nullptr)
+			table[slot] = &mapping;
+	}
+
+	footer += "#define CHAIN_BITS " + std::to_string(bits) + "\n";
+	footer += R"V0G0N(#define CHAIN_MASK ((1u << CHAIN_BITS) - 1)
+typedef ReturnValues (*chain_func)(CPU*, uint64_t, uint64_t, addr_t);
+static const struct {
+	addr_t     pc;
+	chain_func func;
+} chain_table[1u << CHAIN_BITS] = {
+)V0G0N";
+	for (size_t slot = 0; slot <= mask; slot++) {
+		if (table[slot] == nullptr)
+			continue;
+		char buffer[128];
+		snprintf(buffer, sizeof(buffer), "[%zu] = {0x%" PRIx64 ", ", slot, uint64_t(table[slot]->addr));
+		footer += buffer + table[slot]->symbol + "},\n";
+	}
+	footer += R"V0G0N(};
+static inline ReturnValues chain(CPU* cpu, ReturnValues rv, const void* exec)
+{
+	// A system call that changed the execute segment, eg. by evicting
+	// it, returns to the dispatcher instead of staying in this translation.
+	// So does a patched decoder cache, as the dispatcher must see breakpoints.
+	while (LIKELY(rv.counter < rv.max_counter && EXEC_SEGMENT(cpu) == exec && !DECODER_PATCHED(exec))) {
+		const addr_t pc = cpu->pc;
+		unsigned slot = ((uint64_t)pc * 0x9E3779B97F4A7C15ull) >> (64 - CHAIN_BITS);
+		while (chain_table[slot].pc != pc && chain_table[slot].func != 0)
+			slot = (slot + 1) & CHAIN_MASK;
+		if (chain_table[slot].func == 0)
+			break;
+		rv = chain_table[slot].func(cpu, rv.counter, rv.max_counter, pc);
+	}
+	return rv;
+}
+)V0G0N";
+
+	std::vector<std::string> wrappers;
+	wrappers.reserve(handlers.size());
+	for (auto* handler : handlers) {
+		wrappers.push_back("chain_" + *handler);
+		footer += "static ReturnValues " + wrappers.back() + "(CPU* cpu, uint64_t counter, uint64_t max_counter, addr_t pc) {\n"
+			"  const void* exec = EXEC_SEGMENT(cpu);\n"
+			"  return chain(cpu, " + *handler + "(cpu, counter, max_counter, pc), exec);\n}\n";
+	}
+	return wrappers;
+}
+
+template <int W>
+void CPU<W>::binary_translate(const MachineOptions<W>& options, DecodedExecuteSegment<W>& exec,
+	TransOutput<W>& output) const
+{
+	// Run with VERBOSE=1 to see command and output
+	const bool verbose = options.verbose_loader;
+
+	TransBlocks<W> found;
+	this->find_translation_blocks(options, exec, found);
+	auto& blocks = found.blocks;
+	const size_t icounter = found.icounter;
+	const address_t gp = found.gp;
+
+#ifdef RISCV_JIT
+	// The JIT backend produces machine code directly from the code blocks.
+	// C code is still needed when cross-compiling or embedding the result.
+	if constexpr (W != 16) {
+		this->jit_translate(options, found, output);
+		if (output.jit_code != nullptr && options.cross_compile.empty())
+			return;
+	}
+#endif
 
 	// Code generation
+	TIME_POINT(t3);
 	auto& dlmappings = output.mappings;
 	extern const std::string bintr_code;
 	output.code = std::make_shared<std::string>(bintr_code);
 
+	output.block_offsets.reserve(blocks.size() + 1);
 	for (auto& block : blocks)
 	{
-		block.blocks = &blocks;
+		output.block_offsets.push_back(output.code->size());
 		auto result = emit(*output.code, block);
 
 		for (auto& mapping : result) {
 			dlmappings.push_back(std::move(mapping));
 		}
 	}
-	// Append all instruction handler -> dl function mappings
-	// to the footer used by shared libraries
-	auto& footer = output.footer;
-	footer += "VISIBLE const uint32_t no_mappings = "
-		+ std::to_string(dlmappings.size()) + ";\n";
-	footer += R"V0G0N(
-struct Mapping {
-	addr_t   addr;
-	unsigned mapping_index;
-};
-VISIBLE const struct Mapping mappings[] = {
-)V0G0N";
+	output.block_offsets.push_back(output.code->size());
 
 	std::unordered_map<std::string, unsigned> mapping_indices;
 	std::vector<const std::string*> handlers;
 	handlers.reserve(blocks.size());
+	std::string mapping_table;
 
 	for (const auto& mapping : dlmappings)
 	{
@@ -668,17 +915,41 @@ VISIBLE const struct Mapping mappings[] = {
 		snprintf(buffer, sizeof(buffer), 
 			"{0x%lX, %u},\n",
 			(long)mapping.addr, mapping_index);
-		footer.append(buffer);
+		mapping_table.append(buffer);
+	}
+	if (handlers.size() != blocks.size())
+		throw MachineException(INVALID_PROGRAM, "Mismatch in unique mappings");
+
+	// Append all instruction handler -> dl function mappings
+	// to the footer used by shared libraries. The handlers are declared,
+	// as the footer may be compiled separately from the blocks.
+	auto& footer = output.footer;
+	for (auto* handler : handlers) {
+		footer += "BLOCK_FUNC ReturnValues " + *handler + "(CPU*, uint64_t, uint64_t, addr_t);\n";
 	}
-	footer += "};\nVISIBLE const uint32_t no_handlers = "
+	footer += "VISIBLE const uint32_t no_mappings = "
+		+ std::to_string(dlmappings.size()) + ";\n";
+	footer += R"V0G0N(
+struct Mapping {
+	addr_t   addr;
+	unsigned mapping_index;
+};
+VISIBLE const struct Mapping mappings[] = {
+)V0G0N";
+	footer += mapping_table;
+	footer += "};\n";
+
+	std::vector<std::string> wrappers;
+	if (options.translate_block_chaining)
+		wrappers = emit_block_chaining<W>(footer, dlmappings, handlers);
+
+	footer += "VISIBLE const uint32_t no_handlers = "
 		+ std::to_string(mapping_indices.size()) + ";\n"
 		+ "VISIBLE const void* unique_mappings[] = {\n";
 
 	// Create array of unique mappings
-	if (handlers.size() != blocks.size())
-		throw MachineException(INVALID_PROGRAM, "Mismatch in unique mappings");
-	for (auto* handler : handlers) {
-		footer += "    " + *handler + ",\n";
+	for (size_t i = 0; i < handlers.size(); i++) {
+		footer += "    " + (wrappers.empty() ? *handlers[i] : wrappers[i]) + ",\n";
 	}
 	footer += "};\n";
 
@@ -693,6 +964,50 @@ VISIBLE const struct Mapping mappings[] = {
 	}
 }
 
+// Split the generated code into translation units by block, so that
+// they can be compiled concurrently. The first unit holds the mappings and
+// the init function. Returns nothing when the code should not be split.
+template <int W>
+static std::vector<std::string> split_translation_units(const MachineOptions<W>& options, const TransOutput<W>& output)
+{
+	static constexpr size_t MIN_UNIT_BYTES = 64u << 10;
+	const auto& offsets = output.block_offsets;
+	if (output.code == nullptr || offsets.size() < 3)
+		return {};
+	const size_t begin = offsets.front();
+	const size_t total = offsets.back() - begin;
+
+	size_t shards = options.translate_shards;
+	if (shards == 0)
+		shards = std::thread::hardware_concurrency();
+	shards = std::min({shards, offsets.size() - 1, 1 + total / MIN_UNIT_BYTES});
+	if (shards <= 1)
+		return {};
+
+	const std::string_view header { output.code->data(), begin };
+	auto make_unit = [&] (size_t index) {
+		std::string unit = "#define RISCV_TRANSLATION_SHARD " + std::to_string(index) + "\n";
+		unit.append(header);
+		return unit;
+	};
+	std::vector<std::string> units;
+	units.push_back(make_unit(0) + output.footer);
+
+	// Cut between blocks, as close to an even split of the code as possible
+	size_t unit_begin = begin;
+	for (size_t i = 1; i < offsets.size(); i++)
+	{
+		const size_t target = begin + total * units.size() / shards;
+		if (offsets[i] >= target || i == offsets.size() - 1) {
+			std::string unit = make_unit(units.size());
+			unit.append(*output.code, unit_begin, offsets[i] - unit_begin);
+			units.push_back(std::move(unit));
+			unit_begin = offsets[i];
+		}
+	}
+	return units;
+}
+
 template <int W>
 void CPU<W>::produce_embeddable_code(const MachineOptions<W>& options, DecodedExecuteSegment<W>& exec,
 	const TransOutput<W>& output, const MachineTranslationEmbeddableCodeOptions& embed)
@@ -767,7 +1082,9 @@ void CPU<W>::try_translate(const MachineOptions<W>& options, const std::string&
 	output.t0 = t0;
 
 	output.defines = create_defines_for(machine(), options);
-	const bool live_patch = options.translate_background_callback != nullptr;
+	// Tiered segments are already executing, so they are always live-patched
+	const bool live_patch = options.translate_background_callback != nullptr
+		|| shared_segment->is_tiered();
 	void* arena = machine().memory.memory_arena_ptr_ref();
 
 	// Compilation step
@@ -775,6 +1092,11 @@ void CPU<W>::try_translate(const MachineOptions<W>& options, const std::string&
 	[this, options, output = std::move(output), filename, arena, live_patch, shared_segment = shared_segment] () mutable
 	{
 		auto* exec = shared_segment.get();
+		// Tiered execution: The first tier only translates the warm regions,
+		// and must not be cached, as it is not a complete translation. The
+		// second tier then replaces it with a complete translation.
+		const bool partial = exec->hot_tier() == 1;
+		bool retranslate = exec->is_binary_translated();
 
 		this->binary_translate(options, *exec, output);
 
@@ -783,6 +1105,8 @@ void CPU<W>::try_translate(const MachineOptions<W>& options, const std::string&
 
 		for (auto& cc : options.cross_compile)
 		{
+			if (partial)
+				break;
 			if (std::holds_alternative<MachineTranslationEmbeddableCodeOptions>(cc))
 			{
 				auto& embed = std::get<MachineTranslationEmbeddableCodeOptions>(cc);
@@ -790,9 +1114,45 @@ void CPU<W>::try_translate(const MachineOptions<W>& options, const std::string&
 			}
 		}
 
+#ifdef RISCV_JIT
+		if (output.jit_code != nullptr) {
+			if (!exec->is_binary_translated() || retranslate) {
+				TIME_POINT(t8);
+				exec->retire_binary_translation();
+				exec->set_binary_translated(output.jit_code, false, true);
+				activate_mappings(options, *exec, output.jit_mappings.data(), output.jit_mappings.size(),
+					output.jit_handlers.data(), output.jit_handlers.size(), live_patch);
+				if (options.translate_timing) {
+					TIME_POINT(t9);
+					printf(">> JIT activation %ld ns\n", nanodiff(t8, t9));
+				}
+				if (options.verbose_loader) {
+					printf("libriscv: Activated JIT binary translation with %zu mappings%s\n",
+						output.jit_mappings.size(), live_patch ? ", live-patching enabled" : "");
+				}
+			} else {
+				extern void jit_close(void* jit);
+				jit_close(output.jit_code);
+			}
+			output.jit_code = nullptr;
+			retranslate = false;
+			exec->finish_hot_promotion();
+			// Without cross-compilation there is no C code to compile
+			if (output.code == nullptr) {
+				if (options.translate_timing) {
+					TIME_POINT(t10);
+					printf(">> Binary translation totals %.2f ms\n", nanodiff(output.t0, t10) / 1e6);
+				}
+				return;
+			}
+		}
+#endif
+
 		void* dylib = nullptr;
 		// Final shared library loadable code w/footer
 		const std::string shared_library_code = *output.code + output.footer;
+		// Or the same code split into several translation units
+		const auto units = split_translation_units(options, output);
 
 		TIME_POINT(t9);
 		if constexpr (libtcc_enabled) {
@@ -802,20 +1162,43 @@ void CPU<W>::try_translate(const MachineOptions<W>& options, const std::string&
 			std::lock_guard<std::mutex> lock(libtcc_mutex);
 			dylib = libtcc_compile(shared_library_code, W, output.defines, "");
 		} else {
-			extern void* compile(const std::string&, int arch, const std::string& cflags, const std::string&);
+			extern void* compile_units(const std::vector<std::string>&, int arch, const std::string& cflags, const std::string&);
 			extern bool mingw_compile(const std::string&, int arch, const std::string& cflags, const std::string&, const MachineTranslationCrossOptions&);
 			const std::string cflags = defines_to_string(output.defines);
 
 			// If the binary translation has already been loaded, we can skip compilation
-			if (exec->is_binary_translated()) {
+			if (exec->is_binary_translated() && !retranslate) {
 				dylib = exec->binary_translation_so();
 			} else {
-				dylib = compile(shared_library_code, W, cflags, filename);
+				// Only one process produces each cached translation, while
+				// the others wait for it, and then load it from the cache
+				const bool cached = options.translation_cache && !partial;
+				const int cache_lock = cached ? translation_cache_lock(filename) : -1;
+				if (cache_lock >= 0)
+					dylib = dlopen(filename.c_str(), RTLD_LAZY);
+				if (dylib == nullptr) {
+					// Compile to a temporary file, which is published once complete
+					const std::string tmpfile = translation_cache_tmpname(filename);
+					dylib = units.empty() ? compile_units({shared_library_code}, W, cflags, tmpfile)
+						: compile_units(units, W, cflags, tmpfile);
+					if (dylib != nullptr && cached) {
+						translation_cache_publish(tmpfile, filename);
+						if (options.translation_cache_max_bytes != 0)
+							translation_cache_evict(options.translation_prefix, options.translation_suffix,
+								options.translation_cache_max_bytes, filename);
+					} else {
+						// Delete the shared object if it is unwanted
+						unlink(tmpfile.c_str());
+					}
+				}
+				translation_cache_unlock(cache_lock);
 			}
 
 			// Optionally produce cross-compiled binaries
 			for (auto& cc : options.cross_compile)
 			{
+				if (partial)
+					break;
 				if (std::holds_alternative<MachineTranslationCrossOptions>(cc))
 				{
 	#ifndef _MSC_VER
@@ -836,17 +1219,11 @@ void CPU<W>::try_translate(const MachineOptions<W>& options, const std::string&
 
 		// Check compilation result
 		if (dylib != nullptr) {
-			if (!exec->is_binary_translated()) {
+			if (!exec->is_binary_translated() || retranslate) {
 				activate_dylib(options, *exec, dylib, arena, libtcc_enabled, live_patch);
 			}
-
-			if constexpr (!libtcc_enabled) {
-				if (!options.translation_cache) {
-					// Delete the shared object if it is unwanted
-					unlink(filename.c_str());
-				}
-			}
 		}
+		exec->finish_hot_promotion();
 
 		if (options.translate_timing) {
 			TIME_POINT(t12);
@@ -863,10 +1240,35 @@ void CPU<W>::try_translate(const MachineOptions<W>& options, const std::string&
 	}
 }
 
+template <int W>
+void CPU<W>::promote_hot_segment(address_t pc)
+{
+	if (!machine().has_options())
+		return;
+	auto& shared_segment = machine().memory.exec_segment_for(pc);
+	if (shared_segment == nullptr || !shared_segment->begin_hot_promotion())
+		return;
+	const MachineOptions<W>& options = machine().options();
+	if (options.verbose_loader) {
+		printf("libriscv: Execute segment 0x%lX-0x%lX became hot at 0x%lX\n",
+			(long)shared_segment->exec_begin(), (long)shared_segment->exec_end(), (long)pc);
+	}
+	try {
+		this->try_translate(options, shared_segment->hot_translation_filename(), shared_segment);
+	} catch (const std::exception& e) {
+		// Keep interpreting when translation fails
+		if (options.verbose_loader) {
+			fprintf(stderr, "libriscv: Tiered translation failed: %s\n", e.what());
+		}
+	}
+}
+
 template <int W>
 void CPU<W>::activate_dylib(const MachineOptions<W>& options, DecodedExecuteSegment<W>& exec, void* dylib, void* arena, bool is_libtcc, bool live_patch)
 {
 	TIME_POINT(t11);
+	// A complete translation may replace the tiered translation of the warm regions
+	const bool retranslate = exec.is_binary_translated();
 
 	if (!initialize_translated_segment(exec, dylib, arena, is_libtcc))
 	{
@@ -879,7 +1281,8 @@ void CPU<W>::activate_dylib(const MachineOptions<W>& options, DecodedExecuteSegm
 		if (dylib != nullptr) {
 			dylib_close(dylib, is_libtcc);
 		}
-		exec.set_binary_translated(nullptr, false);
+		if (!retranslate)
+			exec.set_binary_translated(nullptr, false);
 		return;
 	}
 
@@ -891,38 +1294,65 @@ void CPU<W>::activate_dylib(const MachineOptions<W>& options, DecodedExecuteSegm
 
 	if (no_mappings == nullptr || mappings == nullptr || *no_mappings > 500000UL) {
 		dylib_close(dylib, is_libtcc);
-		exec.set_binary_translated(nullptr, false);
+		if (!retranslate)
+			exec.set_binary_translated(nullptr, false);
 		throw MachineException(INVALID_PROGRAM, "Invalid mappings in binary translation program");
 	}
 
 	// After this, we should automatically close the dylib on destruction
+	exec.retire_binary_translation();
 	exec.set_binary_translated(dylib, is_libtcc);
 
+	activate_mappings(options, exec, mappings, *no_mappings, handlers, *no_handlers, live_patch);
+
+	if (options.translate_timing) {
+		TIME_POINT(t12);
+		printf(">> Binary translation activation %ld ns\n", nanodiff(t11, t12));
+	}
+	if (options.verbose_loader) {
+		printf("libriscv: Activated %s binary translation with %u/%u mappings%s\n",
+			is_libtcc ? "libtcc" : "full",
+			*no_handlers, *no_mappings,
+			live_patch ? ", live-patching enabled" : "");
+	}
+}
+
+template <int W>
+void CPU<W>::activate_mappings(const MachineOptions<W>& options, DecodedExecuteSegment<W>& exec,
+	const Mapping<W>* mappings, unsigned nmappings, const bintr_block_func<W>* handlers, unsigned unique_mappings, bool live_patch)
+{
 	// Helper to rebuild decoder blocks
 	std::unique_ptr<DecoderCache<W>[]> patched_decoder_cache = nullptr;
 	DecoderData<W>* patched_decoder = nullptr;
 	DecoderData<W>* decoder_begin   = nullptr;
 	std::vector<DecoderData<W>*> livepatch_bintr;
+	// Replacing a live-patched translation: The previous patched decoder
+	// cache is the starting point, and its mappings are kept, so that any
+	// of its entries not replaced here still refer to valid mappings.
+	const bool retranslate = live_patch && exec.patched_decoder_cache_base() != nullptr;
 	if (live_patch) {
 		patched_decoder_cache = std::make_unique<DecoderCache<W>[]>(exec.decoder_cache_size());
 		// Copy the decoder cache to the patched decoder cache
-		std::memcpy(patched_decoder_cache.get(), exec.decoder_cache_base(), exec.decoder_cache_size() * sizeof(DecoderCache<W>));
+		std::memcpy(patched_decoder_cache.get(),
+			retranslate ? exec.patched_decoder_cache_base() : exec.decoder_cache_base(),
+			exec.decoder_cache_size() * sizeof(DecoderCache<W>));
 		// A horrible calculation to find the patched decoder
 		patched_decoder = patched_decoder_cache[0].get_base() - exec.pagedata_base() / DecoderCache<W>::DIVISOR;
 		decoder_begin = &decoder_entry_at(patched_decoder, exec.exec_begin());
 		// Pre-allocate the livepatch_bintr vector
-		livepatch_bintr.reserve(*no_mappings);
+		livepatch_bintr.reserve(nmappings);
 	}
-	std::unordered_map<bintr_block_func<W>, unsigned> block_indices;
-	const unsigned nmappings = *no_mappings;
-	const unsigned unique_mappings = *no_handlers;
 
 	// Create N+1 mappings, where the last one is a catch-all for invalid mappings
-	exec.create_mappings(unique_mappings + 1);
+	unsigned first_mapping = 0;
+	if (retranslate)
+		first_mapping = exec.append_mappings(unique_mappings + 1);
+	else
+		exec.create_mappings(unique_mappings + 1);
 	for (unsigned i = 0; i < unique_mappings; i++) {
-		exec.set_mapping(i, handlers[i]);
+		exec.set_mapping(first_mapping + i, handlers[i]);
 	}
-	exec.set_mapping(unique_mappings, [] (CPU<W>&, uint64_t, uint64_t, address_t) -> bintr_block_returns<W> {
+	exec.set_mapping(first_mapping + unique_mappings, [] (CPU<W>&, uint64_t, uint64_t, address_t) -> bintr_block_returns<W> {
 		throw MachineException(INVALID_PROGRAM, "Translation mapping outside execute area");
 	});
 
@@ -979,11 +1409,15 @@ void CPU<W>::activate_dylib(const MachineOptions<W>& options, DecodedExecuteSegm
 					auto& p = decoder_entry_at(patched_decoder, addr);
 					p.set_bytecode(RV32I_BC_TRANSLATOR);
 					p.set_invalid_handler();
-					p.instr  = mapping_index;
+					p.instr  = first_mapping + mapping_index;
 					p.idxend = 0;
 				#ifdef RISCV_EXT_C
 					p.icount = 0;
 				#endif
+					// 6. A superinstruction must not execute past the new block end
+					auto* prev = &p - (compressed_enabled ? 2 : 1);
+					if (prev >= decoder_begin)
+						prev->set_bytecode(superinstruction_first(prev->get_bytecode()));
 					auto& original_entry = decoder_entry_at(exec.decoder_cache(), addr);
 					livepatch_bintr.push_back(&original_entry);
 				} else {
@@ -1024,17 +1458,6 @@ void CPU<W>::activate_dylib(const MachineOptions<W>& options, DecodedExecuteSegm
 			}
 		}
 	}
-
-	if (options.translate_timing) {
-		TIME_POINT(t12);
-		printf(">> Binary translation activation %ld ns\n", nanodiff(t11, t12));
-	}
-	if (options.verbose_loader) {
-		printf("libriscv: Activated %s binary translation with %u/%u mappings%s\n",
-			is_libtcc ? "libtcc" : "full",
-			unique_mappings, nmappings,
-			live_patch ? ", live-patching enabled" : "");
-	}
 }
 
 template <int W>
@@ -1111,8 +1534,10 @@ CallbackTable<W> create_bintr_callback_table(DecodedExecuteSegment<W>&)
 			try {
 				const auto current_tp = cpu.reg(REG_TP);
 				const auto current_pc = cpu.registers().pc;
+				const auto* current_exec = &cpu.current_execute_segment();
 				cpu.machine().system_call(sysno);
-				return cpu.registers().pc != current_pc || cpu.reg(REG_TP) != current_tp || cpu.machine().stopped();
+				return cpu.registers().pc != current_pc || cpu.reg(REG_TP) != current_tp || cpu.machine().stopped()
+					|| &cpu.current_execute_segment() != current_exec;
 			} catch (...) {
 				cpu.set_current_exception(std::current_exception());
 				cpu.machine().stop();
@@ -1264,16 +1689,19 @@ std::string MachineOptions<W>::translation_filename(const std::string& prefix, u
 #ifdef RISCV_32I
 	template void CPU<4>::try_translate(const MachineOptions<4>&, const std::string&, std::shared_ptr<DecodedExecuteSegment<4>>&) const;
 	template int CPU<4>::load_translation(const MachineOptions<4>&, std::string*, DecodedExecuteSegment<4>&) const;
+	template void CPU<4>::promote_hot_segment(address_type<4>);
 	template std::string MachineOptions<4>::translation_filename(const std::string&, uint32_t, const std::string&);
 #endif
 #ifdef RISCV_64I
 	template void CPU<8>::try_translate(const MachineOptions<8>&, const std::string&, std::shared_ptr<DecodedExecuteSegment<8>>&) const;
 	template int CPU<8>::load_translation(const MachineOptions<8>&, std::string*, DecodedExecuteSegment<8>&) const;
+	template void CPU<8>::promote_hot_segment(address_type<8>);
 	template std::string MachineOptions<8>::translation_filename(const std::string&, uint32_t, const std::string&);
 #endif
 #ifdef RISCV_128I
 	template void CPU<16>::try_translate(const MachineOptions<16>&, const std::string&, std::shared_ptr<DecodedExecuteSegment<16>>&) const;
 	template int CPU<16>::load_translation(const MachineOptions<16>&, std::string*, DecodedExecuteSegment<16>&) const;
+	template void CPU<16>::promote_hot_segment(address_type<16>);
 	template std::string MachineOptions<16>::translation_filename(const std::string&, uint32_t, const std::string&);
 #endif
 
@@ -7,6 +7,16 @@ namespace riscv
 {
 	template <int W>
 	struct TransInstr;
+	template <int W>
+	struct TranslationProfile;
+
+	// An address and the index of the function that handles it. The layout
+	// is shared with the mappings array in generated code.
+	template <int W>
+	struct Mapping {
+		address_type<W> addr;
+		unsigned mapping_index;
+	};
 
 	template <int W>
 	struct TransOutput
@@ -14,8 +24,16 @@ namespace riscv
 		std::unordered_map<std::string, std::string> defines;
 		timespec t0;
 		std::shared_ptr<std::string> code;
+		// Where the code of each block begins, followed by the end of the last block
+		std::vector<size_t> block_offsets;
 		std::string footer;
 		std::vector<TransMapping<W>> mappings;
+#ifdef RISCV_JIT
+		// Machine code produced in-process by the JIT backend
+		void* jit_code = nullptr;
+		std::vector<Mapping<W>> jit_mappings;
+		std::vector<bintr_block_func<W>> jit_handlers;
+#endif
 	};
 
 	template <int W>
@@ -43,5 +61,19 @@ namespace riscv
 		uintptr_t arena_ptr;
 		address_type<W> arena_roend;
 		address_type<W> arena_size;
+
+		// Execution profile, when translating with one
+		const TranslationProfile<W>* profile = nullptr;
+	};
+
+	// Code blocks found in an execute segment, shared by all backends
+	template <int W>
+	struct TransBlocks
+	{
+		address_type<W> gp = 0;
+		size_t icounter = 0;
+		std::unordered_set<address_type<W>> ebreak_locations;
+		std::unordered_set<address_type<W>> global_jump_locations;
+		std::vector<TransInfo<W>> blocks;
 	};
 }
@@ -44,6 +44,7 @@ namespace riscv
 		INVALID_PROGRAM,
 		SYSTEM_CALL_FAILED,
 		EXECUTION_LOOP_DETECTED,
+		MEMORY_QUOTA_EXCEEDED,
 		UNKNOWN_EXCEPTION
 	};
 
@@ -96,6 +97,12 @@ namespace riscv
 	template <int W>
 	struct TransOutput;
 
+	template <int W>
+	struct TransBlocks;
+
+	template <int W>
+	struct Mapping;
+
 	template <int W>
 	struct TransMapping {
 		address_type<W> addr;
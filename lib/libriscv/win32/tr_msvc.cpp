@@ -15,6 +15,20 @@ namespace riscv
 		return nullptr;
 	}
 
+	void* compile_units(const std::vector<std::string>&, int, const std::string&, const std::string&)
+	{
+		return nullptr;
+	}
+
+	// There is no shared translation cache directory on Windows
+	int  translation_cache_lock(const std::string&) { return -1; }
+	void translation_cache_unlock(int) {}
+	std::string translation_cache_tmpname(const std::string& filename) { return filename + ".tmp"; }
+	bool translation_cache_publish(const std::string&, const std::string&) { return false; }
+	void translation_cache_touch(const std::string&) {}
+	bool translation_cache_seed(const std::string&, const std::string&) { return false; }
+	void translation_cache_evict(const std::string&, const std::string&, uint64_t, const std::string&) {}
+
 	void* dylib_lookup(void* dylib, const char* symbol, bool)
 	{
 		return dlsym(dylib, symbol);
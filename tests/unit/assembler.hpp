@@ -0,0 +1,122 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A minimal RV32I/RV64I assembler for tests that need hand-written
+// programs, eg. to compare translated code against the interpreter
+// without requiring a RISC-V toolchain.
+struct Assembler
+{
+	enum Reg : unsigned {
+		ZERO = 0, RA = 1, SP = 2, GP = 3, TP = 4, T0 = 5, T1 = 6, T2 = 7,
+		S0 = 8, S1 = 9, A0 = 10, A1 = 11, A2 = 12, A3 = 13, A4 = 14, A5 = 15,
+		A6 = 16, A7 = 17, S2 = 18, S3 = 19, S4 = 20, S5 = 21, T3 = 28, T4 = 29,
+	};
+
+	void emit(uint32_t instr) { code.push_back(instr); }
+	void label(const std::string& name) { labels[name] = code.size(); }
+	size_t size_bytes() const { return code.size() * 4; }
+	size_t offset_of(const std::string& name) const { return labels.at(name) * 4; }
+
+	void r_type(unsigned opcode, unsigned f3, unsigned f7, unsigned rd, unsigned rs1, unsigned rs2) {
+		emit(opcode | (rd << 7) | (f3 << 12) | (rs1 << 15) | (rs2 << 20) | (f7 << 25));
+	}
+	void i_type(unsigned opcode, unsigned f3, unsigned rd, unsigned rs1, int32_t imm) {
+		emit(opcode | (rd << 7) | (f3 << 12) | (rs1 << 15) | (uint32_t(imm) << 20));
+	}
+	void s_type(unsigned f3, unsigned rs1, unsigned rs2, int32_t imm) {
+		const uint32_t u = imm;
+		emit(0x23 | ((u & 0x1F) << 7) | (f3 << 12) | (rs1 << 15) | (rs2 << 20) | ((u >> 5) << 25));
+	}
+
+	// Integer register-register and register-immediate operations
+	void op(unsigned f3, unsigned f7, unsigned rd, unsigned rs1, unsigned rs2) { r_type(0x33, f3, f7, rd, rs1, rs2); }
+	void op32(unsigned f3, unsigned f7, unsigned rd, unsigned rs1, unsigned rs2) { r_type(0x3B, f3, f7, rd, rs1, rs2); }
+	void op_imm(unsigned f3, unsigned rd, unsigned rs1, int32_t imm) { i_type(0x13, f3, rd, rs1, imm); }
+	void add(unsigned rd, unsigned rs1, unsigned rs2) { op(0x0, 0x00, rd, rs1, rs2); }
+	void sub(unsigned rd, unsigned rs1, unsigned rs2) { op(0x0, 0x20, rd, rs1, rs2); }
+	void addi(unsigned rd, unsigned rs1, int32_t imm) { op_imm(0x0, rd, rs1, imm); }
+	void slli(unsigned rd, unsigned rs1, unsigned shamt) { op_imm(0x1, rd, rs1, shamt); }
+	void srli(unsigned rd, unsigned rs1, unsigned shamt) { op_imm(0x5, rd, rs1, shamt); }
+	void lui(unsigned rd, uint32_t imm20) { emit(0x37 | (rd << 7) | (imm20 << 12)); }
+	// Load a sign-extended 32-bit constant
+	void li(unsigned rd, int32_t value) {
+		const int32_t lo = (value << 20) >> 20;
+		const uint32_t hi = uint32_t(value - lo) >> 12;
+		if (hi != 0) {
+			lui(rd, hi);
+			if (lo != 0)
+				addi(rd, rd, lo);
+		} else {
+			addi(rd, ZERO, lo);
+		}
+	}
+	void mv(unsigned rd, unsigned rs) { addi(rd, rs, 0); }
+	// Load a 32-bit address, always in two instructions
+	void la(unsigned rd, int32_t value) {
+		const int32_t lo = (value << 20) >> 20;
+		lui(rd, uint32_t(value - lo) >> 12);
+		addi(rd, rd, lo);
+	}
+
+	// Loads and stores, where f3 selects the width: 0=B, 1=H, 2=W, 3=D (4-6 unsigned)
+	void load(unsigned f3, unsigned rd, unsigned rs1, int32_t imm) { i_type(0x03, f3, rd, rs1, imm); }
+	void store(unsigned f3, unsigned rs1, unsigned rs2, int32_t imm) { s_type(f3, rs1, rs2, imm); }
+
+	// Branches and jumps to labels, resolved by finish()
+	void branch(unsigned f3, unsigned rs1, unsigned rs2, const std::string& target) {
+		fixups.push_back({code.size(), target, false});
+		emit(0x63 | (f3 << 12) | (rs1 << 15) | (rs2 << 20));
+	}
+	void beq(unsigned rs1, unsigned rs2, const std::string& target) { branch(0x0, rs1, rs2, target); }
+	void bne(unsigned rs1, unsigned rs2, const std::string& target) { branch(0x1, rs1, rs2, target); }
+	void blt(unsigned rs1, unsigned rs2, const std::string& target) { branch(0x4, rs1, rs2, target); }
+	void bltu(unsigned rs1, unsigned rs2, const std::string& target) { branch(0x6, rs1, rs2, target); }
+	void jal(unsigned rd, const std::string& target) {
+		fixups.push_back({code.size(), target, true});
+		emit(0x6F | (rd << 7));
+	}
+	void j(const std::string& target) { jal(ZERO, target); }
+	void call(const std::string& target) { jal(RA, target); }
+	void jalr(unsigned rd, unsigned rs1, int32_t imm) { i_type(0x67, 0x0, rd, rs1, imm); }
+	void ret() { jalr(ZERO, RA, 0); }
+
+	void ecall()  { emit(0x00000073); }
+	void ebreak() { emit(0x00100073); }
+	void stop()   { emit(0x7FF00073); }
+	void nop()    { addi(ZERO, ZERO, 0); }
+	void unimp()  { emit(0xC0001073); }
+	void csrr(unsigned rd, unsigned csr) { i_type(0x73, 0x2, rd, 0, csr); }
+
+	std::vector<uint32_t> finish()
+	{
+		for (const auto& fixup : fixups) {
+			const int32_t offset = int32_t(labels.at(fixup.target) - fixup.index) * 4;
+			const uint32_t u = offset;
+			if (fixup.is_jal) {
+				code[fixup.index] |= (((u >> 20) & 1) << 31) | (((u >> 1) & 0x3FF) << 21)
+					| (((u >> 11) & 1) << 20) | (((u >> 12) & 0xFF) << 12);
+			} else {
+				if (offset < -4096 || offset >= 4096)
+					throw std::runtime_error("Branch out of range: " + fixup.target);
+				code[fixup.index] |= (((u >> 12) & 1) << 31) | (((u >> 5) & 0x3F) << 25)
+					| (((u >> 1) & 0xF) << 8) | (((u >> 11) & 1) << 7);
+			}
+		}
+		fixups.clear();
+		return code;
+	}
+
+	std::vector<uint32_t> code;
+private:
+	struct Fixup {
+		size_t index;
+		std::string target;
+		bool is_jal;
+	};
+	std::map<std::string, size_t> labels;
+	std::vector<Fixup> fixups;
+};
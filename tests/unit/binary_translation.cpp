@@ -0,0 +1,586 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <libriscv/machine.hpp>
+#include <libriscv/decoder_cache.hpp>
+#include <libriscv/threaded_bytecodes.hpp>
+#include <fstream>
+#include <functional>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include "assembler.hpp"
+#include "guest_program.hpp"
+using namespace riscv;
+using A = Assembler;
+
+using OptionsSetup = std::function<void(MachineOptions<RISCV64>&)>;
+using Inspect = std::function<void(Machine<RISCV64>&)>;
+
+struct Result {
+	std::array<uint64_t, 32> regs {};
+	uint64_t counter = 0;
+	bool stopped = false;
+	bool translated = false;
+};
+
+// Run a hand-assembled program, interpreted when translate is false.
+// Translations are never cached, so that each run compiles anew.
+static Result run(const std::vector<uint32_t>& program, bool translate,
+	uint64_t max = 100'000'000ull, OptionsSetup setup = nullptr, Inspect inspect = nullptr)
+{
+	MachineOptions<RISCV64> options;
+	options.use_shared_execute_segments = false;
+	options.translate_enabled = translate;
+	options.translation_cache = false;
+	if (setup)
+		setup(options);
+	Machine<RISCV64> machine { std::string_view{}, options };
+	machine.set_options(std::make_shared<MachineOptions<RISCV64>>(options));
+
+	load_program(machine, program);
+	// Initial register values are unknown to the translator
+	for (int i = 10; i < 16; i++)
+		machine.cpu.reg(i) = 0x9E3779B97F4A7C15ull * i;
+
+	Result result;
+	result.stopped = machine.simulate<false>(max);
+	for (int i = 0; i < 32; i++)
+		result.regs[i] = machine.cpu.reg(i);
+	result.counter = machine.instruction_counter();
+	result.translated = machine.cpu.current_execute_segment().is_binary_translated();
+	if (inspect)
+		inspect(machine);
+	return result;
+}
+
+// Check if the block at addr is entered through a translated function
+static bool is_translated_at(Machine<RISCV64>& machine, uint64_t addr)
+{
+	auto& exec = machine.cpu.current_execute_segment();
+	return exec.decoder_cache()[addr / DecoderCache<RISCV64>::DIVISOR].get_bytecode() == RV32I_BC_TRANSLATOR;
+}
+
+static void require_same(const Result& interpreted, const Result& translated)
+{
+	REQUIRE(!interpreted.translated);
+	REQUIRE(translated.translated);
+	REQUIRE(interpreted.regs == translated.regs);
+	REQUIRE(interpreted.counter == translated.counter);
+	REQUIRE(interpreted.stopped == translated.stopped);
+}
+
+// Translated blocks end at the first indirect jump after ~1250 instructions,
+// so jumping to the next instruction after `instructions` starts a new block.
+static void arithmetic_block(A& a, int instructions)
+{
+	for (int i = 0; i < instructions; i++) {
+		const unsigned rd  = A::A0 + (i % 6);
+		const unsigned rs1 = A::A0 + ((i + 1) % 6);
+		const unsigned rs2 = A::A0 + ((i + 3) % 6);
+		switch (i % 4) {
+		case 0: a.add(rd, rs1, rs2); break;
+		case 1: a.op(0x4, 0x00, rd, rs1, rs2); break; // XOR
+		case 2: a.slli(rd, rs1, 1 + i % 31); break;
+		case 3: a.sub(rd, rs1, rs2); break;
+		}
+	}
+	a.la(A::T0, DST + a.size_bytes() + 12);
+	a.jalr(A::ZERO, A::T0, 0);
+}
+
+TEST_CASE("Translations split into several parts", "[Translation]")
+{
+	// Log every compiler invocation using a wrapper around the compiler
+	const std::string log = "/tmp/rvshards-" + std::to_string(getpid()) + ".log";
+	const std::string wrapper = "/tmp/rvshards-" + std::to_string(getpid()) + ".sh";
+	const char* cc = getenv("CC");
+	const std::string original_cc = cc ? cc : "cc";
+	{
+		std::ofstream script(wrapper);
+		script << "#!/bin/sh\necho \"$@\" >> " << log << "\nexec " << original_cc << " \"$@\"\n";
+	}
+	chmod(wrapper.c_str(), 0755);
+
+	// Several blocks with enough code to reach the minimum part size
+	A a;
+	for (int block = 0; block < 4; block++)
+		arithmetic_block(a, 1300);
+	a.stop();
+	const auto program = a.finish();
+
+	const auto interpreted = run(program, false);
+	Result sharded;
+	{
+		CompilerOverride compiler { wrapper };
+		sharded = run(program, true, 100'000'000ull, [] (auto& options) {
+			options.translate_shards = 4;
+		});
+	}
+
+	std::ifstream logfile(log);
+	std::string line;
+	size_t objects = 0, links = 0;
+	while (std::getline(logfile, line)) {
+		if (line.find(" -c ") != std::string::npos)
+			objects++;
+		else if (line.find("-shared -s") != std::string::npos && line.find(".o") != std::string::npos)
+			links++;
+	}
+	unlink(log.c_str());
+	unlink(wrapper.c_str());
+
+	// The parts were compiled separately, then linked into one shared object
+	REQUIRE(objects >= 2);
+	REQUIRE(links == 1);
+	require_same(interpreted, sharded);
+}
+
+TEST_CASE("Failed compilation keeps interpreting", "[Translation]")
+{
+	A a;
+	arithmetic_block(a, 100);
+	a.stop();
+	const auto program = a.finish();
+
+	CompilerOverride compiler { "false" };
+	const auto interpreted = run(program, false);
+	const auto failed = run(program, true);
+
+	REQUIRE(!failed.translated);
+	REQUIRE(failed.regs == interpreted.regs);
+}
+
+TEST_CASE("Translation profiles keep the hottest blocks", "[Translation]")
+{
+	// Two cold blocks followed by a hot loop in the last block
+	A a;
+	arithmetic_block(a, 1300);
+	arithmetic_block(a, 1300);
+	a.label("last");
+	a.li(A::T1, 0);
+	a.li(A::T2, 5000);
+	a.label("hot");
+	a.addi(A::T1, A::T1, 1);
+	a.add(A::S2, A::S2, A::T1);
+	a.bne(A::T1, A::T2, "hot");
+	a.stop();
+	const auto program = a.finish();
+	const uint64_t first = DST;
+	const uint64_t last = DST + a.offset_of("last");
+	const uint64_t hot = DST + a.offset_of("hot");
+
+	TranslationProfile<RISCV64> profile;
+	const auto profiling = run(program, true, 100'000'000ull, [] (auto& options) {
+		options.record_translation_profile = true;
+	}, [&] (auto& machine) {
+		profile = machine.memory.gather_translation_profile();
+	});
+	REQUIRE(!profiling.translated);
+	REQUIRE(profile.blocks.at(hot) == 5000 - 1);
+	REQUIRE(profile.branches.at(hot + 8).taken == 5000 - 1);
+	REQUIRE(profile.branches.at(hot + 8).not_taken == 1);
+	REQUIRE(profile.heat(last, DST + program.size() * 4) > profile.heat(first, last));
+
+	const auto interpreted = run(program, false);
+	// Without a profile, the first block is kept when only one block is allowed
+	bool first_translated = false, last_translated = false;
+	const auto unprofiled = run(program, true, 100'000'000ull, [] (auto& options) {
+		options.translate_blocks_max = 1;
+	}, [&] (auto& machine) {
+		first_translated = is_translated_at(machine, first);
+		last_translated = is_translated_at(machine, last);
+	});
+	require_same(interpreted, unprofiled);
+	REQUIRE(first_translated);
+	REQUIRE(!last_translated);
+
+	// With the profile, the block containing the hot loop is kept instead
+	const auto profiled = run(program, true, 100'000'000ull, [&] (auto& options) {
+		options.translate_blocks_max = 1;
+		options.translation_profile = profile;
+	}, [&] (auto& machine) {
+		first_translated = is_translated_at(machine, first);
+		last_translated = is_translated_at(machine, last);
+	});
+	require_same(interpreted, profiled);
+	REQUIRE(!first_translated);
+	REQUIRE(last_translated);
+}
+
+TEST_CASE("Forks running in parallel share the profile counters", "[Translation]")
+{
+	A a;
+	a.li(A::T1, 0);
+	a.li(A::T2, 5000);
+	a.label("hot");
+	a.addi(A::T1, A::T1, 1);
+	a.bne(A::T1, A::T2, "hot");
+	a.stop();
+	const auto program = a.finish();
+	const uint64_t hot = DST + a.offset_of("hot");
+
+	MachineOptions<RISCV64> options;
+	options.use_shared_execute_segments = false;
+	options.record_translation_profile = true;
+	Machine<RISCV64> machine { std::string_view{}, options };
+	machine.set_options(std::make_shared<MachineOptions<RISCV64>>(options));
+	load_program(machine, program);
+	REQUIRE(machine.simulate(1'000'000ull));
+
+	// The forks reference the execute segment of the main machine
+	static constexpr int FORKS = 4;
+	std::vector<std::unique_ptr<Machine<RISCV64>>> forks;
+	for (int i = 0; i < FORKS; i++) {
+		forks.push_back(std::make_unique<Machine<RISCV64>>(machine, options));
+		forks.back()->cpu.jump(DST);
+	}
+	std::vector<std::thread> threads;
+	for (auto& fork : forks)
+		threads.emplace_back([&fork] { fork->simulate(1'000'000ull); });
+	for (auto& thread : threads)
+		thread.join();
+
+	const auto profile = machine.memory.gather_translation_profile();
+	REQUIRE(profile.blocks.at(hot) == (FORKS + 1) * (5000 - 1));
+	REQUIRE(profile.branches.at(hot + 4).taken == (FORKS + 1) * (5000 - 1));
+	REQUIRE(profile.branches.at(hot + 4).not_taken == FORKS + 1);
+}
+
+TEST_CASE("Chained blocks keep results and the instruction limit", "[Translation]")
+{
+	// A loop spanning three translated blocks, connected by indirect jumps
+	A a;
+	a.li(A::T2, 20);
+	a.label("top");
+	for (int block = 0; block < 3; block++)
+		arithmetic_block(a, 1300);
+	a.addi(A::T1, A::T1, 1);
+	a.beq(A::T1, A::T2, "done");
+	a.la(A::T0, DST + a.offset_of("top"));
+	a.jalr(A::ZERO, A::T0, 0);
+	a.label("done");
+	a.stop();
+	const auto program = a.finish();
+
+	const auto interpreted = run(program, false);
+	REQUIRE(interpreted.stopped);
+	REQUIRE(interpreted.regs[A::T1] == 20);
+	for (const bool chaining : { false, true }) {
+		auto setup = [=] (auto& options) {
+			options.translate_block_chaining = chaining;
+		};
+		const auto translated = run(program, true, 100'000'000ull, setup);
+		require_same(interpreted, translated);
+
+		// Running out of instructions stops in the middle of the loop,
+		// and the program can be resumed from there
+		static constexpr uint64_t MAX = 10'000;
+		Result resumed;
+		const auto limited = run(program, true, MAX, setup, [&] (auto& machine) {
+			resumed.stopped = machine.template simulate<false>(100'000'000ull);
+			for (int i = 0; i < 32; i++)
+				resumed.regs[i] = machine.cpu.reg(i);
+		});
+		REQUIRE(limited.translated);
+		REQUIRE(!limited.stopped);
+		REQUIRE(limited.counter >= MAX);
+		// The limit is checked between blocks
+		REQUIRE(limited.counter < MAX + 2 * 1310);
+		REQUIRE(limited.regs[A::T1] < 20);
+		REQUIRE(resumed.stopped);
+		REQUIRE(resumed.regs == interpreted.regs);
+	}
+}
+
+TEST_CASE("Static jumps between blocks are chained directly", "[Translation]")
+{
+	// A loop of millions of iterations across two blocks that are
+	// connected only by static jumps. Chained blocks tail-call each
+	// other, and calls that did not become jumps would overflow the stack.
+	static constexpr int ITERATIONS = 3'000'000;
+	A a;
+	a.li(A::T2, ITERATIONS);
+	for (int i = 0; i < 1300; i++)
+		a.add(A::A0 + i % 4, A::A0 + (i + 1) % 4, A::A5);
+	a.label("top");
+	a.addi(A::T1, A::T1, 1);
+	a.beq(A::T1, A::T2, "done");
+	a.j("second");
+	// Never executed, ends the first block
+	a.jalr(A::ZERO, A::T0, 0);
+	a.label("second");
+	a.j("top");
+	a.label("done");
+	a.stop();
+	const auto program = a.finish();
+	char second[64];
+	snprintf(second, sizeof(second), "return f_%lx(cpu", long(DST + a.offset_of("second")));
+	const std::string prefix = "/tmp/rvchain-" + std::to_string(getpid()) + "-";
+
+	const auto interpreted = run(program, false);
+	REQUIRE(interpreted.regs[A::T1] == ITERATIONS);
+	for (const bool register_caching : { false, true }) {
+		std::string filename;
+		const auto translated = run(program, true, 100'000'000ull, [&] (auto& options) {
+			options.translate_use_register_caching = register_caching;
+			options.cross_compile.push_back(MachineTranslationEmbeddableCodeOptions{ prefix, ".c" });
+		}, [&] (auto& machine) {
+			filename = MachineOptions<RISCV64>::translation_filename(prefix,
+				machine.cpu.current_execute_segment().translation_hash(), ".c");
+		});
+		require_same(interpreted, translated);
+
+		std::ifstream file(filename);
+		const std::string code { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+		unlink(filename.c_str());
+		// The jump into the second block is a tail call
+		REQUIRE(code.find(" f_10000(") != std::string::npos);
+		REQUIRE(code.find(second) != std::string::npos);
+	}
+}
+
+TEST_CASE("Breakpoints installed after translation stop chained blocks", "[Translation]")
+{
+	A a;
+	a.li(A::T2, 20);
+	arithmetic_block(a, 1300);
+	a.label("top");
+	arithmetic_block(a, 1300);
+	a.label("second");
+	arithmetic_block(a, 1300);
+	a.addi(A::T1, A::T1, 1);
+	a.beq(A::T1, A::T2, "done");
+	a.la(A::T0, DST + a.offset_of("top"));
+	a.jalr(A::ZERO, A::T0, 0);
+	a.label("done");
+	a.stop();
+	const auto program = a.finish();
+	const uint64_t top = DST + a.offset_of("top");
+
+	static uint64_t breakpoint_pc;
+	breakpoint_pc = 0;
+	Machine<RISCV64>::install_syscall_handler(SYSCALL_EBREAK, [] (Machine<RISCV64>& machine) {
+		breakpoint_pc = machine.cpu.pc();
+		machine.stop();
+	});
+
+	MachineOptions<RISCV64> options;
+	options.use_shared_execute_segments = false;
+	options.translation_cache = false;
+	REQUIRE(options.translate_block_chaining);
+	Machine<RISCV64> machine { std::string_view{}, options };
+	machine.set_options(std::make_shared<MachineOptions<RISCV64>>(options));
+	load_program(machine, program);
+
+	// Stop after the first two blocks, then break where the third block jumps to
+	REQUIRE(!machine.simulate<false>(2000));
+	REQUIRE(machine.cpu.pc() == DST + a.offset_of("second"));
+	REQUIRE(machine.cpu.current_execute_segment().is_binary_translated());
+	REQUIRE(!machine.cpu.current_execute_segment().is_decoder_patched());
+	machine.cpu.install_ebreak_at(top);
+	REQUIRE(machine.cpu.current_execute_segment().is_decoder_patched());
+
+	machine.simulate<false>(100'000'000ull, machine.instruction_counter());
+	REQUIRE(breakpoint_pc == top);
+	REQUIRE(machine.cpu.reg(A::T1) == 1);
+}
+
+TEST_CASE("System calls that replace code leave translated blocks", "[Translation]")
+{
+	// The system call evicts the execute segment and replaces the function
+	// that is called from the next block, which must then run the new code
+	static constexpr int SYSCALL_REPLACE = 500;
+	A a;
+	a.li(A::A7, SYSCALL_REPLACE);
+	a.ecall();
+	arithmetic_block(a, 1300);
+	a.call("f");
+	a.stop();
+	a.label("f");
+	a.li(A::A0, 1);
+	a.ret();
+	const auto program = a.finish();
+
+	A replacement;
+	replacement.li(A::A0, 2);
+	static uint32_t replaced_instruction;
+	static uint64_t replaced_address;
+	replaced_instruction = replacement.finish().at(0);
+	replaced_address = DST + a.offset_of("f");
+	// The evicted segment is kept alive, as its translation is still running
+	static std::shared_ptr<DecodedExecuteSegment<RISCV64>> evicted;
+	Machine<RISCV64>::install_syscall_handler(SYSCALL_REPLACE, [] (Machine<RISCV64>& machine) {
+		evicted = machine.memory.exec_segment_for(machine.cpu.pc());
+		machine.memory.evict_execute_segments();
+		const uint64_t page = replaced_address & ~uint64_t(Page::size() - 1);
+		machine.memory.set_page_attr(page, Page::size(), { .read = false, .write = true, .exec = true });
+		machine.copy_to_guest(replaced_address, &replaced_instruction, sizeof(replaced_instruction));
+		machine.memory.set_page_attr(page, Page::size(), { .read = false, .write = false, .exec = true });
+	});
+
+	for (const bool chaining : { false, true }) {
+		const auto translated = run(program, true, 100'000'000ull, [=] (auto& options) {
+			options.translate_block_chaining = chaining;
+		});
+		REQUIRE(translated.stopped);
+		REQUIRE(translated.regs[A::A0] == 2);
+		evicted = nullptr;
+	}
+}
+
+// A function that is larger than a block, with an indirect call in its
+// loop. Blocks used to end at the indirect call, splitting the loop.
+static std::vector<uint32_t> indirect_call_loop(A& a, int iterations)
+{
+	a.li(A::T2, iterations);
+	a.call("function");
+	a.stop();
+	a.label("helper");
+	a.add(A::A0, A::A0, A::A1);
+	a.ret();
+	a.label("function");
+	a.mv(A::S1, A::RA);
+	for (int i = 0; i < 1300; i++)
+		a.add(A::A1 + i % 4, A::A1 + (i + 1) % 4, A::A5);
+	a.la(A::T0, DST + a.offset_of("helper"));
+	a.label("loop");
+	a.addi(A::A2, A::A2, 3);
+	a.jalr(A::RA, A::T0, 0);
+	a.label("resume");
+	a.add(A::A3, A::A3, A::A0);
+	a.addi(A::T1, A::T1, 1);
+	a.bne(A::T1, A::T2, "loop");
+	a.mv(A::RA, A::S1);
+	a.ret();
+	return a.finish();
+}
+
+TEST_CASE("Translated blocks keep whole functions", "[Translation]")
+{
+	A a;
+	const auto program = indirect_call_loop(a, 1000);
+	char resume[64];
+	snprintf(resume, sizeof(resume), " f_%lx(", long(DST + a.offset_of("resume")));
+	const std::string prefix = "/tmp/rvfunction-" + std::to_string(getpid()) + "-";
+
+	const auto interpreted = run(program, false);
+	std::string filename;
+	const auto translated = run(program, true, 100'000'000ull, [&] (auto& options) {
+		options.cross_compile.push_back(MachineTranslationEmbeddableCodeOptions{ prefix, ".c" });
+	}, [&] (auto& machine) {
+		filename = MachineOptions<RISCV64>::translation_filename(prefix,
+			machine.cpu.current_execute_segment().translation_hash(), ".c");
+	});
+	require_same(interpreted, translated);
+
+	std::ifstream file(filename);
+	const std::string code { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+	unlink(filename.c_str());
+	// The loop stays in the block of the function, so that no block
+	// begins where the indirect call returns to
+	REQUIRE(code.find(" f_10000(") != std::string::npos);
+	REQUIRE(code.find(resume) == std::string::npos);
+}
+
+TEST_CASE("Translated blocks end before aligned functions", "[Translation]")
+{
+	// A large function followed by alignment padding and its callee
+	A a;
+	a.call("function");
+	a.stop();
+	a.label("function");
+	a.mv(A::S1, A::RA);
+	for (int i = 0; i < 1300; i++)
+		a.add(A::A1 + i % 4, A::A1 + (i + 1) % 4, A::A5);
+	a.call("aligned");
+	a.mv(A::RA, A::S1);
+	a.ret();
+	a.nop();
+	a.unimp();
+	while (a.size_bytes() % 64 != 0)
+		a.nop();
+	a.label("aligned");
+	a.addi(A::A0, A::A1, 1);
+	a.ret();
+	const auto program = a.finish();
+	char aligned[64];
+	snprintf(aligned, sizeof(aligned), " f_%lx(", long(DST + a.offset_of("aligned")));
+	const std::string prefix = "/tmp/rvaligned-" + std::to_string(getpid()) + "-";
+
+	const auto interpreted = run(program, false);
+	std::string filename;
+	const auto translated = run(program, true, 100'000'000ull, [&] (auto& options) {
+		options.cross_compile.push_back(MachineTranslationEmbeddableCodeOptions{ prefix, ".c" });
+	}, [&] (auto& machine) {
+		filename = MachineOptions<RISCV64>::translation_filename(prefix,
+			machine.cpu.current_execute_segment().translation_hash(), ".c");
+	});
+	require_same(interpreted, translated);
+
+	std::ifstream file(filename);
+	const std::string code { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+	unlink(filename.c_str());
+	// The block of the large function covers the padding, and
+	// the aligned function begins a block of its own
+	REQUIRE(code.find(aligned) != std::string::npos);
+}
+
+TEST_CASE("Translated functions keep registers in locals", "[Translation]")
+{
+	A a;
+	const auto program = indirect_call_loop(a, 1000);
+	const std::string prefix = "/tmp/rvfuncregs-" + std::to_string(getpid()) + "-";
+	const auto interpreted = run(program, false);
+
+	for (const bool function_registers : { false, true })
+	{
+		std::string filename;
+		const auto translated = run(program, true, 100'000'000ull, [&] (auto& options) {
+			options.translate_use_register_caching = false;
+			options.translate_function_register_caching = function_registers;
+			options.cross_compile.push_back(MachineTranslationEmbeddableCodeOptions{ prefix, ".c" });
+		}, [&] (auto& machine) {
+			filename = MachineOptions<RISCV64>::translation_filename(prefix,
+				machine.cpu.current_execute_segment().translation_hash(), ".c");
+		});
+		require_same(interpreted, translated);
+
+		std::ifstream file(filename);
+		const std::string code { std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+		unlink(filename.c_str());
+		// The loop counter is loaded into a local once, when the block
+		// of the function is entered, and not accessed through the CPU
+		const auto body = code.find(" f_10000(CPU* cpu");
+		REQUIRE(body != std::string::npos);
+		const bool in_local = code.find("addr_t reg6 = cpu->r[6];", body) != std::string::npos;
+		REQUIRE(in_local == function_registers);
+		REQUIRE((code.find("cpu->r[6] += 1;", body) == std::string::npos) == function_registers);
+	}
+}
+
+TEST_CASE("Translated loops with indirect calls", "[.benchmark]")
+{
+	A a;
+	const auto program = indirect_call_loop(a, 1'000'000);
+
+	for (const bool register_caching : { false, true })
+	{
+		MachineOptions<RISCV64> options;
+		options.use_shared_execute_segments = false;
+		options.translation_cache = false;
+		options.translate_use_register_caching = false;
+		options.translate_function_register_caching = register_caching;
+		Machine<RISCV64> machine { std::string_view{}, options };
+		machine.set_options(std::make_shared<MachineOptions<RISCV64>>(options));
+		load_program(machine, program);
+		REQUIRE(machine.simulate<false>(100'000'000ull));
+		REQUIRE(machine.cpu.current_execute_segment().is_binary_translated());
+
+		BENCHMARK(register_caching ? "register caching" : "no register caching") {
+			machine.cpu.reg(A::T1) = 0;
+			machine.cpu.jump(DST);
+			return machine.simulate<false>(100'000'000ull);
+		};
+	}
+}
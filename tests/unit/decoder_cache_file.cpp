@@ -0,0 +1,336 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <libriscv/machine.hpp>
+#include <libriscv/decoder_cache.hpp>
+#include <libriscv/rv32i_instr.hpp>
+#include <libriscv/threaded_bytecodes.hpp>
+#include <libriscv/util/crc32.hpp>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "untranslated.hpp"
+using namespace riscv;
+
+static const std::array<uint32_t, 13> program {
+	0x12345537, //        lui     a0,0x12345
+	0x67850513, //        addi    a0,a0,0x678
+	0x00000593, //        li      a1,0
+	0x06400613, //        li      a2,100
+	0x00158593, // loop:  addi    a1,a1,1
+	0xfec59ee3, //        bne     a1,a2,loop
+	0x00000697, //        auipc   a3,0x0
+	0xfe868693, //        addi    a3,a3,-24
+	0x00000097, //        auipc   ra,0x0
+	0x00c080e7, //        jalr    ra,12(ra)
+	0x7ff00073, //        stop
+	0x00b50533, //        add     a0,a0,a1
+	0x00008067, //        ret
+};
+static constexpr uint32_t DST = 0x1000;
+static const std::string PREFIX = "/tmp/rvdecoder-unittest-";
+
+static void remove_cache_files()
+{
+	const std::filesystem::path dir { "/tmp" };
+	for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+		if (entry.path().string().rfind(PREFIX, 0) == 0)
+			std::filesystem::remove(entry.path());
+	}
+}
+
+template <int W>
+static std::shared_ptr<MachineOptions<W>> cache_options()
+{
+	return untranslated<W>({
+		.use_shared_execute_segments = false,
+		.persistent_decoder_cache = true,
+		.decoder_cache_prefix = PREFIX,
+	});
+}
+
+// The rest of the execute page is filled with copies of filler
+static void run_program(Machine<RISCV32>& machine, uint32_t filler = 0)
+{
+	std::vector<uint32_t> page(riscv::Page::size() / 4, filler);
+	std::copy(program.begin(), program.end(), page.begin());
+	machine.copy_to_guest(DST, page.data(), page.size() * 4);
+	machine.memory.set_page_attr(DST, riscv::Page::size(), {
+		.read = false,
+		.write = false,
+		.exec = true
+	});
+	machine.cpu.jump(DST);
+	machine.simulate(1000);
+
+	REQUIRE(machine.cpu.reg(REG_ARG0) == 0x12345678 + 100);
+	REQUIRE(machine.cpu.reg(REG_ARG1) == 100);
+	REQUIRE(machine.cpu.reg(REG_RA) == DST + 0x28);
+}
+
+// Modify the payload of every stored file and update its checksum
+static void rewrite_payloads(const std::function<void(std::vector<uint8_t>&)>& modify)
+{
+	for (const auto& entry : std::filesystem::directory_iterator("/tmp")) {
+		if (entry.path().string().rfind(PREFIX, 0) != 0)
+			continue;
+		FILE* f = fopen(entry.path().c_str(), "r+b");
+		REQUIRE(f != nullptr);
+		std::vector<uint8_t> payload(std::filesystem::file_size(entry.path()) - 4096);
+		REQUIRE(fseek(f, 4096, SEEK_SET) == 0);
+		REQUIRE(fread(payload.data(), payload.size(), 1, f) == 1);
+		modify(payload);
+		const uint32_t crc = crc32c(payload.data(), payload.size());
+		REQUIRE(fseek(f, 12, SEEK_SET) == 0);
+		REQUIRE(fwrite(&crc, sizeof(crc), 1, f) == 1);
+		REQUIRE(fseek(f, 4096, SEEK_SET) == 0);
+		REQUIRE(fwrite(payload.data(), payload.size(), 1, f) == 1);
+		fclose(f);
+	}
+}
+
+TEST_CASE("Decoder cache is stored and mapped back in", "[DecoderCache]")
+{
+	remove_cache_files();
+	auto options = cache_options<RISCV32>();
+
+	Machine<RISCV32> first { std::string_view{}, *options };
+	first.set_options(options);
+	run_program(first);
+	REQUIRE(!first.cpu.current_execute_segment().is_decoder_cache_mapped());
+
+	Machine<RISCV32> second { std::string_view{}, *options };
+	second.set_options(options);
+	run_program(second);
+#ifdef __linux__
+	REQUIRE(second.cpu.current_execute_segment().is_decoder_cache_mapped());
+#endif
+	REQUIRE(first.instruction_counter() == second.instruction_counter());
+
+	remove_cache_files();
+}
+
+TEST_CASE("Corrupt decoder cache files are ignored", "[DecoderCache]")
+{
+	remove_cache_files();
+	auto options = cache_options<RISCV32>();
+	{
+		Machine<RISCV32> machine { std::string_view{}, *options };
+		machine.set_options(options);
+		run_program(machine);
+	}
+
+	// Flip a byte in the payload of every stored file
+	for (const auto& entry : std::filesystem::directory_iterator("/tmp")) {
+		if (entry.path().string().rfind(PREFIX, 0) != 0)
+			continue;
+		FILE* f = fopen(entry.path().c_str(), "r+b");
+		REQUIRE(f != nullptr);
+		REQUIRE(fseek(f, 4096 + 64, SEEK_SET) == 0);
+		const int c = fgetc(f);
+		REQUIRE(fseek(f, 4096 + 64, SEEK_SET) == 0);
+		fputc(c ^ 0xFF, f);
+		fclose(f);
+	}
+
+	Machine<RISCV32> machine { std::string_view{}, *options };
+	machine.set_options(options);
+	run_program(machine);
+	REQUIRE(!machine.cpu.current_execute_segment().is_decoder_cache_mapped());
+
+	remove_cache_files();
+}
+
+TEST_CASE("Decoder cache files with invalid entries are ignored", "[DecoderCache]")
+{
+	remove_cache_files();
+	auto options = cache_options<RISCV32>();
+	{
+		Machine<RISCV32> machine { std::string_view{}, *options };
+		machine.set_options(options);
+		run_program(machine);
+	}
+
+	// Plant a bytecode outside of the dispatch table, with a matching checksum
+	rewrite_payloads([] (std::vector<uint8_t>& payload) {
+		payload.at(0) = 0xFF; // The bytecode of the first instruction
+	});
+
+	Machine<RISCV32> machine { std::string_view{}, *options };
+	machine.set_options(options);
+	run_program(machine);
+	REQUIRE(!machine.cpu.current_execute_segment().is_decoder_cache_mapped());
+
+	remove_cache_files();
+}
+
+TEST_CASE("Decoder cache files with out-of-segment branches are ignored", "[DecoderCache]")
+{
+	remove_cache_files();
+	auto options = cache_options<RISCV32>();
+	{
+		Machine<RISCV32> machine { std::string_view{}, *options };
+		machine.set_options(options);
+		run_program(machine);
+	}
+
+	// Point the loop branch far below the execute segment
+	rewrite_payloads([] (std::vector<uint8_t>& payload) {
+		auto* entries = (DecoderData<RISCV32> *)payload.data();
+		const size_t n_entries = payload.size() / sizeof(DecoderData<RISCV32>);
+		size_t branches = 0;
+		for (size_t i = 0; i < n_entries; i++) {
+			if (entries[i].get_bytecode() != RV32I_BC_BNE)
+				continue;
+			FasterItype fi { entries[i].instr };
+			fi.imm = uint16_t(-0x4000);
+			entries[i].instr = fi.whole;
+			branches++;
+		}
+		REQUIRE(branches == 1);
+	});
+
+	Machine<RISCV32> machine { std::string_view{}, *options };
+	machine.set_options(options);
+	run_program(machine);
+	REQUIRE(!machine.cpu.current_execute_segment().is_decoder_cache_mapped());
+
+	remove_cache_files();
+}
+
+#ifdef __linux__
+TEST_CASE("Decoder cache files writable by others are ignored", "[DecoderCache]")
+{
+	remove_cache_files();
+	auto options = cache_options<RISCV32>();
+	{
+		Machine<RISCV32> machine { std::string_view{}, *options };
+		machine.set_options(options);
+		run_program(machine);
+	}
+
+	for (const auto& entry : std::filesystem::directory_iterator("/tmp")) {
+		if (entry.path().string().rfind(PREFIX, 0) != 0)
+			continue;
+		REQUIRE((std::filesystem::status(entry.path()).permissions() & std::filesystem::perms::group_write)
+			== std::filesystem::perms::none);
+		std::filesystem::permissions(entry.path(), std::filesystem::perms::group_write,
+			std::filesystem::perm_options::add);
+	}
+
+	Machine<RISCV32> machine { std::string_view{}, *options };
+	machine.set_options(options);
+	run_program(machine);
+	REQUIRE(!machine.cpu.current_execute_segment().is_decoder_cache_mapped());
+
+	remove_cache_files();
+}
+
+// True when the host page is still backed by the file, and not a private copy
+static bool is_file_backed(const void* addr)
+{
+	const int fd = open("/proc/self/pagemap", O_RDONLY);
+	REQUIRE(fd >= 0);
+	const uint64_t pageno = uintptr_t(addr) / getpagesize();
+	uint64_t entry = 0;
+	const bool ok = pread(fd, &entry, sizeof(entry), pageno * sizeof(entry)) == sizeof(entry);
+	close(fd);
+	REQUIRE(ok);
+	const bool present = (entry >> 63) & 1;
+	const bool file_or_shared = (entry >> 61) & 1;
+	return !present || file_or_shared;
+}
+
+TEST_CASE("Mapped decoder cache pages are not written to when loaded", "[DecoderCache]")
+{
+	remove_cache_files();
+	auto options = cache_options<RISCV32>();
+	// clz a0, a0: An instruction without its own bytecode, whose
+	// handler would otherwise have to be resolved after loading
+	static constexpr uint32_t CLZ = 0x60051513;
+	{
+		Machine<RISCV32> first { std::string_view{}, *options };
+		first.set_options(options);
+		run_program(first, CLZ);
+	}
+
+	Machine<RISCV32> second { std::string_view{}, *options };
+	second.set_options(options);
+	run_program(second, CLZ);
+	auto& exec = second.cpu.current_execute_segment();
+	REQUIRE(exec.is_decoder_cache_mapped());
+
+	// Only the host page with the executed instructions may have been copied
+	const auto* begin = (const char *)exec.decoder_cache_base();
+	const auto* end = begin + exec.decoder_cache_size() * sizeof(DecoderCache<RISCV32>);
+	const size_t host_page = getpagesize();
+	REQUIRE(size_t(end - begin) > host_page);
+	for (const char* p = begin + host_page; p < end; p += host_page)
+		REQUIRE(is_file_backed(p));
+
+	remove_cache_files();
+}
+
+#ifdef RISCV_EXT_COMPRESSED
+// Compressed loads and stores are executed through their handlers,
+// and the long run of c.lw ends a block with a handler-based bytecode.
+static void run_compressed_program(Machine<RISCV64>& machine)
+{
+	std::vector<uint32_t> program {
+		0x00008537, //        lui     a0,0x8
+		0xC10C4595, //        c.li    a1,5;     c.sw  a1,0(a0)
+		0xE50C4110, //        c.lw    a2,0(a0); c.sd  a1,8(a0)
+		0x96366514, //        c.ld    a3,8(a0); c.add a2,a3
+	};
+	program.insert(program.end(), 150, 0x41184118); // c.lw a4,0(a0)
+	program.push_back(0x7ff00073); //                  stop
+	machine.copy_to_guest(DST, program.data(), program.size() * 4);
+	machine.memory.set_page_attr(DST, riscv::Page::size(), {
+		.read = false,
+		.write = false,
+		.exec = true
+	});
+	machine.cpu.jump(DST);
+	machine.simulate(1000);
+}
+
+TEST_CASE("Decoder cache files do not depend on handler order", "[DecoderCache]")
+{
+	remove_cache_files();
+	auto options = cache_options<RISCV64>();
+
+	// Store the cache from a process that registers other handlers first,
+	// so that the handlers of this program get other indices than here.
+	const pid_t pid = fork();
+	REQUIRE(pid >= 0);
+	if (pid == 0) {
+		// The invalid instruction must come first, then add, addi, addw, addiw, ld, sd and fence
+		for (const uint32_t instr : { 0x0u, 0x00b50533u, 0x00150513u, 0x00b5053bu, 0x0015051bu,
+				0x00053503u, 0x00b53023u, 0x0ff0000fu })
+			DecoderData<RISCV64>::handler_index_for(CPU<RISCV64>::decode(rv32i_instruction{instr}).handler);
+		Machine<RISCV64> machine { std::string_view{}, *options };
+		machine.set_options(options);
+		run_compressed_program(machine);
+		_exit(machine.cpu.reg(REG_ARG2) == 10 && machine.cpu.reg(REG_ARG4) == 5 ? 0 : 1);
+	}
+	int status = 0;
+	REQUIRE(waitpid(pid, &status, 0) == pid);
+	REQUIRE(WIFEXITED(status));
+	REQUIRE(WEXITSTATUS(status) == 0);
+
+	Machine<RISCV64> machine { std::string_view{}, *options };
+	machine.set_options(options);
+	run_compressed_program(machine);
+	REQUIRE(machine.cpu.current_execute_segment().is_decoder_cache_mapped());
+	REQUIRE(machine.cpu.reg(REG_ARG2) == 10);
+	REQUIRE(machine.cpu.reg(REG_ARG3) == 5);
+	REQUIRE(machine.cpu.reg(REG_ARG4) == 5);
+
+	remove_cache_files();
+}
+#endif
+#endif
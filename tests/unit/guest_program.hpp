@@ -0,0 +1,45 @@
+#pragma once
+#include <libriscv/machine.hpp>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Hand-assembled programs (see assembler.hpp) are placed at DST,
+// with the stack pointer at STACK.
+static constexpr uint64_t DST   = 0x10000;
+static constexpr uint64_t STACK = 0x100000;
+
+// Copy a program into execute-only memory at DST, and jump to it
+template <int W>
+inline void load_program(riscv::Machine<W>& machine, const std::vector<uint32_t>& program)
+{
+	const size_t size = program.size() * 4;
+	machine.copy_to_guest(DST, program.data(), size);
+	machine.memory.set_page_attr(DST, (size + riscv::Page::size() - 1) & ~(riscv::Page::size() - 1), {
+		.read = false,
+		.write = false,
+		.exec = true
+	});
+	machine.cpu.reg(riscv::REG_SP) = STACK;
+	machine.cpu.jump(DST);
+}
+
+// Replace the compiler used by binary translation, eg. with "false" to
+// make compilation fail, until going out of scope
+struct CompilerOverride {
+	CompilerOverride(const std::string& cc) {
+		if (const char* current = getenv("CC")) {
+			original = current;
+			had_original = true;
+		}
+		setenv("CC", cc.c_str(), 1);
+	}
+	~CompilerOverride() {
+		if (had_original)
+			setenv("CC", original.c_str(), 1);
+		else
+			unsetenv("CC");
+	}
+	std::string original;
+	bool had_original = false;
+};
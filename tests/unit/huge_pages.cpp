@@ -0,0 +1,104 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <libriscv/machine.hpp>
+#include "assembler.hpp"
+using namespace riscv;
+using A = Assembler;
+
+static constexpr uint64_t CODE = 0x1000;
+
+// The STREAM triad kernel on 64-bit integers: a[i] = b[i] + 3 * c[i]
+static std::vector<uint32_t> triad_program()
+{
+	A a;
+	a.label("start");
+	a.load(0x3, A::T0, A::A1, 0);  // ld   t0, 0(a1)
+	a.load(0x3, A::T1, A::A2, 0);  // ld   t1, 0(a2)
+	a.slli(A::T2, A::T1, 1);
+	a.add(A::T1, A::T1, A::T2);
+	a.add(A::T0, A::T0, A::T1);
+	a.store(0x3, A::A0, A::T0, 0); // sd   t0, 0(a0)
+	a.addi(A::A0, A::A0, 8);
+	a.addi(A::A1, A::A1, 8);
+	a.addi(A::A2, A::A2, 8);
+	a.addi(A::A3, A::A3, -1);
+	a.bne(A::A3, A::ZERO, "start");
+	a.stop();
+	return a.finish();
+}
+
+struct Triad
+{
+	static constexpr uint64_t A = 0x100000;
+
+	Triad(const MachineOptions<RISCV64>& options, size_t elements)
+		: machine { std::string_view{}, options }, n(elements)
+	{
+		const auto triad = triad_program();
+		machine.copy_to_guest(CODE, triad.data(), triad.size() * 4);
+		machine.memory.set_page_attr(CODE, Page::size(), { .read = false, .write = false, .exec = true });
+		std::vector<uint64_t> values(n);
+		for (size_t i = 0; i < n; i++)
+			values[i] = i;
+		machine.copy_to_guest(b(), values.data(), n * 8);
+		for (size_t i = 0; i < n; i++)
+			values[i] = 2 * i + 1;
+		machine.copy_to_guest(c(), values.data(), n * 8);
+		machine.memory.memset(A, 0, n * 8);
+	}
+	uint64_t b() const noexcept { return A + n * 8; }
+	uint64_t c() const noexcept { return A + 2 * n * 8; }
+
+	void run() {
+		machine.cpu.reg(Assembler::A0) = A;
+		machine.cpu.reg(Assembler::A1) = b();
+		machine.cpu.reg(Assembler::A2) = c();
+		machine.cpu.reg(Assembler::A3) = n;
+		machine.cpu.jump(CODE);
+		machine.simulate(n * 16);
+	}
+
+	Machine<RISCV64> machine;
+	const size_t n;
+};
+
+TEST_CASE("Memory arenas can be backed by huge pages", "[Memory]")
+{
+	static constexpr size_t N = 3 << 16;
+	for (const bool memfd : { false, true })
+	{
+		Triad t { { .memory_max = 16ul << 20, .use_memfd_arena = memfd, .use_huge_pages = true }, N };
+		t.run();
+		REQUIRE(t.machine.instruction_counter() == N * 11 + 1);
+		for (size_t i = 0; i < N; i += 97)
+			REQUIRE(t.machine.memory.read<uint64_t>(Triad::A + i * 8) == i + 3 * (2 * i + 1));
+
+		// Whole-page discards must zero memory, whatever backs the arena
+		t.machine.memory.memdiscard(Triad::A, 4 * Page::size(), true);
+		REQUIRE(t.machine.memory.read<uint64_t>(Triad::A + 8) == 0);
+		REQUIRE(t.machine.memory.read<uint64_t>(Triad::A + 4 * Page::size()) != 0);
+
+		Machine<RISCV64> fork { t.machine, { .memory_max = 16ul << 20 } };
+		REQUIRE(fork.memory.read<uint64_t>(t.c()) == 1);
+		fork.memory.write<uint64_t>(t.c(), 0);
+		REQUIRE(t.machine.memory.read<uint64_t>(t.c()) == 1);
+	}
+}
+
+TEST_CASE("STREAM triad with and without huge pages", "[.benchmark]")
+{
+	// Three 64MB arrays, well beyond what the host TLB covers with 4KB pages
+	static constexpr size_t N = 8u << 20;
+	Triad regular { { .memory_max = 256ul << 20 }, N };
+	Triad huge { { .memory_max = 256ul << 20, .use_huge_pages = true }, N };
+
+	BENCHMARK("4KB pages") {
+		regular.run();
+		return regular.machine.cpu.reg(A::T0);
+	};
+	BENCHMARK("Huge pages") {
+		huge.run();
+		return huge.machine.cpu.reg(A::T0);
+	};
+}
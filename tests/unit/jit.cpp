@@ -0,0 +1,539 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <libriscv/machine.hpp>
+#include <cstring>
+#include "assembler.hpp"
+#include "guest_program.hpp"
+using namespace riscv;
+using A = Assembler;
+
+// Every program is run twice, once interpreted and once translated by the
+// JIT, and the resulting machine states must be identical.
+static constexpr uint64_t DATA  = 0x40000;
+
+template <int W>
+struct Result {
+	std::array<address_type<W>, 32> regs {};
+	address_type<W> pc = 0;
+	uint64_t counter = 0;
+	bool stopped = false;
+	int exception = -1;
+	uint64_t exception_data = 0;
+	bool translated = false;
+};
+
+template <int W>
+static std::unique_ptr<Machine<W>> make_machine(const std::vector<uint32_t>& program, bool translate)
+{
+	auto options = std::make_shared<MachineOptions<W>>();
+	options->use_shared_execute_segments = false;
+	options->translate_enabled = translate;
+	options->translation_cache = false;
+	auto machine = std::make_unique<Machine<W>>(std::string_view{}, *options);
+	machine->set_options(options);
+
+	load_program(*machine, program);
+	return machine;
+}
+
+template <int W>
+static Result<W> result_of(Machine<W>& machine)
+{
+	Result<W> result;
+	for (int i = 0; i < 32; i++)
+		result.regs[i] = machine.cpu.reg(i);
+	result.pc = machine.cpu.pc();
+	result.counter = machine.instruction_counter();
+	result.stopped = !machine.instruction_limit_reached();
+	result.translated = machine.cpu.current_execute_segment().is_binary_translated();
+	return result;
+}
+
+template <int W, typename Setup>
+static Result<W> run(const std::vector<uint32_t>& program, bool translate, uint64_t max, Setup setup)
+{
+	auto machine = make_machine<W>(program, translate);
+	setup(*machine);
+	Result<W> result;
+	try {
+		machine->template simulate<false>(max);
+		result = result_of(*machine);
+	} catch (const MachineException& e) {
+		result = result_of(*machine);
+		result.exception = e.type();
+		result.exception_data = e.data();
+	}
+	return result;
+}
+
+template <int W>
+static void require_same(const Result<W>& interpreted, const Result<W>& jit)
+{
+	REQUIRE(!interpreted.translated);
+	REQUIRE(jit.translated);
+	for (int i = 0; i < 32; i++)
+		REQUIRE(interpreted.regs[i] == jit.regs[i]);
+	REQUIRE(interpreted.exception == jit.exception);
+	REQUIRE(interpreted.exception_data == jit.exception_data);
+	// The interpreter only knows the PC of the block a memory fault happened in
+	if (interpreted.exception == -1 || interpreted.exception == ILLEGAL_OPCODE)
+		REQUIRE(interpreted.pc == jit.pc);
+	REQUIRE(interpreted.stopped == jit.stopped);
+}
+
+template <int W, typename Setup>
+static std::pair<Result<W>, Result<W>> run_both(const std::vector<uint32_t>& program, uint64_t max, Setup setup)
+{
+	auto interpreted = run<W>(program, false, max, setup);
+	auto jit = run<W>(program, true, max, setup);
+	require_same(interpreted, jit);
+	return { interpreted, jit };
+}
+template <int W>
+static std::pair<Result<W>, Result<W>> run_both(const std::vector<uint32_t>& program, uint64_t max = 1'000'000)
+{
+	return run_both<W>(program, max, [] (auto&) {});
+}
+
+template <int W>
+static void alu_edge_cases()
+{
+	static constexpr unsigned XLEN = W * 8;
+	// 0, 1, -1, 7, -7, INT_MIN, INT_MAX
+	static const unsigned values[] = { A::ZERO, A::S1, A::S2, A::S3, A::S4, A::S5, A::T3 };
+	A a;
+	a.li(A::S0, DATA);
+	a.li(A::S1, 1);
+	a.li(A::S2, -1);
+	a.li(A::S3, 7);
+	a.li(A::S4, -7);
+	a.slli(A::S5, A::S1, XLEN - 1);
+	a.srli(A::T3, A::S2, 1);
+
+	struct Op { unsigned f3, f7; bool is_32bit; };
+	std::vector<Op> ops;
+	for (unsigned f3 = 0; f3 < 8; f3++) {
+		ops.push_back({f3, 0x00, false}); // ADD, SLL, SLT, SLTU, XOR, SRL, OR, AND
+		ops.push_back({f3, 0x01, false}); // MUL, MULH, MULHSU, MULHU, DIV, DIVU, REM, REMU
+	}
+	ops.push_back({0x0, 0x20, false}); // SUB
+	ops.push_back({0x5, 0x20, false}); // SRA
+	if constexpr (W == 8) {
+		for (unsigned f3 : { 0x0, 0x1, 0x5 })
+			ops.push_back({f3, 0x00, true}); // ADDW, SLLW, SRLW
+		for (unsigned f3 : { 0x0, 0x4, 0x5, 0x6, 0x7 })
+			ops.push_back({f3, 0x01, true}); // MULW, DIVW, DIVUW, REMW, REMUW
+		ops.push_back({0x0, 0x20, true}); // SUBW
+		ops.push_back({0x5, 0x20, true}); // SRAW
+	}
+
+	size_t stores = 0;
+	for (const auto& op : ops) {
+		for (unsigned rs1 : values) {
+			for (unsigned rs2 : values) {
+				if (op.is_32bit)
+					a.op32(op.f3, op.f7, A::T0, rs1, rs2);
+				else
+					a.op(op.f3, op.f7, A::T0, rs1, rs2);
+				a.store(W == 8 ? 0x3 : 0x2, A::S0, A::T0, 0);
+				a.addi(A::S0, A::S0, W);
+				stores++;
+			}
+		}
+	}
+	a.stop();
+	const auto program = a.finish();
+
+	std::vector<uint8_t> memory[2];
+	for (const bool translate : { false, true })
+	{
+		auto machine = make_machine<W>(program, translate);
+		machine->simulate(1'000'000);
+		REQUIRE(machine->cpu.current_execute_segment().is_binary_translated() == translate);
+		auto& buffer = memory[translate];
+		buffer.resize(stores * W);
+		machine->memory.memcpy_out(buffer.data(), DATA, buffer.size());
+	}
+	REQUIRE(memory[0] == memory[1]);
+}
+
+TEST_CASE("JIT: ALU, MULH and division edge cases", "[JIT]")
+{
+	alu_edge_cases<RISCV32>();
+	alu_edge_cases<RISCV64>();
+}
+
+template <int W>
+static void arena_boundary()
+{
+	// Store, then load back, at addresses around the end of the arena.
+	// Accesses that do not fit in the arena take the slow path. Accesses
+	// straddling the end of the arena are left out, as the page-based
+	// slow path does not split them.
+	A a;
+	a.store(W == 8 ? 0x3 : 0x2, A::A0, A::A1, 0);
+	a.load(W == 8 ? 0x3 : 0x2, A::A2, A::A0, 0);
+	a.load(0x4, A::A3, A::A0, W-1); // LBU
+	a.load(0x1, A::A4, A::A0, 0); // LH
+	a.stop();
+	const auto program = a.finish();
+
+	Machine<W> machine;
+	const uint64_t arena_end = machine.memory.memory_arena_size();
+	for (const uint64_t addr : { arena_end - 2*W, arena_end - W, arena_end, arena_end + 0x1000, uint64_t(0x8), uint64_t(DST) })
+	{
+		auto [interpreted, jit] = run_both<W>(program, 1000, [addr] (auto& m) {
+			m.cpu.reg(REG_ARG0) = addr;
+			m.cpu.reg(REG_ARG1) = address_type<W>(0x8877665544332211ull);
+		});
+		if (addr == arena_end - 2*W) // Fast path
+			REQUIRE(jit.regs[REG_ARG2] == address_type<W>(0x8877665544332211ull));
+	}
+}
+
+TEST_CASE("JIT: Loads and stores at the arena boundary", "[JIT]")
+{
+	arena_boundary<RISCV32>();
+	arena_boundary<RISCV64>();
+}
+
+template <int W>
+static void loops_with_fuel()
+{
+	// Nested loops with signed and unsigned compares
+	A a;
+	a.li(A::A0, 0);
+	a.li(A::A1, 100);
+	a.li(A::A2, 3);
+	a.label("outer");
+	a.li(A::A3, -3);
+	a.label("inner");
+	a.addi(A::A3, A::A3, 1);
+	a.bltu(A::A3, A::A2, "skip"); // Negative values are large when unsigned
+	a.addi(A::A4, A::A4, 1);
+	a.label("skip");
+	a.blt(A::A3, A::A2, "inner");
+	a.addi(A::A0, A::A0, 1);
+	a.bne(A::A0, A::A1, "outer");
+	a.stop();
+	auto [i1, j1] = run_both<W>(a.finish());
+	REQUIRE(j1.regs[REG_ARG4] == 300);
+	REQUIRE(i1.counter == j1.counter);
+
+	A b;
+	b.li(A::A0, 0);
+	b.li(A::A1, 3000);
+	b.label("loop");
+	b.addi(A::A0, A::A0, 1);
+	b.j("skip");
+	b.addi(A::A5, A::A5, 1); // Never executed
+	b.label("skip");
+	b.bne(A::A0, A::A1, "loop");
+	b.stop();
+	const auto program = b.finish();
+
+	// Run to completion
+	auto [interpreted, jit] = run_both<W>(program);
+	REQUIRE(jit.regs[REG_ARG0] == 3000);
+	REQUIRE(jit.regs[REG_ARG5] == 0);
+	REQUIRE(jit.stopped);
+	REQUIRE(interpreted.counter == jit.counter);
+
+	// Run out of fuel in the middle of the loop, then resume
+	for (const bool translate : { false, true })
+	{
+		auto machine = make_machine<W>(program, translate);
+		REQUIRE(!machine->template simulate<false>(1000));
+		REQUIRE(machine->instruction_limit_reached());
+		REQUIRE(machine->instruction_counter() >= 1000);
+		// The counter is checked at least once per loop iteration
+		REQUIRE(machine->instruction_counter() < 1000 + 8);
+		REQUIRE(machine->cpu.reg(REG_ARG0) < 3000);
+
+		REQUIRE(machine->template resume<false>(1'000'000));
+		REQUIRE(machine->cpu.reg(REG_ARG0) == 3000);
+		REQUIRE(machine->instruction_counter() == interpreted.counter);
+	}
+}
+
+TEST_CASE("JIT: Branches and loops with instruction limits", "[JIT]")
+{
+	loops_with_fuel<RISCV32>();
+	loops_with_fuel<RISCV64>();
+}
+
+template <int W>
+static void system_calls()
+{
+	struct Calls {
+		unsigned ecalls = 0;
+		unsigned ebreaks = 0;
+		uint64_t last_counter = 0;
+	};
+	Machine<W>::install_syscall_handler(1, [] (Machine<W>& machine) {
+		auto* calls = machine.template get_userdata<Calls>();
+		calls->ecalls++;
+		// The instruction counter is visible and up to date in system calls
+		REQUIRE(machine.instruction_counter() > calls->last_counter);
+		calls->last_counter = machine.instruction_counter();
+		auto [a, b] = machine.template sysargs<address_type<W>, address_type<W>>();
+		machine.set_result(a * 2 + b);
+	});
+	Machine<W>::install_syscall_handler(SYSCALL_EBREAK, [] (Machine<W>& machine) {
+		machine.template get_userdata<Calls>()->ebreaks++;
+	});
+	Machine<W>::install_syscall_handler(2, [] (Machine<W>& machine) {
+		machine.stop();
+	});
+
+	A a;
+	a.li(A::A7, 1);
+	a.li(A::S1, 10);
+	a.li(A::A0, 1);
+	a.label("loop");
+	a.li(A::A1, 3);
+	a.ecall();
+	a.ebreak();
+	a.addi(A::S1, A::S1, -1);
+	a.bne(A::S1, A::ZERO, "loop");
+	// RDINSTRET is handled outside of the JIT, and must see the current counter
+	a.csrr(A::S2, 0xC02);
+	a.li(A::A7, 2);
+	a.ecall(); // Stops the machine
+	a.li(A::S3, 1); // Never executed
+	a.stop();
+	const auto program = a.finish();
+
+	Calls calls[2];
+	unsigned run_index = 0;
+	auto [interpreted, jit] = run_both<W>(program, 1'000'000, [&] (auto& m) {
+		m.set_userdata(&calls[run_index++]);
+	});
+	REQUIRE(interpreted.counter == jit.counter);
+	REQUIRE(jit.regs[19] == 0);
+	REQUIRE(jit.stopped);
+	REQUIRE(jit.regs[18] > 10 * 5);
+	REQUIRE(jit.regs[18] == interpreted.regs[18]);
+	for (auto& c : calls) {
+		REQUIRE(c.ecalls == 10);
+		REQUIRE(c.ebreaks == 10);
+	}
+}
+
+TEST_CASE("JIT: System calls, EBREAK and stopping", "[JIT]")
+{
+	system_calls<RISCV32>();
+	system_calls<RISCV64>();
+}
+
+template <int W>
+static void replacing_system_calls()
+{
+	// The system call evicts the execute segment and replaces the function
+	// that is called right after, which must then run the new code
+	static constexpr int SYSCALL_REPLACE = 500;
+	A a;
+	a.li(A::A7, SYSCALL_REPLACE);
+	a.ecall();
+	a.li(A::A1, 3);
+	a.call("f");
+	a.stop();
+	a.label("f");
+	a.li(A::A0, 1);
+	a.ret();
+	const auto program = a.finish();
+
+	A replacement;
+	replacement.li(A::A0, 2);
+	static uint32_t replaced_instruction;
+	static uint64_t replaced_address;
+	replaced_instruction = replacement.finish().at(0);
+	replaced_address = DST + a.offset_of("f");
+	// The evicted segment is kept alive, as its translation is still running
+	static std::shared_ptr<DecodedExecuteSegment<W>> evicted;
+	Machine<W>::install_syscall_handler(SYSCALL_REPLACE, [] (Machine<W>& machine) {
+		evicted = machine.memory.exec_segment_for(machine.cpu.pc());
+		machine.memory.evict_execute_segments();
+		const uint64_t page = replaced_address & ~uint64_t(Page::size() - 1);
+		machine.memory.set_page_attr(page, Page::size(), { .read = false, .write = true, .exec = true });
+		machine.copy_to_guest(replaced_address, &replaced_instruction, sizeof(replaced_instruction));
+		machine.memory.set_page_attr(page, Page::size(), { .read = false, .write = false, .exec = true });
+	});
+
+	const auto result = run<W>(program, true, 1000, [] (auto&) {});
+	REQUIRE(result.stopped);
+	REQUIRE(result.exception == -1);
+	REQUIRE(result.regs[REG_ARG0] == 2);
+	REQUIRE(result.regs[REG_ARG1] == 3);
+	evicted = nullptr;
+}
+
+TEST_CASE("JIT: System calls that replace code leave the JIT", "[JIT]")
+{
+	replacing_system_calls<RISCV32>();
+	replacing_system_calls<RISCV64>();
+}
+
+template <int W>
+static void illegal_and_faults()
+{
+	// Illegal instruction after a few regular ones
+	A a;
+	a.li(A::A0, 1234);
+	a.addi(A::A1, A::A0, 1);
+	a.emit(0x00000000);
+	a.stop();
+	auto [i1, j1] = run_both<W>(a.finish());
+	REQUIRE(j1.exception == ILLEGAL_OPCODE);
+	REQUIRE(j1.pc == DST + 8);
+	REQUIRE(i1.pc == DST + 8);
+	REQUIRE(j1.regs[REG_ARG1] == 1235);
+
+	// Protection fault on a load from an unreadable page outside the arena
+	A b;
+	b.li(A::A1, 1);
+	b.load(0x2, A::A2, A::A0, 0);
+	b.li(A::A1, 2);
+	b.stop();
+	auto [i2, j2] = run_both<W>(b.finish(), 1000, [] (auto& m) {
+		const uint64_t addr = m.memory.memory_arena_size() + 0x10000;
+		m.memory.set_page_attr(addr, Page::size(), { .read = false, .write = false, .exec = false });
+		m.cpu.reg(REG_ARG0) = addr;
+	});
+	REQUIRE(j2.exception == PROTECTION_FAULT);
+	REQUIRE(j2.regs[REG_ARG1] == 1);
+
+	// Exception thrown from an instruction handled outside of the JIT
+	A c;
+	c.li(A::A0, 5);
+	c.i_type(0x73, 0x3, A::ZERO, A::A0, 0x7FF); // CSRRC on an unknown CSR
+	c.li(A::A0, 6);
+	c.stop();
+	auto [i3, j3] = run_both<W>(c.finish());
+	REQUIRE(j3.exception == ILLEGAL_OPERATION);
+	REQUIRE(j3.regs[REG_ARG0] == 5);
+
+	// A fault in an atomic, which is handled outside of the JIT,
+	// must not lose the instructions counted before it
+	A d;
+	for (int i = 0; i < 10; i++)
+		d.addi(A::A1, A::A1, 1);
+	d.r_type(0x2F, 0x2, 0x00, A::A2, A::A0, A::A1); // AMOADD.W
+	d.stop();
+	auto [i4, j4] = run_both<W>(d.finish(), 1000, [] (auto& m) {
+		const uint64_t addr = m.memory.memory_arena_size() + 0x10000;
+		m.memory.set_page_attr(addr, Page::size(), { .read = false, .write = false, .exec = false });
+		m.cpu.reg(REG_ARG0) = addr;
+	});
+	REQUIRE(j4.exception == PROTECTION_FAULT);
+	// The interpreter does not update the counter when a handler throws
+	REQUIRE(j4.counter >= 10);
+}
+
+TEST_CASE("JIT: Illegal instructions and exceptions", "[JIT]")
+{
+	illegal_and_faults<RISCV32>();
+	illegal_and_faults<RISCV64>();
+}
+
+template <int W>
+static void misaligned_jumps()
+{
+	// A direct jump to a misaligned address, which is only possible
+	// without compressed instructions, raises an exception at the jump
+	A a;
+	a.li(A::A0, 7);
+	a.emit(0x006000EF); // jal ra, .+6
+	a.li(A::A0, 8);
+	a.li(A::A0, 9);
+	a.stop();
+	const auto program = a.finish();
+	const auto interpreted = run<W>(program, false, 1000, [] (auto&) {});
+	const auto jit = run<W>(program, true, 1000, [] (auto&) {});
+	REQUIRE(jit.translated);
+	REQUIRE(jit.exception == MISALIGNED_INSTRUCTION);
+	REQUIRE(jit.exception_data == DST + 10);
+	// The interpreter does not decode misaligned jumps, and
+	// reports them as illegal instructions instead
+	REQUIRE(interpreted.exception == ILLEGAL_OPCODE);
+	REQUIRE(interpreted.pc == jit.pc);
+	REQUIRE(interpreted.regs == jit.regs);
+	REQUIRE(jit.pc == DST + 4);
+	REQUIRE(jit.regs[REG_ARG0] == 7);
+	REQUIRE(jit.regs[REG_RA] == 0);
+}
+
+TEST_CASE("JIT: Misaligned jumps", "[JIT]")
+{
+	if constexpr (!compressed_enabled) {
+		misaligned_jumps<RISCV32>();
+		misaligned_jumps<RISCV64>();
+	}
+}
+
+template <int W>
+static void counters_in_memory_handlers()
+{
+	// Reads from unmapped pages outside of the arena call the page read
+	// handler from the slow-path, which can see the instruction counter
+	A a;
+	for (int i = 0; i < 10; i++)
+		a.addi(A::A1, A::A1, 1);
+	a.load(0x2, A::A2, A::A0, 0);
+	a.addi(A::A1, A::A1, 1);
+	a.stop();
+	const auto program = a.finish();
+
+	static uint64_t seen_counter;
+	seen_counter = 0;
+	auto [interpreted, jit] = run_both<W>(program, 1000, [] (auto& m) {
+		m.cpu.reg(REG_ARG0) = m.memory.memory_arena_size() + 0x10000;
+		m.memory.set_page_readf_handler([] (const Memory<W>& mem, address_type<W>) -> const Page& {
+			seen_counter = mem.machine().instruction_counter();
+			return Page::cow_page();
+		});
+	});
+	// The load itself is counted, as with other instructions that leave the JIT
+	REQUIRE(seen_counter == 11);
+	REQUIRE(jit.regs[REG_ARG1] == 11);
+	REQUIRE(interpreted.counter == jit.counter);
+}
+
+TEST_CASE("JIT: Memory slow-paths see the instruction counter", "[JIT]")
+{
+	counters_in_memory_handlers<RISCV32>();
+	counters_in_memory_handlers<RISCV64>();
+}
+
+template <int W>
+static void stopping_in_compressed_ebreak()
+{
+	Machine<W>::install_syscall_handler(SYSCALL_EBREAK, [] (Machine<W>& machine) {
+		machine.stop();
+	});
+
+	A a;
+	a.li(A::A0, 1);
+	a.emit(0x00019002); // c.ebreak; c.nop
+	a.addi(A::A0, A::A0, 1);
+	a.stop();
+	const auto program = a.finish();
+
+	auto machine = make_machine<W>(program, true);
+	machine->template simulate<false>(1000);
+	REQUIRE(machine->cpu.current_execute_segment().is_binary_translated());
+	// Stopped right after the 2-byte C.EBREAK
+	REQUIRE(machine->cpu.pc() == DST + 4 + 2);
+	REQUIRE(machine->cpu.reg(REG_ARG0) == 1);
+
+	REQUIRE(machine->template resume<false>(1000));
+	REQUIRE(machine->cpu.reg(REG_ARG0) == 2);
+}
+
+TEST_CASE("JIT: Stopping in a compressed EBREAK", "[JIT]")
+{
+	if constexpr (compressed_enabled) {
+		stopping_in_compressed_ebreak<RISCV32>();
+		stopping_in_compressed_ebreak<RISCV64>();
+	}
+}
@@ -0,0 +1,125 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <libriscv/machine.hpp>
+#include <libriscv/decoder_cache.hpp>
+#include <libriscv/threaded_bytecodes.hpp>
+#include "untranslated.hpp"
+using namespace riscv;
+
+static constexpr uint32_t DST = 0x1800;
+static constexpr unsigned LOOP_LENGTH = 1000;
+static constexpr unsigned ITERATIONS = 10;
+
+// A loop body that crosses the page boundary at 0x2000, while still
+// being short enough for the branch back to the beginning
+static std::vector<uint32_t> make_program()
+{
+	std::vector<uint32_t> program {
+		0x00000513, //        li      a0,0
+		0x00000593, //        li      a1,0
+		0x00a00613, //        li      a2,10
+	};
+	for (unsigned i = 0; i < LOOP_LENGTH; i++)
+		program.push_back(0x00150513); // addi a0,a0,1
+	program.push_back(0x00158593); //   addi    a1,a1,1
+	// bne a1,a2,loop (B-type, offset back to the first addi)
+	const int32_t offset = -int32_t(4 * (LOOP_LENGTH + 1));
+	const uint32_t imm = uint32_t(offset);
+	program.push_back(0x00c59063
+		| (((imm >> 12) & 0x1) << 31) | (((imm >> 5) & 0x3F) << 25)
+		| (((imm >> 1) & 0xF) << 8)   | (((imm >> 11) & 0x1) << 7));
+	program.push_back(0x7ff00073); //   stop
+	return program;
+}
+
+static uint64_t run_program(bool lazy, uint32_t& result)
+{
+	auto options = untranslated<RISCV32>({
+		.use_shared_execute_segments = false,
+		.use_lazy_decoding = lazy,
+	});
+	Machine<RISCV32> machine { std::string_view{}, *options };
+	machine.set_options(options);
+
+	const auto program = make_program();
+	machine.copy_to_guest(DST, program.data(), program.size() * 4);
+	machine.memory.set_page_attr(0x1000, 2 * riscv::Page::size(), {
+		.read = false,
+		.write = false,
+		.exec = true
+	});
+	machine.cpu.jump(DST);
+	machine.simulate(1'000'000);
+
+	REQUIRE(machine.cpu.current_execute_segment().is_lazily_decoded() == lazy);
+	result = machine.cpu.reg(REG_ARG0);
+	return machine.instruction_counter();
+}
+
+TEST_CASE("Lazy decoding matches eager decoding", "[DecoderCache]")
+{
+	uint32_t eager_result = 0, lazy_result = 0;
+	const uint64_t eager_icount = run_program(false, eager_result);
+	const uint64_t lazy_icount  = run_program(true, lazy_result);
+
+	REQUIRE(eager_result == LOOP_LENGTH * ITERATIONS);
+	REQUIRE(lazy_result == eager_result);
+	REQUIRE(lazy_icount == eager_icount);
+}
+
+TEST_CASE("Forks share fully decoded segments", "[DecoderCache]")
+{
+	auto options = untranslated<RISCV32>({
+		.use_shared_execute_segments = false,
+		.use_lazy_decoding = true,
+	});
+	Machine<RISCV32> machine { std::string_view{}, *options };
+	machine.set_options(options);
+
+	// A third page of code that is never executed
+	const auto program = make_program();
+	const std::vector<uint32_t> unused(riscv::Page::size() / 4, 0x00150513);
+	machine.copy_to_guest(DST, program.data(), program.size() * 4);
+	machine.copy_to_guest(0x3000, unused.data(), unused.size() * 4);
+	machine.memory.set_page_attr(0x1000, 3 * riscv::Page::size(), {
+		.read = false,
+		.write = false,
+		.exec = true
+	});
+	machine.cpu.jump(DST);
+	machine.simulate(1'000'000);
+
+	auto& exec = machine.cpu.current_execute_segment();
+	REQUIRE(exec.is_lazily_decoded());
+	auto bytecode_at = [&] (uint32_t addr) {
+		return exec.decoder_cache()[addr / DecoderCache<RISCV32>::DIVISOR].get_bytecode();
+	};
+	REQUIRE(bytecode_at(0x3000) == RV32I_BC_INVALID);
+
+	// The execute segment is shared with the fork, and may be executed
+	// by both at the same time, so it can no longer change
+	Machine<RISCV32> fork { machine, *options };
+	REQUIRE(&fork.cpu.current_execute_segment() == &exec);
+	REQUIRE(bytecode_at(0x3000) != RV32I_BC_INVALID);
+
+	fork.cpu.jump(DST);
+	fork.simulate(1'000'000);
+	REQUIRE(fork.cpu.reg(REG_ARG0) == LOOP_LENGTH * ITERATIONS);
+
+	// Segments that other machines may share are decoded eagerly
+	auto shared = untranslated<RISCV32>({
+		.use_lazy_decoding = true,
+	});
+	Machine<RISCV32> other { std::string_view{}, *shared };
+	other.set_options(shared);
+	other.copy_to_guest(DST, program.data(), program.size() * 4);
+	other.memory.set_page_attr(0x1000, 2 * riscv::Page::size(), {
+		.read = false,
+		.write = false,
+		.exec = true
+	});
+	other.cpu.jump(DST);
+	other.simulate(1'000'000);
+	REQUIRE(!other.cpu.current_execute_segment().is_lazily_decoded());
+	REQUIRE(other.cpu.reg(REG_ARG0) == LOOP_LENGTH * ITERATIONS);
+}
@@ -0,0 +1,184 @@
+#include <catch2/catch_test_macros.hpp>
+#include <libriscv/machine_pool.hpp>
+#include <thread>
+extern std::vector<uint8_t> load_file(const std::string& filename);
+static const uint64_t MAX_MEMORY = 64ul << 20; /* 64MB */
+static const uint64_t MAX_INSTRUCTIONS = 10'000'000ul;
+static const std::string cwd {SRCDIR};
+using namespace riscv;
+
+static void setup_printer(Machine<RISCV64>& fork)
+{
+	fork.set_printer([] (const auto& m, const char* data, size_t size) {
+		auto* text = m.template get_userdata<std::string> ();
+		if (text) text->append(data, data + size);
+	});
+}
+
+TEST_CASE("Pooled forks are handed out and rewound", "[Fork]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+
+	riscv::Machine<RISCV64> machine { binary, {
+		.memory_max = MAX_MEMORY,
+		.use_memfd_arena = true
+	} };
+	machine.setup_linux_syscalls();
+	machine.setup_linux(
+		{"newlib-rv64gb-hello-world"},
+		{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+	const auto heap = machine.memory.heap_address();
+	const auto value = machine.memory.read<uint64_t>(heap);
+
+	MachinePool<RISCV64> pool { machine, 2, { .memory_max = MAX_MEMORY }, setup_printer };
+	REQUIRE(pool.capacity() == 2);
+
+	for (int i = 0; i < 3; i++)
+	{
+		auto a = pool.acquire();
+		auto b = pool.acquire();
+		REQUIRE(a);
+		REQUIRE(b);
+		REQUIRE(!pool.acquire());
+		REQUIRE(pool.in_use() == 2);
+
+		for (auto* fork : { &*a, &*b })
+		{
+			REQUIRE(fork->cpu.pc() == machine.cpu.pc());
+			REQUIRE(fork->memory.read<uint64_t>(heap) == value);
+			std::string text;
+			fork->set_userdata(&text);
+			fork->simulate(MAX_INSTRUCTIONS);
+			fork->set_userdata<std::string>(nullptr);
+			fork->memory.write<uint64_t>(heap, ~value);
+
+			REQUIRE(fork->return_value() == 666);
+			REQUIRE(text.find("Caught exception: Hello Exceptions!") != std::string::npos);
+		}
+		a.release();
+		REQUIRE(pool.in_use() == 1);
+	}
+
+	const auto stats = pool.stats();
+	REQUIRE(stats.in_use == 0);
+	REQUIRE(stats.peak_in_use == 2);
+	REQUIRE(stats.acquired == 6);
+	REQUIRE(stats.exhausted == 3);
+	REQUIRE(stats.recreated == 0);
+	REQUIRE(machine.memory.read<uint64_t>(heap) == value);
+}
+
+TEST_CASE("Pooled forks are shared between threads", "[Fork]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+	riscv::Machine<RISCV64> machine { binary, {
+		.memory_max = MAX_MEMORY,
+		.use_memfd_arena = true
+	} };
+	machine.setup_linux_syscalls();
+	machine.setup_linux(
+		{"newlib-rv64gb-hello-world"},
+		{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+
+	MachinePool<RISCV64> pool { machine, 3, { .memory_max = MAX_MEMORY }, setup_printer };
+
+	static constexpr int THREADS = 6;
+	static constexpr int ROUNDS = 20;
+	std::atomic<int> completed = 0;
+	std::atomic<int> failed = 0;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; t++)
+	{
+		threads.emplace_back([&] {
+			for (int i = 0; i < ROUNDS; )
+			{
+				auto fork = pool.acquire();
+				if (!fork) {
+					std::this_thread::yield();
+					continue;
+				}
+				fork->simulate(MAX_INSTRUCTIONS);
+				if (fork->return_value() != 666)
+					failed++;
+				completed++;
+				i++;
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	REQUIRE(failed == 0);
+	REQUIRE(completed == THREADS * ROUNDS);
+	const auto stats = pool.stats();
+	REQUIRE(stats.in_use == 0);
+	REQUIRE(stats.peak_in_use <= 3);
+	REQUIRE(stats.acquired == uint64_t(THREADS * ROUNDS));
+}
+
+TEST_CASE("Pooled forks that cannot be replaced are retired", "[Fork]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+	riscv::Machine<RISCV64> machine { binary, {
+		.memory_max = MAX_MEMORY,
+		.use_memfd_arena = true
+	} };
+	machine.setup_linux_syscalls();
+	machine.setup_linux(
+		{"newlib-rv64gb-hello-world"},
+		{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+
+	// Creating new forks fails once the pool has been filled
+	bool fail = false;
+	MachinePool<RISCV64> pool { machine, 2, { .memory_max = MAX_MEMORY },
+		[&] (auto& fork) {
+			if (fail)
+				throw MachineException(OUT_OF_MEMORY, "Out of memory");
+			setup_printer(fork);
+		} };
+
+	// A discarded fork is replaced with a new one
+	pool.acquire().discard();
+	REQUIRE(pool.stats().recreated == 1);
+	REQUIRE(pool.capacity() == 2);
+
+	fail = true;
+	{
+		auto fork = pool.acquire();
+		REQUIRE(fork);
+		fork->simulate(MAX_INSTRUCTIONS);
+		fork.discard();
+	}
+	auto stats = pool.stats();
+	REQUIRE(stats.in_use == 0);
+	REQUIRE(stats.recreated == 1);
+	REQUIRE(stats.retired == 1);
+	REQUIRE(pool.capacity() == 1);
+
+	// The remaining fork is still handed out and rewound
+	for (int i = 0; i < 2; i++) {
+		auto fork = pool.acquire();
+		REQUIRE(fork);
+		REQUIRE(!pool.acquire());
+		fork->simulate(MAX_INSTRUCTIONS);
+		REQUIRE(fork->return_value() == 666);
+	}
+	stats = pool.stats();
+	REQUIRE(stats.in_use == 0);
+	REQUIRE(stats.retired == 1);
+}
+
+TEST_CASE("Pools of machines with a plain arena are refused", "[Fork]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+	riscv::Machine<RISCV64> machine { binary, { .memory_max = MAX_MEMORY } };
+	machine.setup_linux_syscalls();
+	machine.setup_linux(
+		{"newlib-rv64gb-hello-world"},
+		{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+	if (!machine.memory.uses_flat_memory_arena())
+		return;
+
+	// Forks would have to run without an arena, which translated code cannot
+	REQUIRE_THROWS_AS((MachinePool<RISCV64> { machine, 2, { .memory_max = MAX_MEMORY } }), MachineException);
+}
@@ -0,0 +1,146 @@
+#include <catch2/catch_test_macros.hpp>
+#include <libriscv/machine.hpp>
+#include <algorithm>
+#include <array>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+static const uint64_t MAX_MEMORY = 64ul << 20; /* 64MB */
+static const uint64_t MAX_INSTRUCTIONS = 10'000'000ul;
+static const std::string cwd {SRCDIR};
+using namespace riscv;
+
+// The read-execute segment of the program, at file offset 0
+static constexpr uint64_t TEXT = 0x10000;
+static constexpr uint64_t TEXT_PAGES = 0x7b;
+
+struct MappedFile {
+	MappedFile(const std::string& filename) {
+		fd = open(filename.c_str(), O_RDONLY);
+		REQUIRE(fd >= 0);
+		struct stat st;
+		REQUIRE(fstat(fd, &st) == 0);
+		size = st.st_size;
+		data = (const char *)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		REQUIRE(data != MAP_FAILED);
+	}
+	~MappedFile() {
+		munmap((void *)data, size);
+		close(fd);
+	}
+	std::string_view view() const noexcept { return { data, size }; }
+
+	int fd = -1;
+	const char* data = nullptr;
+	size_t size = 0;
+};
+
+static bool is_file_mapped_at(const void* addr)
+{
+	std::ifstream maps("/proc/self/maps");
+	std::string line;
+	while (std::getline(maps, line)) {
+		uintptr_t begin, end;
+		if (sscanf(line.c_str(), "%lx-%lx", &begin, &end) == 2
+			&& uintptr_t(addr) >= begin && uintptr_t(addr) < end)
+			return line.find("newlib-rv64gb-hello-world") != std::string::npos;
+	}
+	return false;
+}
+
+static void run_program(Machine<RISCV64>& machine)
+{
+	std::string text;
+	machine.set_userdata(&text);
+	machine.set_printer([] (const auto& m, const char* data, size_t size) {
+		m.template get_userdata<std::string> ()->append(data, data + size);
+	});
+	machine.setup_linux_syscalls();
+	machine.setup_linux(
+		{"newlib-rv64gb-hello-world"},
+		{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+	machine.simulate(MAX_INSTRUCTIONS);
+
+	REQUIRE(machine.return_value() == 666);
+	REQUIRE(text.find("Caught exception: Hello Exceptions!") != std::string::npos);
+}
+
+TEST_CASE("Read-only ELF segments are mapped from the file", "[ELF]")
+{
+	const MappedFile file { cwd + "/elf/newlib-rv64gb-hello-world" };
+
+	for (const bool arena : { true, false })
+	{
+		Machine<RISCV64> machine { file.view(), {
+			.memory_max = MAX_MEMORY,
+			.binary_fd = file.fd,
+			.use_memory_arena = arena
+		} };
+		for (uint64_t i = 0; i < TEXT_PAGES; i++) {
+			const uint64_t addr = TEXT + i * Page::size();
+			REQUIRE(machine.memory.read<uint64_t>(addr + 8) == *(const uint64_t *)&file.data[addr - TEXT + 8]);
+		}
+		if (machine.memory.uses_flat_memory_arena()) {
+			REQUIRE(is_file_mapped_at((const char *)machine.memory.memory_arena_ptr() + TEXT));
+		} else {
+			const auto& page = machine.memory.get_page(TEXT);
+			REQUIRE(page.attr.non_owning);
+			REQUIRE(page.data() == (const uint8_t *)file.data);
+		}
+
+		// Pages made writable by the guest are copied on write
+		const uint64_t addr = TEXT + Page::size();
+		const uint64_t value = *(const uint64_t *)&file.data[Page::size()];
+		machine.memory.set_page_attr(addr, Page::size(), { .read = true, .write = true });
+		machine.memory.write<uint64_t>(addr, ~value);
+		REQUIRE(machine.memory.read<uint64_t>(addr) == ~value);
+		REQUIRE(*(const uint64_t *)&file.data[Page::size()] == value);
+	}
+}
+
+TEST_CASE("Discarded pages of a mapped ELF segment become zero", "[ELF]")
+{
+	const MappedFile file { cwd + "/elf/newlib-rv64gb-hello-world" };
+
+	for (const bool arena : { true, false })
+	{
+		Machine<RISCV64> machine { file.view(), {
+			.memory_max = MAX_MEMORY,
+			.binary_fd = file.fd,
+			.use_memory_arena = arena
+		} };
+		// A read-only page, and a page that was made writable and written to
+		const uint64_t readonly = TEXT + 2 * Page::size();
+		const uint64_t writable = TEXT + 3 * Page::size();
+		machine.memory.set_page_attr(writable, Page::size(), { .read = true, .write = true });
+		machine.memory.write<uint64_t>(writable, 1234);
+		REQUIRE(machine.memory.read<uint64_t>(readonly + 8) != 0);
+
+		machine.memory.memdiscard(readonly, Page::size(), true);
+		machine.memory.memdiscard(writable, Page::size(), false);
+		for (const uint64_t page : { readonly, writable }) {
+			std::array<uint8_t, Page::size()> buffer;
+			machine.memory.memcpy_out(buffer.data(), page, buffer.size());
+			REQUIRE(std::all_of(buffer.begin(), buffer.end(), [] (uint8_t b) { return b == 0; }));
+		}
+		// The file itself is unchanged
+		REQUIRE(*(const uint64_t *)&file.data[readonly - TEXT + 8] != 0);
+	}
+}
+
+TEST_CASE("Programs run from mapped ELF segments", "[ELF]")
+{
+	const MappedFile file { cwd + "/elf/newlib-rv64gb-hello-world" };
+
+	for (const bool arena : { true, false })
+	{
+		Machine<RISCV64> machine { file.view(), {
+			.memory_max = MAX_MEMORY,
+			.binary_fd = file.fd,
+			.use_memory_arena = arena
+		} };
+		run_program(machine);
+	}
+}
@@ -0,0 +1,48 @@
+#include <catch2/catch_test_macros.hpp>
+#include <libriscv/machine.hpp>
+extern std::vector<uint8_t> load_file(const std::string& filename);
+static const uint64_t MAX_MEMORY = 64ul << 20; /* 64MB */
+static const uint64_t MAX_INSTRUCTIONS = 10'000'000ul;
+static const std::string cwd {SRCDIR};
+using namespace riscv;
+
+TEST_CASE("Forks privately map a memfd-backed arena", "[Fork]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+
+	riscv::Machine<RISCV64> machine { binary, {
+		.memory_max = MAX_MEMORY,
+		.use_memfd_arena = true
+	} };
+	machine.setup_linux_syscalls();
+	machine.setup_linux(
+		{"newlib-rv64gb-hello-world"},
+		{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+
+	const auto heap = machine.memory.heap_address();
+	machine.memory.write<uint64_t>(heap, 0x1234);
+
+	for (int i = 0; i < 2; i++)
+	{
+		riscv::Machine<RISCV64> fork { machine, { .memory_max = MAX_MEMORY } };
+		if (fork.memory.uses_flat_memory_arena()) {
+			REQUIRE(fork.memory.memory_arena_ptr() != machine.memory.memory_arena_ptr());
+		}
+
+		// Forks see the main machine's memory, but their writes are private
+		REQUIRE(fork.memory.read<uint64_t>(heap) == 0x1234);
+		fork.memory.write<uint64_t>(heap, 0x5678);
+		REQUIRE(fork.memory.read<uint64_t>(heap) == 0x5678);
+		REQUIRE(machine.memory.read<uint64_t>(heap) == 0x1234);
+
+		std::string text;
+		fork.set_userdata(&text);
+		fork.set_printer([] (const auto& m, const char* data, size_t size) {
+			m.template get_userdata<std::string> ()->append(data, data + size);
+		});
+		fork.simulate(MAX_INSTRUCTIONS);
+
+		REQUIRE(fork.return_value() == 666);
+		REQUIRE(text.find("Caught exception: Hello Exceptions!") != std::string::npos);
+	}
+}
@@ -0,0 +1,80 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <libriscv/machine.hpp>
+#include <numeric>
+using namespace riscv;
+
+static const uint64_t MAX_MEMORY = 16ul << 20;
+// Inside the arena, and far outside of it
+static constexpr uint64_t ARENA_ADDR = 0x200000;
+static constexpr uint64_t PAGED_ADDR = 0x4000000000;
+
+TEST_CASE("Memory helpers across page boundaries", "[Memory]")
+{
+	std::vector<uint8_t> data(3 * Page::size() + 100);
+	std::iota(data.begin(), data.end(), 0);
+
+	for (const bool arena : { true, false })
+	{
+		Machine<RISCV64> machine { std::string_view{}, {
+			.memory_max = MAX_MEMORY, .use_memory_arena = arena
+		} };
+		for (const uint64_t base : { ARENA_ADDR, PAGED_ADDR })
+		{
+			const uint64_t a = base + 0x7F0;
+			const uint64_t b = base + 0x10000 + 0x123;
+			machine.copy_to_guest(a, data.data(), data.size());
+			machine.memory.memcpy(b, machine, a, data.size());
+
+			std::vector<uint8_t> out(data.size());
+			machine.copy_from_guest(out.data(), b, out.size());
+			REQUIRE(out == data);
+			REQUIRE(machine.memory.memcmp(a, b, data.size()) == 0);
+			REQUIRE(machine.memory.memcmp(data.data(), b, data.size()) == 0);
+
+			// The difference of the first mismatching bytes
+			const size_t last = data.size() - 1;
+			machine.memory.write<uint8_t>(b + last, data[last] + 5);
+			REQUIRE(machine.memory.memcmp(a, b, data.size()) == -5);
+			REQUIRE(machine.memory.memcmp(data.data(), b, data.size()) == -5);
+			REQUIRE(machine.memory.memcmp(a, b, last) == 0);
+
+			machine.memory.memset(a + 1, 0xAA, 2 * Page::size());
+			REQUIRE(machine.memory.read<uint8_t>(a) == data[0]);
+			REQUIRE(machine.memory.read<uint8_t>(a + 1) == 0xAA);
+			REQUIRE(machine.memory.read<uint8_t>(a + 2 * Page::size()) == 0xAA);
+			REQUIRE(machine.memory.read<uint8_t>(a + 2 * Page::size() + 1) == data[2 * Page::size() + 1]);
+			REQUIRE(machine.memory.memcmp(a, b, data.size()) > 0);
+		}
+	}
+}
+
+TEST_CASE("Memory helpers respect page protections", "[Memory]")
+{
+	Machine<RISCV64> machine { std::string_view{}, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	machine.memory.set_page_attr(PAGED_ADDR + Page::size(), Page::size(), { .read = false, .write = false });
+
+	const std::array<uint8_t, 64> data {};
+	REQUIRE_THROWS(machine.copy_to_guest(PAGED_ADDR + Page::size() - 32, data.data(), data.size()));
+	REQUIRE_THROWS(machine.memory.memset(PAGED_ADDR + Page::size() - 32, 0, 64));
+	REQUIRE_THROWS(machine.memory.memcmp(PAGED_ADDR, PAGED_ADDR + Page::size() - 32, 64));
+}
+
+TEST_CASE("Guest memcpy and memset inside the arena", "[.benchmark]")
+{
+	Machine<RISCV64> machine { std::string_view{}, { .memory_max = 64ul << 20 } };
+	static constexpr size_t LEN = 8ul << 20;
+	std::vector<uint8_t> data(LEN, 0x1);
+
+	BENCHMARK("copy_to_guest") {
+		machine.copy_to_guest(ARENA_ADDR, data.data(), LEN);
+	};
+	BENCHMARK("memset") {
+		machine.memory.memset(ARENA_ADDR, 0x1, LEN);
+	};
+	machine.copy_to_guest(ARENA_ADDR + LEN, data.data(), LEN);
+	BENCHMARK("memcmp") {
+		return machine.memory.memcmp(ARENA_ADDR, ARENA_ADDR + LEN, LEN);
+	};
+}
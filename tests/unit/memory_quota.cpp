@@ -0,0 +1,218 @@
+#include <catch2/catch_test_macros.hpp>
+#include <libriscv/machine.hpp>
+#include <cstring>
+extern std::vector<uint8_t> load_file(const std::string& filename);
+static const uint64_t MAX_MEMORY = 64ul << 20; /* 64MB */
+static const uint64_t MAX_INSTRUCTIONS = 10'000'000ul;
+static const std::string cwd {SRCDIR};
+using namespace riscv;
+
+static constexpr uint64_t PAGED_ADDR = 0x4000000000;
+static constexpr uint64_t QUOTA_PAGES = 16;
+
+// Count the pages the slow way, outside of any memory arena
+static Memory<RISCV64>::PageCounts recount(const Machine<RISCV64>& machine)
+{
+	Memory<RISCV64>::PageCounts counts;
+	for (const auto& it : machine.memory.pages()) {
+		const auto& page = it.second;
+		if (!page.attr.non_owning && !page.is_cow_page()) counts.owned++;
+		else if (page.attr.is_cow) counts.cow++;
+		else counts.shared++;
+	}
+	return counts;
+}
+
+static void require_counts(const Machine<RISCV64>& machine)
+{
+	const auto expected = recount(machine);
+	const auto& counts = machine.memory.page_counts();
+	REQUIRE(counts.owned == expected.owned);
+	REQUIRE(counts.cow == expected.cow);
+	REQUIRE(counts.shared == expected.shared);
+	REQUIRE(counts.arena == 0);
+	REQUIRE(machine.memory.owned_pages_active() == expected.owned);
+}
+
+static int quota_exception(const std::function<void()>& func)
+{
+	try {
+		func();
+	} catch (const MachineException& me) {
+		return me.type();
+	}
+	return -1;
+}
+
+TEST_CASE("Page counts follow pages as they change", "[Memory]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+	Machine<RISCV64> machine { binary, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	require_counts(machine);
+
+	const auto before = machine.memory.page_counts();
+	for (uint64_t i = 0; i < 8; i++)
+		machine.memory.write<uint64_t>(PAGED_ADDR + i * Page::size(), i);
+	REQUIRE(machine.memory.page_counts().owned == before.owned + 8);
+	machine.memory.set_page_attr(PAGED_ADDR + 16 * Page::size(), 2 * Page::size(), { .read = true, .write = false });
+	REQUIRE(machine.memory.page_counts().shared == before.shared + 2);
+	require_counts(machine);
+
+	machine.memory.free_pages(PAGED_ADDR, 4 * Page::size());
+	REQUIRE(machine.memory.page_counts().owned == before.owned + 4);
+	require_counts(machine);
+
+	// Forks start out owning nothing, and own what they write to
+	Machine<RISCV64> fork { machine, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	REQUIRE(fork.memory.page_counts().owned == 0);
+	require_counts(fork);
+	fork.memory.write<uint64_t>(PAGED_ADDR + 4 * Page::size(), 1);
+	fork.memory.write<uint64_t>(PAGED_ADDR + 5 * Page::size(), 1);
+	REQUIRE(fork.memory.page_counts().owned == 2);
+	require_counts(fork);
+
+	fork.memory.rewind(machine.memory);
+	REQUIRE(fork.memory.page_counts().owned == 0);
+	require_counts(fork);
+
+	// Serialized machines recount their pages
+	std::vector<uint8_t> state;
+	machine.serialize_to(state);
+	Machine<RISCV64> restored { binary, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	restored.deserialize_from(state);
+	require_counts(restored);
+
+	// A damaged state that lists a page twice is rejected
+	// The state begins with a packed header that describes itself:
+	// the page count is at 8, the data page count at 12, the page
+	// size at 18, the size of page attributes at 20, the size of a
+	// page record at 22 and the offset of the first record at 28.
+	const auto field = [&] (auto& value, size_t offset) {
+		std::memcpy(&value, &state.at(offset), sizeof(value));
+	};
+	uint32_t n_pages, n_datapages, mem_offset;
+	uint16_t page_size, attr_size, serp_size;
+	field(n_pages, 8);
+	field(n_datapages, 12);
+	field(page_size, 18);
+	field(attr_size, 20);
+	field(serp_size, 22);
+	field(mem_offset, 28);
+	REQUIRE(page_size == Page::size());
+	REQUIRE(n_pages >= n_datapages);
+	// A page record is its address and attributes, followed by the
+	// copy-on-write flag and padding up to the record size
+	REQUIRE(serp_size == sizeof(uint64_t) + attr_size + 4);
+	const bool first_is_cow = state.at(mem_offset + sizeof(uint64_t) + attr_size);
+	const size_t record_size = serp_size + (first_is_cow ? 0 : page_size);
+	// Append a copy of the first page record to the end of the state
+	const std::vector<uint8_t> record(&state.at(mem_offset), &state.at(mem_offset) + record_size);
+	state.insert(state.end(), record.begin(), record.end());
+	n_pages++;
+	if (!first_is_cow) n_datapages++;
+	std::memcpy(&state.at(8), &n_pages, sizeof(n_pages));
+	std::memcpy(&state.at(12), &n_datapages, sizeof(n_datapages));
+	Machine<RISCV64> damaged { binary, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	REQUIRE_THROWS(damaged.deserialize_from(state));
+
+	machine.setup_linux_syscalls();
+	machine.setup_linux({"newlib-rv64gb-hello-world"}, {"LC_TYPE=C"});
+	machine.set_printer([] (const auto&, const char*, size_t) {});
+	machine.simulate(MAX_INSTRUCTIONS);
+	REQUIRE(machine.return_value() == 666);
+	require_counts(machine);
+	REQUIRE(machine.memory.memory_usage_total() >=
+		machine.memory.page_counts().resident() * Page::size());
+}
+
+TEST_CASE("Arena pages are counted when touched", "[Memory]")
+{
+	Machine<RISCV64> machine { std::string_view{}, { .memory_max = MAX_MEMORY } };
+	if (!machine.memory.uses_flat_memory_arena())
+		return;
+	const auto before = machine.memory.page_counts().arena;
+	machine.memory.set_page_attr(0x200000, 4 * Page::size(), { .read = true, .write = false });
+	REQUIRE(machine.memory.page_counts().arena == before + 4);
+	REQUIRE(machine.memory.page_counts().owned == 0);
+}
+
+TEST_CASE("Memory quota stops page allocation", "[Memory]")
+{
+	Machine<RISCV64> machine { std::string_view{}, {
+		.memory_max = MAX_MEMORY,
+		.memory_quota = QUOTA_PAGES * Page::size(),
+		.use_memory_arena = false
+	} };
+	REQUIRE(machine.memory.memory_quota() == QUOTA_PAGES * Page::size());
+
+	uint64_t pages = 0;
+	const int type = quota_exception([&] {
+		for (; pages < 2 * QUOTA_PAGES; pages++)
+			machine.memory.write<uint64_t>(PAGED_ADDR + pages * Page::size(), pages);
+	});
+	REQUIRE(type == MEMORY_QUOTA_EXCEEDED);
+	REQUIRE(pages == QUOTA_PAGES);
+	REQUIRE(machine.memory.page_counts().resident() == QUOTA_PAGES);
+	// Existing pages are still writable
+	machine.memory.write<uint64_t>(PAGED_ADDR, 1234);
+	REQUIRE(machine.memory.read<uint64_t>(PAGED_ADDR) == 1234);
+
+	// Freeing pages makes room for new ones
+	machine.memory.free_pages(PAGED_ADDR, Page::size());
+	machine.memory.write<uint64_t>(PAGED_ADDR + pages * Page::size(), 1);
+	REQUIRE(quota_exception([&] {
+		machine.memory.write<uint64_t>(PAGED_ADDR + (pages + 1) * Page::size(), 1);
+	}) == MEMORY_QUOTA_EXCEEDED);
+
+	// Raising and removing the quota
+	machine.memory.set_memory_quota((QUOTA_PAGES + 1) * Page::size());
+	machine.memory.write<uint64_t>(PAGED_ADDR + (pages + 1) * Page::size(), 1);
+	machine.memory.set_memory_quota(0);
+	REQUIRE(machine.memory.memory_quota() == 0);
+	machine.memory.write<uint64_t>(PAGED_ADDR + (pages + 2) * Page::size(), 1);
+}
+
+TEST_CASE("Memory quota applies to copy-on-write in forks", "[Memory]")
+{
+	Machine<RISCV64> machine { std::string_view{}, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	for (uint64_t i = 0; i < 2 * QUOTA_PAGES; i++)
+		machine.memory.write<uint64_t>(PAGED_ADDR + i * Page::size(), i);
+
+	Machine<RISCV64> fork { machine, {
+		.memory_max = MAX_MEMORY,
+		.memory_quota = QUOTA_PAGES * Page::size(),
+		.use_memory_arena = false
+	} };
+	// Reading shared pages costs nothing
+	for (uint64_t i = 0; i < 2 * QUOTA_PAGES; i++)
+		REQUIRE(fork.memory.read<uint64_t>(PAGED_ADDR + i * Page::size()) == i);
+	REQUIRE(fork.memory.page_counts().resident() == 0);
+
+	uint64_t pages = 0;
+	REQUIRE(quota_exception([&] {
+		for (; pages < 2 * QUOTA_PAGES; pages++)
+			fork.memory.write<uint64_t>(PAGED_ADDR + pages * Page::size(), 0);
+	}) == MEMORY_QUOTA_EXCEEDED);
+	REQUIRE(pages == QUOTA_PAGES);
+	REQUIRE(fork.memory.read<uint64_t>(PAGED_ADDR + pages * Page::size()) == pages);
+	require_counts(fork);
+
+	// Rewinding a fork gives back its quota
+	fork.memory.rewind(machine.memory);
+	REQUIRE(fork.memory.page_counts().resident() == 0);
+	fork.memory.write<uint64_t>(PAGED_ADDR, 0);
+}
+
+TEST_CASE("Guest programs fail cleanly at the memory quota", "[Memory]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+	Machine<RISCV64> machine { binary, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	// No room for the stack
+	machine.memory.set_memory_quota(machine.memory.page_counts().resident() * Page::size());
+	machine.setup_linux_syscalls();
+	machine.set_printer([] (const auto&, const char*, size_t) {});
+	REQUIRE(quota_exception([&] {
+		machine.setup_linux({"newlib-rv64gb-hello-world"}, {"LC_TYPE=C"});
+		machine.simulate(MAX_INSTRUCTIONS);
+	}) == MEMORY_QUOTA_EXCEEDED);
+}
@@ -493,3 +493,106 @@ TEST_CASE("Crashing payload #6", "[Micro]")
 	}
 	REQUIRE(exception_thrown);
 }
+
+template <int W>
+static void run_muldiv(Machine<W>& machine, const std::vector<uint32_t>& program,
+	address_type<W> a0, address_type<W> a1, bool precise)
+{
+	const address_type<W> dst = 0x1000;
+	machine.copy_to_guest(dst, program.data(), program.size() * 4);
+	machine.memory.set_page_attr(dst, riscv::Page::size(), {
+		.read = false,
+		.write = false,
+		.exec = true
+	});
+	machine.cpu.reg(REG_ARG0) = a0;
+	machine.cpu.reg(REG_ARG1) = a1;
+	machine.cpu.jump(dst);
+	if (precise) {
+		// Precise simulation executes the instruction handlers
+		machine.set_max_instructions(MAX_CYCLES);
+		machine.cpu.simulate_precise();
+	} else {
+		machine.simulate(MAX_CYCLES);
+	}
+	REQUIRE(machine.instruction_counter() == program.size());
+}
+
+TEST_CASE("Division by zero and overflow follow the specification", "[Micro]")
+{
+	static const std::vector<uint32_t> program64 {
+		0x02b54633, //        div     a2,a0,a1
+		0x02b556b3, //        divu    a3,a0,a1
+		0x02b56733, //        rem     a4,a0,a1
+		0x02b577b3, //        remu    a5,a0,a1
+		0x02b54e3b, //        divw    t3,a0,a1
+		0x02b55ebb, //        divuw   t4,a0,a1
+		0x02b56f3b, //        remw    t5,a0,a1
+		0x02b57fbb, //        remuw   t6,a0,a1
+		0x7ff00073, //        stop
+	};
+	for (const bool precise : { false, true })
+	{
+		Machine<RISCV64> machine;
+		run_muldiv(machine, program64, 7, 0, precise);
+		REQUIRE(machine.cpu.reg(REG_ARG2) == ~0ull);
+		REQUIRE(machine.cpu.reg(REG_ARG3) == ~0ull);
+		REQUIRE(machine.cpu.reg(REG_ARG4) == 7);
+		REQUIRE(machine.cpu.reg(REG_ARG5) == 7);
+		REQUIRE(machine.cpu.reg(28) == ~0ull);
+		REQUIRE(machine.cpu.reg(29) == ~0ull);
+		REQUIRE(machine.cpu.reg(30) == 7);
+		REQUIRE(machine.cpu.reg(31) == 7);
+
+		// INT64_MIN / -1 overflows, as does INT32_MIN / -1 in the W variants
+		Machine<RISCV64> overflow;
+		run_muldiv(overflow, program64, 1ull << 63, ~0ull, precise);
+		REQUIRE(overflow.cpu.reg(REG_ARG2) == 1ull << 63);
+		REQUIRE(overflow.cpu.reg(REG_ARG4) == 0);
+		Machine<RISCV64> overflow32;
+		run_muldiv(overflow32, program64, 0xFFFFFFFF80000000ull, ~0ull, precise);
+		REQUIRE(overflow32.cpu.reg(28) == 0xFFFFFFFF80000000ull);
+		REQUIRE(overflow32.cpu.reg(30) == 0);
+	}
+
+	static const std::vector<uint32_t> program32 {
+		0x02b54633, //        div     a2,a0,a1
+		0x02b556b3, //        divu    a3,a0,a1
+		0x02b56733, //        rem     a4,a0,a1
+		0x02b577b3, //        remu    a5,a0,a1
+		0x7ff00073, //        stop
+	};
+	for (const bool precise : { false, true })
+	{
+		Machine<RISCV32> machine;
+		run_muldiv(machine, program32, 7, 0, precise);
+		REQUIRE(machine.cpu.reg(REG_ARG2) == ~0u);
+		REQUIRE(machine.cpu.reg(REG_ARG3) == ~0u);
+		REQUIRE(machine.cpu.reg(REG_ARG4) == 7);
+		REQUIRE(machine.cpu.reg(REG_ARG5) == 7);
+
+		Machine<RISCV32> overflow;
+		run_muldiv(overflow, program32, 0x80000000u, ~0u, precise);
+		REQUIRE(overflow.cpu.reg(REG_ARG2) == 0x80000000u);
+		REQUIRE(overflow.cpu.reg(REG_ARG4) == 0);
+	}
+}
+
+TEST_CASE("High multiplication of signed operands", "[Micro]")
+{
+	static const std::vector<uint32_t> program {
+		0x02b51633, //        mulh    a2,a0,a1
+		0x02b526b3, //        mulhsu  a3,a0,a1
+		0x02b53733, //        mulhu   a4,a0,a1
+		0x7ff00073, //        stop
+	};
+	for (const bool precise : { false, true })
+	{
+		// -2 * 3 = -6 and -2 * 3 = -6, but (2^64 - 2) * 3 is 2 in the high part
+		Machine<RISCV64> machine;
+		run_muldiv(machine, program, ~1ull, 3, precise);
+		REQUIRE(machine.cpu.reg(REG_ARG2) == ~0ull);
+		REQUIRE(machine.cpu.reg(REG_ARG3) == ~0ull);
+		REQUIRE(machine.cpu.reg(REG_ARG4) == 2);
+	}
+}
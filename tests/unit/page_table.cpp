@@ -0,0 +1,144 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <libriscv/machine.hpp>
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+using namespace riscv;
+
+using address_t = address_type<RISCV64>;
+
+static std::vector<address_t> make_page_numbers(size_t count, unsigned seed)
+{
+	// Clusters of pages spread out over the 64-bit address space
+	std::mt19937_64 rng { seed };
+	static constexpr address_t bases[] = {
+		0x0, 0x10, 0x4000, 0xc000000, 0x3FFFFFFF0, 0xFFFFFFFFFFF00
+	};
+	std::vector<address_t> result;
+	for (size_t i = 0; i < count; i++)
+		result.push_back(bases[rng() % std::size(bases)] + rng() % 256);
+	return result;
+}
+
+TEST_CASE("Page table behaves like a map", "[Memory]")
+{
+	PageTable<RISCV64> table;
+	std::unordered_map<address_t, uint8_t> reference;
+
+	for (const auto pageno : make_page_numbers(2000, 1234)) {
+		const uint8_t value = pageno & 0xFF;
+		auto res = table.try_emplace(pageno, PageAttributes{ .user_defined = value });
+		const bool inserted = reference.try_emplace(pageno, value).second;
+		REQUIRE(res.second == inserted);
+		REQUIRE(res.first->first == pageno);
+		REQUIRE(res.first->second.attr.user_defined == value);
+	}
+	REQUIRE(table.size() == reference.size());
+
+	// Erase every other page
+	size_t n = 0;
+	for (const auto pageno : make_page_numbers(2000, 1234)) {
+		if (n++ % 2 == 0) {
+			REQUIRE(table.erase(pageno) == reference.erase(pageno));
+		}
+	}
+	REQUIRE(table.size() == reference.size());
+	REQUIRE(table.find(0x12345678) == table.end());
+
+	// Lookups, and iteration in page number order
+	std::vector<address_t> keys;
+	for (const auto& it : reference) {
+		auto found = table.find(it.first);
+		REQUIRE(found != table.end());
+		REQUIRE(found->second.attr.user_defined == it.second);
+		keys.push_back(it.first);
+	}
+	std::sort(keys.begin(), keys.end());
+	std::vector<address_t> iterated;
+	for (const auto& it : table)
+		iterated.push_back(it.first);
+	REQUIRE(iterated == keys);
+
+	table.clear();
+	REQUIRE(table.size() == 0);
+	REQUIRE(table.begin() == table.end());
+}
+
+TEST_CASE("Sparse guest memory is paged in and forked", "[Memory]")
+{
+	static constexpr address_t addresses[] = {
+		0x2000, 0x7FFFF000, 0xC000001000, 0xFFFFFFFFFFFF0000
+	};
+	Machine<RISCV64> machine;
+	for (const auto addr : addresses)
+		machine.memory.write<uint64_t>(addr + 8, addr);
+
+	Machine<RISCV64> fork { machine };
+	for (const auto addr : addresses) {
+		REQUIRE(fork.memory.read<uint64_t>(addr + 8) == addr);
+		fork.memory.write<uint64_t>(addr + 8, 0);
+		REQUIRE(machine.memory.read<uint64_t>(addr + 8) == addr);
+	}
+
+	machine.memory.free_pages(addresses[2], Page::size());
+	REQUIRE(machine.memory.read<uint64_t>(addresses[2] + 8) == 0);
+	REQUIRE(machine.memory.read<uint64_t>(addresses[3] + 8) == addresses[3]);
+}
+
+TEST_CASE("Page caches follow alternating pages and permission changes", "[Memory]")
+{
+	// Pages that map to the same page cache entry, and pages that don't
+	static constexpr address_t BASE = 0xC000000000;
+	static constexpr address_t pages[] = {
+		BASE, BASE + RISCV_PAGE_CACHE_SIZE * Page::size(),
+		BASE + Page::size(), BASE + 2 * Page::size()
+	};
+	Machine<RISCV64> machine;
+	for (unsigned i = 0; i < 100; i++) {
+		for (const auto addr : pages)
+			machine.memory.write<uint32_t>(addr + 4 * i, addr + i);
+	}
+	for (unsigned i = 0; i < 100; i++) {
+		for (const auto addr : pages)
+			REQUIRE(machine.memory.read<uint32_t>(addr + 4 * i) == uint32_t(addr + i));
+	}
+
+	// Cached writable pages must not stay writable
+	machine.memory.set_page_attr(pages[2], Page::size(), { .read = true, .write = false });
+	REQUIRE(machine.memory.read<uint32_t>(pages[2]) == uint32_t(pages[2]));
+	REQUIRE_THROWS(machine.memory.write<uint32_t>(pages[2], 0));
+	machine.memory.write<uint32_t>(pages[3], 0);
+
+	// Freed pages must not be read or written through the caches
+	machine.memory.free_pageno(pages[3] / Page::size());
+	REQUIRE(machine.memory.read<uint32_t>(pages[3] + 4) == 0);
+}
+
+TEST_CASE("Page table lookups against std::unordered_map", "[.benchmark]")
+{
+	// Strided accesses over many pages, as done by memory-heavy
+	// programs when the page caches keep missing
+	static constexpr size_t PAGES = 16384;
+	static constexpr address_t BASE = 0x400;
+	PageTable<RISCV64> table;
+	std::unordered_map<address_t, Page> map;
+	for (size_t i = 0; i < PAGES; i++) {
+		table.try_emplace(BASE + i, PageAttributes{}, Page::cow_page().m_page.get());
+		map.try_emplace(BASE + i, PageAttributes{}, Page::cow_page().m_page.get());
+	}
+
+	BENCHMARK("PageTable") {
+		size_t count = 0;
+		for (size_t i = 0; i < PAGES; i++)
+			count += table.find(BASE + (i * 17) % PAGES)->second.attr.read;
+		return count;
+	};
+	BENCHMARK("std::unordered_map") {
+		size_t count = 0;
+		for (size_t i = 0; i < PAGES; i++)
+			count += map.find(BASE + (i * 17) % PAGES)->second.attr.read;
+		return count;
+	};
+}
@@ -0,0 +1,77 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <libriscv/machine.hpp>
+#include <libriscv/decoder_cache.hpp>
+#include <cstring>
+#include <random>
+#include "untranslated.hpp"
+using namespace riscv;
+
+static std::vector<DecoderData<RISCV64>> decode(const std::vector<uint8_t>& code, uint64_t addr, unsigned workers)
+{
+	// Compiling megabytes of random bytes would take minutes
+	auto options = untranslated<RISCV64>({
+		.use_shared_execute_segments = false,
+		.decoder_cache_workers = workers,
+	});
+	Machine<RISCV64> machine { std::string_view{}, *options };
+	machine.set_options(options);
+	auto& exec = machine.cpu.init_execute_area(code.data(), addr, code.size());
+
+	std::vector<DecoderData<RISCV64>> entries;
+	for (uint64_t pc = exec.exec_begin(); pc <= exec.exec_end(); pc += DecoderCache<RISCV64>::DIVISOR)
+		entries.push_back(exec.decoder_cache()[pc / DecoderCache<RISCV64>::DIVISOR]);
+	return entries;
+}
+
+static void require_same_decoding(const std::vector<uint8_t>& code, uint64_t addr)
+{
+	const auto sequential = decode(code, addr, 1);
+	const auto parallel   = decode(code, addr, 4);
+	REQUIRE(sequential.size() == parallel.size());
+
+	for (size_t i = 0; i < sequential.size(); i++) {
+		const auto& a = sequential[i];
+		const auto& b = parallel[i];
+		// Handler indices are assigned in the order they are first seen
+		REQUIRE(a.get_bytecode() == b.get_bytecode());
+		REQUIRE(a.get_handler() == b.get_handler());
+		REQUIRE(a.idxend == b.idxend);
+		REQUIRE(a.instruction_count() == b.instruction_count());
+		REQUIRE(a.instr == b.instr);
+	}
+}
+
+TEST_CASE("Parallel decoding matches sequential decoding", "[Decoder]")
+{
+	std::mt19937 rng(1234);
+	// Random bytes produce every kind of instruction, including
+	// 32-bit instructions that straddle the chunk boundaries.
+	std::vector<uint8_t> code(2 << 20);
+	for (auto& byte : code)
+		byte = rng();
+	require_same_decoding(code, 0x100000);
+
+	// Long runs of non-branching instructions, occasionally ended
+	// by branches, jumps and returns of both lengths.
+	static const std::array<uint32_t, 10> instructions {
+		0x00158593, // addi a1,a1,1
+		0x00b50533, // add a0,a0,a1
+		0x0005a503, // lw a0,0(a1)
+		0x00a5a023, // sw a0,0(a1)
+		0x4505,     // c.li a0,1
+		0x0585,     // c.addi a1,1
+		0xfec59ee3, // bne a1,a2,-4
+		0x00008067, // ret
+		0x9502,     // c.jalr a0
+		0x8082,     // c.ret
+	};
+	size_t i = 0;
+	while (i + 4 <= code.size()) {
+		const uint32_t instr = instructions[rng() % (rng() % 256 == 0 ? 10 : 6)];
+		const size_t len = (instr & 3) == 3 ? 4 : 2;
+		std::memcpy(&code[i], &instr, len);
+		i += len;
+	}
+	require_same_decoding(code, 0x200002);
+}
@@ -0,0 +1,81 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <libriscv/machine.hpp>
+using namespace riscv;
+
+static constexpr uint64_t DST = 0x1000;
+static constexpr uint64_t STACK = 0x100000;
+
+static void setup(Machine<RISCV64>& machine, const uint32_t* program, size_t size)
+{
+	machine.copy_to_guest(DST, program, size);
+	machine.memory.set_page_attr(DST, riscv::Page::size(), {
+		.read = false,
+		.write = false,
+		.exec = true
+	});
+	machine.cpu.reg(REG_SP) = STACK;
+	machine.cpu.jump(DST);
+}
+
+TEST_CASE("Returns to a modified return address", "[Dispatch]")
+{
+	static const std::array<uint32_t, 6> program {
+		0x000480E7, //        jalr    ra,0(s1)
+		0x06450513, //        addi    a0,a0,100
+		0x00158593, //        addi    a1,a1,1
+		0x7ff00073, //        stop
+		0x00408093, // func:  addi    ra,ra,4
+		0x00008067, //        ret
+	};
+	for (const bool fast : { false, true })
+	{
+		Machine<RISCV64> machine;
+		setup(machine, program.data(), sizeof(program));
+		machine.cpu.reg(9) = DST + 16; // s1 = func
+		if (fast)
+			machine.cpu.simulate_inaccurate(machine.cpu.pc());
+		else
+			machine.simulate(1000);
+
+		// The return skipped the instruction after the call
+		REQUIRE(machine.cpu.reg(REG_ARG0) == 0);
+		REQUIRE(machine.cpu.reg(REG_ARG1) == 1);
+		if (!fast)
+			REQUIRE(machine.instruction_counter() == 5);
+	}
+}
+
+TEST_CASE("Recursion deeper than the return-address stack", "[Dispatch]")
+{
+	static const std::array<uint32_t, 11> program {
+		0x008000EF, //        jal     ra,func
+		0x7ff00073, //        stop
+		0x02050063, // func:  beqz    a0,done
+		0xff010113, //        addi    sp,sp,-16
+		0x00113023, //        sd      ra,0(sp)
+		0xfff50513, //        addi    a0,a0,-1
+		0xff1ff0ef, //        jal     ra,func
+		0x00158593, //        addi    a1,a1,1
+		0x00013083, //        ld      ra,0(sp)
+		0x01010113, //        addi    sp,sp,16
+		0x00008067, // done:  ret
+	};
+	for (const bool fast : { false, true })
+	{
+		Machine<RISCV64> machine;
+		setup(machine, program.data(), sizeof(program));
+		machine.cpu.reg(REG_ARG0) = 100;
+		if (fast)
+			machine.cpu.simulate_inaccurate(machine.cpu.pc());
+		else
+			machine.simulate(10'000);
+
+		REQUIRE(machine.cpu.reg(REG_ARG0) == 0);
+		REQUIRE(machine.cpu.reg(REG_ARG1) == 100);
+		REQUIRE(machine.cpu.reg(REG_SP) == STACK);
+		REQUIRE(machine.cpu.reg(REG_RA) == DST + 4);
+		if (!fast)
+			REQUIRE(machine.instruction_counter() == 1 + 100 * 9 + 2 + 1);
+	}
+}
@@ -0,0 +1,138 @@
+#include <catch2/catch_test_macros.hpp>
+#include <libriscv/machine.hpp>
+#include <libriscv/native_heap.hpp>
+extern std::vector<uint8_t> load_file(const std::string& filename);
+static const uint64_t MAX_MEMORY = 64ul << 20; /* 64MB */
+static const uint64_t MAX_INSTRUCTIONS = 10'000'000ul;
+static const std::string cwd {SRCDIR};
+using namespace riscv;
+
+static void run_and_rewind(Machine<RISCV64>& machine, const MachineOptions<RISCV64>& fork_options)
+{
+	riscv::Machine<RISCV64> fork { machine, fork_options };
+	std::string text;
+	fork.set_userdata(&text);
+	fork.set_printer([] (const auto& m, const char* data, size_t size) {
+		m.template get_userdata<std::string> ()->append(data, data + size);
+	});
+	const auto heap = machine.memory.heap_address();
+	const auto value = machine.memory.read<uint64_t>(heap);
+
+	uint64_t first_icount = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		REQUIRE(fork.cpu.pc() == machine.cpu.pc());
+		REQUIRE(fork.instruction_counter() == machine.instruction_counter());
+		REQUIRE(fork.memory.read<uint64_t>(heap) == value);
+		REQUIRE(fork.memory.mmap_address() == machine.memory.mmap_address());
+
+		text.clear();
+		fork.simulate(MAX_INSTRUCTIONS);
+		fork.memory.write<uint64_t>(heap, ~value);
+
+		REQUIRE(fork.return_value() == 666);
+		REQUIRE(text.find("Caught exception: Hello Exceptions!") != std::string::npos);
+		if (i == 0)
+			first_icount = fork.instruction_counter();
+		REQUIRE(fork.instruction_counter() == first_icount);
+
+		fork.rewind();
+		REQUIRE(fork.memory.dirty_pages() == 0);
+	}
+	// The main machine was never written to
+	REQUIRE(machine.memory.read<uint64_t>(heap) == value);
+}
+
+TEST_CASE("Forks can be rewound and reused", "[Fork]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+
+	for (const bool memfd : { false, true })
+	{
+		riscv::Machine<RISCV64> machine { binary, {
+			.memory_max = MAX_MEMORY,
+			.use_memory_arena = memfd,
+			.use_memfd_arena = memfd
+		} };
+		machine.setup_linux_syscalls();
+		machine.setup_linux(
+			{"newlib-rv64gb-hello-world"},
+			{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+
+		run_and_rewind(machine, { .memory_max = MAX_MEMORY, .use_memory_arena = memfd });
+	}
+}
+
+TEST_CASE("Only forks without a shared arena can be rewound", "[Fork]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+	riscv::Machine<RISCV64> machine { binary, { .memory_max = MAX_MEMORY } };
+	REQUIRE_THROWS(machine.rewind());
+
+	if (machine.memory.uses_flat_memory_arena())
+	{
+		riscv::Machine<RISCV64> fork { machine };
+		REQUIRE_THROWS(fork.rewind());
+	}
+}
+
+TEST_CASE("Rewinding tracks each changed page once", "[Fork]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+	riscv::Machine<RISCV64> machine { binary, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	riscv::Machine<RISCV64> fork { machine, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+
+	const auto heap = machine.memory.heap_address();
+	for (int i = 0; i < 100; i++) {
+		fork.memory.set_page_attr(heap, Page::size(), { .read = true, .write = (i % 2) == 0 });
+		fork.memory.set_page_attr(heap, Page::size(), { .read = true, .write = true });
+		fork.memory.write<uint64_t>(heap, i);
+	}
+	REQUIRE(fork.memory.dirty_pages() == 1);
+	fork.rewind();
+	REQUIRE(fork.memory.dirty_pages() == 0);
+	REQUIRE(fork.memory.read<uint64_t>(heap) == machine.memory.read<uint64_t>(heap));
+}
+
+TEST_CASE("Rewinding restores the native heap", "[Fork]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+	riscv::Machine<RISCV64> machine { binary, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	constexpr size_t heap_size = 65536;
+	const auto heap = machine.memory.mmap_allocate(heap_size);
+	machine.setup_native_heap(470, heap, heap_size);
+	const auto main_alloc = machine.arena().malloc(128);
+	REQUIRE(main_alloc != 0);
+
+	// A fork using the heap of the main machine gets it back when rewound
+	riscv::Machine<RISCV64> fork { machine, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	fork.transfer_arena_from(machine);
+	for (int i = 0; i < 2; i++) {
+		REQUIRE(fork.arena().bytes_used() == machine.arena().bytes_used());
+		REQUIRE(fork.arena().malloc(256) != 0);
+		REQUIRE(fork.arena().free(main_alloc) == 0);
+		REQUIRE(fork.arena().bytes_used() != machine.arena().bytes_used());
+		fork.rewind();
+		REQUIRE(fork.arena().size(main_alloc) == machine.arena().size(main_alloc));
+		// New mappings do not overlap the heap
+		const auto mapping = fork.memory.mmap_allocate(heap_size);
+		REQUIRE((mapping >= heap + heap_size || mapping + heap_size <= heap));
+		fork.rewind();
+	}
+
+	// A heap created after forking is removed, as the main machine has none
+	riscv::Machine<RISCV64> main2 { binary, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	riscv::Machine<RISCV64> fork2 { main2, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	const auto heap2 = fork2.memory.mmap_allocate(heap_size);
+	fork2.setup_native_heap(470, heap2, heap_size);
+	REQUIRE(fork2.arena().malloc(256) != 0);
+	REQUIRE(fork2.arena().malloc(512) != 0);
+	fork2.rewind();
+	REQUIRE(!fork2.has_arena());
+	// Its memory is mapped again, and may become a new heap
+	const auto mapping = fork2.memory.mmap_allocate(heap_size);
+	REQUIRE(mapping == heap2);
+	fork2.setup_native_heap(470, mapping, heap_size);
+	REQUIRE(fork2.arena().bytes_used() == 0);
+	REQUIRE(fork2.arena().malloc(256) != 0);
+}
@@ -0,0 +1,72 @@
+#include <catch2/catch_test_macros.hpp>
+#include <libriscv/machine.hpp>
+extern std::vector<uint8_t> load_file(const std::string& filename);
+static const uint64_t MAX_MEMORY = 64ul << 20; /* 64MB */
+static const uint64_t MAX_INSTRUCTIONS = 10'000'000ul;
+static const std::string cwd {SRCDIR};
+using namespace riscv;
+
+// Whole pages of the read-execute and read-write segments of the program
+static constexpr uint64_t TEXT = 0x11000;
+static constexpr uint64_t DATA = 0x8d000;
+
+static size_t owned_pages(const Machine<RISCV64>& machine)
+{
+	size_t count = 0;
+	for (const auto& it : machine.memory.pages())
+		count += !it.second.attr.non_owning;
+	return count;
+}
+
+static void run_program(Machine<RISCV64>& machine)
+{
+	std::string text;
+	machine.set_userdata(&text);
+	machine.set_printer([] (const auto& m, const char* data, size_t size) {
+		m.template get_userdata<std::string> ()->append(data, data + size);
+	});
+	machine.setup_linux_syscalls();
+	machine.setup_linux(
+		{"newlib-rv64gb-hello-world"},
+		{"LC_TYPE=C", "LC_ALL=C", "USER=root"});
+	machine.simulate(MAX_INSTRUCTIONS);
+
+	REQUIRE(machine.return_value() == 666);
+	REQUIRE(text.find("Caught exception: Hello Exceptions!") != std::string::npos);
+}
+
+TEST_CASE("Initial pages are shared between machines", "[Memory]")
+{
+	const auto binary = load_file(cwd + "/elf/newlib-rv64gb-hello-world");
+	const MachineOptions<RISCV64> options {
+		.memory_max = MAX_MEMORY,
+		.use_memory_arena = false,
+		.use_shared_initial_pages = true
+	};
+	Machine<RISCV64> machine1 { binary, options };
+	Machine<RISCV64> machine2 { binary, options };
+	Machine<RISCV64> private_machine { binary, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+
+	for (const auto addr : { TEXT, DATA }) {
+		REQUIRE(machine1.memory.get_page(addr).attr.non_owning);
+		REQUIRE(machine1.memory.get_page(addr).data() == machine2.memory.get_page(addr).data());
+		REQUIRE(machine1.memory.read<uint64_t>(addr) == private_machine.memory.read<uint64_t>(addr));
+	}
+	REQUIRE(owned_pages(machine1) < owned_pages(private_machine));
+
+	// Writable pages are copied on write, and read-only pages stay read-only
+	const auto value = machine2.memory.read<uint64_t>(DATA);
+	machine1.memory.write<uint64_t>(DATA, ~value);
+	REQUIRE(machine1.memory.read<uint64_t>(DATA) == ~value);
+	REQUIRE(machine2.memory.read<uint64_t>(DATA) == value);
+	REQUIRE_THROWS(machine1.memory.write<uint64_t>(TEXT, 0));
+
+	run_program(machine2);
+	// Programs still run after others have left
+	{
+		Machine<RISCV64> machine3 { binary, options };
+		run_program(machine3);
+	}
+	Machine<RISCV64> fork { machine2, { .memory_max = MAX_MEMORY, .use_memory_arena = false } };
+	REQUIRE(fork.memory.read<uint64_t>(TEXT) == private_machine.memory.read<uint64_t>(TEXT));
+}
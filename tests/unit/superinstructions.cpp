@@ -0,0 +1,117 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <libriscv/machine.hpp>
+#include <libriscv/decoder_cache.hpp>
+#include <libriscv/threaded_bytecodes.hpp>
+#include "untranslated.hpp"
+using namespace riscv;
+
+static const std::array<uint32_t, 13> fusable_program {
+	0x12345537, //        lui     a0,0x12345
+	0x67850513, //        addi    a0,a0,0x678
+	0x00000593, //        li      a1,0
+	0x06400613, //        li      a2,100
+	0x00158593, // loop:  addi    a1,a1,1
+	0xfec59ee3, //        bne     a1,a2,loop
+	0x00000697, //        auipc   a3,0x0
+	0xfe868693, //        addi    a3,a3,-24
+	0x00000097, //        auipc   ra,0x0
+	0x00c080e7, //        jalr    ra,12(ra)
+	0x7ff00073, //        stop
+	0x00b50533, //        add     a0,a0,a1
+	0x00008067, //        ret
+};
+static constexpr uint32_t DST = 0x1000;
+
+static void load_program(Machine<RISCV32>& machine)
+{
+	machine.copy_to_guest(DST, &fusable_program[0], sizeof(fusable_program));
+	machine.memory.set_page_attr(DST, riscv::Page::size(), {
+		.read = false,
+		.write = false,
+		.exec = true
+	});
+	machine.cpu.jump(DST);
+}
+
+static uint8_t bytecode_at(Machine<RISCV32>& machine, uint32_t addr)
+{
+	auto& exec = machine.cpu.current_execute_segment();
+	return exec.decoder_cache()[addr / DecoderCache<RISCV32>::DIVISOR].get_bytecode();
+}
+
+TEST_CASE("Superinstructions produce the same results", "[Superinstructions]")
+{
+	// Execute segments created after construction use the stored options
+	auto fused_options = untranslated<RISCV32>({
+		.use_superinstructions = true
+	});
+	auto unfused_options = untranslated<RISCV32>({
+		.use_superinstructions = false
+	});
+	Machine<RISCV32> fused { std::string_view{}, *fused_options };
+	fused.set_options(fused_options);
+	Machine<RISCV32> unfused { std::string_view{}, *unfused_options };
+	unfused.set_options(unfused_options);
+
+	for (auto* machine : { &fused, &unfused })
+	{
+		load_program(*machine);
+		machine->simulate(1000);
+
+		REQUIRE(machine->cpu.reg(REG_ARG0) == 0x12345678 + 100);
+		REQUIRE(machine->cpu.reg(REG_ARG1) == 100);
+		REQUIRE(machine->cpu.reg(REG_ARG3) == DST);
+		REQUIRE(machine->cpu.reg(REG_RA) == DST + 0x28);
+	}
+	// Fused pairs still count as two instructions
+	REQUIRE(fused.instruction_counter() == unfused.instruction_counter());
+
+	REQUIRE(bytecode_at(fused, DST + 0x00) == RV32I_BC_LUI_ADDI);
+	REQUIRE(bytecode_at(fused, DST + 0x18) == RV32I_BC_AUIPC_ADDI);
+	REQUIRE(bytecode_at(fused, DST + 0x20) == RV32I_BC_AUIPC_JALR);
+	REQUIRE(bytecode_at(fused, DST + 0x10) == RV32I_BC_ADDI_BNE);
+	REQUIRE(bytecode_at(unfused, DST + 0x00) == RV32I_BC_LUI);
+}
+
+TEST_CASE("Profile adjacent bytecode sequences", "[Superinstructions]")
+{
+	auto options = untranslated<RISCV32>({});
+	Machine<RISCV32> machine { std::string_view{}, *options };
+	machine.set_options(options);
+	load_program(machine);
+	machine.simulate(1000);
+
+	const auto sequences =
+		machine.cpu.current_execute_segment().profile_bytecode_sequences(64);
+	REQUIRE(!sequences.empty());
+
+	// Fused entries are profiled as their original bytecodes
+	bool found_lui_addi = false;
+	for (const auto& seq : sequences) {
+		REQUIRE(seq.count > 0);
+		REQUIRE((seq.length == 2 || seq.length == 3));
+		if (seq.length == 2 && seq.bytecodes[0] == RV32I_BC_LUI && seq.bytecodes[1] == RV32I_BC_ADDI)
+			found_lui_addi = true;
+	}
+	REQUIRE(found_lui_addi);
+}
+
+TEST_CASE("Breakpoints split superinstructions", "[Superinstructions]")
+{
+	// Breakpoints modify the decoder cache
+	auto options = untranslated<RISCV32>({
+		.use_shared_execute_segments = false,
+		.use_superinstructions = true
+	});
+	Machine<RISCV32> machine { std::string_view{}, *options };
+	machine.set_options(options);
+	load_program(machine);
+	machine.simulate(1000);
+	REQUIRE(bytecode_at(machine, DST) == RV32I_BC_LUI_ADDI);
+
+	// The second half of the pair is now a block-ending instruction
+	machine.cpu.install_ebreak_at(DST + 4);
+	REQUIRE(bytecode_at(machine, DST) == RV32I_BC_LUI);
+	REQUIRE(bytecode_at(machine, DST + 4) == RV32I_BC_SYSTEM);
+}
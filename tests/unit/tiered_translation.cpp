@@ -0,0 +1,175 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <libriscv/machine.hpp>
+#include <thread>
+#include <unistd.h>
+#include "assembler.hpp"
+#include "guest_program.hpp"
+using namespace riscv;
+using A = Assembler;
+
+static constexpr unsigned THRESHOLD = 100;
+
+// Two loops, each in its own translated block and hot region. The first
+// loop runs 2000 times, while the second loop runs `second_loop` times.
+static std::vector<uint32_t> two_loops(int32_t second_loop)
+{
+	A a;
+	a.li(A::A0, 0);
+	a.li(A::A1, 2000);
+	a.label("loop1");
+	a.addi(A::A0, A::A0, 1);
+	a.add(A::A5, A::A5, A::A0);
+	a.bne(A::A0, A::A1, "loop1");
+	// Translated blocks end at the first indirect jump after ~1250 instructions
+	for (int i = 0; i < 1400; i++)
+		a.addi(A::ZERO, A::ZERO, 0);
+	const int32_t second = DST + a.size_bytes() + 12;
+	a.lui(A::T0, uint32_t(second - ((second << 20) >> 20)) >> 12);
+	a.addi(A::T0, A::T0, (second << 20) >> 20);
+	a.jalr(A::ZERO, A::T0, 0);
+	a.label("second");
+	a.li(A::A2, 0);
+	a.li(A::A3, second_loop);
+	a.label("loop2");
+	a.addi(A::A2, A::A2, 1);
+	a.add(A::A4, A::A4, A::A2);
+	a.bne(A::A2, A::A3, "loop2");
+	a.stop();
+	REQUIRE(DST + a.offset_of("second") == uint64_t(second));
+	return a.finish();
+}
+
+struct TieredResult {
+	std::array<uint64_t, 32> regs {};
+	uint64_t counter = 0;
+	bool translated = false;
+	bool jit = false;
+	unsigned tier = 0;
+	std::string filename;
+};
+
+template <int W>
+static TieredResult run(const std::vector<uint32_t>& program, unsigned threshold)
+{
+	MachineOptions<W> options;
+	options.use_shared_execute_segments = false;
+	options.translate_enabled = threshold != 0;
+	options.translate_hot_threshold = threshold;
+	options.translation_prefix = "/tmp/rvtiered-" + std::to_string(getpid()) + "-";
+	Machine<W> machine { std::string_view{}, options };
+	machine.set_options(std::make_shared<MachineOptions<W>>(options));
+
+	load_program(machine, program);
+	REQUIRE(machine.simulate(10'000'000ull));
+
+	TieredResult result;
+	for (int i = 0; i < 32; i++)
+		result.regs[i] = machine.cpu.reg(i);
+	result.counter = machine.instruction_counter();
+	auto& exec = machine.cpu.current_execute_segment();
+	result.translated = exec.is_binary_translated();
+	result.jit = exec.is_jit();
+	result.tier = exec.hot_tier();
+	if (exec.is_tiered())
+		result.filename = exec.hot_translation_filename();
+	return result;
+}
+
+template <int W>
+static void tiered_promotion()
+{
+	// The second loop stays cold: Only the first tier is translated,
+	// and the partial translation is not stored in the cache
+	const auto program1 = two_loops(10);
+	const auto interpreted1 = run<W>(program1, 0);
+	const auto tiered1 = run<W>(program1, THRESHOLD);
+	REQUIRE(!interpreted1.translated);
+	REQUIRE(tiered1.translated);
+	REQUIRE(tiered1.tier == 1);
+	REQUIRE(tiered1.regs == interpreted1.regs);
+	REQUIRE(tiered1.counter == interpreted1.counter);
+	REQUIRE(access(tiered1.filename.c_str(), F_OK) != 0);
+
+	// The second loop becomes hot after the first tier was translated,
+	// and is included in the complete translation of the second tier
+	const auto program2 = two_loops(2000);
+	const auto interpreted2 = run<W>(program2, 0);
+	const auto tiered2 = run<W>(program2, THRESHOLD);
+	REQUIRE(tiered2.translated);
+	REQUIRE(tiered2.tier == 2);
+	REQUIRE(tiered2.regs == interpreted2.regs);
+	REQUIRE(tiered2.counter == interpreted2.counter);
+	REQUIRE(tiered2.regs[REG_ARG4] == 2000 * 2001 / 2);
+	// The complete translation is cached, and used by the next run
+	if (tiered2.jit)
+		return;
+	REQUIRE(access(tiered2.filename.c_str(), F_OK) == 0);
+	const auto cached = run<W>(program2, THRESHOLD);
+	REQUIRE(cached.translated);
+	REQUIRE(cached.tier == 0);
+	REQUIRE(cached.regs == interpreted2.regs);
+	unlink(tiered2.filename.c_str());
+	unlink((tiered2.filename + ".lock").c_str());
+}
+
+TEST_CASE("Tiered translation promotes hot regions", "[Tiered]")
+{
+	tiered_promotion<RISCV32>();
+	tiered_promotion<RISCV64>();
+}
+
+template <int W>
+static void tiered_forks()
+{
+	// Forks running in parallel count the same hot regions, and one
+	// of them promotes the shared execute segment while the others run
+	const auto program = two_loops(2000);
+	const auto interpreted = run<W>(program, 0);
+
+	MachineOptions<W> options;
+	options.use_shared_execute_segments = false;
+	options.translate_hot_threshold = THRESHOLD;
+	options.translation_prefix = "/tmp/rvtiered-forks-" + std::to_string(getpid()) + "-";
+	auto shared_options = std::make_shared<MachineOptions<W>>(options);
+	Machine<W> machine { std::string_view{}, options };
+	machine.set_options(shared_options);
+	load_program(machine, program);
+	// Create the execute segment that the forks will share. This runs
+	// the first block, so the forks start over from the initial state.
+	const auto initial = machine.cpu.registers();
+	machine.template simulate<false>(1);
+
+	static constexpr int FORKS = 4;
+	std::vector<std::unique_ptr<Machine<W>>> forks;
+	for (int i = 0; i < FORKS; i++) {
+		forks.push_back(std::make_unique<Machine<W>>(machine, options));
+		forks.back()->set_options(shared_options);
+		forks.back()->cpu.registers() = initial;
+		forks.back()->set_instruction_counter(0);
+	}
+	std::vector<std::thread> threads;
+	for (auto& fork : forks)
+		threads.emplace_back([&fork] { fork->simulate(10'000'000ull); });
+	for (auto& thread : threads)
+		thread.join();
+
+	for (auto& fork : forks) {
+		for (int i = 0; i < 32; i++)
+			REQUIRE(fork->cpu.reg(i) == interpreted.regs[i]);
+		REQUIRE(fork->instruction_counter() == interpreted.counter);
+	}
+	auto& exec = machine.cpu.current_execute_segment();
+	REQUIRE(exec.is_binary_translated());
+	REQUIRE(exec.hot_tier() == 2);
+	if (!exec.is_jit()) {
+		unlink(exec.hot_translation_filename().c_str());
+		unlink((exec.hot_translation_filename() + ".lock").c_str());
+	}
+}
+
+TEST_CASE("Forks running in parallel promote a shared segment", "[Tiered]")
+{
+	tiered_forks<RISCV32>();
+	tiered_forks<RISCV64>();
+}
@@ -0,0 +1,251 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <libriscv/machine.hpp>
+#include <atomic>
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include "assembler.hpp"
+#include "guest_program.hpp"
+using namespace riscv;
+using A = Assembler;
+
+using OptionsSetup = std::function<void(MachineOptions<RISCV64>&)>;
+
+struct CacheResult {
+	uint64_t a0 = 0;
+	bool translated = false;
+	std::string filename;
+};
+
+// A translation cache in its own directory, removed afterwards
+struct CacheDirectory {
+	CacheDirectory() {
+		char tmpl[] = "/tmp/rvcache-XXXXXX";
+		REQUIRE(mkdtemp(tmpl) != nullptr);
+		path = tmpl;
+	}
+	~CacheDirectory() {
+		for (const auto& name : files())
+			unlink((path + "/" + name).c_str());
+		rmdir(path.c_str());
+	}
+	std::set<std::string> files() const {
+		std::set<std::string> result;
+		DIR* dir = opendir(path.c_str());
+		while (struct dirent* ent = readdir(dir)) {
+			const std::string name = ent->d_name;
+			if (name != "." && name != "..")
+				result.insert(name);
+		}
+		closedir(dir);
+		return result;
+	}
+	std::string prefix() const { return path + "/rvbintr-"; }
+	std::string path;
+};
+
+// Each value gives a different program, and thus a different translation
+static std::vector<uint32_t> program_for(int32_t value)
+{
+	A a;
+	a.li(A::A0, value);
+	for (int i = 0; i < 50; i++)
+		a.addi(A::A0, A::A0, 1);
+	a.stop();
+	return a.finish();
+}
+
+static CacheResult run(const std::vector<uint32_t>& program, const std::string& prefix, OptionsSetup setup = nullptr)
+{
+	MachineOptions<RISCV64> options;
+	options.use_shared_execute_segments = false;
+	options.translation_prefix = prefix;
+	if (setup)
+		setup(options);
+	Machine<RISCV64> machine { std::string_view{}, options };
+	machine.set_options(std::make_shared<MachineOptions<RISCV64>>(options));
+
+	load_program(machine, program);
+	REQUIRE(machine.simulate(1'000'000ull));
+
+	CacheResult result;
+	result.a0 = machine.cpu.reg(REG_ARG0);
+	auto& exec = machine.cpu.current_execute_segment();
+	result.translated = exec.is_binary_translated();
+	result.filename = options.translation_filename(prefix, exec.translation_hash(), options.translation_suffix);
+	return result;
+}
+
+static std::string basename_of(const std::string& filename)
+{
+	return filename.substr(filename.find_last_of('/') + 1);
+}
+
+static void set_mtime(const std::string& filename, time_t seconds_ago)
+{
+	const struct timespec times[2] {
+		{ time(nullptr) - seconds_ago, 0 },
+		{ time(nullptr) - seconds_ago, 0 },
+	};
+	REQUIRE(utimensat(AT_FDCWD, filename.c_str(), times, 0) == 0);
+}
+
+static void copy_file(const std::string& from, const std::string& to)
+{
+	std::ifstream in(from, std::ios::binary);
+	std::ofstream out(to, std::ios::binary);
+	out << in.rdbuf();
+}
+
+// Translations are loaded from the cache, so compiling must not be needed
+struct WithoutCompiler : CompilerOverride {
+	WithoutCompiler() : CompilerOverride("false") {}
+};
+
+TEST_CASE("Translations are published to the cache", "[Cache]")
+{
+	CacheDirectory cache;
+	const auto program = program_for(1000);
+
+	const auto compiled = run(program, cache.prefix());
+	REQUIRE(compiled.translated);
+	REQUIRE(compiled.a0 == 1050);
+	// Only the translation and its lock remain, without temporary files
+	const std::set<std::string> expected {
+		basename_of(compiled.filename), basename_of(compiled.filename) + ".lock" };
+	REQUIRE(cache.files() == expected);
+	struct stat st;
+	REQUIRE(stat(compiled.filename.c_str(), &st) == 0);
+	REQUIRE((st.st_mode & 0777) == 0644);
+
+	// The next machine loads the published translation
+	WithoutCompiler without_compiler;
+	const auto cached = run(program, cache.prefix());
+	REQUIRE(cached.translated);
+	REQUIRE(cached.a0 == 1050);
+}
+
+TEST_CASE("Translations are copied from the seed directory", "[Cache]")
+{
+	CacheDirectory cache;
+	CacheDirectory seed;
+	const auto program = program_for(2000);
+
+	// Produce a translation ahead of time, and move it into the seed directory
+	const auto compiled = run(program, seed.prefix());
+	REQUIRE(compiled.translated);
+	unlink((compiled.filename + ".lock").c_str());
+
+	WithoutCompiler without_compiler;
+	const auto seeded = run(program, cache.prefix(), [&] (auto& options) {
+		options.translation_cache_seed = seed.path;
+	});
+	REQUIRE(seeded.translated);
+	REQUIRE(seeded.a0 == 2050);
+	REQUIRE(cache.files() == std::set<std::string>{ basename_of(seeded.filename) });
+	// Without the seed directory there is no translation to be found
+	CacheDirectory empty;
+	const auto unseeded = run(program, empty.prefix());
+	REQUIRE(!unseeded.translated);
+	REQUIRE(unseeded.a0 == 2050);
+}
+
+TEST_CASE("Only one process produces each translation", "[Cache]")
+{
+	CacheDirectory cache;
+	const auto program = program_for(3000);
+
+	// Produce the translation, then remove it from the cache
+	const auto compiled = run(program, cache.prefix());
+	REQUIRE(compiled.translated);
+	const std::string produced = cache.path + "/produced";
+	REQUIRE(rename(compiled.filename.c_str(), produced.c_str()) == 0);
+
+	// Pretend to be another process that is producing the translation
+	const std::string lockfile = compiled.filename + ".lock";
+	const int lock = open(lockfile.c_str(), O_RDWR);
+	REQUIRE(lock >= 0);
+	REQUIRE(flock(lock, LOCK_EX) == 0);
+
+	// Without a compiler, the waiting machine can only load the translation
+	WithoutCompiler without_compiler;
+	std::atomic<bool> finished = false;
+	CacheResult waited;
+	std::thread thread([&] {
+		waited = run(program, cache.prefix());
+		finished = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	const bool finished_early = finished;
+
+	// Publish the translation, and let the waiting machine load it
+	REQUIRE(rename(produced.c_str(), compiled.filename.c_str()) == 0);
+	close(lock);
+	thread.join();
+
+	REQUIRE(!finished_early);
+	REQUIRE(waited.translated);
+	REQUIRE(waited.a0 == 3050);
+}
+
+TEST_CASE("Least recently used translations are evicted", "[Cache]")
+{
+	CacheDirectory cache;
+	const auto old_program = program_for(4000);
+	const auto used_program = program_for(5000);
+	const auto new_program = program_for(6000);
+
+	const auto old_result = run(old_program, cache.prefix());
+	const auto used_result = run(used_program, cache.prefix());
+	REQUIRE(old_result.translated);
+	REQUIRE(used_result.translated);
+	set_mtime(old_result.filename, 200);
+	set_mtime(used_result.filename, 100);
+	struct stat st;
+	REQUIRE(stat(old_result.filename.c_str(), &st) == 0);
+	const uint64_t size = st.st_size;
+
+	// Loading a translation from the cache makes it the most recently used
+	const auto used_again = run(used_program, cache.prefix(), [] (auto& options) {
+		options.translation_cache_max_bytes = 1ull << 40;
+	});
+	REQUIRE(used_again.translated);
+
+	// A temporary file left behind by an interrupted compilation, and one
+	// that is still being produced by another process
+	const std::string stale_tmpfile = old_result.filename + ".abcdef";
+	const std::string busy_tmpfile  = used_result.filename + ".ghijkl";
+	copy_file(old_result.filename, stale_tmpfile);
+	copy_file(old_result.filename, busy_tmpfile);
+	set_mtime(stale_tmpfile, 7200);
+	set_mtime(busy_tmpfile, 7200);
+	const int lock = open((used_result.filename + ".lock").c_str(), O_RDWR);
+	REQUIRE(lock >= 0);
+	REQUIRE(flock(lock, LOCK_EX | LOCK_NB) == 0);
+
+	// There is room for the new translation and one more, counting the busy
+	// temporary file, so the least recently used translation is evicted
+	const auto new_result = run(new_program, cache.prefix(), [&] (auto& options) {
+		options.translation_cache_max_bytes = 3 * size + size / 2;
+	});
+	close(lock);
+	REQUIRE(new_result.translated);
+	REQUIRE(new_result.a0 == 6050);
+
+	const auto files = cache.files();
+	REQUIRE(files.count(basename_of(new_result.filename)) == 1);
+	REQUIRE(files.count(basename_of(used_result.filename)) == 1);
+	REQUIRE(files.count(basename_of(old_result.filename)) == 0);
+	REQUIRE(files.count(basename_of(stale_tmpfile)) == 0);
+	REQUIRE(files.count(basename_of(busy_tmpfile)) == 1);
+	// Lock files stay, as other processes may be waiting on them
+	REQUIRE(files.count(basename_of(old_result.filename) + ".lock") == 1);
+}
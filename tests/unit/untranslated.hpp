@@ -0,0 +1,16 @@
+#pragma once
+#include <libriscv/machine.hpp>
+#include <memory>
+
+// Options for machines whose decoder cache is inspected or stored.
+// Binary translation would live-patch the bytecodes, and segments that
+// may be translated are decoded eagerly and never stored in files.
+template <int W>
+inline std::shared_ptr<riscv::MachineOptions<W>> untranslated(riscv::MachineOptions<W> options = {})
+{
+#ifdef RISCV_BINARY_TRANSLATION
+	options.translate_enabled = false;
+	options.translate_enable_embedded = false;
+#endif
+	return std::make_shared<riscv::MachineOptions<W>>(std::move(options));
+}
@@ -0,0 +1,90 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <libriscv/machine.hpp>
+using namespace riscv;
+
+#ifdef RISCV_EXT_VECTOR
+static constexpr uint64_t DST  = 0x1000;
+static constexpr uint64_t DATA = 0x10000;
+static constexpr unsigned N = VectorLane::VSIZE / 4;
+
+static constexpr uint32_t opv(uint32_t funct6, uint32_t vm, uint32_t vs2, uint32_t vs1, uint32_t funct3, uint32_t vd) {
+	return funct6 << 26 | vm << 25 | vs2 << 20 | vs1 << 15 | funct3 << 12 | vd << 7 | 0x57;
+}
+static constexpr uint32_t vmem(uint32_t opcode, uint32_t mop, uint32_t vm, uint32_t rs2, uint32_t rs1, uint32_t vd) {
+	return mop << 26 | vm << 25 | rs2 << 20 | rs1 << 15 | 0x6 << 12 | vd << 7 | opcode;
+}
+static constexpr uint32_t OPIVV = 0, OPFVV = 1, OPMVV = 2, OPFVF = 5;
+
+TEST_CASE("Vector arithmetic, reductions, merges and strided loads", "[Vector]")
+{
+	const std::array<uint32_t, 13> program {
+		vmem(0x07, 0, 1, 0, 10, 1),           // vle32.v     v1, (a0)
+		vmem(0x07, 0, 1, 0, 11, 2),           // vle32.v     v2, (a1)
+		opv(0b101100, 1, 2, 0, OPFVF, 1),     // vfmacc.vf   v1, f0, v2
+		vmem(0x27, 0, 1, 0, 12, 1),           // vse32.v     v1, (a2)
+		vmem(0x07, 2, 1, 5, 10, 3),           // vlse32.v    v3, (a0), t0
+		opv(0b000001, 1, 3, 5, OPFVV, 4),     // vfredusum.vs v4, v3, v5
+		opv(0b010000, 1, 4, 0, OPFVV, 1),     // vfmv.f.s    f1, v4
+		opv(0b010111, 0, 2, 1, OPIVV, 6),     // vmerge.vvm  v6, v2, v1, v0
+		opv(0b100100, 0, 2, 1, OPFVV, 8),     // vfmul.vv    v8, v2, v1, v0.t
+		opv(0b000000, 1, 10, 9, OPIVV, 11),   // vadd.vv     v11, v10, v9
+		opv(0b000000, 1, 10, 9, OPMVV, 12),   // vredsum.vs  v12, v10, v9
+		vmem(0x27, 2, 0, 5, 13, 10),          // vsse32.v    v10, (a3), t0, v0.t
+		0x7ff00073,                           // stop
+	};
+	std::array<float, 2 * N> a;
+	std::array<float, N> b;
+	for (unsigned i = 0; i < a.size(); i++)
+		a[i] = float(i + 1);
+	for (unsigned i = 0; i < N; i++)
+		b[i] = float(100 * i);
+
+	Machine<RISCV64> machine;
+	machine.copy_to_guest(DST, program.data(), sizeof(program));
+	machine.memory.set_page_attr(DST, riscv::Page::size(), {
+		.read = false,
+		.write = false,
+		.exec = true
+	});
+	machine.copy_to_guest(DATA, a.data(), sizeof(a));
+	machine.copy_to_guest(DATA + 0x100, b.data(), sizeof(b));
+	machine.memory.memset(DATA + 0x200, 0, 0x200);
+	machine.cpu.reg(10) = DATA;
+	machine.cpu.reg(11) = DATA + 0x100;
+	machine.cpu.reg(12) = DATA + 0x200;
+	machine.cpu.reg(13) = DATA + 0x300;
+	machine.cpu.reg(5) = 8; // Stride
+	machine.cpu.registers().getfl(0).set_float(2.0f);
+
+	auto& rvv = machine.cpu.registers().rvv();
+	rvv.get(0).u8[0] = 0x55; // Mask: every other element
+	for (unsigned i = 0; i < N; i++) {
+		rvv.u32(9)[i] = i;
+		rvv.u32(10)[i] = 1000 + i;
+	}
+	machine.cpu.jump(DST);
+	machine.simulate(1000);
+
+	uint32_t sum = 0;
+	std::array<float, N> stored;
+	machine.copy_from_guest(stored.data(), DATA + 0x200, sizeof(stored));
+	for (unsigned i = 0; i < N; i++) {
+		const float macc = 2.0f * b[i] + a[i];
+		const bool active = (0x55 >> i) & 1;
+		REQUIRE(rvv.f32(1)[i] == macc);
+		REQUIRE(stored[i] == macc);
+		REQUIRE(rvv.f32(3)[i] == a[2 * i]);
+		REQUIRE(rvv.f32(6)[i] == (active ? macc : b[i]));
+		REQUIRE(rvv.f32(8)[i] == (active ? macc * b[i] : 0.0f));
+		REQUIRE(rvv.u32(11)[i] == 1000 + 2 * i);
+		REQUIRE(machine.memory.read<uint32_t>(DATA + 0x300 + 8 * i) == (active ? 1000 + i : 0));
+		sum += 1000 + i;
+	}
+	float strided_sum = 0.0f;
+	for (unsigned i = 0; i < N; i++)
+		strided_sum += a[2 * i];
+	REQUIRE(machine.cpu.registers().getfl(1).f32[0] == strided_sum);
+	REQUIRE(rvv.u32(12)[0] == sum + rvv.u32(9)[0]);
+}
+#endif